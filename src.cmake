@@ -52,6 +52,7 @@ set(COMMONLIST
     ${COMMON_DIR}/Math.h
     ${COMMON_DIR}/Optional.h
     ${COMMON_DIR}/Platform.h
+    ${COMMON_DIR}/Serialize.cpp
     ${COMMON_DIR}/Serialize.h
     ${COMMON_DIR}/String.cpp
     ${COMMON_DIR}/String.h
@@ -208,6 +209,7 @@ set(SERVERLIST
     ${ENGINE_DIR}/server/sv_init.cpp
     ${ENGINE_DIR}/server/sv_main.cpp
     ${ENGINE_DIR}/server/sv_net_chan.cpp
+    ${ENGINE_DIR}/server/sv_profile.cpp
     ${ENGINE_DIR}/server/sv_sgame.cpp
     ${ENGINE_DIR}/server/sv_snapshot.cpp
     ${ENGINE_DIR}/server/CryptoChallenge.cpp
@@ -239,8 +241,11 @@ set(ENGINELIST
     ${ENGINE_DIR}/framework/Resource.h
     ${ENGINE_DIR}/framework/System.cpp
     ${ENGINE_DIR}/framework/System.h
+    ${ENGINE_DIR}/framework/ThreadPool.cpp
+    ${ENGINE_DIR}/framework/ThreadPool.h
     ${ENGINE_DIR}/framework/VirtualMachine.cpp
     ${ENGINE_DIR}/framework/VirtualMachine.h
+    ${ENGINE_DIR}/framework/VMTrace.h
     ${ENGINE_DIR}/framework/Crypto.cpp
     ${ENGINE_DIR}/framework/Crypto.h
     ${ENGINE_DIR}/framework/Rcon.cpp
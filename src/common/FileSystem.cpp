@@ -53,6 +53,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <fcntl.h>
 #include <dirent.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #endif
 #ifdef __APPLE__
 #include <mach-o/dyld.h>
@@ -125,6 +126,7 @@ namespace FS {
 #ifdef BUILD_ENGINE
 static Cvar::Cvar<bool> fs_legacypaks("fs_legacypaks", "also load pk3s, ignoring version", Cvar::NONE, false);
 static Cvar::Cvar<int> fs_maxSymlinkDepth("fs_maxSymlinkDepth", "max depth of symlinks in zip paks (0 means disabled)", Cvar::NONE, 1);
+static Cvar::Cvar<bool> fs_pakIndexCache("fs_pakIndexCache", "remember the file lists of dpks in the homepath to load them faster", Cvar::NONE, true);
 
 bool UseLegacyPaks()
 {
@@ -690,6 +692,11 @@ public:
 			unzClose(zipFile);
 	}
 
+	bool IsOpen() const
+	{
+		return zipFile != nullptr;
+	}
+
 	// Open an archive from an existing file descriptor
 	static ZipArchive Open(int fd, std::error_code& err)
 	{
@@ -936,6 +943,23 @@ public:
 		}
 	}
 
+	// Get where the data of the currently open file starts in the archive,
+	// if it is stored without compression or encryption, and its CRC
+	Util::optional<offset_t> StoredDataOffset(uint32_t& crc, std::error_code& err) const
+	{
+		unz_file_info64 fileInfo;
+		int result = unzGetCurrentFileInfo64(zipFile, &fileInfo, nullptr, 0, nullptr, 0, nullptr, 0);
+		if (result != UNZ_OK) {
+			SetErrorCodeZlib(err, result);
+			return Util::nullopt;
+		}
+		ClearErrorCode(err);
+		if (fileInfo.compression_method != 0 || (fileInfo.flag & 1))
+			return Util::nullopt;
+		crc = fileInfo.crc;
+		return unzGetCurrentFileZStreamPos64(zipFile);
+	}
+
 	// Get the length of the currently open file
 	offset_t FileLength(std::error_code& err) const
 	{
@@ -1046,6 +1070,224 @@ static LoadedPakGuard loadedPaksGuard;
 static std::unordered_map<std::string, std::pair<uint32_t, offset_t>> fileMap;
 
 #ifndef BUILD_VM
+// Cache of the file lists of zip paks, so that loading a pak which didn't
+// change since it was last loaded doesn't need to parse its central directory.
+// Entries are keyed by the path of the pak and checked against its size and
+// change time. All the files are kept, since the checksum depends on the prefix.
+#define PAK_INDEX_CACHE_FILE "pakindex.cache"
+static const uint32_t PAK_INDEX_CACHE_VERSION = 2;
+
+struct pakIndexFile_t {
+	std::string filename;
+	offset_t offset;
+	uint32_t crc;
+};
+struct pakIndex_t {
+	uint64_t size;
+	int64_t timestamp; // see PakChangeTime
+
+	// The file lists read from the cache are only parsed when their pak is
+	// loaded, until then they are a range of pakIndexCacheData
+	bool parsed;
+	size_t dataOffset;
+	size_t dataLength;
+	std::vector<pakIndexFile_t> files;
+};
+static std::unordered_map<std::string, pakIndex_t> pakIndexCache;
+static std::string pakIndexCacheData;
+static bool pakIndexCacheLoaded = false;
+static bool pakIndexCacheDirty = false;
+
+static void LoadPakIndexCache()
+{
+	if (pakIndexCacheLoaded)
+		return;
+	pakIndexCacheLoaded = true;
+
+	std::error_code err;
+	File file = HomePath::OpenRead(PAK_INDEX_CACHE_FILE, err);
+	if (err)
+		return;
+	pakIndexCacheData = file.ReadAll(err);
+	if (err)
+		return;
+
+	Util::Reader reader;
+	reader.SetView(pakIndexCacheData.data(), pakIndexCacheData.size());
+	try {
+		if (reader.Read<uint32_t>() != PAK_INDEX_CACHE_VERSION)
+			return;
+		uint32_t numPaks = reader.Read<uint32_t>();
+		for (uint32_t i = 0; i < numPaks; i++) {
+			std::string path = reader.Read<std::string>();
+			pakIndex_t index;
+			index.size = reader.Read<uint64_t>();
+			index.timestamp = reader.Read<int64_t>();
+			index.parsed = false;
+			index.dataLength = reader.Read<uint32_t>();
+			const char* data = static_cast<const char*>(reader.ReadInline(index.dataLength));
+			index.dataOffset = data - pakIndexCacheData.data();
+
+			// Don't replace the paks which were read while the cache was disabled
+			pakIndexCache.emplace(std::move(path), std::move(index));
+		}
+		reader.CheckEndRead();
+	} catch (Sys::DropErr& error) {
+		fsLogs.Warn("Ignoring invalid pak index cache: %s", error.what());
+		pakIndexCache.clear();
+	}
+}
+
+static bool ParsePakIndex(pakIndex_t& index)
+{
+	if (index.parsed)
+		return true;
+
+	Util::Reader reader;
+	reader.SetView(pakIndexCacheData.data() + index.dataOffset, index.dataLength);
+	try {
+		uint32_t numFiles = reader.Read<uint32_t>();
+		index.files.reserve(std::min<size_t>(numFiles, index.dataLength));
+		for (uint32_t i = 0; i < numFiles; i++) {
+			pakIndexFile_t indexFile;
+			indexFile.filename = reader.Read<std::string>();
+			indexFile.offset = reader.Read<uint64_t>();
+			indexFile.crc = reader.Read<uint32_t>();
+			index.files.push_back(std::move(indexFile));
+		}
+		reader.CheckEndRead();
+	} catch (Sys::DropErr& error) {
+		fsLogs.Warn("Ignoring invalid pak index cache entry: %s", error.what());
+		index.files.clear();
+		return false;
+	}
+	index.parsed = true;
+	return true;
+}
+
+static void SavePakIndexCache()
+{
+	if (!pakIndexCacheDirty || !fs_pakIndexCache.Get())
+		return;
+	pakIndexCacheDirty = false;
+
+	// Forget the paks which don't exist anymore
+	std::vector<std::unordered_map<std::string, pakIndex_t>::const_iterator> entries;
+	for (auto it = pakIndexCache.begin(); it != pakIndexCache.end(); ++it) {
+		if (std::any_of(availablePaks.begin(), availablePaks.end(), [&it](const PakInfo& pak) { return pak.path == it->first; }))
+			entries.push_back(it);
+	}
+
+	Util::Writer writer;
+	writer.Write<uint32_t>(PAK_INDEX_CACHE_VERSION);
+	writer.Write<uint32_t>(entries.size());
+	for (auto it: entries) {
+		const pakIndex_t& index = it->second;
+		writer.Write<std::string>(it->first);
+		writer.Write<uint64_t>(index.size);
+		writer.Write<int64_t>(index.timestamp);
+		if (!index.parsed) {
+			writer.Write<uint32_t>(index.dataLength);
+			writer.WriteData(pakIndexCacheData.data() + index.dataOffset, index.dataLength);
+			continue;
+		}
+
+		Util::Writer files;
+		files.Write<uint32_t>(index.files.size());
+		for (const pakIndexFile_t& indexFile: index.files) {
+			files.Write<std::string>(indexFile.filename);
+			files.Write<uint64_t>(indexFile.offset);
+			files.Write<uint32_t>(indexFile.crc);
+		}
+		writer.Write<uint32_t>(files.GetData().size());
+		writer.WriteData(files.GetData().data(), files.GetData().size());
+	}
+
+	// Write to a temporary file first so that a partially written cache is never used
+	std::string tempName = HomePath::TempFileName(PAK_INDEX_CACHE_FILE);
+	std::error_code err;
+	File file = HomePath::OpenWrite(tempName, err);
+	if (!err)
+		file.Write(writer.GetData().data(), writer.GetData().size(), err);
+	if (!err)
+		file.Close(err);
+	if (!err)
+		HomePath::MoveFile(PAK_INDEX_CACHE_FILE, tempName, err);
+	if (err) {
+		fsLogs.Warn("Could not save the pak index cache: %s", err.message());
+		std::error_code ignored;
+		HomePath::DeleteFile(tempName, ignored);
+	}
+}
+
+// Time of the last change of a pak, in the finest unit the platform gives, so
+// that a pak rewritten within the same second doesn't keep its cached index
+static int64_t PakChangeTime(int fd, const my_stat_t& st)
+{
+#ifdef _WIN32
+	// In 100 ns units
+	FILETIME creation, write;
+	if (!GetFileTime(reinterpret_cast<HANDLE>(_get_osfhandle(fd)), &creation, nullptr, &write))
+		return int64_t(std::max(st.st_ctime, st.st_mtime)) * 10000000;
+	auto ticks = [](const FILETIME& time) {
+		return int64_t(uint64_t(time.dwHighDateTime) << 32 | time.dwLowDateTime);
+	};
+	return std::max(ticks(creation), ticks(write));
+#else
+	Q_UNUSED(fd);
+	auto ns = [](const timespec& time) {
+		return int64_t(time.tv_sec) * 1000000000 + time.tv_nsec;
+	};
+#ifdef __APPLE__
+	return std::max(ns(st.st_ctimespec), ns(st.st_mtimespec));
+#else
+	return std::max(ns(st.st_ctim), ns(st.st_mtim));
+#endif
+#endif
+}
+
+// Get the list of files in a zip pak, from the cache if it is up to date or by
+// opening the archive otherwise
+static const std::vector<pakIndexFile_t>* GetPakIndex(const PakInfo& pak, int fd, ZipArchive& zipFile, std::error_code& err)
+{
+	my_stat_t st;
+	if (my_fstat(fd, &st) == -1) {
+		SetErrorCodeSystem(err);
+		return nullptr;
+	}
+	uint64_t size = st.st_size;
+	int64_t timestamp = PakChangeTime(fd, st);
+
+	if (fs_pakIndexCache.Get()) {
+		LoadPakIndexCache();
+		auto it = pakIndexCache.find(pak.path);
+		if (it != pakIndexCache.end() && it->second.size == size && it->second.timestamp == timestamp && ParsePakIndex(it->second)) {
+			fsLogs.Debug("Using the cached file list of pak '%s'", pak.path);
+			ClearErrorCode(err);
+			return &it->second.files;
+		}
+	}
+
+	zipFile = ZipArchive::Open(fd, err);
+	if (err)
+		return nullptr;
+
+	pakIndex_t index;
+	index.size = size;
+	index.timestamp = timestamp;
+	index.parsed = true;
+	zipFile.ForEachFile([&index](Str::StringRef filename, offset_t offset, uint32_t crc) {
+		index.files.push_back({filename, offset, crc});
+	}, err);
+	if (err)
+		return nullptr;
+
+	pakIndex_t& entry = pakIndexCache[pak.path];
+	entry = std::move(index);
+	pakIndexCacheDirty = true;
+	return &entry.files;
+}
+
 // Parse the dependencies file of a package
 // Each line of the dependencies file is a name followed by an optional version
 static void ParseDeps(const PakInfo& parent, Str::StringRef depsData, std::error_code& err)
@@ -1183,38 +1425,36 @@ static void InternalLoadPak(const PakInfo& pak, Util::optional<uint32_t> expecte
 			return;
 		}
 
-		// Open zip
-		zipFile = ZipArchive::Open(loadedPak.fd, err);
+		// Get the file list, the zip is only opened if it isn't cached
+		const std::vector<pakIndexFile_t>* files = GetPakIndex(pak, loadedPak.fd, zipFile, err);
 		if (err)
 			return;
 
-		// Get the file list and calculate the checksum of the package (checksum of all file checksums)
+		// Calculate the checksum of the package (checksum of all file checksums)
 		realChecksum = crc32(0, Z_NULL, 0);
-		zipFile.ForEachFile([&pak, &realChecksum, &pathPrefix, &hasDeps, &depsOffset, &isLegacy](Str::StringRef filename, offset_t offset, uint32_t crc) {
-			// Note that 'return' is effectively 'continue' since we are in a lambda
+		for (const pakIndexFile_t& indexFile: *files) {
+			const std::string& filename = indexFile.filename;
 			if (!Str::IsPrefix(pathPrefix, filename) && filename != PAK_DEPS_FILE)
-				return;
+				continue;
 			if (Str::IsSuffix("/", filename))
-				return;
+				continue;
 			if (!Path::IsValid(filename, false)) {
 				fsLogs.Warn("Invalid filename '%s' in pak '%s'", filename, pak.path);
-				return;
+				continue;
 			}
 
 			// Legacy paks don't have version neither checksum
 			if (!isLegacy) {
-				realChecksum = crc32(*realChecksum, reinterpret_cast<const Bytef*>(&crc), sizeof(crc));
+				realChecksum = crc32(*realChecksum, reinterpret_cast<const Bytef*>(&indexFile.crc), sizeof(indexFile.crc));
 			}
 
 			if (!isLegacy && (filename == PAK_DEPS_FILE)) {
 				hasDeps = true;
-				depsOffset = offset;
-				return;
+				depsOffset = indexFile.offset;
+				continue;
 			}
-			fileMap.emplace(filename, std::pair<uint32_t, offset_t>(loadedPaks.size() - 1, offset));
-		}, err);
-		if (err)
-			return;
+			fileMap.emplace(filename, std::pair<uint32_t, offset_t>(loadedPaks.size() - 1, indexFile.offset));
+		}
 	} else {
 		ASSERT_UNREACHABLE();
 	}
@@ -1259,6 +1499,11 @@ static void InternalLoadPak(const PakInfo& pak, Util::optional<uint32_t> expecte
 			if (err)
 				return;
 		} else if (pak.type == pakType_t::PAK_ZIP) {
+			if (!zipFile.IsOpen()) {
+				zipFile = ZipArchive::Open(loadedPak.fd, err);
+				if (err)
+					return;
+			}
 			zipFile.OpenFile(depsOffset, err);
 			if (err)
 				return;
@@ -1280,16 +1525,19 @@ static void InternalLoadPak(const PakInfo& pak, Util::optional<uint32_t> expecte
 void LoadPak(const PakInfo& pak, std::error_code& err)
 {
 	InternalLoadPak(pak, Util::nullopt, "", err);
+	SavePakIndexCache();
 }
 
 void LoadPakPrefix(const PakInfo& pak, Str::StringRef pathPrefix, std::error_code& err)
 {
 	InternalLoadPak(pak, Util::nullopt, pathPrefix, err);
+	SavePakIndexCache();
 }
 
 void LoadPakExplicit(const PakInfo& pak, uint32_t expectedChecksum, std::error_code& err)
 {
 	InternalLoadPak(pak, expectedChecksum, "", err);
+	SavePakIndexCache();
 }
 
 void ClearPaks()
@@ -1348,6 +1596,27 @@ std::string ReadFile(Str::StringRef path, std::error_code& err) {
 	ClearErrorCode(err);
 	return content;
 }
+
+MappedFile MapFile(Str::StringRef path, std::error_code& err)
+{
+	MappedFile out;
+	if (!PakPath::FileExists(path)) {
+		SetErrorCodeFilesystem(err, filesystem_error::no_such_file);
+		return out;
+	}
+	Util::optional<IPC::SharedMemory> shm;
+	uint64_t length;
+	VM::SendMsg<VM::FSPakPathMapFileMsg>(path, shm, length);
+	if (!shm) {
+		SetErrorCodeFilesystem(err, filesystem_error::io_error);
+		return out;
+	}
+	out.shm.reset(new IPC::SharedMemory(std::move(*shm)));
+	out.base = static_cast<const char*>(out.shm->GetBase());
+	out.length = length;
+	ClearErrorCode(err);
+	return out;
+}
 #endif
 
 #ifdef BUILD_ENGINE
@@ -1458,8 +1727,178 @@ void CopyFile(Str::StringRef path, const File& dest, std::error_code& err)
 		ASSERT_UNREACHABLE();
 	}
 }
+
+// Map a range of a file read-only, returns false if the OS can't
+static bool MapFileRange(int fd, offset_t offset, size_t length, void*& mapping, size_t& mappingLength)
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	offset_t start = offset - offset % info.dwAllocationGranularity;
+	HANDLE section = CreateFileMappingW(reinterpret_cast<HANDLE>(_get_osfhandle(fd)), nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!section)
+		return false;
+	mappingLength = length + (offset - start);
+	mapping = MapViewOfFile(section, FILE_MAP_READ, start >> 32, start & 0xffffffff, mappingLength);
+
+	// The view keeps the section alive
+	CloseHandle(section);
+	return mapping != nullptr;
+#else
+	offset_t pageSize = sysconf(_SC_PAGESIZE);
+	offset_t start = offset - offset % pageSize;
+	mappingLength = length + (offset - start);
+	mapping = mmap(nullptr, mappingLength, PROT_READ, MAP_PRIVATE, fd, start);
+	if (mapping == MAP_FAILED) {
+		mapping = nullptr;
+		return false;
+	}
+	return true;
+#endif
+}
+
+MappedFile MapFile(Str::StringRef path, std::error_code& err)
+{
+	MappedFile out;
+	auto it = fileMap.find(path);
+	if (it == fileMap.end()) {
+		SetErrorCodeFilesystem(err, filesystem_error::no_such_file);
+		return out;
+	}
+
+	const LoadedPakInfo& pak = loadedPaks[it->second.first];
+	if (pak.type == pakType_t::PAK_DIR) {
+		// Open file, the mapping stays valid once it is closed
+		int fd = my_open(Path::Build(pak.path, path), openMode_t::MODE_READ);
+		if (fd == -1) {
+			SetErrorCodeSystem(err);
+			return out;
+		}
+
+		my_stat_t st;
+		if (my_fstat(fd, &st) == -1) {
+			SetErrorCodeSystem(err);
+			close(fd);
+			return out;
+		}
+
+		out.length = st.st_size;
+		bool mapped = out.length && MapFileRange(fd, 0, out.length, out.mapping, out.mappingLength);
+		close(fd);
+		if (mapped) {
+			out.base = static_cast<const char*>(out.mapping);
+			ClearErrorCode(err);
+			return out;
+		}
+	} else if (pak.type == pakType_t::PAK_ZIP) {
+		// Open zip
+		ZipArchive zipFile = ZipArchive::Open(pak.fd, err);
+		if (err)
+			return out;
+
+		// Open file in zip
+		offset_t length = zipFile.OpenFileWithSymlinkResolution(path, it->second.second, err);
+		if (err)
+			return out;
+
+		uint32_t crc = 0;
+		std::error_code ignored;
+		Util::optional<offset_t> dataOffset = zipFile.StoredDataOffset(crc, err);
+		if (err) {
+			zipFile.CloseFile(ignored);
+			return out;
+		}
+
+		out.length = length;
+		if (dataOffset && length && MapFileRange(pak.fd, *dataOffset, length, out.mapping, out.mappingLength)) {
+			zipFile.CloseFile(ignored);
+			out.base = static_cast<const char*>(out.mapping) + (out.mappingLength - out.length);
+
+			// Check for CRC errors like reading the file through zlib does
+			uLong realCrc = crc32(0, nullptr, 0);
+			for (size_t done = 0; done != out.length;) {
+				uInt chunk = std::min<size_t>(out.length - done, INT_MAX);
+				realCrc = crc32(realCrc, reinterpret_cast<const Bytef*>(out.base + done), chunk);
+				done += chunk;
+			}
+			if (realCrc != crc) {
+				SetErrorCodeZlib(err, UNZ_CRCERROR);
+				return out;
+			}
+			ClearErrorCode(err);
+			return out;
+		}
+
+		// Read file
+		out.contents.resize(length);
+		zipFile.ReadFile(out.contents.data(), length, err);
+		if (err) {
+			zipFile.CloseFile(ignored);
+			return out;
+		}
+
+		// Close file and check for CRC errors
+		zipFile.CloseFile(err);
+		out.base = out.contents.data();
+		return out;
+	} else {
+		ASSERT_UNREACHABLE();
+	}
+
+	// Fall back to reading files which can't be mapped
+	std::string data = ReadFile(path, err);
+	out.contents.assign(data.begin(), data.end());
+	out.base = out.contents.data();
+	out.length = out.contents.size();
+	return out;
+}
 #endif //BUILD_ENGINE
 
+MappedFile::MappedFile()
+	: base(""), length(0), mapping(nullptr), mappingLength(0) {}
+
+MappedFile::MappedFile(MappedFile&& other) NOEXCEPT
+	: MappedFile()
+{
+	*this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) NOEXCEPT
+{
+	// Swapping the vectors keeps base pointing into the contents
+	std::swap(base, other.base);
+	std::swap(length, other.length);
+	std::swap(mapping, other.mapping);
+	std::swap(mappingLength, other.mappingLength);
+	std::swap(contents, other.contents);
+	std::swap(shm, other.shm);
+	return *this;
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+void MappedFile::Close()
+{
+#ifdef BUILD_ENGINE
+	if (mapping) {
+#ifdef _WIN32
+		UnmapViewOfFile(mapping);
+#else
+		munmap(mapping, mappingLength);
+#endif
+	}
+#endif
+	base = "";
+	length = 0;
+	mapping = nullptr;
+	mappingLength = 0;
+	contents.clear();
+	shm.reset();
+}
+
 bool FileExists(Str::StringRef path)
 {
 	return fileMap.find(path) != fileMap.end();
@@ -1945,6 +2384,31 @@ File OpenEdit(Str::StringRef path, std::error_code& err)
 {
 	return OpenMode(path, openMode_t::MODE_EDIT, err);
 }
+
+PakPath::MappedFile MapFile(Str::StringRef path, std::error_code& err)
+{
+	PakPath::MappedFile out;
+	File file = OpenRead(path, err);
+	if (err)
+		return out;
+
+	// The mapping stays valid once the file is closed
+	out.length = file.Length(err);
+	if (err)
+		return out;
+	if (!out.length)
+		return out;
+	if (PakPath::MapFileRange(fileno(file.GetHandle()), 0, out.length, out.mapping, out.mappingLength)) {
+		out.base = static_cast<const char*>(out.mapping);
+		return out;
+	}
+
+	// Fall back to reading files which can't be mapped
+	out.contents.resize(out.length);
+	file.Read(out.contents.data(), out.length, err);
+	out.base = out.contents.data();
+	return out;
+}
 #endif //BUILD_ENGINE
 
 bool FileExists(Str::StringRef path)
@@ -2016,6 +2480,17 @@ void DeleteFile(Str::StringRef path, std::error_code& err)
 #endif
 }
 
+#ifndef BUILD_VM
+std::string TempFileName(Str::StringRef path)
+{
+#ifdef _WIN32
+	return Str::Format("%s.%d.tmp", path, GetCurrentProcessId());
+#else
+	return Str::Format("%s.%d.tmp", path, getpid());
+#endif
+}
+#endif
+
 DirectoryRange ListFiles(Str::StringRef path, std::error_code& err)
 {
 #ifdef BUILD_VM
@@ -2737,6 +3212,23 @@ void HandleFileSystemSyscall(int minor, Util::Reader& reader, IPC::Channel& chan
 		});
 		break;
 
+	case VM::FS_PAKPATH_MAPFILE:
+		IPC::HandleMsg<VM::FSPakPathMapFileMsg>(channel, std::move(reader), [](std::string path, Util::optional<IPC::SharedMemory>& out, uint64_t& length) {
+			std::error_code err;
+			length = 0;
+			PakPath::MappedFile file = PakPath::MapFile(path, err);
+			if (err)
+				return;
+
+			// One copy from the mapped pages, instead of one into the
+			// message and another out of it
+			IPC::SharedMemory shm = IPC::SharedMemory::Create(std::max<size_t>(file.size(), 1));
+			memcpy(shm.GetBase(), file.data(), file.size());
+			length = file.size();
+			out = std::move(shm);
+		});
+		break;
+
 	default:
 		Sys::Drop("Bad filesystem syscall number '%d' for VM '%s'", minor, vmName);
 	}
@@ -37,6 +37,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "IPC/Channel.h"
 #endif
 
+namespace IPC {
+	class SharedMemory;
+}
+
 namespace FS {
 
 bool UseLegacyPaks();
@@ -291,6 +295,16 @@ struct LoadedPakInfo: public PakInfo {
 	std::string pathPrefix;
 };
 
+namespace PakPath {
+	class MappedFile;
+}
+#ifdef BUILD_ENGINE
+namespace HomePath {
+	// Map an entire file read-only, see PakPath::MapFile
+	PakPath::MappedFile MapFile(Str::StringRef path, std::error_code& err);
+}
+#endif
+
 // Operations which work on files that are in packages. Packages should be used
 // for read-only assets which can be distributed by auto-download.
 namespace PakPath {
@@ -315,6 +329,61 @@ namespace PakPath {
 	// Read an entire file into a string
 	std::string ReadFile(Str::StringRef path, std::error_code& err = throws());
 
+	// Read-only view of an entire file, see MapFile
+	class MappedFile {
+	public:
+		MappedFile();
+		MappedFile(MappedFile&& other) NOEXCEPT;
+		MappedFile& operator=(MappedFile&& other) NOEXCEPT;
+		~MappedFile();
+
+		// Noncopyable
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		const char* data() const
+		{
+			return base;
+		}
+		size_t size() const
+		{
+			return length;
+		}
+
+		// Whether the contents are mapped from the file or from shared memory
+		// rather than read into a buffer of their own
+		bool IsMapped() const
+		{
+			return mapping != nullptr || shm != nullptr;
+		}
+
+		// Whether the contents are the pages of the file itself, which the
+		// system can drop and read again, rather than memory of their own
+		bool IsFileMapping() const
+		{
+			return mapping != nullptr;
+		}
+
+	private:
+		friend MappedFile MapFile(Str::StringRef path, std::error_code& err);
+#ifdef BUILD_ENGINE
+		friend MappedFile HomePath::MapFile(Str::StringRef path, std::error_code& err);
+#endif
+		void Close();
+
+		const char* base;
+		size_t length;
+		void* mapping; // the start of the pages mapped from the file
+		size_t mappingLength;
+		std::vector<char> contents;
+		std::unique_ptr<IPC::SharedMemory> shm;
+	};
+
+	// Map an entire file read-only. The pages of a file in a pak directory or
+	// stored uncompressed in a zip are mapped in place, other files are read
+	// into memory. In a VM the engine reads the file into shared memory.
+	MappedFile MapFile(Str::StringRef path, std::error_code& err = throws());
+
 	// Copy an entire file to another file
 	void CopyFile(Str::StringRef path, const File& dest, std::error_code& err = throws());
 
@@ -470,6 +539,12 @@ namespace HomePath {
 	void MoveFile(Str::StringRef dest, Str::StringRef src, std::error_code& err = throws());
 	void DeleteFile(Str::StringRef path, std::error_code& err = throws());
 
+#ifndef BUILD_VM
+	// Name of a temporary file to write before moving it to path, unique to
+	// this process so that engines sharing a homepath don't write to the same one
+	std::string TempFileName(Str::StringRef path);
+#endif
+
 	// List all files in the given subdirectory, optionally recursing into subdirectories
 	// Directory names are returned with a trailing slash to differentiate them from files
 #ifdef BUILD_VM
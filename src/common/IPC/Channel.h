@@ -84,16 +84,18 @@ namespace IPC {
     class Channel {
     public:
         Channel()
-            : canSendSyncMsg(TOPLEVEL_MSG_ALLOWED), canSendAsyncMsg(TOPLEVEL_MSG_ALLOWED) {}
+            : canSendSyncMsg(TOPLEVEL_MSG_ALLOWED), canSendAsyncMsg(TOPLEVEL_MSG_ALLOWED), discardReply(false), bytesSent(0) {}
         Channel(Socket socket)
-            : socket(std::move(socket)), canSendSyncMsg(TOPLEVEL_MSG_ALLOWED), canSendAsyncMsg(TOPLEVEL_MSG_ALLOWED) {}
+            : socket(std::move(socket)), canSendSyncMsg(TOPLEVEL_MSG_ALLOWED), canSendAsyncMsg(TOPLEVEL_MSG_ALLOWED), discardReply(false), bytesSent(0) {}
         Channel(Channel&& other)
-            : socket(std::move(other.socket)), canSendSyncMsg(TOPLEVEL_MSG_ALLOWED), canSendAsyncMsg(TOPLEVEL_MSG_ALLOWED) {}
+            : socket(std::move(other.socket)), canSendSyncMsg(TOPLEVEL_MSG_ALLOWED), canSendAsyncMsg(TOPLEVEL_MSG_ALLOWED), discardReply(false), bytesSent(0) {}
         Channel& operator=(Channel&& other)
         {
             std::swap(socket, other.socket);
             canSendSyncMsg = other.canSendSyncMsg;
             canSendAsyncMsg = other.canSendAsyncMsg;
+            discardReply = other.discardReply;
+            bytesSent = other.bytesSent;
             return *this;
         }
         explicit operator bool() const
@@ -105,11 +107,16 @@ namespace IPC {
         void SendMsg(const Util::Writer& writer) const
         {
             socket.SendMsg(writer);
+            bytesSent += writer.GetData().size();
         }
         Util::Reader RecvMsg() const
         {
             return socket.RecvMsg();
         }
+        Sys::OSHandle GetHandle() const
+        {
+            return socket.GetHandle();
+        }
         void SetRecvTimeout(std::chrono::nanoseconds timeout)
         {
             socket.SetRecvTimeout(timeout);
@@ -131,6 +138,13 @@ namespace IPC {
     public:
         bool canSendSyncMsg;
         bool canSendAsyncMsg;
+
+        // Set when handling a SyncMessage that was queued in a command buffer,
+        // the sender doesn't wait for the reply so it must not be sent.
+        bool discardReply;
+
+        // Total size of the messages sent, used to trace the syscalls
+        mutable uint64_t bytesSent;
     };
 
     namespace detail {
@@ -210,6 +224,10 @@ namespace IPC {
             reader.FillTuple<0>(Util::TypeListFromTuple<typename Message::Inputs>(), inputs);
             reader.CheckEndRead();
 
+            // Only applies to this message, not to the ones received while handling it
+            bool discardReply = channel.discardReply;
+            channel.discardReply = false;
+
             bool oldSync = channel.canSendSyncMsg;
             bool oldAsync = channel.canSendAsyncMsg;
             channel.canSendSyncMsg = true;
@@ -218,6 +236,9 @@ namespace IPC {
             channel.canSendSyncMsg = oldSync;
             channel.canSendAsyncMsg = oldAsync;
 
+            if (discardReply)
+                return;
+
             Util::Writer writer;
             writer.Write<uint32_t>(ID_RETURN);
             writer.WriteTuple(Util::TypeListFromTuple<typename Message::Outputs>(), std::move(outputs));
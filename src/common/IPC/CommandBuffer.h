@@ -117,6 +117,8 @@ namespace IPC {
         size_t size;
     };
 
+    // Sent by the VM for its command buffer, and by the engine for the
+    // messages it queues with VMBase::QueueMsg.
     enum {
         COMMAND_BUFFER_LOCATE,
         COMMAND_BUFFER_CONSUME,
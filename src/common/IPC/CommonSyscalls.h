@@ -256,7 +256,8 @@ namespace VM {
         FS_HOMEPATH_LISTFILES,
         FS_HOMEPATH_LISTFILESRECURSIVE,
         FS_PAKPATH_TIMESTAMP,
-        FS_PAKPATH_LOADPAK
+        FS_PAKPATH_LOADPAK,
+        FS_PAKPATH_MAPFILE
     };
 
     using FSInitializeMsg = IPC::SyncMessage<
@@ -294,6 +295,11 @@ namespace VM {
     using FSPakPathLoadPakMsg = IPC::SyncMessage<
         IPC::Message<IPC::Id<FILESYSTEM, FS_PAKPATH_LOADPAK>, uint32_t, Util::optional<uint32_t>, std::string>
     >;
+    // The shared memory is rounded up to pages, so the length of the file is sent along
+    using FSPakPathMapFileMsg = IPC::SyncMessage<
+        IPC::Message<IPC::Id<FILESYSTEM, FS_PAKPATH_MAPFILE>, std::string>,
+        IPC::Reply<Util::optional<IPC::SharedMemory>, uint64_t>
+    >;
 
 }
 
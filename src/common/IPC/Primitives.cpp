@@ -171,10 +171,50 @@ FileHandle FileHandle::FromDesc(const FileDesc& desc)
 #endif
 }
 
+// Large messages are copied through a shared memory segment and only a small
+// descriptor is sent over the socket, which avoids splitting them into many
+// datagrams. Each socket keeps a few segments which are reused once the other
+// side has copied the message out of them; the first bytes of a segment hold a
+// flag which is set by the sender and cleared by the receiver.
+static const size_t BULK_MIN_BYTES = 16 << 10;
+static const size_t BULK_MIN_SEGMENT_SIZE = 256 << 10;
+static const size_t BULK_MAX_SEGMENTS = 4;
+static const size_t BULK_HEADER_SIZE = 64;
+
+// First byte of every datagram
+enum : char {
+	MSG_LAST,
+	MSG_MORE,
+	MSG_BULK,
+};
+
+struct bulkDescriptor_t {
+	uint32_t segment;
+	uint32_t length;
+};
+
+static std::atomic<bool> bulkEnabled(true);
+static std::mutex bulkSendLock, bulkRecvLock;
+static std::unordered_map<Sys::OSHandle, std::vector<SharedMemory>> bulkSendSegments, bulkRecvSegments;
+
+static std::atomic<uint32_t>& BulkBusyFlag(const SharedMemory& segment)
+{
+	return *static_cast<std::atomic<uint32_t>*>(segment.GetBase());
+}
+
 void Socket::Close()
 {
-	if (Sys::IsValidHandle(handle))
+	if (Sys::IsValidHandle(handle)) {
+		{
+			std::lock_guard<std::mutex> guard(bulkSendLock);
+			bulkSendSegments.erase(handle);
+		}
+		{
+			std::lock_guard<std::mutex> guard(bulkRecvLock);
+			bulkRecvSegments.erase(handle);
+		}
 		NaClClose(handle);
+	}
 	handle = Sys::INVALID_HANDLE;
 }
 
@@ -201,7 +241,7 @@ Socket Socket::FromHandle(Sys::OSHandle handle)
 	return out;
 }
 
-static void InternalSendMsg(Sys::OSHandle handle, bool more, const FileDesc* handles, size_t numHandles, const void* data, size_t len)
+static void InternalSendMsg(Sys::OSHandle handle, char tag, const FileDesc* handles, size_t numHandles, const void* data, size_t len)
 {
 	NaClMessageHeader hdr;
 	NaClIOVec iov[4];
@@ -219,7 +259,7 @@ static void InternalSendMsg(Sys::OSHandle handle, bool more, const FileDesc* han
 	hdr.handles = h;
 	hdr.handle_count = numHandles;
 	hdr.flags = 0;
-	iov[0].base = &more;
+	iov[0].base = &tag;
 	iov[0].length = 1;
 	iov[1].base = const_cast<void*>(data);
 	iov[1].length = len;
@@ -276,7 +316,7 @@ static void InternalSendMsg(Sys::OSHandle handle, bool more, const FileDesc* han
 	iov[0].length = sizeof(NaClInternalHeader);
 	iov[1].base = descBuffer.get();
 	iov[1].length = descBytes;
-	iov[2].base = &more;
+	iov[2].base = &tag;
 	iov[2].length = 1;
 	iov[3].base = const_cast<void*>(data);
 	iov[3].length = len;
@@ -289,6 +329,66 @@ static void InternalSendMsg(Sys::OSHandle handle, bool more, const FileDesc* han
 #endif
 }
 
+// Returns false if all segments are in use, the message is then sent in pieces
+static bool SendBulkMsg(Sys::OSHandle handle, const void* data, size_t len)
+{
+	SharedMemory created;
+	while (true) {
+		std::unique_lock<std::mutex> guard(bulkSendLock);
+		std::vector<SharedMemory>& segments = bulkSendSegments[handle];
+
+		// Prefer a free segment that is large enough, otherwise replace a free
+		// one which is too small or add a new one.
+		size_t index = segments.size();
+		size_t replace = segments.size();
+		for (size_t i = 0; i < segments.size(); i++) {
+			if (BulkBusyFlag(segments[i]).load(std::memory_order_acquire))
+				continue;
+			if (segments[i].GetSize() - BULK_HEADER_SIZE >= len) {
+				index = i;
+				break;
+			}
+			replace = i;
+		}
+
+		bool isNew = false;
+		if (index == segments.size()) {
+			if (replace == segments.size() && segments.size() == BULK_MAX_SEGMENTS)
+				return false;
+
+			// Creating the segment may itself need to send a message in the
+			// VM, so do it without holding the lock and look again afterwards.
+			if (!created || created.GetSize() - BULK_HEADER_SIZE < len) {
+				guard.unlock();
+				size_t size = BULK_MIN_SEGMENT_SIZE;
+				while (size - BULK_HEADER_SIZE < len)
+					size *= 2;
+				created = SharedMemory::Create(size);
+				new(created.GetBase()) std::atomic<uint32_t>(0);
+				continue;
+			}
+
+			index = replace;
+			if (index == segments.size())
+				segments.emplace_back();
+			segments[index] = std::move(created);
+			isNew = true;
+		}
+
+		SharedMemory& segment = segments[index];
+		memcpy(static_cast<char*>(segment.GetBase()) + BULK_HEADER_SIZE, data, len);
+		BulkBusyFlag(segment).store(1, std::memory_order_release);
+
+		// The segment handle is only sent the first time it is used
+		bulkDescriptor_t desc;
+		desc.segment = index;
+		desc.length = len;
+		FileDesc segmentDesc = segment.GetDesc();
+		InternalSendMsg(handle, MSG_BULK, isNew ? &segmentDesc : nullptr, isNew ? 1 : 0, &desc, sizeof(desc));
+		return true;
+	}
+}
+
 void Socket::SendMsg(const Util::Writer& writer) const
 {
 	const FileDesc* handles = writer.GetHandles().data();
@@ -300,9 +400,12 @@ void Socket::SendMsg(const Util::Writer& writer) const
 	// NaCl defines NACL_ABI_IMC_USER_BYTES_MAX as 128K, use 4K instead
 	const size_t MAX_IPC_BYTES = 4 << 10;
 
+	if (numHandles == 0 && len >= BULK_MIN_BYTES && len <= UINT32_MAX && bulkEnabled && SendBulkMsg(handle, data, len))
+		return;
+
 	while (numHandles || len) {
-		bool more = numHandles > NACL_ABI_IMC_DESC_MAX || len > MAX_IPC_BYTES;
-		InternalSendMsg(handle, more, handles, std::min<size_t>(numHandles, NACL_ABI_IMC_DESC_MAX), data, std::min<size_t>(len, MAX_IPC_BYTES));
+		char tag = numHandles > NACL_ABI_IMC_DESC_MAX || len > MAX_IPC_BYTES ? MSG_MORE : MSG_LAST;
+		InternalSendMsg(handle, tag, handles, std::min<size_t>(numHandles, NACL_ABI_IMC_DESC_MAX), data, std::min<size_t>(len, MAX_IPC_BYTES));
 		handles += std::min<size_t>(numHandles, NACL_ABI_IMC_DESC_MAX);
 		numHandles -= std::min<size_t>(numHandles, NACL_ABI_IMC_DESC_MAX);
 		data = static_cast<const char*>(data) + std::min<size_t>(len, MAX_IPC_BYTES);
@@ -326,6 +429,40 @@ thread_local
 #endif
 static std::unique_ptr<char[]> recvBuffer;
 
+// Copies a message out of a segment described by a MSG_BULK datagram. A handle
+// that came with the datagram replaces the segment previously at that index.
+static void RecvBulkMsg(Sys::OSHandle handle, Util::Reader& reader, size_t firstHandle, const char* data, size_t len)
+{
+	if (len != sizeof(bulkDescriptor_t))
+		Sys::Drop("IPC: Invalid shared memory message descriptor");
+	bulkDescriptor_t desc;
+	memcpy(&desc, data, sizeof(desc));
+	if (desc.segment >= BULK_MAX_SEGMENTS)
+		Sys::Drop("IPC: Invalid shared memory message segment %u", desc.segment);
+
+	std::lock_guard<std::mutex> guard(bulkRecvLock);
+	std::vector<SharedMemory>& segments = bulkRecvSegments[handle];
+	if (reader.GetHandles().size() > firstHandle) {
+		if (reader.GetHandles().size() != firstHandle + 1)
+			Sys::Drop("IPC: Invalid shared memory message segment %u", desc.segment);
+		if (desc.segment >= segments.size())
+			segments.resize(desc.segment + 1);
+		segments[desc.segment] = SharedMemory::FromDesc(reader.GetHandles().back());
+		reader.GetHandles().pop_back();
+		if (segments[desc.segment].GetSize() < BULK_HEADER_SIZE)
+			Sys::Drop("IPC: Invalid shared memory message segment %u", desc.segment);
+	}
+	if (desc.segment >= segments.size() || !segments[desc.segment])
+		Sys::Drop("IPC: Unknown shared memory message segment %u", desc.segment);
+
+	SharedMemory& segment = segments[desc.segment];
+	if (desc.length > segment.GetSize() - BULK_HEADER_SIZE)
+		Sys::Drop("IPC: Shared memory message of size %u too large for segment", desc.length);
+	const char* base = static_cast<const char*>(segment.GetBase()) + BULK_HEADER_SIZE;
+	reader.GetData().insert(reader.GetData().end(), base, base + desc.length);
+	BulkBusyFlag(segment).store(0, std::memory_order_release);
+}
+
 bool InternalRecvMsg(Sys::OSHandle handle, Util::Reader& reader)
 {
 	NaClMessageHeader hdr;
@@ -334,6 +471,7 @@ bool InternalRecvMsg(Sys::OSHandle handle, Util::Reader& reader)
 	if (!recvBuffer) {
 		recvBuffer.reset(new char[NACL_ABI_IMC_BYTES_MAX]);
 	}
+	size_t firstHandle = reader.GetHandles().size();
 
 	for (size_t i = 0; i < NACL_ABI_IMC_DESC_MAX; i++)
 		h[i] = NACL_INVALID_HANDLE;
@@ -363,8 +501,14 @@ bool InternalRecvMsg(Sys::OSHandle handle, Util::Reader& reader)
 			reader.GetHandles().back().handle = h[i];
 		}
 	}
+	if (result < 1)
+		Sys::Drop("IPC: Socket closed by remote end");
+	if (recvBuffer[0] == MSG_BULK) {
+		RecvBulkMsg(handle, reader, firstHandle, &recvBuffer[1], result - 1);
+		return false;
+	}
 	reader.GetData().insert(reader.GetData().end(), &recvBuffer[1], &recvBuffer[result]);
-	return recvBuffer[0];
+	return recvBuffer[0] == MSG_MORE;
 #else
 	NaClInternalHeader internalHdr;
 	hdr.iov = iov;
@@ -453,8 +597,12 @@ bool InternalRecvMsg(Sys::OSHandle handle, Util::Reader& reader)
 		h[i] = NACL_INVALID_HANDLE;
 	}
 
+	if (desc_end[0] == MSG_BULK) {
+		RecvBulkMsg(handle, reader, firstHandle, &desc_end[1], result - 1);
+		return false;
+	}
 	reader.GetData().insert(reader.GetData().end(), &desc_end[1], &desc_end[result]);
-	return desc_end[0];
+	return desc_end[0] == MSG_MORE;
 #endif
 }
 
@@ -580,4 +728,75 @@ SharedMemory SharedMemory::Create(size_t size)
 }
 #endif
 
+#ifdef BUILD_ENGINE
+class IPCBenchmarkCmd : public Cmd::StaticCmd
+{
+public:
+	IPCBenchmarkCmd()
+		: Cmd::StaticCmd("ipcBenchmark", Cmd::SYSTEM, "measures message throughput over a socket with and without shared memory transfers") {}
+
+	void Run(const Cmd::Args& args) const override
+	{
+		int megabytes = 64;
+
+		if (args.Argc() > 2 || (args.Argc() == 2 && (!Str::ParseInt(megabytes, args.Argv(1)) || megabytes <= 0))) {
+			PrintUsage(args, "[<megabytes per size>]", "");
+			return;
+		}
+
+		// The other end acknowledges each message like a synchronous syscall
+		// would, and stops on a message of a single byte.
+		std::pair<Socket, Socket> sockets = Socket::CreatePair();
+		std::thread echo([&sockets] {
+			while (true) {
+				Util::Reader reader = sockets.second.RecvMsg();
+				Util::Writer writer;
+				writer.Write<uint32_t>(reader.GetData().size());
+				sockets.second.SendMsg(writer);
+				if (reader.GetData().size() == 1)
+					break;
+			}
+		});
+
+		bool wasEnabled = bulkEnabled;
+		Print("%10s %12s %12s %12s", "size", "sockets", "shm", "allocations");
+		for (size_t size = 256; size <= (4 << 20); size *= 4) {
+			Util::Writer writer;
+			std::vector<char> payload(size, 'x');
+			writer.WriteData(payload.data(), payload.size());
+			int count = Math::Clamp<int>((size_t(megabytes) << 20) / size, 16, 100000);
+
+			double bytesPerSecond[2];
+			uint64_t allocations = Util::GetBufferAllocations();
+			for (int bulk = 0; bulk < 2; bulk++) {
+				bulkEnabled = bulk;
+				auto start = Sys::SteadyClock::now();
+				for (int i = 0; i < count; i++) {
+					sockets.first.SendMsg(writer);
+					Util::Reader reader = sockets.first.RecvMsg();
+					if (reader.Read<uint32_t>() != size)
+						Sys::Drop("IPC: Benchmark message was received with the wrong size");
+				}
+				auto duration = std::chrono::duration_cast<std::chrono::duration<double>>(Sys::SteadyClock::now() - start);
+				bytesPerSecond[bulk] = size * count / duration.count();
+			}
+
+			// Readers and Writers of both threads which didn't get a large
+			// enough buffer from their pool, should stay small
+			allocations = Util::GetBufferAllocations() - allocations;
+
+			Print("%10zu %9.1fMB/s %9.1fMB/s %12llu", size, bytesPerSecond[0] / (1 << 20), bytesPerSecond[1] / (1 << 20), (unsigned long long)allocations);
+		}
+		bulkEnabled = wasEnabled;
+
+		Util::Writer stop;
+		stop.Write<uint8_t>(0);
+		sockets.first.SendMsg(stop);
+		sockets.first.RecvMsg();
+		echo.join();
+	}
+};
+static IPCBenchmarkCmd IPCBenchmarkCmdRegistration;
+#endif
+
 } // namespace IPC
@@ -0,0 +1,73 @@
+/*
+===========================================================================
+Daemon BSD Source Code
+Copyright (c) 2016, Daemon Developers
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Daemon developers nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DAEMON DEVELOPERS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================
+*/
+
+#include "Common.h"
+
+namespace Util {
+
+// Buffers which grew larger than this are given back to the allocator, as are
+// the ones exceeding the number of buffers kept.
+static const size_t MAX_POOLED_BUFFER_SIZE = 1 << 20;
+static const size_t MAX_POOLED_BUFFERS = 32;
+
+#ifndef __native_client__
+thread_local
+#endif
+static std::vector<std::vector<char>> bufferPool;
+
+static std::atomic<uint64_t> bufferAllocations;
+
+std::vector<char> GetPooledBuffer()
+{
+	std::vector<char> out;
+	if (!bufferPool.empty()) {
+		std::swap(out, bufferPool.back());
+		bufferPool.pop_back();
+	}
+	return out;
+}
+
+void ReleasePooledBuffer(std::vector<char>& buffer, size_t pooledCapacity)
+{
+	if (buffer.capacity() != pooledCapacity)
+		bufferAllocations++;
+
+	if (buffer.capacity() == 0 || buffer.capacity() > MAX_POOLED_BUFFER_SIZE || bufferPool.size() >= MAX_POOLED_BUFFERS)
+		return;
+	buffer.clear();
+	bufferPool.push_back(std::move(buffer));
+}
+
+uint64_t GetBufferAllocations()
+{
+	return bufferAllocations;
+}
+
+} // namespace Util
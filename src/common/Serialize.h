@@ -69,9 +69,35 @@ namespace Util {
 	// Trait declaration for the serialization trait.
 	template<typename T, typename = void> struct SerializeTraits {};
 
+	// The data buffers of Readers and Writers are recycled per thread so that
+	// messages don't allocate once the buffers have grown to the usual sizes.
+	// The number of Readers and Writers which had to allocate is counted.
+	std::vector<char> GetPooledBuffer();
+	void ReleasePooledBuffer(std::vector<char>& buffer, size_t pooledCapacity);
+	uint64_t GetBufferAllocations();
+
 	// Class to generate messages
 	class Writer {
 	public:
+		Writer()
+			: data(GetPooledBuffer()), pooledCapacity(data.capacity()) {}
+		Writer(Writer&& other) NOEXCEPT
+			: data(std::move(other.data)), handles(std::move(other.handles)), pooledCapacity(other.pooledCapacity)
+		{
+			other.pooledCapacity = other.data.capacity();
+		}
+		Writer& operator=(Writer&& other) NOEXCEPT
+		{
+			std::swap(data, other.data);
+			std::swap(handles, other.handles);
+			std::swap(pooledCapacity, other.pooledCapacity);
+			return *this;
+		}
+		~Writer()
+		{
+			ReleasePooledBuffer(data, pooledCapacity);
+		}
+
 		void WriteData(const void* p, size_t len)
 		{
 			data.insert(data.end(), static_cast<const char*>(p), static_cast<const char*>(p) + len);
@@ -123,21 +149,29 @@ namespace Util {
 	private:
 		std::vector<char> data;
 		std::vector<IPC::FileDesc> handles;
+		size_t pooledCapacity;
 	};
 
 	// Class to read messages
 	class Reader {
 	public:
 		Reader()
-			: pos(0), handles_pos(0) {}
+			: data(GetPooledBuffer()), pos(0), handles_pos(0), view(nullptr), viewSize(0), pooledCapacity(data.capacity()) {}
 		Reader(Reader&& other) NOEXCEPT
-			: data(std::move(other.data)), handles(std::move(other.handles)), pos(other.pos), handles_pos(other.handles_pos) {}
+			: data(std::move(other.data)), handles(std::move(other.handles)), pos(other.pos), handles_pos(other.handles_pos),
+			  view(other.view), viewSize(other.viewSize), pooledCapacity(other.pooledCapacity)
+		{
+			other.pooledCapacity = other.data.capacity();
+		}
 		Reader& operator=(Reader&& other) NOEXCEPT
 		{
 			std::swap(data, other.data);
 			std::swap(handles, other.handles);
 			std::swap(pos, other.pos);
 			std::swap(handles_pos, other.handles_pos);
+			std::swap(view, other.view);
+			std::swap(viewSize, other.viewSize);
+			std::swap(pooledCapacity, other.pooledCapacity);
 			return *this;
 		}
 		~Reader()
@@ -145,12 +179,24 @@ namespace Util {
 			// Close any handles that weren't read
 			for (size_t i = handles_pos; i < handles.size(); i++)
 				handles[i].Close();
+			ReleasePooledBuffer(data, pooledCapacity);
+		}
+
+		// Read the message from memory owned by someone else instead of copying
+		// it, the memory must stay valid while the Reader is used. Reads never
+		// go outside of it even if it is modified concurrently.
+		void SetView(const void* p, size_t len)
+		{
+			data.clear();
+			view = static_cast<const char*>(p);
+			viewSize = len;
+			pos = 0;
 		}
 
 		void ReadData(void* p, size_t len)
 		{
-			if (pos + len <= data.size()) {
-				memcpy(p, data.data() + pos, len);
+			if (pos + len <= Size()) {
+				memcpy(p, Base() + pos, len);
 				pos += len;
 			} else
 				Sys::Drop("IPC: Unexpected end of message");
@@ -166,8 +212,8 @@ namespace Util {
 		}
 		const void* ReadInline(size_t len)
 		{
-			if (pos + len <= data.size()) {
-				const void* out = data.data() + pos;
+			if (pos + len <= Size()) {
+				const void* out = Base() + pos;
 				pos += len;
 				return out;
 			} else
@@ -198,14 +244,19 @@ namespace Util {
 
 		void CheckEndRead()
 		{
-			if (pos != data.size())
+			if (pos != Size())
 				Sys::Drop("Reader: Unread bytes at end of message");
 			if (handles_pos != handles.size())
 				Sys::Drop("Reader: Unread handles at end of message");
 		}
 
+		// Copies a viewed message to be able to give access to it
 		std::vector<char>& GetData()
 		{
+			if (view) {
+				data.assign(view, view + viewSize);
+				view = nullptr;
+			}
 			return data;
 		}
 		std::vector<IPC::FileDesc>& GetHandles()
@@ -214,10 +265,22 @@ namespace Util {
 		}
 
 	private:
+		const char* Base() const
+		{
+			return view ? view : data.data();
+		}
+		size_t Size() const
+		{
+			return view ? viewSize : data.size();
+		}
+
 		std::vector<char> data;
 		std::vector<IPC::FileDesc> handles;
 		size_t pos;
 		size_t handles_pos;
+		const char* view;
+		size_t viewSize;
+		size_t pooledCapacity;
 	};
 
 	// Implementation of the serialization traits for common types and std containers
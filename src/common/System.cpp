@@ -143,12 +143,24 @@ SteadyClock::time_point SleepUntil(SteadyClock::time_point time)
 	return time;
 }
 
+#ifndef BUILD_VM
+static Sys::SteadyClock::time_point MillisecondsBaseTime()
+{
+	static Sys::SteadyClock::time_point baseTime = Sys::SteadyClock::now();
+	return baseTime;
+}
+
+SteadyClock::time_point MillisecondsTimePoint(int msec)
+{
+	return MillisecondsBaseTime() + std::chrono::milliseconds(msec);
+}
+#endif
+
 int Milliseconds() {
 #ifdef BUILD_VM
 	return trap_Milliseconds();
 #else
-	static Sys::SteadyClock::time_point baseTime = Sys::SteadyClock::now();
-	return std::chrono::duration_cast<std::chrono::milliseconds>(Sys::SteadyClock::now() - baseTime).count();
+	return std::chrono::duration_cast<std::chrono::milliseconds>(Sys::SteadyClock::now() - MillisecondsBaseTime()).count();
 #endif
 }
 
@@ -69,6 +69,11 @@ void SleepFor(SteadyClock::duration time);
 // Results *within a single module* (engine/cgame/sgame) are monotonic.
 int Milliseconds();
 
+#ifndef BUILD_VM
+// Returns the time point at which Milliseconds() starts returning msec.
+SteadyClock::time_point MillisecondsTimePoint(int msec);
+#endif
+
 // Exit with a fatal error. Only critical subsystems are shut down cleanly, and
 // an error message is displayed to the user.
 NORETURN void Error(Str::StringRef errorMessage);
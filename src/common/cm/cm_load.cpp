@@ -47,8 +47,14 @@ static const int BOX_PLANES       = 12;
 #define LL( x ) x = LittleLong( x )
 
 clipMap_t cm;
-int       c_pointcontents;
-int       c_traces, c_brush_traces, c_patch_traces, c_trisoup_traces;
+#ifndef __native_client__
+thread_local
+#endif
+int c_pointcontents;
+#ifndef __native_client__
+thread_local
+#endif
+int c_traces, c_brush_traces, c_patch_traces, c_trisoup_traces;
 
 cmodel_t  box_model;
 cplane_t  *box_planes;
@@ -58,10 +64,18 @@ void      CM_InitBoxHull();
 void      CM_FloodAreaConnections();
 
 Cvar::Cvar<bool> cm_forceTriangles(VM_STRING_PREFIX "cm_forceTriangles", "Convert all patches into triangles?", Cvar::CHEAT | Cvar::ROM, false);
+Cvar::Cvar<bool> cm_flatTree(VM_STRING_PREFIX "cm_flatTree", "sweep box traces through the compiled copy of the world tree", Cvar::NONE, true);
+Cvar::Cvar<bool> cm_facetTree(VM_STRING_PREFIX "cm_facetTree", "only test traces against the patch and triangle soup facets their bounds touch", Cvar::NONE, true);
 Log::Logger cmLog(VM_STRING_PREFIX "common.cm");
 
 static std::vector<void*> allocations;
 
+// the map being loaded, lumps that need no conversion are referenced in it
+// when it is mapped from the file, otherwise it is freed once loaded
+static FS::PakPath::MappedFile cmMapFile;
+static bool                    lumpsInPlace;
+static int                     inPlaceBytes;
+
 void* CM_Alloc( int size )
 {
     void* alloc = malloc(size);
@@ -87,6 +101,29 @@ void CM_FreeAll()
 ===============================================================================
 */
 
+/*
+=================
+CMod_LumpInPlace
+
+Returns a lump stored the way it is used where it is in the map file, or
+nullptr if the map file isn't kept or the lump needs byte swapping or isn't
+aligned for its type
+=================
+*/
+template<typename T>
+static const T *CMod_LumpInPlace( const byte *const cmod_base, const lump_t *l )
+{
+	const byte *data = cmod_base + l->fileofs;
+
+	if ( !lumpsInPlace || LittleLong( 1 ) != 1 || reinterpret_cast<uintptr_t>( data ) % alignof( T ) )
+	{
+		return nullptr;
+	}
+
+	inPlaceBytes += l->filelen;
+	return reinterpret_cast<const T *>( data );
+}
+
 /*
 =================
 CMod_LoadShaders
@@ -94,7 +131,7 @@ CMod_LoadShaders
 */
 void CMod_LoadShaders(const byte *const cmod_base, lump_t *l)
 {
-	dshader_t *in, *out;
+	dshader_t *in, *out, *shaders;
 	int       i, count;
 
 	in = ( dshader_t * )( cmod_base + l->fileofs );
@@ -111,14 +148,22 @@ void CMod_LoadShaders(const byte *const cmod_base, lump_t *l)
 		Sys::Drop( "Map with no shaders" );
 	}
 
-	cm.shaders = ( dshader_t * ) CM_Alloc( count * sizeof( *cm.shaders ) );
 	cm.numShaders = count;
+	cm.shaders = CMod_LumpInPlace<dshader_t>( cmod_base, l );
+
+	if ( cm.shaders )
+	{
+		return;
+	}
+
+	shaders = ( dshader_t * ) CM_Alloc( count * sizeof( *shaders ) );
+	cm.shaders = shaders;
 
-	Com_Memcpy( cm.shaders, in, count * sizeof( *cm.shaders ) );
+	Com_Memcpy( shaders, in, count * sizeof( *shaders ) );
 
 	if ( LittleLong( 1 ) != 1 )
 	{
-		out = cm.shaders;
+		out = shaders;
 
 		for ( i = 0; i < count; i++, in++, out++ )
 		{
@@ -454,10 +499,16 @@ void CMod_LoadLeafSurfaces(const byte *const cmod_base, lump_t *l)
 
 	count = l->filelen / sizeof( *in );
 
-	cm.leafsurfaces = ( int * ) CM_Alloc( count * sizeof( *cm.leafsurfaces ) );
 	cm.numLeafSurfaces = count;
+	cm.leafsurfaces = CMod_LumpInPlace<int>( cmod_base, l );
+
+	if ( cm.leafsurfaces )
+	{
+		return;
+	}
 
-	out = cm.leafsurfaces;
+	out = ( int * ) CM_Alloc( count * sizeof( *out ) );
+	cm.leafsurfaces = out;
 
 	for ( i = 0; i < count; i++, in++, out++ )
 	{
@@ -673,10 +724,21 @@ void CMod_LoadEntityString(const byte *const cmod_base, lump_t *l)
 	char keyname[ MAX_TOKEN_CHARS ];
 	char value[ MAX_TOKEN_CHARS ];
 
-	cm.entityString = ( char * ) CM_Alloc( l->filelen + 1);
 	cm.numEntityChars = l->filelen;
-	Com_Memcpy( cm.entityString, cmod_base + l->fileofs, l->filelen );
-	cm.entityString[l->filelen] = '\0';
+
+	// the string is usually stored with its terminator
+	if ( l->filelen && cmod_base[ l->fileofs + l->filelen - 1 ] == '\0' )
+	{
+		cm.entityString = CMod_LumpInPlace<char>( cmod_base, l );
+	}
+
+	if ( !cm.entityString )
+	{
+		char *entityString = ( char * ) CM_Alloc( l->filelen + 1);
+		Com_Memcpy( entityString, cmod_base + l->fileofs, l->filelen );
+		entityString[l->filelen] = '\0';
+		cm.entityString = entityString;
+	}
 
 	p = cm.entityString;
 
@@ -743,18 +805,29 @@ void CMod_LoadVisibility(const byte *const cmod_base, lump_t *l)
 	if ( !len )
 	{
 		cm.clusterBytes = ( cm.numClusters + 31 ) & ~31;
-		cm.visibility = ( byte * ) CM_Alloc( cm.clusterBytes );
-		memset( cm.visibility, 255, cm.clusterBytes );
+		byte *visibility = ( byte * ) CM_Alloc( cm.clusterBytes );
+		memset( visibility, 255, cm.clusterBytes );
+		cm.visibility = visibility;
 		return;
 	}
 
 	const byte *buf = cmod_base + l->fileofs;
 
 	cm.vised = true;
-	cm.visibility = ( byte * ) CM_Alloc( len - VIS_HEADER );
 	cm.numClusters = LittleLong( ( ( int * ) buf ) [ 0 ] );
 	cm.clusterBytes = LittleLong( ( ( int * ) buf ) [ 1 ] );
-	Com_Memcpy( cm.visibility, buf + VIS_HEADER, len - VIS_HEADER );
+
+	// the bit vectors are the same on any host
+	if ( lumpsInPlace )
+	{
+		cm.visibility = buf + VIS_HEADER;
+		inPlaceBytes += len - VIS_HEADER;
+		return;
+	}
+
+	byte *visibility = ( byte * ) CM_Alloc( len - VIS_HEADER );
+	Com_Memcpy( visibility, buf + VIS_HEADER, len - VIS_HEADER );
+	cm.visibility = visibility;
 }
 
 //==================================================================
@@ -894,6 +967,194 @@ void CMod_LoadSurfaces(const byte *const cmod_base, lump_t *surfs, lump_t *verts
 	}
 }
 
+/*
+=================
+CM_BuildFlatTree
+
+Compiles the world tree for the box sweeps, see cFlatTree_t
+=================
+*/
+static void CM_BuildFlatTree()
+{
+	cFlatTree_t *flat = &cm.flat;
+
+	if ( !cm.numNodes )
+	{
+		return;
+	}
+
+	// number the nodes and brushes in the order of a depth first walk
+	std::vector<int> nodeOrder, leafOrder;
+	std::vector<int> nodeNums( cm.numNodes, -1 ), brushNums( cm.numBrushes, -1 );
+	std::vector<int> brushOrder;
+	std::vector<int> stack{ 0 };
+	int              numSides = 0;
+
+	nodeOrder.reserve( cm.numNodes );
+
+	while ( !stack.empty() )
+	{
+		int num = stack.back();
+		stack.pop_back();
+
+		if ( num < 0 )
+		{
+			leafOrder.push_back( -1 - num );
+			continue;
+		}
+
+		if ( nodeNums[ num ] >= 0 )
+		{
+			continue;
+		}
+
+		nodeNums[ num ] = nodeOrder.size();
+		nodeOrder.push_back( num );
+
+		// the front child is walked first and so follows its parent
+		stack.push_back( cm.nodes[ num ].children[ 1 ] );
+		stack.push_back( cm.nodes[ num ].children[ 0 ] );
+	}
+
+	for ( int leafnum : leafOrder )
+	{
+		const cLeaf_t *leaf = &cm.leafs[ leafnum ];
+
+		for ( int k = 0; k < leaf->numLeafBrushes; k++ )
+		{
+			int brushnum = leaf->firstLeafBrush[ k ];
+
+			if ( brushNums[ brushnum ] < 0 )
+			{
+				brushNums[ brushnum ] = brushOrder.size();
+				brushOrder.push_back( brushnum );
+				numSides += PAD( cm.brushes[ brushnum ].numsides, FLAT_SIDE_LANES );
+			}
+		}
+	}
+
+	// one allocation, with each array aligned for its members
+	size_t size = 0;
+	auto reserve = [ &size ]( size_t bytes ) {
+		size_t offset = size;
+		size += ( bytes + 15 ) & ~15;
+		return offset;
+	};
+
+	size_t nodesOffset = reserve( nodeOrder.size() * sizeof( cFlatNode_t ) );
+	size_t leafsOffset = reserve( cm.numLeafs * sizeof( cFlatLeaf_t ) );
+	size_t leafBrushesOffset = reserve( cm.numLeafBrushes * sizeof( int ) );
+	size_t brushesOffset = reserve( brushOrder.size() * sizeof( cFlatBrush_t ) );
+	size_t normalsOffset[ 3 ];
+
+	for ( int i = 0; i < 3; i++ )
+	{
+		normalsOffset[ i ] = reserve( numSides * sizeof( float ) );
+	}
+
+	size_t distsOffset = reserve( numSides * sizeof( float ) );
+	size_t signbitsOffset = reserve( numSides * sizeof( byte ) );
+	size_t surfaceFlagsOffset = reserve( numSides * sizeof( int ) );
+	size_t planesOffset = reserve( numSides * sizeof( cplane_t * ) );
+
+	byte *arena = ( byte * ) CM_Alloc( size );
+
+	flat->size = size;
+	flat->numNodes = nodeOrder.size();
+	flat->nodes = ( cFlatNode_t * ) ( arena + nodesOffset );
+	flat->leafs = ( cFlatLeaf_t * ) ( arena + leafsOffset );
+	flat->leafBrushes = ( int * ) ( arena + leafBrushesOffset );
+	flat->numBrushes = brushOrder.size();
+	flat->brushes = ( cFlatBrush_t * ) ( arena + brushesOffset );
+	flat->numSides = numSides;
+
+	for ( int i = 0; i < 3; i++ )
+	{
+		flat->sideNormals[ i ] = ( float * ) ( arena + normalsOffset[ i ] );
+	}
+
+	flat->sideDists = ( float * ) ( arena + distsOffset );
+	flat->sideSignbits = arena + signbitsOffset;
+	flat->sideSurfaceFlags = ( int * ) ( arena + surfaceFlagsOffset );
+	flat->sidePlanes = ( const cplane_t ** ) ( arena + planesOffset );
+
+	for ( int i = 0; i < flat->numNodes; i++ )
+	{
+		const cNode_t *node = &cm.nodes[ nodeOrder[ i ] ];
+		cFlatNode_t   *out = &flat->nodes[ i ];
+
+		VectorCopy( node->plane->normal, out->normal );
+		out->dist = node->plane->dist;
+		out->type = node->plane->type < 3 ? node->plane->type : PLANE_NON_AXIAL;
+
+		for ( int j = 0; j < 2; j++ )
+		{
+			int child = node->children[ j ];
+			out->children[ j ] = child < 0 ? child : nodeNums[ child ];
+		}
+	}
+
+	// leafs out of the tree are never walked, their brushes have no numbers
+	int numLeafBrushes = 0;
+
+	for ( int leafnum = 0; leafnum < cm.numLeafs; leafnum++ )
+	{
+		const cLeaf_t *leaf = &cm.leafs[ leafnum ];
+		cFlatLeaf_t   *out = &flat->leafs[ leafnum ];
+
+		out->firstBrush = numLeafBrushes;
+		out->numBrushes = 0;
+
+		for ( int k = 0; k < leaf->numLeafBrushes; k++ )
+		{
+			int brushnum = brushNums[ leaf->firstLeafBrush[ k ] ];
+
+			if ( brushnum >= 0 )
+			{
+				flat->leafBrushes[ numLeafBrushes++ ] = brushnum;
+				out->numBrushes++;
+			}
+		}
+	}
+
+	int side = 0;
+
+	for ( int i = 0; i < flat->numBrushes; i++ )
+	{
+		const cbrush_t *brush = &cm.brushes[ brushOrder[ i ] ];
+		cFlatBrush_t   *out = &flat->brushes[ i ];
+
+		VectorCopy( brush->bounds[ 0 ], out->bounds[ 0 ] );
+		VectorCopy( brush->bounds[ 1 ], out->bounds[ 1 ] );
+		out->contents = brush->contents;
+		out->firstSide = side;
+		out->numSides = brush->numsides;
+		out->brushNum = brushOrder[ i ];
+
+		for ( int j = 0; j < brush->numsides; j++, side++ )
+		{
+			const cplane_t *plane = brush->sides[ j ].plane;
+
+			flat->sideNormals[ 0 ][ side ] = plane->normal[ 0 ];
+			flat->sideNormals[ 1 ][ side ] = plane->normal[ 1 ];
+			flat->sideNormals[ 2 ][ side ] = plane->normal[ 2 ];
+			flat->sideDists[ side ] = plane->dist;
+			flat->sideSignbits[ side ] = plane->signbits;
+			flat->sideSurfaceFlags[ side ] = brush->sides[ j ].surfaceFlags;
+			flat->sidePlanes[ side ] = plane;
+		}
+
+		// everything is far behind the padding sides
+		for ( ; side % FLAT_SIDE_LANES; side++ )
+		{
+			flat->sideDists[ side ] = 1.0e30f;
+		}
+	}
+
+	cmLog.Debug( "CM_BuildFlatTree: %d nodes, %d brushes, %d sides in %d bytes",
+	             flat->numNodes, flat->numBrushes, flat->numSides, size );
+}
+
 //==================================================================
 
 /*
@@ -912,7 +1173,7 @@ void CM_LoadMap(Str::StringRef name)
 	std::string mapFile = "maps/" + name + ".bsp";
 
 	std::error_code err;
-	std::string mapData = FS::PakPath::ReadFile(mapFile, err);
+	FS::PakPath::MappedFile mapData = FS::PakPath::MapFile(mapFile, err);
 	if (err) {
 		Sys::Drop("Could not load %s", mapFile.c_str());
 	}
@@ -921,6 +1182,13 @@ void CM_LoadMap(Str::StringRef name)
 	CM_FreeAll();
 	CM_ClearMap();
 
+	// keep the file for as long as the lumps referenced in it, a copy in
+	// memory of its own (in a VM or out of a compressed pak) would keep the
+	// whole map resident for a few small lumps
+	cmMapFile = std::move(mapData);
+	lumpsInPlace = cmMapFile.IsFileMapping();
+	inPlaceBytes = 0;
+
 	if ( !name[ 0 ] )
 	{
 		cm.numLeafs = 1;
@@ -930,20 +1198,38 @@ void CM_LoadMap(Str::StringRef name)
 		return;
 	}
 
-	header = * ( dheader_t * ) mapData.data();
+	c_facetTrees = 0;
+	c_facetTreeFacets = 0;
+	c_facetTreeTime = {};
+
+	if ( cmMapFile.size() < sizeof( dheader_t ) )
+	{
+		Sys::Drop( "CM_LoadMap: %s is too short", mapFile );
+	}
+
+	header = * ( dheader_t * ) cmMapFile.data();
 
 	for (unsigned i = 0; i < sizeof( dheader_t ) / 4; i++ )
 	{
 		( ( int * ) &header ) [ i ] = LittleLong( ( ( int * ) &header ) [ i ] );
 	}
 
+	// a mapped file can't be read past its end
+	for ( const lump_t &lump : header.lumps )
+	{
+		if ( lump.fileofs < 0 || lump.filelen < 0 || size_t( lump.fileofs ) + lump.filelen > cmMapFile.size() )
+		{
+			Sys::Drop( "CM_LoadMap: %s has a lump out of bounds", mapFile );
+		}
+	}
+
 	if ( header.version != BSP_VERSION && header.version != BSP_VERSION_Q3 )
 	{
 		Sys::Drop( "CM_LoadMap: %s has wrong version number (%i should be %i for ET or %i for Q3)",
 		           name.c_str(), header.version, BSP_VERSION, BSP_VERSION_Q3 );
 	}
 
-	const byte *const cmod_base = reinterpret_cast<const byte*>(mapData.data());
+	const byte *const cmod_base = reinterpret_cast<const byte*>(cmMapFile.data());
 
 	// load into heap
 	CMod_LoadShaders(cmod_base, &header.lumps[LUMP_SHADERS]);
@@ -965,6 +1251,20 @@ void CM_LoadMap(Str::StringRef name)
 	CM_InitBoxHull();
 
 	CM_FloodAreaConnections();
+
+	CM_BuildFlatTree();
+
+	cmLog.Debug( "CM_LoadMap: %s was %s, %d bytes of its lumps are referenced in place", mapFile,
+	             cmMapFile.IsFileMapping() ? "mapped" : "read into memory", inPlaceBytes );
+
+	if ( !lumpsInPlace )
+	{
+		cmMapFile = FS::PakPath::MappedFile();
+	}
+
+	cmLog.Verbose( "CM_LoadMap: built %d facet trees over %d facets in %.3f ms", c_facetTrees, c_facetTreeFacets,
+	               std::chrono::duration<double, std::milli>( c_facetTreeTime ).count() );
+	cmLog.DoVerboseCode( CM_ReportFacetTrees );
 }
 
 /*
@@ -975,6 +1275,7 @@ CM_ClearMap
 void CM_ClearMap()
 {
 	Com_Memset( &cm, 0, sizeof( cm ) );
+	cmMapFile = FS::PakPath::MappedFile();
 	CM_ClearLevelPatches();
 }
 
@@ -1023,7 +1324,7 @@ int CM_NumInlineModels()
 	return cm.numSubModels;
 }
 
-char           *CM_EntityString()
+const char     *CM_EntityString()
 {
 	return cm.entityString;
 }
@@ -89,8 +89,6 @@ struct cbrush_t
 	vec3_t       bounds[ 2 ];
 	int          numsides;
 	cbrushside_t *sides;
-	int          checkcount; // to avoid repeated testings
-	bool     collided; // marker for optimisation
 	cbrushedge_t *edges;
 	int          numEdges;
 };
@@ -115,6 +113,16 @@ struct cFacet_t
 	bool borderNoAdjust[ MAX_FACET_BEVELS ];
 };
 
+// a node of the bounding volume hierarchy over the facets of a surface, stored
+// in depth first order, so the first child of a node directly follows it
+struct cFacetNode_t
+{
+	vec3_t bounds[ 2 ];
+	int    firstFacet; // into facetNums, for leafs
+	int    numFacets; // 0 for inner nodes
+	int    skip; // the node after the subtree
+};
+
 struct cSurfaceCollide_t
 {
 	vec3_t   bounds[ 2 ];
@@ -123,17 +131,71 @@ struct cSurfaceCollide_t
 
 	int      numFacets;
 	cFacet_t *facets;
+
+	int          numNodes; // 0 for surfaces too small to need the hierarchy
+	cFacetNode_t *nodes;
+	int          *facetNums;
 };
 
 struct cSurface_t
 {
-	int               checkcount; // to avoid repeated testings
 	int               surfaceFlags;
 	int               contents;
 	cSurfaceCollide_t *sc;
 	mapSurfaceType_t type;
 };
 
+// the world tree compiled for sweeping box traces, in a single allocation:
+// nodes in depth first order with their plane inlined, the brushes in the
+// order the leafs list them, and the sides of each brush next to each other
+// as arrays of each member, padded to a multiple of FLAT_SIDE_LANES with
+// sides everything is behind
+static const int FLAT_SIDE_LANES = 8;
+
+struct cFlatNode_t
+{
+	vec3_t normal;
+	float  dist;
+	int    type; // PLANE_X, PLANE_Y, PLANE_Z or PLANE_NON_AXIAL
+	int    children[ 2 ]; // negative numbers are leafs
+	int    pad;
+};
+
+struct cFlatLeaf_t
+{
+	int firstBrush; // in leafBrushes
+	int numBrushes;
+};
+
+struct cFlatBrush_t
+{
+	vec3_t bounds[ 2 ];
+	int    contents;
+	int    firstSide;
+	int    numSides;
+	int    brushNum; // in cm.brushes
+};
+
+struct cFlatTree_t
+{
+	size_t         size; // of the allocation, which starts with the nodes
+	int            numNodes;
+	cFlatNode_t    *nodes;
+
+	cFlatLeaf_t    *leafs; // the same numbers as cm.leafs
+	int            *leafBrushes; // in brushes
+
+	int            numBrushes;
+	cFlatBrush_t   *brushes;
+
+	int            numSides;
+	float          *sideNormals[ 3 ];
+	float          *sideDists;
+	byte           *sideSignbits;
+	int            *sideSurfaceFlags;
+	const cplane_t **sidePlanes;
+};
+
 struct cArea_t
 {
 	int floodnum;
@@ -143,7 +205,7 @@ struct cArea_t
 struct clipMap_t
 {
 	int          numShaders;
-	dshader_t    *shaders;
+	const dshader_t *shaders; // these may point into the map file
 
 	int          numBrushSides;
 	cbrushside_t *brushsides;
@@ -161,7 +223,7 @@ struct clipMap_t
 	int          *leafbrushes;
 
 	int          numLeafSurfaces;
-	int          *leafsurfaces;
+	const int    *leafsurfaces;
 
 	int          numSubModels;
 	cmodel_t     *cmodels;
@@ -171,11 +233,11 @@ struct clipMap_t
 
 	int          numClusters;
 	int          clusterBytes;
-	byte         *visibility;
+	const byte   *visibility;
 	bool     vised; // if false, visibility is just a single cluster of ffs
 
 	int          numEntityChars;
-	char         *entityString;
+	const char   *entityString;
 
 	int          numAreas;
 	cArea_t      *areas;
@@ -185,8 +247,9 @@ struct clipMap_t
 	cSurface_t   **surfaces; // non-patches will be nullptr
 
 	int          floodvalid;
-	int          checkcount; // incremented on each trace
 	bool     perPolyCollision;
+
+	cFlatTree_t  flat;
 };
 
 // keep 1/8 unit away to keep the position valid before network snapping
@@ -194,9 +257,16 @@ struct clipMap_t
 #define SURFACE_CLIP_EPSILON ( 0.125 )
 
 extern clipMap_t cm;
-extern int       c_pointcontents;
-extern int       c_traces, c_brush_traces, c_patch_traces, c_trisoup_traces;
+#ifndef __native_client__
+extern thread_local int c_pointcontents;
+extern thread_local int c_traces, c_brush_traces, c_patch_traces, c_trisoup_traces;
+#else
+extern int c_pointcontents;
+extern int c_traces, c_brush_traces, c_patch_traces, c_trisoup_traces;
+#endif
 extern Cvar::Cvar<bool> cm_forceTriangles;
+extern Cvar::Cvar<bool> cm_flatTree;
+extern Cvar::Cvar<bool> cm_facetTree;
 extern Log::Logger cmLog;
 
 // cm_test.c
@@ -215,6 +285,16 @@ struct sphere_t
 	vec3_t offset;
 };
 
+// what the traces of a thread have already tested, by brush and surface
+// number, so that a trace doesn't test them again in another leaf
+struct traceVisited_t
+{
+	int              checkcount; // incremented on each trace
+	std::vector<int> brushes; // checkcount of the last trace testing it
+	std::vector<int> collided; // checkcount of the last trace crossing it
+	std::vector<int> surfaces;
+};
+
 struct traceWork_t
 {
 	traceType_t type;
@@ -233,6 +313,8 @@ struct traceWork_t
 	sphere_t    sphere; // sphere for oriendted capsule collision
 	biSphere_t  biSphere;
 	bool    testLateralCollision; // whether or not to test for lateral collision
+	traceVisited_t *visited;
+	int         checkcount; // the visited marks of this trace
 };
 
 struct leafList_t
@@ -287,6 +369,11 @@ void     CM_AddFacetBevels( cFacet_t *facet );
 bool CM_GenerateFacetFor3Points( cFacet_t *facet, const vec3_t p1, const vec3_t p2, const vec3_t p3 );
 bool CM_GenerateFacetFor4Points( cFacet_t *facet, const vec3_t p1, const vec3_t p2, const vec3_t p3, const vec3_t p4 );
 
+extern int                        c_facetTrees, c_facetTreeFacets;
+extern Sys::SteadyClock::duration c_facetTreeTime;
+
+void     CM_BuildFacetTree( cSurfaceCollide_t *sc );
+
 
 // cm_test.c
 extern const cSurfaceCollide_t *debugSurfaceCollide;
@@ -305,3 +392,6 @@ bool                       CM_BoundsIntersect( const vec3_t mins, const vec3_t m
 bool                       CM_BoundsIntersectPoint( const vec3_t mins, const vec3_t maxs, const vec3_t point );
 
 // XreaL END
+
+// cm_trace.c
+void CM_ReportFacetTrees();
@@ -877,5 +877,7 @@ cSurfaceCollide_t *CM_GeneratePatchCollide( int width, int height, vec3_t *point
 	sc->bounds[ 1 ][ 1 ] += 1;
 	sc->bounds[ 1 ][ 2 ] += 1;
 
+	CM_BuildFacetTree( sc );
+
 	return sc;
 }
@@ -34,6 +34,8 @@ Maryland 20850 USA.
 
 #include "cm_local.h"
 
+#include <algorithm>
+
 static const int PLANE_HASHES = 8192;
 static cPlane_t *planeHashTable[ PLANE_HASHES ];
 
@@ -43,6 +45,9 @@ cPlane_t planes[ SHADER_MAX_TRIANGLES ];
 int      numFacets;
 cFacet_t facets[ SHADER_MAX_TRIANGLES ];
 
+int                        c_facetTrees, c_facetTreeFacets;
+Sys::SteadyClock::duration c_facetTreeTime;
+
 /*
 =================
 CM_ResetPlaneCounts
@@ -701,3 +706,187 @@ bool CM_GenerateFacetFor3Points( cFacet_t *facet, const vec3_t p1, const vec3_t
 
 	return true;
 }
+
+/*
+================================================================================
+
+FACET TREE
+
+================================================================================
+*/
+
+static const int   FACET_TREE_MIN_FACETS = 16; // fewer are as quickly tested one by one
+static const int   FACET_TREE_LEAF_FACETS = 4;
+static const float FACET_TREE_OPEN = 1.0e30f;
+
+struct facetTreeItem_t
+{
+	int    facetNum;
+	vec3_t bounds[ 2 ];
+	vec3_t center;
+};
+
+/*
+==================
+CM_FacetBounds
+
+A facet keeps traces out of the space behind its surface plane and inside
+its borders, which the axial bevels close on most sides. Where no axial
+plane closes it, the bounds are left open, and they are expanded by a unit
+for the epsilons of the trace code.
+==================
+*/
+static void CM_FacetBounds( const cSurfaceCollide_t *sc, const cFacet_t *facet, vec3_t mins, vec3_t maxs )
+{
+	int   i, j, axis;
+	float normal[ 3 ], dist;
+
+	VectorSet( mins, -FACET_TREE_OPEN, -FACET_TREE_OPEN, -FACET_TREE_OPEN );
+	VectorSet( maxs, FACET_TREE_OPEN, FACET_TREE_OPEN, FACET_TREE_OPEN );
+
+	for ( i = -1; i < facet->numBorders; i++ )
+	{
+		const cPlane_t *p = &sc->planes[ i < 0 ? facet->surfacePlane : facet->borderPlanes[ i ] ];
+
+		// the space kept free is behind the planes as the trace code uses them
+		if ( i >= 0 && facet->borderInward[ i ] )
+		{
+			VectorNegate( p->plane, normal );
+			dist = -p->plane[ 3 ];
+		}
+		else
+		{
+			VectorCopy( p->plane, normal );
+			dist = p->plane[ 3 ];
+		}
+
+		for ( axis = 0; axis < 3; axis++ )
+		{
+			for ( j = 0; j < 3; j++ )
+			{
+				if ( j != axis && normal[ j ] != 0 )
+				{
+					break;
+				}
+			}
+
+			if ( j < 3 )
+			{
+				continue;
+			}
+
+			if ( normal[ axis ] == 1 )
+			{
+				maxs[ axis ] = std::min( maxs[ axis ], dist + 1 );
+			}
+			else if ( normal[ axis ] == -1 )
+			{
+				mins[ axis ] = std::max( mins[ axis ], -dist - 1 );
+			}
+		}
+	}
+}
+
+/*
+==================
+CM_BuildFacetTree_r
+==================
+*/
+static void CM_BuildFacetTree_r( std::vector<cFacetNode_t> &nodes, std::vector<int> &facetNums,
+                                 facetTreeItem_t *items, int count )
+{
+	int          i, axis;
+	vec3_t       centerMins, centerMaxs, size;
+	int          nodeNum = nodes.size();
+	cFacetNode_t node{};
+
+	ClearBounds( node.bounds[ 0 ], node.bounds[ 1 ] );
+	ClearBounds( centerMins, centerMaxs );
+
+	for ( i = 0; i < count; i++ )
+	{
+		AddPointToBounds( items[ i ].bounds[ 0 ], node.bounds[ 0 ], node.bounds[ 1 ] );
+		AddPointToBounds( items[ i ].bounds[ 1 ], node.bounds[ 0 ], node.bounds[ 1 ] );
+		AddPointToBounds( items[ i ].center, centerMins, centerMaxs );
+	}
+
+	nodes.push_back( node );
+
+	if ( count <= FACET_TREE_LEAF_FACETS )
+	{
+		nodes[ nodeNum ].firstFacet = facetNums.size();
+		nodes[ nodeNum ].numFacets = count;
+		nodes[ nodeNum ].skip = nodeNum + 1;
+
+		for ( i = 0; i < count; i++ )
+		{
+			facetNums.push_back( items[ i ].facetNum );
+		}
+
+		return;
+	}
+
+	// split at the median along the longest axis of the centers
+	VectorSubtract( centerMaxs, centerMins, size );
+	axis = ( size[ 0 ] >= size[ 1 ] && size[ 0 ] >= size[ 2 ] ) ? 0 : ( size[ 1 ] >= size[ 2 ] ? 1 : 2 );
+
+	std::nth_element( items, items + count / 2, items + count,
+	                  [ axis ]( const facetTreeItem_t &a, const facetTreeItem_t &b ) { return a.center[ axis ] < b.center[ axis ]; } );
+
+	CM_BuildFacetTree_r( nodes, facetNums, items, count / 2 );
+	CM_BuildFacetTree_r( nodes, facetNums, items + count / 2, count - count / 2 );
+
+	nodes[ nodeNum ].skip = nodes.size();
+}
+
+/*
+==================
+CM_BuildFacetTree
+
+Builds the bounding volume hierarchy that lets traces skip the facets of
+a surface they can't touch
+==================
+*/
+void CM_BuildFacetTree( cSurfaceCollide_t *sc )
+{
+	int                          i, j;
+	std::vector<facetTreeItem_t> items;
+	std::vector<cFacetNode_t>    nodes;
+	std::vector<int>             facetNums;
+
+	if ( sc->numFacets < FACET_TREE_MIN_FACETS )
+	{
+		return;
+	}
+
+	auto start = Sys::SteadyClock::now();
+
+	items.resize( sc->numFacets );
+
+	for ( i = 0; i < sc->numFacets; i++ )
+	{
+		facetTreeItem_t *item = &items[ i ];
+
+		item->facetNum = i;
+		CM_FacetBounds( sc, &sc->facets[ i ], item->bounds[ 0 ], item->bounds[ 1 ] );
+
+		// open sides don't move the center out of the surface
+		for ( j = 0; j < 3; j++ )
+		{
+			item->center[ j ] = 0.5f * ( std::max( item->bounds[ 0 ][ j ], sc->bounds[ 0 ][ j ] )
+			                             + std::min( item->bounds[ 1 ][ j ], sc->bounds[ 1 ][ j ] ) );
+		}
+	}
+
+	CM_BuildFacetTree_r( nodes, facetNums, items.data(), sc->numFacets );
+
+	sc->numNodes = nodes.size();
+	sc->nodes = ( cFacetNode_t * ) CM_Alloc( sc->numNodes * sizeof( *sc->nodes ) );
+	Com_Memcpy( sc->nodes, nodes.data(), sc->numNodes * sizeof( *sc->nodes ) );
+	sc->facetNums = ( int * ) CM_Alloc( facetNums.size() * sizeof( *sc->facetNums ) );
+	Com_Memcpy( sc->facetNums, facetNums.data(), facetNums.size() * sizeof( *sc->facetNums ) );
+
+	c_facetTrees++;
+	c_facetTreeFacets += sc->numFacets;
+	c_facetTreeTime += Sys::SteadyClock::now() - start;
+}
@@ -32,6 +32,9 @@ Maryland 20850 USA.
 ===========================================================================
 */
 
+#ifndef CM_PUBLIC_H_
+#define CM_PUBLIC_H_
+
 #include "engine/qcommon/q_shared.h"
 #include "engine/qcommon/qfiles.h"
 #include "engine/renderer/tr_types.h"
@@ -45,7 +48,7 @@ clipHandle_t CM_TempBoxModel( const vec3_t mins, const vec3_t maxs, int capsule
 void         CM_ModelBounds( clipHandle_t model, vec3_t mins, vec3_t maxs );
 
 int          CM_NumInlineModels();
-char         *CM_EntityString();
+const char   *CM_EntityString();
 
 // returns an ORed contents mask
 int          CM_PointContents( const vec3_t p, clipHandle_t model );
@@ -54,6 +57,15 @@ int          CM_TransformedPointContents( const vec3_t p, clipHandle_t model, co
 void         CM_BoxTrace( trace_t *results, const vec3_t start, const vec3_t end, vec3_t mins,
                           vec3_t maxs, clipHandle_t model, int brushmask, int skipmask,
                           traceType_t type );
+// one of the traces of a CM_BoxTraceBatch
+struct cmBoxTrace_t
+{
+	vec3_t start, end;
+	vec3_t mins, maxs;
+};
+
+void         CM_BoxTraceBatch( trace_t *results, const cmBoxTrace_t *traces, int numTraces,
+                               clipHandle_t model, int brushmask, int skipmask, traceType_t type );
 void         CM_TransformedBoxTrace( trace_t *results, const vec3_t start, const vec3_t end,
                                      const vec3_t mins, const vec3_t maxs, clipHandle_t model,
                                      int brushmask, int skipmask, const vec3_t origin,
@@ -67,7 +79,8 @@ void         CM_TransformedBiSphereTrace( trace_t *results, const vec3_t start,
 
 float CM_DistanceToModel( const vec3_t loc, clipHandle_t model );
 
-byte *CM_ClusterPVS( int cluster );
+const byte *CM_ClusterPVS( int cluster );
+int   CM_NumClusters();
 
 int  CM_PointLeafnum( const vec3_t p );
 
@@ -89,3 +102,5 @@ int      CM_MarkFragments( int numPoints, const vec3_t *points, const vec3_t pro
 
 // cm_patch.c
 void CM_DrawDebugSurface( void ( *drawPoly )( int color, int numPoints, float *points ) );
+
+#endif // CM_PUBLIC_H_
@@ -36,6 +36,16 @@ Maryland 20850 USA.
 
 #include "cm_patch.h"
 
+#include <common/FileSystem.h>
+
+#ifdef BUILD_ENGINE
+#include <thread>
+#endif
+
+#if idx86_sse >= 2 && defined( __GNUC__ )
+#include <immintrin.h>
+#endif
+
 // always use bbox vs. bbox collision and never capsule vs. bbox or vice versa
 //#define ALWAYS_BBOX_VS_BBOX
 // always use capsule vs. capsule collision and never capsule vs. bbox or vice versa
@@ -46,6 +56,83 @@ Cvar::Cvar<bool> cm_noCurves(VM_STRING_PREFIX "cm_noCurves", "something in cm ab
 /*
 ===============================================================================
 
+VISITED MARKS
+
+===============================================================================
+*/
+
+/*
+================
+CM_BeginVisits
+
+Gives a new trace of this thread its own marks, so that traces running on
+several threads at once don't skip what the others have tested
+================
+*/
+static void CM_BeginVisits( traceWork_t *tw )
+{
+#ifndef __native_client__
+	thread_local
+#endif
+	static traceVisited_t visited;
+
+	// the box brush follows the brushes of the map
+	size_t numBrushes = cm.numBrushes + 1;
+	size_t numSurfaces = cm.numSurfaces;
+
+	if ( visited.brushes.size() < numBrushes || visited.surfaces.size() < numSurfaces
+	     || visited.checkcount == std::numeric_limits<int>::max() )
+	{
+		visited.brushes.assign( std::max( numBrushes, visited.brushes.size() ), 0 );
+		visited.collided.assign( visited.brushes.size(), 0 );
+		visited.surfaces.assign( std::max( numSurfaces, visited.surfaces.size() ), 0 );
+		visited.checkcount = 0;
+	}
+
+	tw->visited = &visited;
+	tw->checkcount = ++visited.checkcount;
+}
+
+// returns false if the trace has already tested the brush in another leaf
+static inline bool CM_VisitBrush( traceWork_t *tw, int brushnum )
+{
+	int &mark = tw->visited->brushes[ brushnum ];
+
+	if ( mark == tw->checkcount )
+	{
+		return false;
+	}
+
+	mark = tw->checkcount;
+	return true;
+}
+
+static inline bool CM_VisitSurface( traceWork_t *tw, int surfacenum )
+{
+	int &mark = tw->visited->surfaces[ surfacenum ];
+
+	if ( mark == tw->checkcount )
+	{
+		return false;
+	}
+
+	mark = tw->checkcount;
+	return true;
+}
+
+static inline void CM_MarkCollided( traceWork_t *tw, const cbrush_t *brush )
+{
+	tw->visited->collided[ brush - cm.brushes ] = tw->checkcount;
+}
+
+static inline bool CM_Collided( const traceWork_t *tw, const cbrush_t *brush )
+{
+	return tw->visited->collided[ brush - cm.brushes ] == tw->checkcount;
+}
+
+/*
+===============================================================================
+
 BASIC MATH
 
 ===============================================================================
@@ -246,6 +333,58 @@ static void CM_TestBoxInBrush( traceWork_t *tw, cbrush_t *brush )
 	tw->trace.contents = brush->contents;
 }
 
+/*
+====================
+CM_ListFacets
+
+Walks the facet tree of the surface for the facets whose bounds the trace
+touches and returns them in the order they are stored in, so the first of
+equally near hits is still the one kept. Returns nullptr when all facets
+have to be tested.
+====================
+*/
+static const int *CM_ListFacets( const traceWork_t *tw, const cSurfaceCollide_t *sc, int *numListed )
+{
+#ifndef __native_client__
+	thread_local
+#endif
+	static int         list[ SHADER_MAX_TRIANGLES ];
+	int                i, j, count;
+	const cFacetNode_t      *node;
+
+	// the bounds of bisphere traces don't hold their spheres
+	if ( !sc->nodes || !cm_facetTree.Get() || tw->type == traceType_t::TT_BISPHERE )
+	{
+		*numListed = sc->numFacets;
+		return nullptr;
+	}
+
+	count = 0;
+
+	for ( i = 0; i < sc->numNodes; )
+	{
+		node = &sc->nodes[ i ];
+
+		if ( !CM_BoundsIntersect( tw->bounds[ 0 ], tw->bounds[ 1 ], node->bounds[ 0 ], node->bounds[ 1 ] ) )
+		{
+			i = node->skip;
+			continue;
+		}
+
+		for ( j = 0; j < node->numFacets; j++ )
+		{
+			list[ count++ ] = sc->facetNums[ node->firstFacet + j ];
+		}
+
+		i++;
+	}
+
+	std::sort( list, list + count );
+
+	*numListed = count;
+	return list;
+}
+
 /*
 ====================
 CM_PositionTestInSurfaceCollide
@@ -253,23 +392,25 @@ CM_PositionTestInSurfaceCollide
 */
 static bool CM_PositionTestInSurfaceCollide( traceWork_t *tw, const cSurfaceCollide_t *sc )
 {
-	int      i, j;
-	float    offset, t;
-	cPlane_t *planes;
-	cFacet_t *facet;
-	float    plane[ 4 ];
-	vec3_t   startp;
+	int       i, j, numListed;
+	const int *list;
+	float     offset, t;
+	cPlane_t  *planes;
+	cFacet_t  *facet;
+	float     plane[ 4 ];
+	vec3_t    startp;
 
 	if ( tw->isPoint )
 	{
 		return false;
 	}
 
-	//
-	facet = sc->facets;
+	list = CM_ListFacets( tw, sc, &numListed );
 
-	for ( i = 0; i < sc->numFacets; i++, facet++ )
+	for ( i = 0; i < numListed; i++ )
 	{
+		facet = &sc->facets[ list ? list[ i ] : i ];
+
 		planes = &sc->planes[ facet->surfacePlane ];
 		VectorCopy( planes->plane, plane );
 		plane[ 3 ] = planes->plane[ 3 ];
@@ -379,13 +520,11 @@ void CM_TestInLeaf( traceWork_t *tw, cLeaf_t *leaf )
 		brushnum = leaf->firstLeafBrush[ k ];
 		b = &cm.brushes[ brushnum ];
 
-		if ( b->checkcount == cm.checkcount )
+		if ( !CM_VisitBrush( tw, brushnum ) )
 		{
 			continue; // already checked this brush in another leaf
 		}
 
-		b->checkcount = cm.checkcount;
-
 		if ( !( b->contents & tw->contents ) )
 		{
 			continue;
@@ -414,13 +553,11 @@ void CM_TestInLeaf( traceWork_t *tw, cLeaf_t *leaf )
 			continue;
 		}
 
-		if ( surface->checkcount == cm.checkcount )
+		if ( !CM_VisitSurface( tw, leaf->firstLeafSurface[ k ] ) )
 		{
 			continue; // already checked this surface in another leaf
 		}
 
-		surface->checkcount = cm.checkcount;
-
 		if ( !( surface->contents & tw->contents ) )
 		{
 			continue;
@@ -614,12 +751,8 @@ void CM_PositionTest( traceWork_t *tw )
 	ll.lastLeaf = 0;
 	ll.overflowed = false;
 
-	cm.checkcount++;
-
 	CM_BoxLeafnums_r( &ll, 0 );
 
-	cm.checkcount++;
-
 	// test the contents of the leafs
 	for ( i = 0; i < ll.count; i++ )
 	{
@@ -649,12 +782,19 @@ CM_TracePointThroughSurfaceCollide
 */
 void CM_TracePointThroughSurfaceCollide( traceWork_t *tw, const cSurfaceCollide_t *sc )
 {
-	static bool frontFacing[ SHADER_MAX_TRIANGLES ];
+#ifndef __native_client__
+	thread_local
+#endif
+	static bool     frontFacing[ SHADER_MAX_TRIANGLES ];
+#ifndef __native_client__
+	thread_local
+#endif
 	static float    intersection[ SHADER_MAX_TRIANGLES ];
 	float           intersect;
 	const cPlane_t  *planes;
 	const cFacet_t  *facet;
-	int             i, j, k;
+	int             i, j, k, numListed;
+	const int       *list;
 	float           offset;
 	float           d1, d2;
 
@@ -663,42 +803,67 @@ void CM_TracePointThroughSurfaceCollide( traceWork_t *tw, const cSurfaceCollide_
 		return;
 	}
 
-	// determine the trace's relationship to all planes
-	planes = sc->planes;
+	auto relate = [ & ]( int planeNum ) {
+		const cPlane_t *p = &sc->planes[ planeNum ];
 
-	for ( i = 0; i < sc->numPlanes; i++, planes++ )
-	{
-		offset = DotProduct( tw->offsets[ planes->signbits ], planes->plane );
-		d1 = DotProduct( tw->start, planes->plane ) - planes->plane[ 3 ] + offset;
-		d2 = DotProduct( tw->end, planes->plane ) - planes->plane[ 3 ] + offset;
+		offset = DotProduct( tw->offsets[ p->signbits ], p->plane );
+		d1 = DotProduct( tw->start, p->plane ) - p->plane[ 3 ] + offset;
+		d2 = DotProduct( tw->end, p->plane ) - p->plane[ 3 ] + offset;
 
 		if ( d1 <= 0 )
 		{
-			frontFacing[ i ] = false;
+			frontFacing[ planeNum ] = false;
 		}
 		else
 		{
-			frontFacing[ i ] = true;
+			frontFacing[ planeNum ] = true;
 		}
 
 		if ( d1 == d2 )
 		{
-			intersection[ i ] = 99999;
+			intersection[ planeNum ] = 99999;
 		}
 		else
 		{
-			intersection[ i ] = d1 / ( d1 - d2 );
+			intersection[ planeNum ] = d1 / ( d1 - d2 );
+
+			if ( intersection[ planeNum ] <= 0 )
+			{
+				intersection[ planeNum ] = 99999;
+			}
+		}
+	};
+
+	list = CM_ListFacets( tw, sc, &numListed );
+
+	// determine the trace's relationship to all planes, or to
+	// the planes of the facets it can touch
+	if ( !list )
+	{
+		for ( i = 0; i < sc->numPlanes; i++ )
+		{
+			relate( i );
+		}
+	}
+	else
+	{
+		for ( i = 0; i < numListed; i++ )
+		{
+			facet = &sc->facets[ list[ i ] ];
+			relate( facet->surfacePlane );
 
-			if ( intersection[ i ] <= 0 )
+			for ( j = 0; j < facet->numBorders; j++ )
 			{
-				intersection[ i ] = 99999;
+				relate( facet->borderPlanes[ j ] );
 			}
 		}
 	}
 
 	// see if any of the surface planes are intersected
-	for ( i = 0, facet = sc->facets; i < sc->numFacets; i++, facet++ )
+	for ( i = 0; i < numListed; i++ )
 	{
+		facet = &sc->facets[ list ? list[ i ] : i ];
+
 		if ( !frontFacing[ facet->surfacePlane ] )
 		{
 			continue;
@@ -830,7 +995,8 @@ CM_TraceThroughSurfaceCollide
 */
 void CM_TraceThroughSurfaceCollide( traceWork_t *tw, const cSurfaceCollide_t *sc )
 {
-	int           i, j, hit, hitnum;
+	int           i, j, hit, hitnum, numListed;
+	const int     *list;
 	float         offset, enterFrac, leaveFrac, t;
 	cPlane_t      *planes;
 	cFacet_t      *facet;
@@ -849,8 +1015,12 @@ void CM_TraceThroughSurfaceCollide( traceWork_t *tw, const cSurfaceCollide_t *sc
 		return;
 	}
 
-	for ( i = 0, facet = sc->facets; i < sc->numFacets; i++, facet++ )
+	list = CM_ListFacets( tw, sc, &numListed );
+
+	for ( i = 0; i < numListed; i++ )
 	{
+		facet = &sc->facets[ list ? list[ i ] : i ];
+
 		enterFrac = -1.0;
 		leaveFrac = 1.0;
 		hitnum = -1;
@@ -1085,7 +1255,7 @@ void CM_TraceThroughBrush( traceWork_t *tw, cbrush_t *brush )
 				continue;
 			}
 
-			brush->collided = true;
+			CM_MarkCollided( tw, brush );
 
 			// crosses face
 			if ( d1 > d2 )
@@ -1176,7 +1346,7 @@ void CM_TraceThroughBrush( traceWork_t *tw, cbrush_t *brush )
 				continue;
 			}
 
-			brush->collided = true;
+			CM_MarkCollided( tw, brush );
 
 			// crosses face
 			if ( d1 > d2 )
@@ -1253,7 +1423,7 @@ void CM_TraceThroughBrush( traceWork_t *tw, cbrush_t *brush )
 				continue;
 			}
 
-			brush->collided = true;
+			CM_MarkCollided( tw, brush );
 
 			// crosses face
 			if ( d1 > d2 )
@@ -1351,6 +1521,8 @@ static void CM_ProximityToBrush( traceWork_t *tw, cbrush_t *brush )
 	VectorClear( tw2.sphere.offset );
 	VectorCopy( tw->start, tw2.start );
 	VectorCopy( tw->end, tw2.end );
+	tw2.visited = tw->visited;
+	tw2.checkcount = tw->checkcount;
 
 	CM_TraceThroughBrush( &tw2, brush );
 
@@ -1428,89 +1600,95 @@ static void CM_ProximityToSurface( traceWork_t *tw, cSurface_t *surface )
 
 /*
 ================
-CM_TraceThroughLeaf
+CM_TraceThroughLeafSurfaces
+
+Returns false if the trace can't go any further
 ================
 */
-void CM_TraceThroughLeaf( traceWork_t *tw, cLeaf_t *leaf )
+static bool CM_TraceThroughLeafSurfaces( traceWork_t *tw, const cLeaf_t *leaf )
 {
-	int        k;
-	int        brushnum;
-	cbrush_t   *b;
-	cSurface_t *surface;
-
-	// trace line against all brushes in the leaf
-	for ( k = 0; k < leaf->numLeafBrushes; k++ )
+	// trace line against all surfaces in the leaf
+	for ( int k = 0; k < leaf->numLeafSurfaces; k++ )
 	{
-		brushnum = leaf->firstLeafBrush[ k ];
-
-		b = &cm.brushes[ brushnum ];
+		cSurface_t *surface = cm.surfaces[ leaf->firstLeafSurface[ k ] ];
 
-		if ( b->checkcount == cm.checkcount )
+		if ( !surface )
 		{
-			continue; // already checked this brush in another leaf
+			continue;
 		}
 
-		b->checkcount = cm.checkcount;
+		if ( !CM_VisitSurface( tw, leaf->firstLeafSurface[ k ] ) )
+		{
+			continue; // already checked this surface in another leaf
+		}
 
-		if ( !( b->contents & tw->contents ) )
+		if ( !( surface->contents & tw->contents ) )
 		{
 			continue;
 		}
 
-		if ( b->contents & tw->skipContents )
+		if ( surface->contents & tw->skipContents )
 		{
 			continue;
 		}
 
-		b->collided = false;
-
-		if ( !CM_BoundsIntersect( tw->bounds[ 0 ], tw->bounds[ 1 ], b->bounds[ 0 ], b->bounds[ 1 ] ) )
+		if ( !CM_BoundsIntersect( tw->bounds[ 0 ], tw->bounds[ 1 ], surface->sc->bounds[ 0 ], surface->sc->bounds[ 1 ] ) )
 		{
 			continue;
 		}
 
-		CM_TraceThroughBrush( tw, b );
+		CM_TraceThroughSurface( tw, surface );
 
 		if ( !tw->trace.fraction )
 		{
 			tw->trace.lateralFraction = 0.0f;
-			return;
+			return false;
 		}
 	}
 
-	// trace line against all surfaces in the leaf
-	for ( k = 0; k < leaf->numLeafSurfaces; k++ )
+	return true;
+}
+
+/*
+================
+CM_TraceThroughLeaf
+================
+*/
+void CM_TraceThroughLeaf( traceWork_t *tw, cLeaf_t *leaf )
+{
+	int        k;
+	int        brushnum;
+	cbrush_t   *b;
+	cSurface_t *surface;
+
+	// trace line against all brushes in the leaf
+	for ( k = 0; k < leaf->numLeafBrushes; k++ )
 	{
-		surface = cm.surfaces[ leaf->firstLeafSurface[ k ] ];
+		brushnum = leaf->firstLeafBrush[ k ];
 
-		if ( !surface )
-		{
-			continue;
-		}
+		b = &cm.brushes[ brushnum ];
 
-		if ( surface->checkcount == cm.checkcount )
+		if ( !CM_VisitBrush( tw, brushnum ) )
 		{
-			continue; // already checked this surface in another leaf
+			continue; // already checked this brush in another leaf
 		}
 
-		surface->checkcount = cm.checkcount;
-
-		if ( !( surface->contents & tw->contents ) )
+		if ( !( b->contents & tw->contents ) )
 		{
 			continue;
 		}
 
-		if ( surface->contents & tw->skipContents )
+		if ( b->contents & tw->skipContents )
 		{
 			continue;
 		}
 
-		if ( !CM_BoundsIntersect( tw->bounds[ 0 ], tw->bounds[ 1 ], surface->sc->bounds[ 0 ], surface->sc->bounds[ 1 ] ) )
+		if ( !CM_BoundsIntersect( tw->bounds[ 0 ], tw->bounds[ 1 ], b->bounds[ 0 ], b->bounds[ 1 ] ) )
 		{
 			continue;
 		}
 
-		CM_TraceThroughSurface( tw, surface );
+		CM_TraceThroughBrush( tw, b );
 
 		if ( !tw->trace.fraction )
 		{
@@ -1519,6 +1697,11 @@ void CM_TraceThroughLeaf( traceWork_t *tw, cLeaf_t *leaf )
 		}
 	}
 
+	if ( !CM_TraceThroughLeafSurfaces( tw, leaf ) )
+	{
+		return;
+	}
+
 	if ( tw->testLateralCollision && tw->trace.fraction < 1.0f )
 	{
 		for ( k = 0; k < leaf->numLeafBrushes; k++ )
@@ -1528,7 +1711,7 @@ void CM_TraceThroughLeaf( traceWork_t *tw, cLeaf_t *leaf )
 			b = &cm.brushes[ brushnum ];
 
 			// This brush never collided, so don't bother
-			if ( !b->collided )
+			if ( !CM_Collided( tw, b ) )
 			{
 				continue;
 			}
@@ -2052,276 +2235,1786 @@ static void CM_TraceThroughTree( traceWork_t *tw, int num, float p1f, float p2f,
 	CM_TraceThroughTree( tw, node->children[ side ^ 1 ], midf, p2f, mid, p2 );
 }
 
-//======================================================================
-
 /*
-==================
-CM_Trace
-==================
-*/
-static void CM_Trace( trace_t *results, const vec3_t start, const vec3_t end, const vec3_t mins,
-                      const vec3_t maxs, clipHandle_t model, const vec3_t origin, int brushmask,
-                      int skipmask, traceType_t type, sphere_t *sphere )
-{
-	int         i;
-	traceWork_t tw;
-	vec3_t      offset;
-	cmodel_t    *cmod;
-
-	cmod = CM_ClipHandleToModel( model );
+===============================================================================
 
-	cm.checkcount++; // for multi-check avoidance
+FLAT TREE
 
-	c_traces++; // for statistics, may be zeroed
+===============================================================================
+*/
 
-	// fill in a default trace
-	Com_Memset( &tw, 0, sizeof( tw ) );
-	tw.trace.fraction = 1; // assume it goes the entire distance until shown otherwise
-	VectorCopy( origin, tw.modelOrigin );
-	tw.type = type;
+/*
+================
+CM_ClipToFlatBrush
 
-	if ( !cm.numNodes )
+Ends the brush tests of CM_TraceThroughBrush, once all the sides are
+checked and the trace isn't completely outside of the brush
+================
+*/
+static void CM_ClipToFlatBrush( traceWork_t *tw, const cFlatBrush_t *brush, bool startout, bool getout,
+                                float enterFrac, float leaveFrac, int leadside )
+{
+	if ( !startout )
 	{
-		*results = tw.trace;
+		// original point was inside brush
+		tw->trace.startsolid = true;
 
-		return; // map not loaded, shouldn't happen
-	}
+		if ( !getout )
+		{
+			tw->trace.allsolid = true;
+			tw->trace.fraction = 0;
+			tw->trace.contents = brush->contents;
+		}
 
-	// allow nullptr to be passed in for 0,0,0
-	if ( !mins )
-	{
-		mins = vec3_origin;
+		return;
 	}
 
-	if ( !maxs )
+	if ( enterFrac < leaveFrac )
 	{
-		maxs = vec3_origin;
-	}
-
-	// set basic parms
-	tw.contents = brushmask;
-	tw.skipContents = skipmask;
+		if ( enterFrac > -1 && enterFrac < tw->trace.fraction )
+		{
+			if ( enterFrac < 0 )
+			{
+				enterFrac = 0;
+			}
 
-	// adjust so that mins and maxs are always symmetric, which
-	// avoids some complications with plane expanding of rotated
-	// bmodels
-	for ( i = 0; i < 3; i++ )
-	{
-		offset[ i ] = ( mins[ i ] + maxs[ i ] ) * 0.5;
-		tw.size[ 0 ][ i ] = mins[ i ] - offset[ i ];
-		tw.size[ 1 ][ i ] = maxs[ i ] - offset[ i ];
-		tw.start[ i ] = start[ i ] + offset[ i ];
-		tw.end[ i ] = end[ i ] + offset[ i ];
+			tw->trace.fraction = enterFrac;
+			tw->trace.plane = *cm.flat.sidePlanes[ brush->firstSide + leadside ];
+			tw->trace.surfaceFlags = cm.flat.sideSurfaceFlags[ brush->firstSide + leadside ];
+			tw->trace.contents = brush->contents;
+		}
 	}
+}
 
-	// if a sphere is already specified
-	if ( sphere )
-	{
-		tw.sphere = *sphere;
-	}
-	else
-	{
-		tw.sphere.radius = ( tw.size[ 1 ][ 0 ] > tw.size[ 1 ][ 2 ] ) ? tw.size[ 1 ][ 2 ] : tw.size[ 1 ][ 0 ];
-		tw.sphere.halfheight = tw.size[ 1 ][ 2 ];
-		VectorSet( tw.sphere.offset, 0, 0, tw.size[ 1 ][ 2 ] - tw.sphere.radius );
-	}
+/*
+================
+CM_TraceThroughFlatBrushScalar
 
-	tw.maxOffset = tw.size[ 1 ][ 0 ] + tw.size[ 1 ][ 1 ] + tw.size[ 1 ][ 2 ];
+CM_TraceThroughBrush for boxes and points, on the sides of the compiled tree
+================
+*/
+static void CM_TraceThroughFlatBrushScalar( traceWork_t *tw, const cFlatBrush_t *brush )
+{
+	const cFlatTree_t *flat = &cm.flat;
+	float             enterFrac = -1.0f, leaveFrac = 1.0f;
+	bool              getout = false, startout = false;
+	int               leadside = -1;
 
-	// tw.offsets[signbits] = vector to appropriate corner from origin
-	tw.offsets[ 0 ][ 0 ] = tw.size[ 0 ][ 0 ];
-	tw.offsets[ 0 ][ 1 ] = tw.size[ 0 ][ 1 ];
-	tw.offsets[ 0 ][ 2 ] = tw.size[ 0 ][ 2 ];
+	const float *normalsX = flat->sideNormals[ 0 ] + brush->firstSide;
+	const float *normalsY = flat->sideNormals[ 1 ] + brush->firstSide;
+	const float *normalsZ = flat->sideNormals[ 2 ] + brush->firstSide;
+	const float *dists = flat->sideDists + brush->firstSide;
+	const byte  *signbits = flat->sideSignbits + brush->firstSide;
 
-	tw.offsets[ 1 ][ 0 ] = tw.size[ 1 ][ 0 ];
-	tw.offsets[ 1 ][ 1 ] = tw.size[ 0 ][ 1 ];
-	tw.offsets[ 1 ][ 2 ] = tw.size[ 0 ][ 2 ];
+	//
+	// compare the trace against all planes of the brush
+	// find the latest time the trace crosses a plane towards the interior
+	// and the earliest time the trace crosses a plane towards the exterior
+	//
+	for ( int i = 0; i < brush->numSides; i++ )
+	{
+		vec3_t normal = { normalsX[ i ], normalsY[ i ], normalsZ[ i ] };
 
-	tw.offsets[ 2 ][ 0 ] = tw.size[ 0 ][ 0 ];
-	tw.offsets[ 2 ][ 1 ] = tw.size[ 1 ][ 1 ];
-	tw.offsets[ 2 ][ 2 ] = tw.size[ 0 ][ 2 ];
+		// adjust the plane distance appropriately for mins/maxs
+		float dist = dists[ i ] - DotProduct( tw->offsets[ signbits[ i ] ], normal );
 
-	tw.offsets[ 3 ][ 0 ] = tw.size[ 1 ][ 0 ];
-	tw.offsets[ 3 ][ 1 ] = tw.size[ 1 ][ 1 ];
-	tw.offsets[ 3 ][ 2 ] = tw.size[ 0 ][ 2 ];
+		float d1 = DotProduct( tw->start, normal ) - dist;
+		float d2 = DotProduct( tw->end, normal ) - dist;
 
-	tw.offsets[ 4 ][ 0 ] = tw.size[ 0 ][ 0 ];
-	tw.offsets[ 4 ][ 1 ] = tw.size[ 0 ][ 1 ];
-	tw.offsets[ 4 ][ 2 ] = tw.size[ 1 ][ 2 ];
+		if ( d2 > 0 )
+		{
+			getout = true; // endpoint is not in solid
+		}
 
-	tw.offsets[ 5 ][ 0 ] = tw.size[ 1 ][ 0 ];
-	tw.offsets[ 5 ][ 1 ] = tw.size[ 0 ][ 1 ];
-	tw.offsets[ 5 ][ 2 ] = tw.size[ 1 ][ 2 ];
+		if ( d1 > 0 )
+		{
+			startout = true;
+		}
+
+		// if completely in front of face, no intersection with the entire brush
+		if ( d1 > 0 && ( d2 >= SURFACE_CLIP_EPSILON || d2 >= d1 ) )
+		{
+			return;
+		}
+
+		// if it doesn't cross the plane, the plane isn't relevant
+		if ( d1 <= 0 && d2 <= 0 )
+		{
+			continue;
+		}
+
+		// crosses face
+		if ( d1 > d2 )
+		{
+			// enter
+			float f = ( d1 - SURFACE_CLIP_EPSILON ) / ( d1 - d2 );
+
+			if ( f < 0 )
+			{
+				f = 0;
+			}
+
+			if ( f > enterFrac )
+			{
+				enterFrac = f;
+				leadside = i;
+			}
+		}
+		else
+		{
+			// leave
+			float f = ( d1 + SURFACE_CLIP_EPSILON ) / ( d1 - d2 );
+
+			if ( f > 1 )
+			{
+				f = 1;
+			}
+
+			if ( f < leaveFrac )
+			{
+				leaveFrac = f;
+			}
+		}
+	}
+
+	CM_ClipToFlatBrush( tw, brush, startout, getout, enterFrac, leaveFrac, leadside );
+}
+
+/*
+The vector kernels below test FLAT_SIDE_LANES / 2 or FLAT_SIDE_LANES sides
+at once. The first side of the largest entering fraction leads, and a side
+the whole trace is in front of discards the brush wherever it is in the
+list, like in the scalar one. Their fractions may differ from it in the
+last bits, as -ffast-math leaves the compiler free to reorder its sums.
+*/
+#if idx86_sse >= 2
+
+// the first lane set in a mask of _mm_movemask_ps, which isn't 0
+static inline int CM_LowestLane( int mask )
+{
+#if defined( __GNUC__ )
+	return __builtin_ctz( mask );
+#else
+	int lane = 0;
+
+	while ( !( mask & 1 ) )
+	{
+		mask >>= 1;
+		lane++;
+	}
+
+	return lane;
+#endif
+}
+
+/*
+================
+CM_TraceThroughFlatBrushSSE2
+================
+*/
+static void CM_TraceThroughFlatBrushSSE2( traceWork_t *tw, const cFlatBrush_t *brush )
+{
+	const cFlatTree_t *flat = &cm.flat;
+	float             enterFrac = -1.0f, leaveFrac = 1.0f;
+	int               getout = 0, startout = 0;
+	int               leadside = -1;
+
+	const __m128  zero = _mm_setzero_ps();
+	const __m128  one = _mm_set1_ps( 1.0f );
+	const __m128  minusOne = _mm_set1_ps( -1.0f );
+	const __m128  epsilon = _mm_set1_ps( SURFACE_CLIP_EPSILON );
+	const __m128d epsilonD = _mm_set1_pd( SURFACE_CLIP_EPSILON );
+
+	__m128 start[ 3 ], end[ 3 ], mins[ 3 ], maxs[ 3 ];
+
+	for ( int j = 0; j < 3; j++ )
+	{
+		start[ j ] = _mm_set1_ps( tw->start[ j ] );
+		end[ j ] = _mm_set1_ps( tw->end[ j ] );
+		mins[ j ] = _mm_set1_ps( tw->size[ 0 ][ j ] );
+		maxs[ j ] = _mm_set1_ps( tw->size[ 1 ][ j ] );
+	}
+
+	for ( int i = 0; i < brush->numSides; i += 4 )
+	{
+		__m128 normal[ 3 ], offset[ 3 ];
+
+		for ( int j = 0; j < 3; j++ )
+		{
+			normal[ j ] = _mm_loadu_ps( flat->sideNormals[ j ] + brush->firstSide + i );
+
+			// the corner tw->offsets[ signbits ] picks
+			__m128 negative = _mm_cmplt_ps( normal[ j ], zero );
+			offset[ j ] = _mm_or_ps( _mm_and_ps( negative, maxs[ j ] ), _mm_andnot_ps( negative, mins[ j ] ) );
+		}
+
+		__m128 dist = _mm_sub_ps( _mm_loadu_ps( flat->sideDists + brush->firstSide + i ),
+		                          _mm_add_ps( _mm_add_ps( _mm_mul_ps( offset[ 0 ], normal[ 0 ] ), _mm_mul_ps( offset[ 1 ], normal[ 1 ] ) ),
+		                                      _mm_mul_ps( offset[ 2 ], normal[ 2 ] ) ) );
+		__m128 d1 = _mm_sub_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( start[ 0 ], normal[ 0 ] ), _mm_mul_ps( start[ 1 ], normal[ 1 ] ) ),
+		                                    _mm_mul_ps( start[ 2 ], normal[ 2 ] ) ), dist );
+		__m128 d2 = _mm_sub_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( end[ 0 ], normal[ 0 ] ), _mm_mul_ps( end[ 1 ], normal[ 1 ] ) ),
+		                                    _mm_mul_ps( end[ 2 ], normal[ 2 ] ) ), dist );
+
+		__m128 startOut = _mm_cmpgt_ps( d1, zero );
+		__m128 front = _mm_and_ps( startOut, _mm_or_ps( _mm_cmpge_ps( d2, epsilon ), _mm_cmpge_ps( d2, d1 ) ) );
+
+		if ( _mm_movemask_ps( front ) )
+		{
+			return;
+		}
+
+		getout |= _mm_movemask_ps( _mm_cmpgt_ps( d2, zero ) );
+		startout |= _mm_movemask_ps( startOut );
+
+		__m128 behind = _mm_and_ps( _mm_cmple_ps( d1, zero ), _mm_cmple_ps( d2, zero ) );
+		__m128 enters = _mm_cmpgt_ps( d1, d2 );
+		__m128 entering = _mm_andnot_ps( behind, enters );
+		__m128 leaving = _mm_andnot_ps( behind, _mm_andnot_ps( enters, _mm_castsi128_ps( _mm_set1_epi32( -1 ) ) ) );
+
+		// ( d1 -+ SURFACE_CLIP_EPSILON ) / ( d1 - d2 ), as doubles like the scalar code
+		__m128  delta = _mm_sub_ps( d1, d2 );
+		__m128d d1Low = _mm_cvtps_pd( d1 ), d1High = _mm_cvtps_pd( _mm_movehl_ps( d1, d1 ) );
+		__m128d deltaLow = _mm_cvtps_pd( delta ), deltaHigh = _mm_cvtps_pd( _mm_movehl_ps( delta, delta ) );
+
+		__m128 enterF = _mm_movelh_ps( _mm_cvtpd_ps( _mm_div_pd( _mm_sub_pd( d1Low, epsilonD ), deltaLow ) ),
+		                               _mm_cvtpd_ps( _mm_div_pd( _mm_sub_pd( d1High, epsilonD ), deltaHigh ) ) );
+		__m128 leaveF = _mm_movelh_ps( _mm_cvtpd_ps( _mm_div_pd( _mm_add_pd( d1Low, epsilonD ), deltaLow ) ),
+		                               _mm_cvtpd_ps( _mm_div_pd( _mm_add_pd( d1High, epsilonD ), deltaHigh ) ) );
+
+		enterF = _mm_andnot_ps( _mm_cmplt_ps( enterF, zero ), enterF );
+		enterF = _mm_or_ps( _mm_and_ps( entering, enterF ), _mm_andnot_ps( entering, minusOne ) );
+
+		__m128 over = _mm_cmpgt_ps( leaveF, one );
+		leaveF = _mm_or_ps( _mm_and_ps( over, one ), _mm_andnot_ps( over, leaveF ) );
+		leaveF = _mm_or_ps( _mm_and_ps( leaving, leaveF ), _mm_andnot_ps( leaving, one ) );
+
+		__m128 enterMax = _mm_max_ps( enterF, _mm_shuffle_ps( enterF, enterF, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+		enterMax = _mm_max_ps( enterMax, _mm_shuffle_ps( enterMax, enterMax, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+
+		if ( _mm_cvtss_f32( enterMax ) > enterFrac )
+		{
+			enterFrac = _mm_cvtss_f32( enterMax );
+			leadside = i + CM_LowestLane( _mm_movemask_ps( _mm_cmpeq_ps( enterF, enterMax ) ) );
+		}
+
+		__m128 leaveMin = _mm_min_ps( leaveF, _mm_shuffle_ps( leaveF, leaveF, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+		leaveMin = _mm_min_ps( leaveMin, _mm_shuffle_ps( leaveMin, leaveMin, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+		leaveFrac = std::min( leaveFrac, _mm_cvtss_f32( leaveMin ) );
+	}
+
+	CM_ClipToFlatBrush( tw, brush, startout, getout, enterFrac, leaveFrac, leadside );
+}
+#endif
+
+#if idx86_sse >= 2 && defined( __GNUC__ )
+#define CM_AVX 1
+
+/*
+================
+CM_TraceThroughFlatBrushAVX
+================
+*/
+__attribute__(( target( "avx" ) ))
+static void CM_TraceThroughFlatBrushAVX( traceWork_t *tw, const cFlatBrush_t *brush )
+{
+	const cFlatTree_t *flat = &cm.flat;
+	float             enterFrac = -1.0f, leaveFrac = 1.0f;
+	int               getout = 0, startout = 0;
+	int               leadside = -1;
+
+	const __m256  zero = _mm256_setzero_ps();
+	const __m256  one = _mm256_set1_ps( 1.0f );
+	const __m256  minusOne = _mm256_set1_ps( -1.0f );
+	const __m256  epsilon = _mm256_set1_ps( SURFACE_CLIP_EPSILON );
+	const __m256d epsilonD = _mm256_set1_pd( SURFACE_CLIP_EPSILON );
+
+	__m256 start[ 3 ], end[ 3 ], mins[ 3 ], maxs[ 3 ];
+
+	for ( int j = 0; j < 3; j++ )
+	{
+		start[ j ] = _mm256_set1_ps( tw->start[ j ] );
+		end[ j ] = _mm256_set1_ps( tw->end[ j ] );
+		mins[ j ] = _mm256_set1_ps( tw->size[ 0 ][ j ] );
+		maxs[ j ] = _mm256_set1_ps( tw->size[ 1 ][ j ] );
+	}
+
+	for ( int i = 0; i < brush->numSides; i += 8 )
+	{
+		__m256 normal[ 3 ], offset[ 3 ];
+
+		for ( int j = 0; j < 3; j++ )
+		{
+			normal[ j ] = _mm256_loadu_ps( flat->sideNormals[ j ] + brush->firstSide + i );
+
+			// the corner tw->offsets[ signbits ] picks
+			offset[ j ] = _mm256_blendv_ps( mins[ j ], maxs[ j ], _mm256_cmp_ps( normal[ j ], zero, _CMP_LT_OQ ) );
+		}
+
+		__m256 dist = _mm256_sub_ps( _mm256_loadu_ps( flat->sideDists + brush->firstSide + i ),
+		                             _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( offset[ 0 ], normal[ 0 ] ), _mm256_mul_ps( offset[ 1 ], normal[ 1 ] ) ),
+		                                            _mm256_mul_ps( offset[ 2 ], normal[ 2 ] ) ) );
+		__m256 d1 = _mm256_sub_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( start[ 0 ], normal[ 0 ] ), _mm256_mul_ps( start[ 1 ], normal[ 1 ] ) ),
+		                                          _mm256_mul_ps( start[ 2 ], normal[ 2 ] ) ), dist );
+		__m256 d2 = _mm256_sub_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( end[ 0 ], normal[ 0 ] ), _mm256_mul_ps( end[ 1 ], normal[ 1 ] ) ),
+		                                          _mm256_mul_ps( end[ 2 ], normal[ 2 ] ) ), dist );
+
+		__m256 startOut = _mm256_cmp_ps( d1, zero, _CMP_GT_OQ );
+		__m256 front = _mm256_and_ps( startOut, _mm256_or_ps( _mm256_cmp_ps( d2, epsilon, _CMP_GE_OQ ), _mm256_cmp_ps( d2, d1, _CMP_GE_OQ ) ) );
+
+		if ( _mm256_movemask_ps( front ) )
+		{
+			return;
+		}
+
+		getout |= _mm256_movemask_ps( _mm256_cmp_ps( d2, zero, _CMP_GT_OQ ) );
+		startout |= _mm256_movemask_ps( startOut );
+
+		__m256 behind = _mm256_and_ps( _mm256_cmp_ps( d1, zero, _CMP_LE_OQ ), _mm256_cmp_ps( d2, zero, _CMP_LE_OQ ) );
+		__m256 enters = _mm256_cmp_ps( d1, d2, _CMP_GT_OQ );
+		__m256 entering = _mm256_andnot_ps( behind, enters );
+		__m256 leaving = _mm256_andnot_ps( behind, _mm256_cmp_ps( d1, d2, _CMP_NGT_UQ ) );
+
+		// ( d1 -+ SURFACE_CLIP_EPSILON ) / ( d1 - d2 ), as doubles like the scalar code
+		__m256  delta = _mm256_sub_ps( d1, d2 );
+		__m256d d1Low = _mm256_cvtps_pd( _mm256_castps256_ps128( d1 ) ), d1High = _mm256_cvtps_pd( _mm256_extractf128_ps( d1, 1 ) );
+		__m256d deltaLow = _mm256_cvtps_pd( _mm256_castps256_ps128( delta ) ), deltaHigh = _mm256_cvtps_pd( _mm256_extractf128_ps( delta, 1 ) );
+
+		__m256 enterF = _mm256_insertf128_ps( _mm256_castps128_ps256( _mm256_cvtpd_ps( _mm256_div_pd( _mm256_sub_pd( d1Low, epsilonD ), deltaLow ) ) ),
+		                                      _mm256_cvtpd_ps( _mm256_div_pd( _mm256_sub_pd( d1High, epsilonD ), deltaHigh ) ), 1 );
+		__m256 leaveF = _mm256_insertf128_ps( _mm256_castps128_ps256( _mm256_cvtpd_ps( _mm256_div_pd( _mm256_add_pd( d1Low, epsilonD ), deltaLow ) ) ),
+		                                      _mm256_cvtpd_ps( _mm256_div_pd( _mm256_add_pd( d1High, epsilonD ), deltaHigh ) ), 1 );
+
+		enterF = _mm256_blendv_ps( enterF, zero, _mm256_cmp_ps( enterF, zero, _CMP_LT_OQ ) );
+		enterF = _mm256_blendv_ps( minusOne, enterF, entering );
+		leaveF = _mm256_blendv_ps( leaveF, one, _mm256_cmp_ps( leaveF, one, _CMP_GT_OQ ) );
+		leaveF = _mm256_blendv_ps( one, leaveF, leaving );
+
+		__m256 enterMax = _mm256_max_ps( enterF, _mm256_permute2f128_ps( enterF, enterF, 1 ) );
+		enterMax = _mm256_max_ps( enterMax, _mm256_permute_ps( enterMax, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+		enterMax = _mm256_max_ps( enterMax, _mm256_permute_ps( enterMax, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+
+		if ( _mm256_cvtss_f32( enterMax ) > enterFrac )
+		{
+			enterFrac = _mm256_cvtss_f32( enterMax );
+			leadside = i + CM_LowestLane( _mm256_movemask_ps( _mm256_cmp_ps( enterF, enterMax, _CMP_EQ_OQ ) ) );
+		}
+
+		__m256 leaveMin = _mm256_min_ps( leaveF, _mm256_permute2f128_ps( leaveF, leaveF, 1 ) );
+		leaveMin = _mm256_min_ps( leaveMin, _mm256_permute_ps( leaveMin, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+		leaveMin = _mm256_min_ps( leaveMin, _mm256_permute_ps( leaveMin, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+		leaveFrac = std::min( leaveFrac, _mm256_cvtss_f32( leaveMin ) );
+	}
+
+	CM_ClipToFlatBrush( tw, brush, startout, getout, enterFrac, leaveFrac, leadside );
+}
+#endif
+
+enum class brushKernel_t
+{
+	SCALAR,
+	SSE2,
+	AVX
+};
+
+// the widest kernel this processor runs
+static brushKernel_t CM_BestBrushKernel()
+{
+#if defined( CM_AVX )
+	if ( __builtin_cpu_supports( "avx" ) )
+	{
+		return brushKernel_t::AVX;
+	}
+#endif
+
+#if idx86_sse >= 2
+	return brushKernel_t::SSE2;
+#else
+	return brushKernel_t::SCALAR;
+#endif
+}
+
+static const brushKernel_t bestBrushKernel = CM_BestBrushKernel();
+
+// AVX only pays on brushes with more than 4 sides, and converting 8 fractions
+// to double costs about as much, so SSE2 is the default
+static Cvar::Range<Cvar::Cvar<int>> cm_brushKernel(VM_STRING_PREFIX "cm_brushKernel", "widest vector instructions to clip against brush sides with: 0 none, 1 SSE2, 2 AVX", Cvar::NONE, 1, 0, 2);
+
+static void CM_TraceThroughFlatBrushWith( brushKernel_t kernel, traceWork_t *tw, const cFlatBrush_t *brush )
+{
+	switch ( kernel )
+	{
+#if defined( CM_AVX )
+		case brushKernel_t::AVX:
+			CM_TraceThroughFlatBrushAVX( tw, brush );
+			break;
+#endif
+#if idx86_sse >= 2
+		case brushKernel_t::SSE2:
+			CM_TraceThroughFlatBrushSSE2( tw, brush );
+			break;
+#endif
+		default:
+			CM_TraceThroughFlatBrushScalar( tw, brush );
+			break;
+	}
+}
+
+/*
+================
+CM_TraceThroughFlatBrush
+================
+*/
+static void CM_TraceThroughFlatBrush( traceWork_t *tw, const cFlatBrush_t *brush )
+{
+	if ( !brush->numSides )
+	{
+		return;
+	}
+
+	c_brush_traces++;
+
+	brushKernel_t kernel = std::min( bestBrushKernel, Util::enum_cast<brushKernel_t>( cm_brushKernel.Get() ) );
+	CM_TraceThroughFlatBrushWith( kernel, tw, brush );
+}
+
+/*
+================
+CM_TraceThroughFlatLeaf
+================
+*/
+static void CM_TraceThroughFlatLeaf( traceWork_t *tw, int leafnum )
+{
+	const cFlatLeaf_t *leaf = &cm.flat.leafs[ leafnum ];
+	const int         *leafBrushes = cm.flat.leafBrushes + leaf->firstBrush;
+
+	// trace line against all brushes in the leaf, marked by their flat number
+	for ( int k = 0; k < leaf->numBrushes; k++ )
+	{
+		const cFlatBrush_t *b = &cm.flat.brushes[ leafBrushes[ k ] ];
+
+		if ( !CM_VisitBrush( tw, leafBrushes[ k ] ) )
+		{
+			continue; // already checked this brush in another leaf
+		}
+
+		if ( !( b->contents & tw->contents ) )
+		{
+			continue;
+		}
+
+		if ( b->contents & tw->skipContents )
+		{
+			continue;
+		}
+
+		if ( !CM_BoundsIntersect( tw->bounds[ 0 ], tw->bounds[ 1 ], b->bounds[ 0 ], b->bounds[ 1 ] ) )
+		{
+			continue;
+		}
+
+		CM_TraceThroughFlatBrush( tw, b );
+
+		if ( !tw->trace.fraction )
+		{
+			tw->trace.lateralFraction = 0.0f;
+			return;
+		}
+	}
+
+	CM_TraceThroughLeafSurfaces( tw, &cm.leafs[ leafnum ] );
+}
+
+/*
+==================
+CM_TraceThroughFlatTree
+
+CM_TraceThroughTree on the compiled tree
+==================
+*/
+static void CM_TraceThroughFlatTree( traceWork_t *tw, int num, float p1f, float p2f, vec3_t p1, vec3_t p2 )
+{
+	float t1, t2, offset;
+	float frac, frac2;
+	float idist;
+	vec3_t mid;
+	int   side;
+	float midf;
+
+	if ( tw->trace.fraction <= p1f )
+	{
+		return; // already hit something nearer
+	}
+
+	// if < 0, we are in a leaf node
+	if ( num < 0 )
+	{
+		CM_TraceThroughFlatLeaf( tw, -1 - num );
+		return;
+	}
+
+	const cFlatNode_t *node = cm.flat.nodes + num;
+
+	// adjust the plane distance appropriately for mins/maxs
+	if ( node->type < 3 )
+	{
+		t1 = p1[ node->type ] - node->dist;
+		t2 = p2[ node->type ] - node->dist;
+		offset = tw->extents[ node->type ];
+	}
+	else
+	{
+		t1 = DotProduct( node->normal, p1 ) - node->dist;
+		t2 = DotProduct( node->normal, p2 ) - node->dist;
+		offset = tw->isPoint ? 0 : 2048;
+	}
+
+	// see which sides we need to consider
+	if ( t1 >= offset + 1 && t2 >= offset + 1 )
+	{
+		CM_TraceThroughFlatTree( tw, node->children[ 0 ], p1f, p2f, p1, p2 );
+		return;
+	}
+
+	if ( t1 < -offset - 1 && t2 < -offset - 1 )
+	{
+		CM_TraceThroughFlatTree( tw, node->children[ 1 ], p1f, p2f, p1, p2 );
+		return;
+	}
+
+	// put the crosspoint SURFACE_CLIP_EPSILON pixels on the near side
+	if ( t1 < t2 )
+	{
+		idist = 1.0 / ( t1 - t2 );
+		side = 1;
+		frac2 = ( t1 + offset + SURFACE_CLIP_EPSILON ) * idist;
+		frac = ( t1 - offset + SURFACE_CLIP_EPSILON ) * idist;
+	}
+	else if ( t1 > t2 )
+	{
+		idist = 1.0 / ( t1 - t2 );
+		side = 0;
+		frac2 = ( t1 - offset - SURFACE_CLIP_EPSILON ) * idist;
+		frac = ( t1 + offset + SURFACE_CLIP_EPSILON ) * idist;
+	}
+	else
+	{
+		side = 0;
+		frac = 1;
+		frac2 = 0;
+	}
+
+	// move up to the node
+	if ( frac < 0 )
+	{
+		frac = 0;
+	}
+
+	if ( frac > 1 )
+	{
+		frac = 1;
+	}
+
+	midf = p1f + ( p2f - p1f ) * frac;
+
+	mid[ 0 ] = p1[ 0 ] + frac * ( p2[ 0 ] - p1[ 0 ] );
+	mid[ 1 ] = p1[ 1 ] + frac * ( p2[ 1 ] - p1[ 1 ] );
+	mid[ 2 ] = p1[ 2 ] + frac * ( p2[ 2 ] - p1[ 2 ] );
+
+	CM_TraceThroughFlatTree( tw, node->children[ side ], p1f, midf, p1, mid );
+
+	// go past the node
+	if ( frac2 < 0 )
+	{
+		frac2 = 0;
+	}
+
+	if ( frac2 > 1 )
+	{
+		frac2 = 1;
+	}
+
+	midf = p1f + ( p2f - p1f ) * frac2;
+
+	mid[ 0 ] = p1[ 0 ] + frac2 * ( p2[ 0 ] - p1[ 0 ] );
+	mid[ 1 ] = p1[ 1 ] + frac2 * ( p2[ 1 ] - p1[ 1 ] );
+	mid[ 2 ] = p1[ 2 ] + frac2 * ( p2[ 2 ] - p1[ 2 ] );
+
+	CM_TraceThroughFlatTree( tw, node->children[ side ^ 1 ], midf, p2f, mid, p2 );
+}
+
+/*
+==================
+CM_TraceThroughWorld
+
+Sweeps through the world tree, the compiled one when it can
+==================
+*/
+static void CM_TraceThroughWorld( traceWork_t *tw )
+{
+	if ( cm.flat.nodes && cm_flatTree.Get() && tw->type != traceType_t::TT_CAPSULE
+	     && tw->type != traceType_t::TT_BISPHERE && !tw->testLateralCollision )
+	{
+		CM_TraceThroughFlatTree( tw, 0, 0, 1, tw->start, tw->end );
+	}
+	else
+	{
+		CM_TraceThroughTree( tw, 0, 0, 1, tw->start, tw->end );
+	}
+}
+
+//======================================================================
+
+/*
+==================
+CM_InitTraceWork
+
+Fills in everything the sweep and position tests need, returns false if
+there is no map to trace through
+==================
+*/
+static bool CM_InitTraceWork( traceWork_t *tw, const vec3_t start, const vec3_t end, const vec3_t mins,
+                              const vec3_t maxs, const vec3_t origin, int brushmask, int skipmask,
+                              traceType_t type, sphere_t *sphere )
+{
+	int    i;
+	vec3_t offset;
+
+	// fill in a default trace
+	Com_Memset( tw, 0, sizeof( *tw ) );
+	tw->trace.fraction = 1; // assume it goes the entire distance until shown otherwise
+	VectorCopy( origin, tw->modelOrigin );
+	tw->type = type;
+
+	if ( !cm.numNodes )
+	{
+		return false; // map not loaded, shouldn't happen
+	}
+
+	CM_BeginVisits( tw );
+
+	// allow nullptr to be passed in for 0,0,0
+	if ( !mins )
+	{
+		mins = vec3_origin;
+	}
+
+	if ( !maxs )
+	{
+		maxs = vec3_origin;
+	}
+
+	// set basic parms
+	tw->contents = brushmask;
+	tw->skipContents = skipmask;
+
+	// adjust so that mins and maxs are always symmetric, which
+	// avoids some complications with plane expanding of rotated
+	// bmodels
+	for ( i = 0; i < 3; i++ )
+	{
+		offset[ i ] = ( mins[ i ] + maxs[ i ] ) * 0.5;
+		tw->size[ 0 ][ i ] = mins[ i ] - offset[ i ];
+		tw->size[ 1 ][ i ] = maxs[ i ] - offset[ i ];
+		tw->start[ i ] = start[ i ] + offset[ i ];
+		tw->end[ i ] = end[ i ] + offset[ i ];
+	}
+
+	// if a sphere is already specified
+	if ( sphere )
+	{
+		tw->sphere = *sphere;
+	}
+	else
+	{
+		tw->sphere.radius = ( tw->size[ 1 ][ 0 ] > tw->size[ 1 ][ 2 ] ) ? tw->size[ 1 ][ 2 ] : tw->size[ 1 ][ 0 ];
+		tw->sphere.halfheight = tw->size[ 1 ][ 2 ];
+		VectorSet( tw->sphere.offset, 0, 0, tw->size[ 1 ][ 2 ] - tw->sphere.radius );
+	}
+
+	tw->maxOffset = tw->size[ 1 ][ 0 ] + tw->size[ 1 ][ 1 ] + tw->size[ 1 ][ 2 ];
+
+	// tw->offsets[signbits] = vector to appropriate corner from origin
+	tw->offsets[ 0 ][ 0 ] = tw->size[ 0 ][ 0 ];
+	tw->offsets[ 0 ][ 1 ] = tw->size[ 0 ][ 1 ];
+	tw->offsets[ 0 ][ 2 ] = tw->size[ 0 ][ 2 ];
+
+	tw->offsets[ 1 ][ 0 ] = tw->size[ 1 ][ 0 ];
+	tw->offsets[ 1 ][ 1 ] = tw->size[ 0 ][ 1 ];
+	tw->offsets[ 1 ][ 2 ] = tw->size[ 0 ][ 2 ];
+
+	tw->offsets[ 2 ][ 0 ] = tw->size[ 0 ][ 0 ];
+	tw->offsets[ 2 ][ 1 ] = tw->size[ 1 ][ 1 ];
+	tw->offsets[ 2 ][ 2 ] = tw->size[ 0 ][ 2 ];
+
+	tw->offsets[ 3 ][ 0 ] = tw->size[ 1 ][ 0 ];
+	tw->offsets[ 3 ][ 1 ] = tw->size[ 1 ][ 1 ];
+	tw->offsets[ 3 ][ 2 ] = tw->size[ 0 ][ 2 ];
+
+	tw->offsets[ 4 ][ 0 ] = tw->size[ 0 ][ 0 ];
+	tw->offsets[ 4 ][ 1 ] = tw->size[ 0 ][ 1 ];
+	tw->offsets[ 4 ][ 2 ] = tw->size[ 1 ][ 2 ];
+
+	tw->offsets[ 5 ][ 0 ] = tw->size[ 1 ][ 0 ];
+	tw->offsets[ 5 ][ 1 ] = tw->size[ 0 ][ 1 ];
+	tw->offsets[ 5 ][ 2 ] = tw->size[ 1 ][ 2 ];
+
+	tw->offsets[ 6 ][ 0 ] = tw->size[ 0 ][ 0 ];
+	tw->offsets[ 6 ][ 1 ] = tw->size[ 1 ][ 1 ];
+	tw->offsets[ 6 ][ 2 ] = tw->size[ 1 ][ 2 ];
+
+	tw->offsets[ 7 ][ 0 ] = tw->size[ 1 ][ 0 ];
+	tw->offsets[ 7 ][ 1 ] = tw->size[ 1 ][ 1 ];
+	tw->offsets[ 7 ][ 2 ] = tw->size[ 1 ][ 2 ];
+
+	//
+	// calculate bounds
+	//
+	if ( tw->type == traceType_t::TT_CAPSULE )
+	{
+		for ( i = 0; i < 3; i++ )
+		{
+			if ( tw->start[ i ] < tw->end[ i ] )
+			{
+				tw->bounds[ 0 ][ i ] = tw->start[ i ] - fabs( tw->sphere.offset[ i ] ) - tw->sphere.radius;
+				tw->bounds[ 1 ][ i ] = tw->end[ i ] + fabs( tw->sphere.offset[ i ] ) + tw->sphere.radius;
+			}
+			else
+			{
+				tw->bounds[ 0 ][ i ] = tw->end[ i ] - fabs( tw->sphere.offset[ i ] ) - tw->sphere.radius;
+				tw->bounds[ 1 ][ i ] = tw->start[ i ] + fabs( tw->sphere.offset[ i ] ) + tw->sphere.radius;
+			}
+		}
+	}
+	else
+	{
+		for ( i = 0; i < 3; i++ )
+		{
+			if ( tw->start[ i ] < tw->end[ i ] )
+			{
+				tw->bounds[ 0 ][ i ] = tw->start[ i ] + tw->size[ 0 ][ i ];
+				tw->bounds[ 1 ][ i ] = tw->end[ i ] + tw->size[ 1 ][ i ];
+			}
+			else
+			{
+				tw->bounds[ 0 ][ i ] = tw->end[ i ] + tw->size[ 0 ][ i ];
+				tw->bounds[ 1 ][ i ] = tw->start[ i ] + tw->size[ 1 ][ i ];
+			}
+		}
+	}
+
+	//
+	// check for point special case, sweeps only
+	//
+	if ( !VectorCompare( start, end ) )
+	{
+		if ( tw->size[ 0 ][ 0 ] == 0 && tw->size[ 0 ][ 1 ] == 0 && tw->size[ 0 ][ 2 ] == 0 )
+		{
+			tw->isPoint = true;
+			VectorClear( tw->extents );
+		}
+		else
+		{
+			tw->isPoint = false;
+			tw->extents[ 0 ] = tw->size[ 1 ][ 0 ];
+			tw->extents[ 1 ] = tw->size[ 1 ][ 1 ];
+			tw->extents[ 2 ] = tw->size[ 1 ][ 2 ];
+		}
+	}
+
+	return true;
+}
+
+/*
+==================
+CM_FinishTrace
+==================
+*/
+static void CM_FinishTrace( trace_t *results, traceWork_t *tw, const vec3_t start, const vec3_t end )
+{
+	// generate endpos from the original, unmodified start/end
+	if ( tw->trace.fraction == 1 )
+	{
+		VectorCopy( end, tw->trace.endpos );
+	}
+	else
+	{
+		VectorLerp( start, end, tw->trace.fraction, tw->trace.endpos );
+	}
+
+	*results = tw->trace;
+}
+
+/*
+==================
+CM_Trace
+==================
+*/
+static void CM_Trace( trace_t *results, const vec3_t start, const vec3_t end, const vec3_t mins,
+                      const vec3_t maxs, clipHandle_t model, const vec3_t origin, int brushmask,
+                      int skipmask, traceType_t type, sphere_t *sphere )
+{
+	traceWork_t tw;
+	cmodel_t    *cmod;
+
+	cmod = CM_ClipHandleToModel( model );
+
+	c_traces++; // for statistics, may be zeroed
+
+	if ( !CM_InitTraceWork( &tw, start, end, mins, maxs, origin, brushmask, skipmask, type, sphere ) )
+	{
+		*results = tw.trace;
+
+		return;
+	}
+
+	//
+	// check for position test special case
+	//
+	if ( start[ 0 ] == end[ 0 ] && start[ 1 ] == end[ 1 ] && start[ 2 ] == end[ 2 ] )
+	{
+		if ( model )
+		{
+#ifdef ALWAYS_BBOX_VS_BBOX // FIXME - compile time flag?
+
+			if ( model == BOX_MODEL_HANDLE || model == CAPSULE_MODEL_HANDLE )
+			{
+				tw.type = TT_AABB;
+				CM_TestInLeaf( &tw, &cmod->leaf );
+			}
+			else
+#elif defined( ALWAYS_CAPSULE_VS_CAPSULE )
+			if ( model == BOX_MODEL_HANDLE || model == CAPSULE_MODEL_HANDLE )
+			{
+				CM_TestCapsuleInCapsule( &tw, model );
+			}
+			else
+#endif
+				if ( model == CAPSULE_MODEL_HANDLE )
+				{
+					if ( tw.type == traceType_t::TT_CAPSULE )
+					{
+						CM_TestCapsuleInCapsule( &tw, model );
+					}
+					else
+					{
+						CM_TestBoundingBoxInCapsule( &tw, model );
+					}
+				}
+				else
+				{
+					CM_TestInLeaf( &tw, &cmod->leaf );
+				}
+		}
+		else
+		{
+			CM_PositionTest( &tw );
+		}
+	}
+	else
+	{
+		//
+		// general sweeping through world
+		//
+		if ( model )
+		{
+#ifdef ALWAYS_BBOX_VS_BBOX
+
+			if ( model == BOX_MODEL_HANDLE || model == CAPSULE_MODEL_HANDLE )
+			{
+				tw.type = TT_AABB;
+				CM_TraceThroughLeaf( &tw, &cmod->leaf );
+			}
+			else
+#elif defined( ALWAYS_CAPSULE_VS_CAPSULE )
+			if ( model == BOX_MODEL_HANDLE || model == CAPSULE_MODEL_HANDLE )
+			{
+				CM_TraceCapsuleThroughCapsule( &tw, model );
+			}
+			else
+#endif
+				if ( model == CAPSULE_MODEL_HANDLE )
+				{
+					if ( tw.type == traceType_t::TT_CAPSULE )
+					{
+						CM_TraceCapsuleThroughCapsule( &tw, model );
+					}
+					else
+					{
+						CM_TraceBoundingBoxThroughCapsule( &tw, model );
+					}
+				}
+				else
+				{
+					CM_TraceThroughLeaf( &tw, &cmod->leaf );
+				}
+		}
+		else
+		{
+			CM_TraceThroughWorld( &tw );
+		}
+	}
+
+	CM_FinishTrace( results, &tw, start, end );
+}
+
+/*
+===============================================================================
+
+TRACE RECORDING
+
+===============================================================================
+*/
+
+static const char TRACE_RECORD_MAGIC[ 4 ] = { 'C', 'M', 'T', 'R' };
+
+// the arguments of a CM_BoxTrace call, as written by cm_traceRecord
+struct traceRecord_t
+{
+	cmBoxTrace_t trace;
+	int          model;
+	int          brushmask;
+	int          skipmask;
+	int          type;
+};
+
+static FS::File traceRecordFile;
+static int      traceRecordCount;
+
+static void CM_RecordTrace( const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs,
+                            clipHandle_t model, int brushmask, int skipmask, traceType_t type )
+{
+	traceRecord_t record;
+
+	VectorCopy( start, record.trace.start );
+	VectorCopy( end, record.trace.end );
+	VectorCopy( mins ? mins : vec3_origin, record.trace.mins );
+	VectorCopy( maxs ? maxs : vec3_origin, record.trace.maxs );
+	record.model = model;
+	record.brushmask = brushmask;
+	record.skipmask = skipmask;
+	record.type = Util::ordinal( type );
+
+	std::error_code err;
+	traceRecordFile.Write( &record, sizeof( record ), err );
+
+	if ( err )
+	{
+		Log::Warn( "Stopped recording the traces: %s", err.message() );
+		traceRecordFile.Close( err );
+		return;
+	}
+
+	traceRecordCount++;
+}
+
+class TraceRecordCmd : public Cmd::StaticCmd
+{
+public:
+	TraceRecordCmd()
+		: Cmd::StaticCmd(VM_STRING_PREFIX "cm_traceRecord", Cmd::SYSTEM, "records the box traces in a file for cm_traceReplay, or stops") {}
+
+	void Run(const Cmd::Args& args) const override
+	{
+		if (args.Argc() > 2) {
+			PrintUsage(args, "[<file>]", "starts recording, or stops without a file");
+			return;
+		}
+
+		if (traceRecordFile) {
+			std::error_code err;
+			traceRecordFile.Close(err);
+			Print("Recorded %d traces", traceRecordCount);
+		}
+
+		if (args.Argc() == 1) {
+			return;
+		}
+
+		try {
+			traceRecordFile = FS::HomePath::OpenWrite(args.Argv(1));
+			traceRecordFile.Write(TRACE_RECORD_MAGIC, sizeof(TRACE_RECORD_MAGIC));
+			traceRecordCount = 0;
+		} catch (std::system_error& err) {
+			Print("Couldn't write %s: %s", args.Argv(1), err.what());
+			traceRecordFile = FS::File();
+		}
+	}
+};
+static TraceRecordCmd TraceRecordCmdRegistration;
+
+/*
+==================
+CM_BoxTrace
+==================
+*/
+void CM_BoxTrace( trace_t *results, const vec3_t start, const vec3_t end, vec3_t mins, vec3_t maxs,
+                  clipHandle_t model, int brushmask, int skipmask, traceType_t type )
+{
+	if ( traceRecordFile )
+	{
+		CM_RecordTrace( start, end, mins, maxs, model, brushmask, skipmask, type );
+	}
+
+	CM_Trace( results, start, end, mins, maxs, model, vec3_origin, brushmask, skipmask, type, nullptr );
+}
+
+/*
+===============================================================================
+
+BATCHED TRACES
+
+===============================================================================
+*/
+
+static const int   MAX_BATCH_GROUP = 32; // sweeps sharing a walk of the tree
+static const float MAX_BATCH_SPREAD = 1024.0f; // largest box around them
+static const int   MAX_BATCH_LEAFS = 1024;
+
+struct traceBatch_t
+{
+	traceWork_t tw[ MAX_BATCH_GROUP ];
+	int         traceNums[ MAX_BATCH_GROUP ];
+	int         count;
+	vec3_t      bounds[ 2 ];
+
+	int         leafs[ MAX_BATCH_LEAFS ];
+	std::vector<cbrush_t *>   brushes;
+	std::vector<cSurface_t *> surfaces;
+};
+
+/*
+==================
+CM_TraceBatchGroup
+
+Walks the tree once for the box around all the sweeps of the group, then
+clips each sweep against the brushes and surfaces found there that its own
+box touches. The results are those of CM_Trace, but for which brush side is
+reported when two are hit at exactly the same fraction.
+==================
+*/
+static void CM_TraceBatchGroup( traceBatch_t *batch, trace_t *results, const cmBoxTrace_t *traces )
+{
+	leafList_t ll;
+
+	// the tree walk of a sweep keeps to 1 unit around its box
+	for ( int i = 0; i < 3; i++ )
+	{
+		ll.bounds[ 0 ][ i ] = batch->bounds[ 0 ][ i ] - 1;
+		ll.bounds[ 1 ][ i ] = batch->bounds[ 1 ][ i ] + 1;
+	}
+
+	ll.count = 0;
+	ll.maxcount = MAX_BATCH_LEAFS;
+	ll.list = batch->leafs;
+	ll.storeLeafs = CM_StoreLeafs;
+	ll.lastLeaf = 0;
+	ll.overflowed = false;
+
+	if ( batch->count > 1 )
+	{
+		CM_BoxLeafnums_r( &ll, 0 );
+	}
+
+	if ( batch->count == 1 || ll.overflowed )
+	{
+		for ( int i = 0; i < batch->count; i++ )
+		{
+			traceWork_t        *tw = &batch->tw[ i ];
+			const cmBoxTrace_t *trace = &traces[ batch->traceNums[ i ] ];
+
+			c_traces++;
+			CM_TraceThroughWorld( tw );
+			CM_FinishTrace( &results[ batch->traceNums[ i ] ], tw, trace->start, trace->end );
+		}
+
+		return;
+	}
+
+	// everything the group may hit, once each, with marks of its own
+	const traceWork_t *first = &batch->tw[ 0 ];
+	traceWork_t       collect;
+
+	CM_BeginVisits( &collect );
+	batch->brushes.clear();
+	batch->surfaces.clear();
+
+	for ( int i = 0; i < ll.count; i++ )
+	{
+		const cLeaf_t *leaf = &cm.leafs[ batch->leafs[ i ] ];
+
+		for ( int k = 0; k < leaf->numLeafBrushes; k++ )
+		{
+			cbrush_t *b = &cm.brushes[ leaf->firstLeafBrush[ k ] ];
+
+			if ( !CM_VisitBrush( &collect, leaf->firstLeafBrush[ k ] ) )
+			{
+				continue;
+			}
+
+			if ( !( b->contents & first->contents ) || ( b->contents & first->skipContents ) )
+			{
+				continue;
+			}
+
+			if ( CM_BoundsIntersect( batch->bounds[ 0 ], batch->bounds[ 1 ], b->bounds[ 0 ], b->bounds[ 1 ] ) )
+			{
+				batch->brushes.push_back( b );
+			}
+		}
+
+		for ( int k = 0; k < leaf->numLeafSurfaces; k++ )
+		{
+			cSurface_t *surface = cm.surfaces[ leaf->firstLeafSurface[ k ] ];
+
+			if ( !surface || !CM_VisitSurface( &collect, leaf->firstLeafSurface[ k ] ) )
+			{
+				continue;
+			}
+
+			if ( !( surface->contents & first->contents ) || ( surface->contents & first->skipContents ) )
+			{
+				continue;
+			}
+
+			if ( CM_BoundsIntersect( batch->bounds[ 0 ], batch->bounds[ 1 ], surface->sc->bounds[ 0 ], surface->sc->bounds[ 1 ] ) )
+			{
+				batch->surfaces.push_back( surface );
+			}
+		}
+	}
+
+	for ( int i = 0; i < batch->count; i++ )
+	{
+		traceWork_t        *tw = &batch->tw[ i ];
+		const cmBoxTrace_t *trace = &traces[ batch->traceNums[ i ] ];
+
+		c_traces++;
+
+		for ( cbrush_t *b : batch->brushes )
+		{
+			if ( !tw->trace.fraction )
+			{
+				break;
+			}
+
+			if ( CM_BoundsIntersect( tw->bounds[ 0 ], tw->bounds[ 1 ], b->bounds[ 0 ], b->bounds[ 1 ] ) )
+			{
+				CM_TraceThroughBrush( tw, b );
+			}
+		}
+
+		for ( cSurface_t *surface : batch->surfaces )
+		{
+			if ( !tw->trace.fraction )
+			{
+				break;
+			}
+
+			if ( CM_BoundsIntersect( tw->bounds[ 0 ], tw->bounds[ 1 ], surface->sc->bounds[ 0 ], surface->sc->bounds[ 1 ] ) )
+			{
+				CM_TraceThroughSurface( tw, surface );
+			}
+		}
+
+		if ( !tw->trace.fraction )
+		{
+			tw->trace.lateralFraction = 0.0f;
+		}
+
+		CM_FinishTrace( &results[ batch->traceNums[ i ] ], tw, trace->start, trace->end );
+	}
+}
+
+/*
+==================
+CM_BoxTraceBatch
+
+CM_BoxTrace for many traces with the same model and masks, such as the ones
+of the bots or of a shotgun. Sweeps through the world close to each other
+are grouped so that they walk the tree together.
+==================
+*/
+void CM_BoxTraceBatch( trace_t *results, const cmBoxTrace_t *traces, int numTraces, clipHandle_t model,
+                       int brushmask, int skipmask, traceType_t type )
+{
+	if ( model || !cm.numNodes )
+	{
+		// only the world has a tree to share
+		for ( int i = 0; i < numTraces; i++ )
+		{
+			CM_Trace( &results[ i ], traces[ i ].start, traces[ i ].end, traces[ i ].mins, traces[ i ].maxs,
+			          model, vec3_origin, brushmask, skipmask, type, nullptr );
+		}
+
+		return;
+	}
+
+#ifndef __native_client__
+	thread_local
+#endif
+	static traceBatch_t batch;
+	int i = 0;
+
+	while ( i < numTraces )
+	{
+		batch.count = 0;
+
+		for ( ; i < numTraces && batch.count < MAX_BATCH_GROUP; i++ )
+		{
+			const cmBoxTrace_t *trace = &traces[ i ];
+
+			if ( VectorCompare( trace->start, trace->end ) )
+			{
+				// position tests don't walk the tree
+				CM_Trace( &results[ i ], trace->start, trace->end, trace->mins, trace->maxs,
+				          model, vec3_origin, brushmask, skipmask, type, nullptr );
+				continue;
+			}
+
+			traceWork_t *tw = &batch.tw[ batch.count ];
+			vec3_t      bounds[ 2 ];
+
+			CM_InitTraceWork( tw, trace->start, trace->end, trace->mins, trace->maxs, vec3_origin,
+			                  brushmask, skipmask, type, nullptr );
+
+			if ( !batch.count )
+			{
+				VectorCopy( tw->bounds[ 0 ], batch.bounds[ 0 ] );
+				VectorCopy( tw->bounds[ 1 ], batch.bounds[ 1 ] );
+			}
+			else
+			{
+				VectorMin( batch.bounds[ 0 ], tw->bounds[ 0 ], bounds[ 0 ] );
+				VectorMax( batch.bounds[ 1 ], tw->bounds[ 1 ], bounds[ 1 ] );
+
+				if ( bounds[ 1 ][ 0 ] - bounds[ 0 ][ 0 ] > MAX_BATCH_SPREAD ||
+				     bounds[ 1 ][ 1 ] - bounds[ 0 ][ 1 ] > MAX_BATCH_SPREAD ||
+				     bounds[ 1 ][ 2 ] - bounds[ 0 ][ 2 ] > MAX_BATCH_SPREAD )
+				{
+					break; // starts the next group
+				}
+
+				VectorCopy( bounds[ 0 ], batch.bounds[ 0 ] );
+				VectorCopy( bounds[ 1 ], batch.bounds[ 1 ] );
+			}
+
+			batch.traceNums[ batch.count++ ] = i;
+		}
+
+		if ( batch.count )
+		{
+			CM_TraceBatchGroup( &batch, results, traces );
+		}
+	}
+}
+
+// reads a recording of cm_traceRecord, returns an error message on failure
+static std::string CM_ReadTraceRecording( Str::StringRef path, std::vector<traceRecord_t> &records )
+{
+	std::string data;
+
+	try
+	{
+		data = FS::HomePath::OpenRead( path ).ReadAll();
+	}
+	catch ( std::system_error &err )
+	{
+		return Str::Format( "Couldn't read %s: %s", path, err.what() );
+	}
+
+	if ( data.size() < sizeof( TRACE_RECORD_MAGIC ) || memcmp( data.data(), TRACE_RECORD_MAGIC, sizeof( TRACE_RECORD_MAGIC ) )
+	     || ( data.size() - sizeof( TRACE_RECORD_MAGIC ) ) % sizeof( traceRecord_t ) )
+	{
+		return Str::Format( "%s is not a trace recording", path );
+	}
+
+	records.resize( ( data.size() - sizeof( TRACE_RECORD_MAGIC ) ) / sizeof( traceRecord_t ) );
+	memcpy( records.data(), data.data() + sizeof( TRACE_RECORD_MAGIC ), records.size() * sizeof( traceRecord_t ) );
+
+	return "";
+}
+
+static void CM_ReplayTrace( const traceRecord_t &r, trace_t *result )
+{
+	CM_Trace( result, r.trace.start, r.trace.end, r.trace.mins, r.trace.maxs, r.model, vec3_origin,
+	          r.brushmask, r.skipmask, Util::enum_cast<traceType_t>( r.type ), nullptr );
+}
+
+// replays the traces one by one, from the given one on and wrapping around
+static void CM_ReplayTraces( const std::vector<traceRecord_t> &records, trace_t *results, int first )
+{
+	int numTraces = records.size();
+
+	for ( int n = 0; n < numTraces; n++ )
+	{
+		int i = ( first + n ) % numTraces;
+		CM_ReplayTrace( records[ i ], &results[ i ] );
+	}
+}
 
-	tw.offsets[ 6 ][ 0 ] = tw.size[ 0 ][ 0 ];
-	tw.offsets[ 6 ][ 1 ] = tw.size[ 1 ][ 1 ];
-	tw.offsets[ 6 ][ 2 ] = tw.size[ 1 ][ 2 ];
+#if idx86_sse >= 2
+static void CM_FlushRange( const void *data, size_t size )
+{
+	const char *p = static_cast<const char *>( data );
 
-	tw.offsets[ 7 ][ 0 ] = tw.size[ 1 ][ 0 ];
-	tw.offsets[ 7 ][ 1 ] = tw.size[ 1 ][ 1 ];
-	tw.offsets[ 7 ][ 2 ] = tw.size[ 1 ][ 2 ];
+	for ( size_t offset = 0; offset < size; offset += 64 )
+	{
+		_mm_clflush( p + offset );
+	}
+}
 
-	//
-	// calculate bounds
-	//
-	if ( tw.type == traceType_t::TT_CAPSULE )
+// evicts what the box sweeps read from the caches, in both layouts
+static void CM_FlushCollisionData( const cFlatNode_t *flatNodes )
+{
+	CM_FlushRange( cm.nodes, cm.numNodes * sizeof( *cm.nodes ) );
+	CM_FlushRange( cm.planes, cm.numPlanes * sizeof( *cm.planes ) );
+	CM_FlushRange( cm.leafs, cm.numLeafs * sizeof( *cm.leafs ) );
+	CM_FlushRange( cm.leafbrushes, cm.numLeafBrushes * sizeof( *cm.leafbrushes ) );
+	CM_FlushRange( cm.leafsurfaces, cm.numLeafSurfaces * sizeof( *cm.leafsurfaces ) );
+	CM_FlushRange( cm.brushes, cm.numBrushes * sizeof( *cm.brushes ) );
+	CM_FlushRange( cm.brushsides, cm.numBrushSides * sizeof( *cm.brushsides ) );
+	CM_FlushRange( flatNodes, cm.flat.size );
+	_mm_mfence();
+}
+#endif
+
+// replays the runs of traces with the same model and masks batched
+static void CM_ReplayTracesBatched( const std::vector<traceRecord_t> &records, const cmBoxTrace_t *traces, trace_t *results )
+{
+	int numTraces = records.size();
+
+	for ( int i = 0, next; i < numTraces; i = next )
 	{
-		for ( i = 0; i < 3; i++ )
-		{
-			if ( tw.start[ i ] < tw.end[ i ] )
-			{
-				tw.bounds[ 0 ][ i ] = tw.start[ i ] - fabs( tw.sphere.offset[ i ] ) - tw.sphere.radius;
-				tw.bounds[ 1 ][ i ] = tw.end[ i ] + fabs( tw.sphere.offset[ i ] ) + tw.sphere.radius;
-			}
-			else
-			{
-				tw.bounds[ 0 ][ i ] = tw.end[ i ] - fabs( tw.sphere.offset[ i ] ) - tw.sphere.radius;
-				tw.bounds[ 1 ][ i ] = tw.start[ i ] + fabs( tw.sphere.offset[ i ] ) + tw.sphere.radius;
-			}
-		}
+		const traceRecord_t &r = records[ i ];
+
+		for ( next = i + 1; next < numTraces && records[ next ].model == r.model && records[ next ].brushmask == r.brushmask
+		      && records[ next ].skipmask == r.skipmask && records[ next ].type == r.type; next++ ) {}
+
+		CM_BoxTraceBatch( &results[ i ], &traces[ i ], next - i, r.model, r.brushmask, r.skipmask,
+		                  Util::enum_cast<traceType_t>( r.type ) );
 	}
-	else
+}
+
+static bool CM_SameTrace( const trace_t &a, const trace_t &b )
+{
+	return a.allsolid == b.allsolid && a.startsolid == b.startsolid && a.fraction == b.fraction
+	       && VectorCompare( a.endpos, b.endpos ) && VectorCompare( a.plane.normal, b.plane.normal )
+	       && a.plane.dist == b.plane.dist && a.surfaceFlags == b.surfaceFlags && a.contents == b.contents
+	       && a.lateralFraction == b.lateralFraction;
+}
+
+class TraceReplayCmd : public Cmd::StaticCmd
+{
+public:
+	TraceReplayCmd()
+		: Cmd::StaticCmd(VM_STRING_PREFIX "cm_traceReplay", Cmd::SYSTEM, "replays recorded traces one by one and batched on the current map, comparing and timing both") {}
+
+	void Run(const Cmd::Args& args) const override
 	{
-		for ( i = 0; i < 3; i++ )
-		{
-			if ( tw.start[ i ] < tw.end[ i ] )
-			{
-				tw.bounds[ 0 ][ i ] = tw.start[ i ] + tw.size[ 0 ][ i ];
-				tw.bounds[ 1 ][ i ] = tw.end[ i ] + tw.size[ 1 ][ i ];
-			}
-			else
-			{
-				tw.bounds[ 0 ][ i ] = tw.end[ i ] + tw.size[ 0 ][ i ];
-				tw.bounds[ 1 ][ i ] = tw.start[ i ] + tw.size[ 1 ][ i ];
+		int iterations = 10;
+
+		if (args.Argc() < 2 || args.Argc() > 3 || (args.Argc() == 3 && (!Str::ParseInt(iterations, args.Argv(2)) || iterations <= 0))) {
+			PrintUsage(args, "<file> [<iterations>]", "");
+			return;
+		}
+
+		if (!cm.numNodes) {
+			Print("No map loaded");
+			return;
+		}
+
+		std::vector<traceRecord_t> records;
+		std::string error = CM_ReadTraceRecording(args.Argv(1), records);
+
+		if (!error.empty()) {
+			Print(error);
+			return;
+		}
+
+		int numTraces = records.size();
+		std::vector<cmBoxTrace_t> traces(numTraces);
+		std::vector<trace_t> single(numTraces), batched(numTraces);
+
+		for (int i = 0; i < numTraces; i++) {
+			traces[i] = records[i].trace;
+		}
+
+		Sys::SteadyClock::duration singleTime{}, batchedTime{};
+
+		for (int it = 0; it < iterations; it++) {
+			auto start = Sys::SteadyClock::now();
+			CM_ReplayTraces(records, single.data(), 0);
+			auto middle = Sys::SteadyClock::now();
+			CM_ReplayTracesBatched(records, traces.data(), batched.data());
+
+			singleTime += middle - start;
+			batchedTime += Sys::SteadyClock::now() - middle;
+		}
+
+		int differ = 0, tied = 0;
+
+		for (int i = 0; i < numTraces; i++) {
+			const trace_t& a = single[i];
+			const trace_t& b = batched[i];
+
+			if (a.fraction != b.fraction || !VectorCompare(a.endpos, b.endpos) || a.startsolid != b.startsolid
+			    || a.allsolid != b.allsolid) {
+				differ++;
+			} else if (!VectorCompare(a.plane.normal, b.plane.normal) || a.surfaceFlags != b.surfaceFlags || a.contents != b.contents) {
+				tied++;
 			}
 		}
-	}
 
-	//
-	// check for position test special case
-	//
-	if ( start[ 0 ] == end[ 0 ] && start[ 1 ] == end[ 1 ] && start[ 2 ] == end[ 2 ] )
-	{
-		if ( model )
-		{
-#ifdef ALWAYS_BBOX_VS_BBOX // FIXME - compile time flag?
+		auto perTrace = [&](Sys::SteadyClock::duration time) {
+			return std::chrono::duration<double, std::nano>(time).count() / iterations / std::max(numTraces, 1);
+		};
 
-			if ( model == BOX_MODEL_HANDLE || model == CAPSULE_MODEL_HANDLE )
-			{
-				tw.type = TT_AABB;
-				CM_TestInLeaf( &tw, &cmod->leaf );
+		Print("%d traces: %d differ, %d hit another brush at the same fraction", numTraces, differ, tied);
+		Print("one by one %.1f ns/trace, batched %.1f ns/trace", perTrace(singleTime), perTrace(batchedTime));
+
+		if (!cm.flat.nodes || !cm_flatTree.Get()) {
+			return;
+		}
+
+		// the same traces through the tree as loaded, which they take without the compiled one
+		cFlatNode_t* flatNodes = cm.flat.nodes;
+		std::vector<trace_t> tree(numTraces);
+		Sys::SteadyClock::duration treeTime{};
+
+		cm.flat.nodes = nullptr;
+
+		for (int it = 0; it < iterations; it++) {
+			auto start = Sys::SteadyClock::now();
+			CM_ReplayTraces(records, tree.data(), 0);
+			treeTime += Sys::SteadyClock::now() - start;
+		}
+
+		cm.flat.nodes = flatNodes;
+
+		differ = 0;
+
+		for (int i = 0; i < numTraces; i++) {
+			if (!CM_SameTrace(tree[i], single[i])) {
+				differ++;
 			}
-			else
-#elif defined( ALWAYS_CAPSULE_VS_CAPSULE )
-			if ( model == BOX_MODEL_HANDLE || model == CAPSULE_MODEL_HANDLE )
-			{
-				CM_TestCapsuleInCapsule( &tw, model );
+		}
+
+		Print("tree as loaded %.1f ns/trace, %d differ from the compiled tree", perTrace(treeTime), differ);
+
+#if idx86_sse >= 2
+		// each trace starting with nothing of the map in the caches
+		int numCold = std::min(numTraces, 2000);
+		Sys::SteadyClock::duration coldTime[2]{};
+
+		for (int flat = 0; flat < 2; flat++) {
+			cm.flat.nodes = flat ? flatNodes : nullptr;
+
+			for (int i = 0; i < numCold; i++) {
+				CM_FlushCollisionData(flatNodes);
+				auto start = Sys::SteadyClock::now();
+				CM_ReplayTrace(records[i], &tree[i]);
+				coldTime[flat] += Sys::SteadyClock::now() - start;
 			}
-			else
+		}
+
+		cm.flat.nodes = flatNodes;
+
+		auto perColdTrace = [&](Sys::SteadyClock::duration time) {
+			return std::chrono::duration<double, std::nano>(time).count() / std::max(numCold, 1);
+		};
+
+		Print("out of the caches: tree as loaded %.1f ns/trace, compiled tree %.1f ns/trace",
+		      perColdTrace(coldTime[0]), perColdTrace(coldTime[1]));
 #endif
-				if ( model == CAPSULE_MODEL_HANDLE )
-				{
-					if ( tw.type == traceType_t::TT_CAPSULE )
-					{
-						CM_TestCapsuleInCapsule( &tw, model );
+	}
+};
+static TraceReplayCmd TraceReplayCmdRegistration;
+
+// Threads can't be started in the VMs
+#ifdef BUILD_ENGINE
+class TraceStressCmd : public Cmd::StaticCmd
+{
+public:
+	TraceStressCmd()
+		: Cmd::StaticCmd(VM_STRING_PREFIX "cm_traceStress", Cmd::SYSTEM, "replays recorded traces on several threads at once, checking that they match the ones of a single thread") {}
+
+	void Run(const Cmd::Args& args) const override
+	{
+		int numThreads = 4;
+		int iterations = 10;
+
+		if (args.Argc() < 2 || args.Argc() > 4
+		    || (args.Argc() >= 3 && (!Str::ParseInt(numThreads, args.Argv(2)) || numThreads <= 0 || numThreads > 64))
+		    || (args.Argc() == 4 && (!Str::ParseInt(iterations, args.Argv(3)) || iterations <= 0))) {
+			PrintUsage(args, "<file> [<threads>] [<iterations>]", "");
+			return;
+		}
+
+		if (!cm.numNodes) {
+			Print("No map loaded");
+			return;
+		}
+
+		std::vector<traceRecord_t> records;
+		std::string error = CM_ReadTraceRecording(args.Argv(1), records);
+
+		if (!error.empty()) {
+			Print(error);
+			return;
+		}
+
+		int numTraces = records.size();
+		std::vector<cmBoxTrace_t> traces(numTraces);
+		std::vector<trace_t> single(numTraces), batched(numTraces);
+
+		for (int i = 0; i < numTraces; i++) {
+			traces[i] = records[i].trace;
+		}
+
+		CM_ReplayTraces(records, single.data(), 0);
+		CM_ReplayTracesBatched(records, traces.data(), batched.data());
+
+		// each thread starts at another trace so that they don't walk the same leafs in step
+		std::atomic<int> differ{0};
+		std::vector<std::thread> threads;
+		auto start = Sys::SteadyClock::now();
+
+		for (int t = 0; t < numThreads; t++) {
+			threads.emplace_back([&, t] {
+				std::vector<trace_t> results(numTraces);
+
+				for (int it = 0; it < iterations; it++) {
+					bool batch = (t + it) & 1;
+
+					if (batch) {
+						CM_ReplayTracesBatched(records, traces.data(), results.data());
+					} else {
+						CM_ReplayTraces(records, results.data(), t * numTraces / numThreads);
 					}
-					else
-					{
-						CM_TestBoundingBoxInCapsule( &tw, model );
+
+					const std::vector<trace_t>& expected = batch ? batched : single;
+
+					for (int i = 0; i < numTraces; i++) {
+						if (!CM_SameTrace(results[i], expected[i])) {
+							differ++;
+						}
 					}
 				}
-				else
-				{
-					CM_TestInLeaf( &tw, &cmod->leaf );
-				}
+			});
 		}
-		else
-		{
-			CM_PositionTest( &tw );
+
+		for (std::thread& thread : threads) {
+			thread.join();
 		}
+
+		double seconds = std::chrono::duration<double>(Sys::SteadyClock::now() - start).count();
+
+		Print("%d threads traced %d times %d traces: %d differ from a single thread, %.0f traces/s",
+		      numThreads, iterations, numTraces, differ.load(), numThreads * iterations * numTraces / seconds);
 	}
-	else
+};
+static TraceStressCmd TraceStressCmdRegistration;
+#endif
+
+class TestBrushKernelsCmd : public Cmd::StaticCmd
+{
+public:
+	TestBrushKernelsCmd()
+		: Cmd::StaticCmd(VM_STRING_PREFIX "cm_testBrushKernels", Cmd::SYSTEM, "sweeps boxes against every brush of the map with each brush side kernel, comparing and timing them") {}
+
+	void Run(const Cmd::Args& args) const override
 	{
-		//
-		// check for point special case
-		//
-		if ( tw.size[ 0 ][ 0 ] == 0 && tw.size[ 0 ][ 1 ] == 0 && tw.size[ 0 ][ 2 ] == 0 )
-		{
-			tw.isPoint = true;
-			VectorClear( tw.extents );
+		int sweepsPerBrush = 64;
+
+		if (args.Argc() > 2 || (args.Argc() == 2 && (!Str::ParseInt(sweepsPerBrush, args.Argv(1)) || sweepsPerBrush <= 0))) {
+			PrintUsage(args, "[<sweeps per brush>]", "");
+			return;
 		}
-		else
-		{
-			tw.isPoint = false;
-			tw.extents[ 0 ] = tw.size[ 1 ][ 0 ];
-			tw.extents[ 1 ] = tw.size[ 1 ][ 1 ];
-			tw.extents[ 2 ] = tw.size[ 1 ][ 2 ];
+
+		if (!cm.flat.nodes) {
+			Print("No map loaded");
+			return;
 		}
 
-		//
-		// general sweeping through world
-		//
-		if ( model )
+		// sweeps of points and boxes starting and ending around each brush
+		struct sweep_t
 		{
-#ifdef ALWAYS_BBOX_VS_BBOX
+			const cFlatBrush_t *brush;
+			traceWork_t        tw;
+		};
 
-			if ( model == BOX_MODEL_HANDLE || model == CAPSULE_MODEL_HANDLE )
-			{
-				tw.type = TT_AABB;
-				CM_TraceThroughLeaf( &tw, &cmod->leaf );
+		std::vector<sweep_t> sweeps;
+		std::mt19937 rng(sweepsPerBrush);
+
+		for (int i = 0; i < cm.flat.numBrushes; i++) {
+			const cFlatBrush_t* brush = &cm.flat.brushes[i];
+
+			for (int n = 0; n < sweepsPerBrush; n++) {
+				vec3_t start, end, mins, maxs;
+
+				for (int j = 0; j < 3; j++) {
+					std::uniform_real_distribution<float> around(brush->bounds[0][j] - 64.0f, brush->bounds[1][j] + 64.0f);
+					std::uniform_real_distribution<float> size(0.0f, 32.0f);
+
+					start[j] = around(rng);
+					end[j] = around(rng);
+					maxs[j] = n & 1 ? size(rng) : 0.0f;
+					mins[j] = -maxs[j];
+				}
+
+				sweeps.emplace_back();
+				sweeps.back().brush = brush;
+				CM_InitTraceWork(&sweeps.back().tw, start, end, mins, maxs, vec3_origin, -1, 0, traceType_t::TT_AABB, nullptr);
 			}
-			else
-#elif defined( ALWAYS_CAPSULE_VS_CAPSULE )
-			if ( model == BOX_MODEL_HANDLE || model == CAPSULE_MODEL_HANDLE )
-			{
-				CM_TraceCapsuleThroughCapsule( &tw, model );
+		}
+
+		std::vector<trace_t> expected(sweeps.size());
+
+		for (int kernel = 0; kernel <= Util::ordinal(bestBrushKernel); kernel++) {
+			std::vector<trace_t> results(sweeps.size());
+			auto start = Sys::SteadyClock::now();
+
+			for (size_t i = 0; i < sweeps.size(); i++) {
+				traceWork_t* tw = &sweeps[i].tw;
+				trace_t before = tw->trace;
+
+				CM_TraceThroughFlatBrushWith(Util::enum_cast<brushKernel_t>(kernel), tw, sweeps[i].brush);
+				results[i] = tw->trace;
+				tw->trace = before;
 			}
-			else
-#endif
-				if ( model == CAPSULE_MODEL_HANDLE )
-				{
-					if ( tw.type == traceType_t::TT_CAPSULE )
-					{
-						CM_TraceCapsuleThroughCapsule( &tw, model );
-					}
-					else
-					{
-						CM_TraceBoundingBoxThroughCapsule( &tw, model );
-					}
-				}
-				else
-				{
-					CM_TraceThroughLeaf( &tw, &cmod->leaf );
+
+			double ns = std::chrono::duration<double, std::nano>(Sys::SteadyClock::now() - start).count() / std::max<size_t>(sweeps.size(), 1);
+
+			if (!kernel) {
+				expected = results;
+				Print("scalar: %.1f ns/brush", ns);
+				continue;
+			}
+
+			// the same hits, at fractions within the rounding of the scalar sums
+			int differ = 0, inexact = 0;
+			float maxError = 0.0f;
+
+			for (size_t i = 0; i < sweeps.size(); i++) {
+				const trace_t& a = results[i];
+				const trace_t& b = expected[i];
+				float error = fabsf(a.fraction - b.fraction);
+
+				if (a.startsolid != b.startsolid || a.allsolid != b.allsolid || error > 1.0e-4f
+				    || (a.fraction < 1.0f) != (b.fraction < 1.0f) || a.contents != b.contents) {
+					differ++;
+				} else if (memcmp(&a, &b, sizeof(trace_t))) {
+					inexact++;
+					maxError = std::max(maxError, error);
 				}
-		}
-		else
-		{
-			CM_TraceThroughTree( &tw, 0, 0, 1, tw.start, tw.end );
-		}
-	}
+			}
 
-	// generate endpos from the original, unmodified start/end
-	if ( tw.trace.fraction == 1 )
-	{
-		VectorCopy( end, tw.trace.endpos );
-	}
-	else
-	{
-		VectorLerp( start, end, tw.trace.fraction, tw.trace.endpos );
+			Print("%s: %.1f ns/brush, %d of %d sweeps differ from scalar, %d by up to %g", kernel == 1 ? "SSE2" : "AVX", ns,
+			      differ, sweeps.size(), inexact, maxError);
+		}
 	}
-
-	*results = tw.trace;
-}
+};
+static TestBrushKernelsCmd TestBrushKernelsCmdRegistration;
 
 /*
 ==================
-CM_BoxTrace
+CM_ReportFacetTrees
+
+Sweeps points, boxes and capsules around every surface with a facet tree,
+with and without the tree, and logs the time per trace and any difference
 ==================
 */
-void CM_BoxTrace( trace_t *results, const vec3_t start, const vec3_t end, vec3_t mins, vec3_t maxs,
-                  clipHandle_t model, int brushmask, int skipmask, traceType_t type )
+void CM_ReportFacetTrees()
 {
-	CM_Trace( results, start, end, mins, maxs, model, vec3_origin, brushmask, skipmask, type, nullptr );
+	struct sweep_t
+	{
+		cSurfaceCollide_t *sc;
+		traceWork_t       tw;
+	};
+
+	std::vector<sweep_t> sweeps;
+	std::mt19937 rng(cm.numSurfaces);
+	int numTrees = 0;
+
+	for (int i = 0; i < cm.numSurfaces; i++) {
+		cSurfaceCollide_t* sc = cm.surfaces[i] ? cm.surfaces[i]->sc : nullptr;
+
+		if (!sc || !sc->nodes) {
+			continue;
+		}
+
+		numTrees++;
+
+		for (int n = 0; n < 64; n++) {
+			vec3_t start, end, mins, maxs;
+
+			// as short as most movement and hit traces
+			for (int j = 0; j < 3; j++) {
+				std::uniform_real_distribution<float> around(sc->bounds[0][j] - 32.0f, sc->bounds[1][j] + 32.0f);
+				std::uniform_real_distribution<float> move(-64.0f, 64.0f);
+				std::uniform_real_distribution<float> size(0.0f, 16.0f);
+
+				start[j] = around(rng);
+				end[j] = n & 3 ? start[j] + move(rng) : start[j];
+				maxs[j] = n & 1 ? size(rng) : 0.0f;
+				mins[j] = -maxs[j];
+			}
+
+			sweeps.emplace_back();
+			sweeps.back().sc = sc;
+			CM_InitTraceWork(&sweeps.back().tw, start, end, mins, maxs, vec3_origin, -1, 0,
+			                 n & 2 ? traceType_t::TT_CAPSULE : traceType_t::TT_AABB, nullptr);
+		}
+	}
+
+	if (sweeps.empty()) {
+		return;
+	}
+
+	std::vector<trace_t> results[2];
+	Sys::SteadyClock::duration time[2]{};
+
+	for (int tree = 0; tree < 2; tree++) {
+		results[tree].resize(sweeps.size());
+
+		for (size_t i = 0; i < sweeps.size(); i++) {
+			traceWork_t tw = sweeps[i].tw;
+			cSurfaceCollide_t* sc = sweeps[i].sc;
+			cFacetNode_t* nodes = sc->nodes;
+
+			if (!tree) {
+				sc->nodes = nullptr;
+			}
+
+			auto start = Sys::SteadyClock::now();
+
+			if (VectorCompare(tw.start, tw.end)) {
+				tw.trace.startsolid = tw.trace.allsolid = CM_PositionTestInSurfaceCollide(&tw, sc);
+			} else {
+				CM_TraceThroughSurfaceCollide(&tw, sc);
+			}
+
+			time[tree] += Sys::SteadyClock::now() - start;
+			sc->nodes = nodes;
+			results[tree][i] = tw.trace;
+		}
+	}
+
+	int differ = 0;
+
+	for (size_t i = 0; i < sweeps.size(); i++) {
+		if (!CM_SameTrace(results[0][i], results[1][i])) {
+			differ++;
+		}
+	}
+
+	auto perTrace = [&](Sys::SteadyClock::duration t) {
+		return std::chrono::duration<double, std::nano>(t).count() / sweeps.size();
+	};
+
+	cmLog.Verbose("CM_LoadMap: %d traces against %d facet trees took %.1f ns each with them and %.1f ns without, %d differ",
+	              sweeps.size(), numTrees, perTrace(time[1]), perTrace(time[0]), differ);
 }
 
 /*
@@ -2449,8 +4142,6 @@ void CM_BiSphereTrace( trace_t *results, const vec3_t start, const vec3_t end, f
 
 	cmod = CM_ClipHandleToModel( model );
 
-	cm.checkcount++; // for multi-check avoidance
-
 	c_traces++; // for statistics, may be zeroed
 
 	// fill in a default trace
@@ -2468,6 +4159,8 @@ void CM_BiSphereTrace( trace_t *results, const vec3_t start, const vec3_t end, f
 		return; // map not loaded, shouldn't happen
 	}
 
+	CM_BeginVisits( &tw );
+
 	// set basic parms
 	tw.contents = mask;
 	tw.skipContents = skipmask;
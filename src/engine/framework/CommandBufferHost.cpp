@@ -97,6 +97,9 @@ namespace IPC {
             Sys::Drop("Command buffer for %s had an incomplete message write", name);
             return false;
         }
+        // Copied rather than read in place: the VM can still write to the
+        // buffer, so a handler could otherwise see a field change after
+        // validating it. The reader's buffer is pooled so this doesn't allocate.
         std::vector<char>& readerData = reader.GetData();
         readerData.resize(size);
         buffer.Read(readerData.data(), size, sizeof(uint32_t));
@@ -0,0 +1,162 @@
+/*
+===========================================================================
+Daemon BSD Source Code
+Copyright (c) 2026, Daemon Developers
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Daemon developers nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DAEMON DEVELOPERS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================
+*/
+
+#include "common/Common.h"
+#include "ThreadPool.h"
+
+namespace Sys {
+
+ThreadPool::~ThreadPool()
+{
+	Resize(0);
+}
+
+void ThreadPool::Resize(int numThreads)
+{
+	if (numThreads == static_cast<int>(threads.size())) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+
+	threads.clear();
+
+	// A new thread must only wake up for the jobs started after it was
+	// counted in busy, so it starts from the current generation.
+	unsigned seen;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = false;
+		seen = generation;
+	}
+
+	for (int i = 0; i < numThreads; i++) {
+		try {
+			threads.emplace_back(&ThreadPool::WorkerMain, this, i + 1, seen);
+		} catch (std::system_error& err) {
+			Log::Warn("Could not create worker thread: %s", err.what());
+			break;
+		}
+	}
+}
+
+void ThreadPool::Run(int count, const Job& job)
+{
+	if (count <= 0) {
+		return;
+	}
+
+	if (threads.empty()) {
+		for (int i = 0; i < count; i++) {
+			job(i, 0);
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->job = &job;
+		this->count = count;
+		next = 0;
+		error = nullptr;
+		busy = threads.size();
+		generation++;
+	}
+	wake.notify_all();
+
+	Work(0, job, count);
+
+	std::exception_ptr error;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this] { return busy == 0; });
+		error = this->error;
+		this->error = nullptr;
+		this->job = nullptr;
+	}
+
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
+
+void ThreadPool::WorkerMain(int worker, unsigned seen)
+{
+	while (true) {
+		const Job* job;
+		int count;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return quit || generation != seen; });
+
+			if (quit) {
+				return;
+			}
+
+			seen = generation;
+			job = this->job;
+			count = this->count;
+		}
+
+		Work(worker, *job, count);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--busy == 0) {
+				done.notify_one();
+			}
+		}
+	}
+}
+
+void ThreadPool::Work(int worker, const Job& job, int count)
+{
+	for (int i; (i = next++) < count;) {
+		try {
+			job(i, worker);
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!error) {
+				error = std::current_exception();
+			}
+			next = count;
+		}
+	}
+}
+
+} // namespace Sys
@@ -0,0 +1,96 @@
+/*
+===========================================================================
+Daemon BSD Source Code
+Copyright (c) 2026, Daemon Developers
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Daemon developers nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DAEMON DEVELOPERS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================
+*/
+#ifndef FRAMEWORK_THREADPOOL_H_
+#define FRAMEWORK_THREADPOOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Sys {
+
+/*
+ * A fixed set of worker threads running the iterations of a loop.
+ *
+ * The thread calling Run takes part in the loop as worker 0, the
+ * background threads are workers 1 to NumWorkers() - 1, so the caller
+ * can keep per-worker scratch data indexed by the worker number.
+ * The iterations are handed out in no particular order and must not
+ * depend on each other.
+ */
+class ThreadPool {
+public:
+	using Job = std::function<void(int index, int worker)>;
+
+	ThreadPool() = default;
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Starts or stops threads so that there are numThreads background threads
+	void Resize(int numThreads);
+
+	int NumWorkers() const
+	{
+		return threads.size() + 1;
+	}
+
+	// Runs job(i, worker) for i in [0, count) and waits for all of them.
+	// If some of them throw, the first exception is rethrown here once
+	// the other workers are done, and the remaining iterations are skipped.
+	void Run(int count, const Job& job);
+
+private:
+	void WorkerMain(int worker, unsigned seen);
+	void Work(int worker, const Job& job, int count);
+
+	std::vector<std::thread> threads;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	unsigned generation = 0;
+	bool quit = false;
+	int busy = 0;
+
+	const Job* job = nullptr;
+	int count = 0;
+	std::atomic<int> next{0};
+	std::exception_ptr error;
+};
+
+} // namespace Sys
+
+#endif // FRAMEWORK_THREADPOOL_H_
@@ -0,0 +1,74 @@
+/*
+===========================================================================
+Daemon BSD Source Code
+Copyright (c) 2013-2016, Daemon Developers
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Daemon developers nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DAEMON DEVELOPERS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================
+*/
+
+#ifndef VMTRACE_H_
+#define VMTRACE_H_
+
+#include <stdint.h>
+
+/*
+ * Binary trace of the messages between the engine and a VM, recorded when
+ * vm.<name>.logSyscalls is 2. Records are kept in a fixed-size ring buffer
+ * which is written to <name>.syscallTrace when /vmTraceDump is used or when
+ * an error happens while talking to the VM. The vmtrace tool reads the dump.
+ *
+ * This header is included by the vmtrace tool so it must not depend on the
+ * rest of the engine.
+ */
+
+namespace VM {
+
+static const char TRACE_MAGIC[8] = {'V', 'M', 'T', 'R', 'A', 'C', 'E', '1'};
+
+enum traceFlags_t {
+	TRACE_VM_TO_ENGINE = 1 << 0,
+	TRACE_START = 1 << 1,
+};
+
+// A dump is the magic, a traceHeader_t and numRecords records, oldest first.
+// Everything is in the byte order of the machine that recorded it.
+struct traceHeader_t {
+	uint64_t numRecords;
+	uint64_t droppedRecords; // overwritten before the dump
+};
+
+struct traceRecord_t {
+	uint64_t ns; // steady clock
+	uint32_t id; // major << 16 | minor
+	uint32_t size; // bytes sent with the message for a start, of its reply for an end, 0 if unknown
+	uint16_t flags;
+	uint16_t depth; // number of unfinished messages when this one started
+	uint32_t padding;
+};
+static_assert(sizeof(traceRecord_t) == 24, "traceRecord_t must not change size");
+
+} // namespace VM
+
+#endif // VMTRACE_H_
@@ -49,6 +49,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 // File handle for the root socket
 #define ROOT_SOCKET_FD 100
 
+// Number of records in the binary syscall trace, must be a power of two
+static const size_t TRACE_RECORDS = 1 << 16;
+
 // MinGW doesn't define JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE
 #ifndef JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE
 #define JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE 0x2000
@@ -405,7 +408,7 @@ uint32_t VMBase::Create()
 	Free();
 
 	// Open the syscall log
-	if (params.logSyscalls.Get()) {
+	if (params.logSyscalls.Get() == 1) {
 		std::string filename = name + ".syscallLog";
 		std::error_code err;
 		syscallLogFile = FS::HomePath::OpenWrite(filename, err);
@@ -413,6 +416,13 @@ uint32_t VMBase::Create()
 			Log::Warn("Couldn't open %s: %s", filename, err.message());
 	}
 
+	// The previous trace is kept until the VM is created again
+	traceRecords = nullptr;
+	traceNext = 0;
+	traceDepth = 0;
+	if (params.logSyscalls.Get() == 2)
+		traceRecords.reset(new traceRecord_t[TRACE_RECORDS]);
+
 	// Create the socket pair to get the handle for the root socket
 	std::pair<IPC::Socket, IPC::Socket> pair = IPC::Socket::CreatePair();
 
@@ -465,8 +475,26 @@ void VMBase::FreeInProcessVM() {
 	inProcess.running = false;
 }
 
-void VMBase::LogMessage(bool vmToEngine, bool start, int id)
+uint64_t VMBase::LogMessage(bool vmToEngine, bool start, int id, uint32_t size)
 {
+	if (traceRecords) {
+		if (!start)
+			traceDepth--;
+
+		uint64_t index = traceNext.fetch_add(1, std::memory_order_relaxed);
+		traceRecord_t& record = traceRecords[index & (TRACE_RECORDS - 1)];
+		record.ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Sys::SteadyClock::now().time_since_epoch()).count();
+		record.id = id;
+		record.size = size;
+		record.flags = (vmToEngine ? TRACE_VM_TO_ENGINE : 0) | (start ? TRACE_START : 0);
+		record.depth = std::max(traceDepth, 0);
+		record.padding = 0;
+
+		if (start)
+			traceDepth++;
+		return index;
+	}
+
 	if (syscallLogFile) {
 		int minor = id & 0xffff;
 		int major = id >> 16;
@@ -480,6 +508,149 @@ void VMBase::LogMessage(bool vmToEngine, bool start, int id)
 			Log::Warn("Error while writing the VM syscall log: %s", err.what());
 		}
 	}
+	return 0;
+}
+
+void VMBase::LogMessageSize(uint64_t record, uint32_t size)
+{
+	// Unless it was overwritten already
+	if (traceRecords && traceNext.load(std::memory_order_relaxed) - record <= TRACE_RECORDS)
+		traceRecords[record & (TRACE_RECORDS - 1)].size = size;
+}
+
+void VMBase::TraceError(const Sys::DropErr& err)
+{
+	if (!traceRecords)
+		return;
+
+	traceDepth = 0;
+	if (DumpTrace())
+		Log::Warn("Wrote the syscall trace of %s to %s.syscallTrace after error: %s", name, name, err.what());
+}
+
+bool VMBase::DumpTrace()
+{
+	if (!traceRecords)
+		return false;
+
+	uint64_t next = traceNext.load(std::memory_order_relaxed);
+	traceHeader_t header;
+	header.numRecords = std::min<uint64_t>(next, TRACE_RECORDS);
+	header.droppedRecords = next - header.numRecords;
+
+	std::string filename = name + ".syscallTrace";
+	try {
+		FS::File file = FS::HomePath::OpenWrite(filename);
+		file.Write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+		file.Write(&header, sizeof(header));
+
+		// Oldest first, in at most two pieces
+		uint64_t first = next - header.numRecords;
+		size_t start = first & (TRACE_RECORDS - 1);
+		size_t firstPiece = std::min<uint64_t>(header.numRecords, TRACE_RECORDS - start);
+		file.Write(&traceRecords[start], firstPiece * sizeof(traceRecord_t));
+		file.Write(&traceRecords[0], (header.numRecords - firstPiece) * sizeof(traceRecord_t));
+		file.Close();
+	} catch (std::system_error& err) {
+		Log::Warn("Couldn't write %s: %s", filename, err.what());
+		return false;
+	}
+	return true;
+}
+
+// The VMs are globals, so this can't be a global itself
+static std::vector<VMBase*>& VMInstances()
+{
+	static std::vector<VMBase*> instances;
+	return instances;
+}
+
+void VMBase::RegisterInstance()
+{
+	VMInstances().push_back(this);
+}
+
+void VMBase::UnregisterInstance()
+{
+	auto& instances = VMInstances();
+	instances.erase(std::remove(instances.begin(), instances.end(), this), instances.end());
+}
+
+const std::vector<VMBase*>& VMBase::GetInstances()
+{
+	return VMInstances();
+}
+
+class TraceDumpCmd: public Cmd::StaticCmd {
+public:
+	TraceDumpCmd()
+		: Cmd::StaticCmd("vmTraceDump", Cmd::SYSTEM, "writes the syscall trace recorded with vm.<name>.logSyscalls 2 to <name>.syscallTrace") {}
+
+	void Run(const Cmd::Args& args) const override
+	{
+		if (args.Argc() != 2) {
+			PrintUsage(args, "<vm name>", "");
+			return;
+		}
+
+		for (VMBase* vm : VMBase::GetInstances()) {
+			if (vm->GetName() != args.Argv(1))
+				continue;
+
+			if (vm->DumpTrace())
+				Print("Wrote %s.syscallTrace", vm->GetName());
+			else
+				Print("%s isn't recording a trace, set vm.%s.logSyscalls to 2 before it starts", vm->GetName(), vm->GetName());
+			return;
+		}
+		Print("No VM named %s", args.Argv(1));
+	}
+};
+static TraceDumpCmd TraceDumpCmdRegistration;
+
+// Large enough for a few hundred small messages between two flushes
+static const size_t QUEUE_SIZE = 64 * 1024;
+
+void VMBase::QueueWriter(const Util::Writer& writer)
+{
+	if (!queueShm) {
+		queueShm = IPC::SharedMemory::Create(IPC::CommandBuffer::DATA_OFFSET + QUEUE_SIZE);
+		queue.Init(queueShm.GetBase(), queueShm.GetSize());
+		queue.Reset();
+		SendMsg<IPC::CommandBufferLocateMsg>(queueShm);
+	}
+
+	const std::vector<char>& data = writer.GetData();
+	uint32_t dataSize = data.size();
+	uint32_t totalSize = dataSize + sizeof(uint32_t);
+
+	if (writer.GetHandles().size() != 0) {
+		Sys::Drop("VM: Handles can't be queued for %s", name);
+	}
+
+	queue.LoadReaderData();
+	if (!queue.CanWrite(totalSize)) {
+		FlushQueue();
+		queue.LoadReaderData();
+		if (!queue.CanWrite(totalSize)) {
+			Sys::Drop("VM: Message of size %u doesn't fit in the queue for %s of size %u", dataSize, name, queue.GetSize());
+		}
+	}
+
+	queue.Write((const char*)&dataSize, sizeof(uint32_t));
+	queue.Write(data.data(), dataSize, sizeof(uint32_t));
+	queue.AdvanceWritePointer(totalSize);
+	numQueued++;
+}
+
+void VMBase::FlushQueue()
+{
+	if (numQueued == 0)
+		return;
+
+	numQueued = 0;
+	queueGeneration++;
+	SendMsg<IPC::CommandBufferConsumeMsg>();
 }
 
 void VMBase::Free()
@@ -506,6 +677,10 @@ void VMBase::Free()
 	}
 	rootChannel = IPC::Channel();
 
+	// Messages still in the queue are dropped with the VM
+	queueShm.Close();
+	numQueued = 0;
+
 	if (type != TYPE_NATIVE_DLL) {
 #ifdef _WIN32
 		// Closing the job object should kill the child process
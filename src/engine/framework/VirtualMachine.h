@@ -31,6 +31,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <common/FileSystem.h>
 #include "common/Common.h"
 #include "common/IPC/Channel.h"
+#include "common/IPC/CommandBuffer.h"
+#include "VMTrace.h"
 
 #ifndef VIRTUALMACHINE_H_
 #define VIRTUALMACHINE_H_
@@ -94,24 +96,30 @@ enum vmType_t {
 
 struct VMParams {
 	VMParams(std::string name, int vmTypeFlags)
-		: logSyscalls("vm." + name + ".logSyscalls", "dump all the syscalls in the " + name + ".syscallLog file", Cvar::NONE, false),
+		: logSyscalls("vm." + name + ".logSyscalls", "log all the syscalls, 1: as text in the " + name + ".syscallLog file, 2: in a binary ring buffer written by /vmTraceDump", Cvar::NONE, 0, 0, 2),
 		  vmType("vm." + name + ".type", "how the vm should be loaded for " + name, vmTypeFlags,
 		         Util::ordinal(vmType_t::TYPE_NACL), 0, Util::ordinal(vmType_t::TYPE_END) - 1),
 		  debug("vm." + name + ".debug", "run a gdbserver on localhost:4014 to debug the VM", Cvar::NONE, false),
-		  debugLoader("vm." + name + ".debugLoader", "make nacl_loader dump information to " + name + "-nacl_loader.log", Cvar::NONE, 1, 0, 5) {
+		  debugLoader("vm." + name + ".debugLoader", "make nacl_loader dump information to " + name + "-nacl_loader.log", Cvar::NONE, 1, 0, 5),
+		  queueMessages("vm." + name + ".queueMessages", "send the messages that have no reply to " + name + " in batches", Cvar::NONE, true) {
 	}
 
-	Cvar::Cvar<bool> logSyscalls;
+	Cvar::Range<Cvar::Cvar<int>> logSyscalls;
 	Cvar::Range<Cvar::Cvar<int>> vmType;
 	Cvar::Cvar<bool> debug;
 	Cvar::Range<Cvar::Cvar<int>> debugLoader;
+	Cvar::Cvar<bool> queueMessages;
 };
 
 // Base class for a virtual machine instance
 class VMBase {
 public:
 	VMBase(std::string name, int vmTypeCvarFlags)
-		: processHandle(Sys::INVALID_HANDLE), name(name), type(TYPE_NACL), params(name, vmTypeCvarFlags) {}
+		: processHandle(Sys::INVALID_HANDLE), name(name), type(TYPE_NACL), params(name, vmTypeCvarFlags),
+		  traceNext(0), traceDepth(0), numQueued(0), queueGeneration(1), sentMsgs(0), queuedMsgs(0)
+	{
+		RegisterInstance();
+	}
 
 	// Create the VM for the named module. Returns the ABI version reported
 	// by the module. This will automatically free any existing VM.
@@ -126,23 +134,106 @@ public:
 		return Sys::IsValidHandle(processHandle) || inProcess.thread.joinable();
 	}
 
+	// Engine side of the root socket, used to wait for the VM with other handles
+	Sys::OSHandle GetRootSocketHandle() const
+	{
+		return rootChannel.GetHandle();
+	}
+
 	// Make sure the VM is closed on exit
 	virtual ~VMBase()
 	{
 		Free();
+		UnregisterInstance();
 	}
 
 	// Send a message to the VM
 	template<typename Msg, typename... Args> void SendMsg(Args&&... args)
 	{
-		// Marking lambda as mutable to work around a bug in gcc 4.6
-		LogMessage(false, true, Msg::id);
-		IPC::SendMsg<Msg>(rootChannel, [this](uint32_t id, Util::Reader reader) mutable {
-			LogMessage(true, true, id);
-			Syscall(id, std::move(reader), rootChannel);
-			LogMessage(true, false, id);
-		}, std::forward<Args>(args)...);
-		LogMessage(false, false, Msg::id);
+		int depth = traceDepth;
+		try {
+			FlushQueue();
+			sentMsgs++;
+
+			// The size of the message is known once it has been sent, that is
+			// before the first syscall or the reply.
+			uint64_t sentBefore = rootChannel.bytesSent;
+			uint64_t record = LogMessage(false, true, Msg::id);
+			bool sizeLogged = false;
+			auto logSize = [this, record, sentBefore, &sizeLogged] {
+				if (!sizeLogged) {
+					LogMessageSize(record, rootChannel.bytesSent - sentBefore);
+					sizeLogged = true;
+				}
+			};
+
+			// Marking lambda as mutable to work around a bug in gcc 4.6
+			IPC::SendMsg<Msg>(rootChannel, [this, &logSize](uint32_t id, Util::Reader reader) mutable {
+				logSize();
+				uint64_t syscallSentBefore = rootChannel.bytesSent;
+				LogMessage(true, true, id, reader.GetData().size());
+				Syscall(id, std::move(reader), rootChannel);
+				LogMessage(true, false, id, rootChannel.bytesSent - syscallSentBefore);
+			}, std::forward<Args>(args)...);
+			logSize();
+			LogMessage(false, false, Msg::id);
+		} catch (Sys::DropErr& err) {
+			// Keep the trace of what led to the error, once for the outermost message
+			if (depth == 0)
+				TraceError(err);
+			throw;
+		}
+	}
+
+	// Queue a SyncMessage without outputs instead of waiting for the VM to
+	// handle it. The VM handles the queued messages in order when the queue is
+	// flushed, which happens before any other message is sent to it.
+	template<typename Msg, typename... Args> void QueueMsg(Args&&... args)
+	{
+		static_assert(std::tuple_size<typename Msg::Outputs>::value == 0, "Only messages without outputs can be queued");
+		static_assert(sizeof...(Args) == std::tuple_size<typename Msg::Inputs>::value, "Incorrect number of arguments for VMBase::QueueMsg");
+
+		if (!params.queueMessages.Get()) {
+			SendMsg<Msg>(std::forward<Args>(args)...);
+			return;
+		}
+
+		Util::Writer writer;
+		writer.Write<uint32_t>(Msg::id);
+		writer.WriteArgs(Util::TypeListFromTuple<typename Msg::Inputs>(), std::forward<Args>(args)...);
+		QueueWriter(writer);
+		queuedMsgs++;
+	}
+
+	// Make the VM handle the queued messages
+	void FlushQueue();
+
+	// Changes each time the queue is flushed
+	uint32_t GetQueueGeneration() const
+	{
+		return queueGeneration;
+	}
+
+	// Write the binary syscall trace to <name>.syscallTrace, returns false if
+	// it isn't being recorded
+	bool DumpTrace();
+
+	// The VMs that exist, to find them by name
+	static const std::vector<VMBase*>& GetInstances();
+
+	const std::string& GetName() const
+	{
+		return name;
+	}
+
+	// Number of messages sent, counting each flush as one, and of messages queued
+	uint64_t GetSentMsgs() const
+	{
+		return sentMsgs;
+	}
+	uint64_t GetQueuedMsgs() const
+	{
+		return queuedMsgs;
 	}
 
 	struct InProcessInfo {
@@ -181,7 +272,30 @@ private:
 	// Logging the syscalls
 	FS::File syscallLogFile;
 
-	void LogMessage(bool vmToEngine, bool start, int id);
+	// Returns the index of the record in the binary trace, for LogMessageSize
+	uint64_t LogMessage(bool vmToEngine, bool start, int id, uint32_t size = 0);
+	void LogMessageSize(uint64_t record, uint32_t size);
+	void TraceError(const Sys::DropErr& err);
+
+	// Binary syscall trace, a ring buffer of records which is only allocated
+	// when recording
+	std::unique_ptr<traceRecord_t[]> traceRecords;
+	std::atomic<uint64_t> traceNext;
+	int traceDepth;
+
+	void RegisterInstance();
+	void UnregisterInstance();
+
+	// Messages queued for the VM, written in a command buffer that the VM
+	// reads when it receives a CommandBufferConsumeMsg
+	IPC::SharedMemory queueShm;
+	IPC::CommandBuffer queue;
+	int numQueued;
+	uint32_t queueGeneration;
+	uint64_t sentMsgs;
+	uint64_t queuedMsgs;
+
+	void QueueWriter(const Util::Writer& writer);
 };
 
 } // namespace VM
@@ -302,13 +302,14 @@ std::unique_ptr<Sys::EventBase> Com_GetEvent()
 		Com_QueueEvent( Util::make_unique<Sys::ConsoleInputEvent>( s ) );
 	}
 
-	// check for network packets
+	// check for network packets, in batched mode they are handled
+	// directly by Com_EventLoop without going through the event queue
 	msg_t netmsg;
 	netadr_t adr;
 	MSG_Init( &netmsg, sys_packetReceived, sizeof( sys_packetReceived ) );
 	adr.type = netadrtype_t::NA_UNSPEC;
 
-	if ( Sys_GetPacket( &adr, &netmsg ) )
+	if ( !NET_BatchMode() && Sys_GetPacket( &adr, &netmsg ) )
 	{
 		Com_QueueEvent( Util::make_unique<Sys::PacketEvent>(
 			adr, &netmsg.data[ netmsg.readcount ], netmsg.cursize - netmsg.readcount ) );
@@ -371,7 +372,7 @@ static void HandleConsoleInputEvent(const Sys::ConsoleInputEvent& event)
 	}
 }
 
-static void HandlePacketEvent(const Sys::PacketEvent& event)
+static void HandlePacket(const netadr_t& adr, msg_t* buf)
 {
 	// this cvar allows simulation of connections that
 	// drop a lot of packets.  Note that loopback connections
@@ -385,6 +386,19 @@ static void HandlePacketEvent(const Sys::PacketEvent& event)
 			return; // drop this packet
 		}
 	}
+
+	if ( com_sv_running->integer )
+	{
+		Com_RunAndTimeServerPacket( &adr, buf );
+	}
+	else
+	{
+		CL_PacketEvent( adr, buf );
+	}
+}
+
+static void HandlePacketEvent(const Sys::PacketEvent& event)
+{
 	msg_t buf;
 	byte bufData[ MAX_MSGLEN ];
 	MSG_Init( &buf, bufData, sizeof( bufData ) );
@@ -402,14 +416,7 @@ static void HandlePacketEvent(const Sys::PacketEvent& event)
 	buf.cursize = event.data.size();
 	memcpy( buf.data, event.data.data(), buf.cursize );
 
-	if ( com_sv_running->integer )
-	{
-		Com_RunAndTimeServerPacket( &event.adr, &buf );
-	}
-	else
-	{
-		CL_PacketEvent( event.adr, &buf );
-	}
+	HandlePacket( event.adr, &buf );
 }
 
 /*
@@ -441,6 +448,17 @@ void Com_EventLoop()
 				CL_MouseEvent( mouseX, mouseY );
 			}
 
+			// batched network packets are handled in place instead of
+			// being copied into a heap allocated event
+			if ( NET_BatchMode() )
+			{
+				while ( Sys_GetPacket( &evFrom, &buf ) )
+				{
+					HandlePacket( evFrom, &buf );
+					MSG_Init( &buf, bufData, sizeof( bufData ) );
+				}
+			}
+
 			// manually send packet events for the loopback channel
 			while ( NET_GetLoopPacket( netsrc_t::NS_CLIENT, &evFrom, &buf ) )
 			{
@@ -962,7 +980,14 @@ void Com_Frame()
 	while ( msec < minMsec )
 	{
 		//give cycles back to the OS
-		Sys::SleepFor(std::chrono::milliseconds(std::min(minMsec - msec, 50)));
+		if ( Com_IsDedicatedServer() && NET_UseFrameScheduler() )
+		{
+			NET_SleepUntil( lastTime + minMsec );
+		}
+		else
+		{
+			Sys::SleepFor(std::chrono::milliseconds(std::min(minMsec - msec, 50)));
+		}
 		IN_Frame();
 
 		Com_EventLoop();
@@ -1081,8 +1106,8 @@ void Com_Frame()
 	//
 	if ( showTraceStats.Get() )
 	{
-		extern int c_traces, c_brush_traces, c_patch_traces, c_trisoup_traces;
-		extern int c_pointcontents;
+		extern thread_local int c_traces, c_brush_traces, c_patch_traces, c_trisoup_traces;
+		extern thread_local int c_pointcontents;
 
 		Log::Notice( "%4i traces  (%ib %ip %it) %4i points\n", c_traces, c_brush_traces, c_patch_traces, c_trisoup_traces,
 		            c_pointcontents );
@@ -457,26 +457,42 @@ void FS_WriteFile(const char* path, const void* buffer, int size)
 	}
 }
 
+// Doesn't go through the handle table, so that the renderer can read images
+// from several threads at once
 int FS_ReadFile(const char* path, void** buffer)
 {
-	fileHandle_t handle;
-	int length = FS_FOpenFileRead(path, &handle);
-
-	if (length < 0) {
-		if (buffer)
-			*buffer = nullptr;
-		return -1;
+	if (!buffer) {
+		fileHandle_t handle;
+		int length = FS_FOpenFileRead(path, &handle);
+		if (length >= 0)
+			FS_FCloseFile(handle);
+		return length;
 	}
 
-	if (buffer) {
-		char* buf = new char[length + 1];
-		*buffer = buf;
-		FS_Read(buf, length, handle);
-		buf[length] = '\0';
+	std::error_code err;
+	std::string data;
+	if (FS::PakPath::FileExists(path)) {
+		data = FS::PakPath::ReadFile(path, err);
+	} else {
+		FS::File file = FS::HomePath::OpenRead(path, err);
+		if (!err)
+			data = file.ReadAll(err);
+	}
+	if (err) {
+		Log::Debug("Failed to open '%s' for reading: %s", path, err.message());
+		*buffer = nullptr;
+		return -1;
+	} else if (static_cast<FS::offset_t>(data.size()) > MAX_FILE_LENGTH) {
+		Log::Warn("FS_ReadFile: Failed to open '%s' for reading: size %d is too large", path, data.size());
+		*buffer = nullptr;
+		return -1;
 	}
 
-	FS_FCloseFile(handle);
-	return length;
+	char* buf = new char[data.size() + 1];
+	memcpy(buf, data.data(), data.size());
+	buf[data.size()] = '\0';
+	*buffer = buf;
+	return data.size();
 }
 
 void FS_FreeFile(void* buffer)
@@ -39,7 +39,8 @@ Maryland 20850 USA.
 #include "qcommon/q_shared.h"
 #include "qcommon.h"
 
-static int bloc = 0;
+// per thread so that messages can be written by the snapshot workers
+static thread_local int bloc = 0;
 
 //bani - optimized version
 //clears data along the way so we don't have to memset() it ahead of time
@@ -604,3 +605,395 @@ void Huff_Init( huffman_t *huff )
 	huff->compressor.tree->parent = huff->compressor.tree->left = huff->compressor.tree->right = nullptr;
 	huff->compressor.loc[ NYT ] = huff->compressor.tree;
 }
+
+/*
+=============================================================================
+
+TABLE DRIVEN CODEC
+
+=============================================================================
+*/
+
+static const uint32_t HUFF_DECODE_SUBTREE = 0x80000000u;
+static const int      HUFF_MAX_TABLE_LENGTH = 48;
+
+static void Huff_FillTables( const node_t *node, uint64_t code, int length, huffTables_t *tables )
+{
+	if ( !node )
+	{
+		return;
+	}
+
+	if ( length == HUFF_DECODE_BITS && node->symbol == INTERNAL_NODE )
+	{
+		tables->decode[ code ] = HUFF_DECODE_SUBTREE;
+		tables->subtrees[ code ] = node;
+	}
+
+	if ( node->symbol != INTERNAL_NODE )
+	{
+		if ( node->symbol < HMAX )
+		{
+			tables->codes[ node->symbol ] = code;
+			tables->lengths[ node->symbol ] = length;
+		}
+
+		tables->maxLength = std::max( tables->maxLength, length );
+
+		// every index starting with the code decodes to it
+		for ( uint64_t next = code; length <= HUFF_DECODE_BITS && next < ( 1u << HUFF_DECODE_BITS ); next += uint64_t( 1 ) << length )
+		{
+			tables->decode[ next ] = node->symbol | ( length << 16 );
+		}
+
+		return;
+	}
+
+	if ( length >= HUFF_MAX_TABLE_LENGTH )
+	{
+		tables->maxLength = HUFF_MAX_TABLE_LENGTH + 1;
+		return;
+	}
+
+	Huff_FillTables( node->left, code, length + 1, tables );
+	Huff_FillTables( node->right, code | ( uint64_t( 1 ) << length ), length + 1, tables );
+}
+
+/*
+============
+Huff_BuildTables
+
+The encoding tables are made from the compressor and the decoding ones from
+the decompressor. Returns false if the codes are too long for the tables.
+============
+*/
+bool Huff_BuildTables( const huffman_t *huff, huffTables_t *tables )
+{
+	huffTables_t decoder;
+
+	Com_Memset( tables, 0, sizeof( *tables ) );
+	Com_Memset( &decoder, 0, sizeof( decoder ) );
+
+	Huff_FillTables( huff->compressor.tree, 0, 0, tables );
+	Huff_FillTables( huff->decompressor.tree, 0, 0, &decoder );
+
+	Com_Memcpy( tables->decode, decoder.decode, sizeof( decoder.decode ) );
+	Com_Memcpy( tables->subtrees, decoder.subtrees, sizeof( decoder.subtrees ) );
+	tables->maxLength = std::max( tables->maxLength, decoder.maxLength );
+
+	for ( int i = 0; i < HMAX; i++ )
+	{
+		if ( !tables->lengths[ i ] )
+		{
+			return false;
+		}
+	}
+
+	return tables->maxLength <= HUFF_MAX_TABLE_LENGTH;
+}
+
+// Writes the lowest length bits of buffer, keeping the bits before *offset
+// and clearing the rest of the last byte, like Huff_putBit
+static void Huff_FlushBits( byte *fout, int *offset, uint64_t buffer, int length )
+{
+	byte *out = fout + ( *offset >> 3 );
+	int  shift = *offset & 7;
+	int  total = shift + length;
+
+	*offset += length;
+
+	if ( shift )
+	{
+		// at most 7 + 56 bits
+		buffer = ( buffer << shift ) | ( out[ 0 ] & ( ( 1 << shift ) - 1 ) );
+	}
+
+	for ( int i = 0; i < ( total + 7 ) >> 3; i++ )
+	{
+		out[ i ] = buffer >> ( 8 * i );
+	}
+}
+
+/*
+============
+Huff_WriteBits
+
+Writes the bits & 7 lowest bits of value as is, then its remaining bytes
+coded, as MSG_WriteBits does with Huff_putBit and Huff_offsetTransmit
+============
+*/
+void Huff_WriteBits( const huffTables_t *tables, byte *fout, int *offset, uint32_t value, int bits )
+{
+	int      raw = bits & 7;
+	uint64_t buffer = value & ( ( 1u << raw ) - 1 );
+	int      length = raw;
+
+	value >>= raw;
+
+	for ( int i = raw; i < bits; i += 8 )
+	{
+		int symbol = value & 0xff;
+
+		if ( length + tables->lengths[ symbol ] > 56 )
+		{
+			Huff_FlushBits( fout, offset, buffer, length );
+			buffer = 0;
+			length = 0;
+		}
+
+		buffer |= tables->codes[ symbol ] << length;
+		length += tables->lengths[ symbol ];
+		value >>= 8;
+	}
+
+	if ( length )
+	{
+		Huff_FlushBits( fout, offset, buffer, length );
+	}
+}
+
+// The 64 bits starting at byte index, the ones past size being 0
+static uint64_t Huff_LoadBits( const byte *fin, int size, int index )
+{
+	uint64_t bits = 0;
+
+	if ( index + 8 <= size )
+	{
+		for ( int i = 0; i < 8; i++ )
+		{
+			bits |= uint64_t( fin[ index + i ] ) << ( 8 * i );
+		}
+
+		return bits;
+	}
+
+	for ( int i = 0; i < 8 && index + i < size; i++ )
+	{
+		bits |= uint64_t( fin[ index + i ] ) << ( 8 * i );
+	}
+
+	return bits;
+}
+
+// The symbol whose code starts buffer, and the length of that code
+static inline uint32_t Huff_DecodeSymbol( const huffTables_t *tables, uint64_t buffer, int *length )
+{
+	uint32_t entry = tables->decode[ buffer & ( ( 1u << HUFF_DECODE_BITS ) - 1 ) ];
+
+	if ( entry & HUFF_DECODE_SUBTREE )
+	{
+		const node_t *node = tables->subtrees[ buffer & ( ( 1u << HUFF_DECODE_BITS ) - 1 ) ];
+
+		for ( *length = HUFF_DECODE_BITS; node->symbol == INTERNAL_NODE; ( *length )++ )
+		{
+			node = ( buffer >> *length ) & 1 ? node->right : node->left;
+		}
+
+		return node->symbol;
+	}
+
+	*length = entry >> 16;
+	return entry & 0xffff;
+}
+
+/*
+============
+Huff_ReadBits
+
+Reads what Huff_WriteBits wrote, as MSG_ReadBits does with Huff_getBit and
+Huff_offsetReceive, size being the number of bytes that can be read in fin
+============
+*/
+uint32_t Huff_ReadBits( const huffTables_t *tables, const byte *fin, int size, int *offset, int bits )
+{
+	int      raw = bits & 7;
+	uint64_t buffer = Huff_LoadBits( fin, size, *offset >> 3 ) >> ( *offset & 7 );
+	int      available = 64 - ( *offset & 7 );
+	uint32_t value = buffer & ( ( 1u << raw ) - 1 );
+
+	buffer >>= raw;
+	available -= raw;
+	*offset += raw;
+
+	for ( int i = raw; i < bits; i += 8 )
+	{
+		if ( available < tables->maxLength )
+		{
+			buffer = Huff_LoadBits( fin, size, *offset >> 3 ) >> ( *offset & 7 );
+			available = 64 - ( *offset & 7 );
+		}
+
+		int      length;
+		uint32_t symbol = Huff_DecodeSymbol( tables, buffer, &length );
+
+		value |= symbol << i;
+		buffer >>= length;
+		available -= length;
+		*offset += length;
+	}
+
+	return value;
+}
+
+/*
+============
+Huff_BeginWriter
+
+Starts a sequence of Huff_PutBits at offset, the bits written so far in the
+last byte being kept. Huff_PutBits stores whole 64 bit words, so there must
+be 8 bytes of room past the last byte that is written.
+============
+*/
+void Huff_BeginWriter( huffWriter_t *writer, byte *fout, int offset )
+{
+	int shift = offset & 7;
+
+	writer->fout = fout;
+	writer->base = offset >> 3;
+	writer->buffer = shift ? fout[ writer->base ] & ( ( 1u << shift ) - 1 ) : 0;
+	writer->length = shift;
+}
+
+/*
+============
+Huff_SpillWriter
+
+Stores the whole bytes of the buffer, keeping the last partial one in it
+============
+*/
+void Huff_SpillWriter( huffWriter_t *writer )
+{
+	byte *out = writer->fout + writer->base;
+	int  bytes = writer->length >> 3;
+
+	for ( int i = 0; i < 8; i++ )
+	{
+		out[ i ] = writer->buffer >> ( 8 * i );
+	}
+
+	writer->base += bytes;
+	writer->buffer = bytes == 8 ? 0 : writer->buffer >> ( 8 * bytes );
+	writer->length -= 8 * bytes;
+}
+
+/*
+============
+Huff_PutBits
+
+Huff_WriteBits for a writer, the bits only reaching the buffer when
+the 64 bit word they are gathered in is full or on Huff_EndWriter
+============
+*/
+void Huff_PutBits( const huffTables_t *tables, huffWriter_t *writer, uint32_t value, int bits )
+{
+	int raw = bits & 7;
+
+	if ( raw )
+	{
+		Huff_PutRawBits( writer, value & ( ( 1u << raw ) - 1 ), raw );
+		value >>= raw;
+	}
+
+	for ( int i = raw; i < bits; i += 8 )
+	{
+		int symbol = value & 0xff;
+		int length = tables->lengths[ symbol ];
+
+		if ( writer->length + length > 64 )
+		{
+			Huff_SpillWriter( writer );
+		}
+
+		writer->buffer |= tables->codes[ symbol ] << writer->length;
+		writer->length += length;
+		value >>= 8;
+	}
+}
+
+/*
+============
+Huff_EndWriter
+
+Writes the bits still in the writer, clearing the rest of the last byte like
+Huff_putBit, and returns the offset following them
+============
+*/
+int Huff_EndWriter( huffWriter_t *writer )
+{
+	byte *out = writer->fout + writer->base;
+
+	for ( int i = 0; i < ( writer->length + 7 ) >> 3; i++ )
+	{
+		out[ i ] = writer->buffer >> ( 8 * i );
+	}
+
+	return Huff_WriterOffset( writer );
+}
+
+// Loads the 64 bits following the offset of the reader
+static void Huff_RefillReader( huffReader_t *reader )
+{
+	reader->buffer = Huff_LoadBits( reader->fin, reader->size, reader->offset >> 3 ) >> ( reader->offset & 7 );
+	reader->available = 64 - ( reader->offset & 7 );
+}
+
+/*
+============
+Huff_BeginReader
+
+Starts a sequence of Huff_GetBits at offset, size being the number of bytes
+that can be read in fin
+============
+*/
+void Huff_BeginReader( huffReader_t *reader, const byte *fin, int size, int offset )
+{
+	reader->fin = fin;
+	reader->size = size;
+	reader->offset = offset;
+	Huff_RefillReader( reader );
+}
+
+/*
+============
+Huff_GetBits
+
+Huff_ReadBits for a reader, the 64 bits following its offset only being
+loaded again once fewer than the longest code are left
+============
+*/
+uint32_t Huff_GetBits( const huffTables_t *tables, huffReader_t *reader, int bits )
+{
+	int      raw = bits & 7;
+	uint32_t value = 0;
+
+	if ( raw )
+	{
+		if ( reader->available < raw )
+		{
+			Huff_RefillReader( reader );
+		}
+
+		value = reader->buffer & ( ( 1u << raw ) - 1 );
+		reader->buffer >>= raw;
+		reader->available -= raw;
+		reader->offset += raw;
+	}
+
+	for ( int i = raw; i < bits; i += 8 )
+	{
+		if ( reader->available < tables->maxLength )
+		{
+			Huff_RefillReader( reader );
+		}
+
+		int      length;
+		uint32_t symbol = Huff_DecodeSymbol( tables, reader->buffer, &length );
+
+		value |= symbol << i;
+		reader->buffer >>= length;
+		reader->available -= length;
+		reader->offset += length;
+	}
+
+	return value;
+}
@@ -36,8 +36,18 @@ Maryland 20850 USA.
 #include "qcommon.h"
 
 static huffman_t msgHuff;
+static huffTables_t msgHuffTables;
 static bool  msgInit = false;
 
+// The netField_t::used statistics are only counted on the main thread, as
+// the snapshots can also be written by worker threads (server.snapshotThreads)
+static const std::thread::id msgStatsThread = std::this_thread::get_id();
+
+static bool MSG_CountFieldStats()
+{
+	return std::this_thread::get_id() == msgStatsThread;
+}
+
 /*
 ==============================================================================
 
@@ -134,17 +144,25 @@ bit functions
 =============================================================================
 */
 
+// this isn't an exact overflow check, but close enough
+static bool MSG_CheckWriteOverflow( msg_t *msg )
+{
+	if ( msg->maxsize - msg->cursize < 32 )
+	{
+		msg->overflowed = true;
+		return true;
+	}
+
+	return false;
+}
+
 // negative bit values include signs
 void MSG_WriteBits( msg_t *msg, int value, int bits )
 {
-	int i;
-
 	msg->uncompsize += bits; // NERVE - SMF - net debugging
 
-	// this isn't an exact overflow check, but close enough
-	if ( msg->maxsize - msg->cursize < 32 )
+	if ( MSG_CheckWriteOverflow( msg ) )
 	{
-		msg->overflowed = true;
 		return;
 	}
 
@@ -191,40 +209,125 @@ void MSG_WriteBits( msg_t *msg, int value, int bits )
 	{
 		value &= ( 0xffffffff >> ( 32 - bits ) );
 
-		if ( bits & 7 )
-		{
-			int nbits;
+		Huff_WriteBits( &msgHuffTables, msg->data, &msg->bit, value, bits );
 
-			nbits = bits & 7;
+		msg->cursize = ( msg->bit >> 3 ) + 1;
+	}
+}
 
-			for ( i = 0; i < nbits; i++ )
-			{
-				Huff_putBit( ( value & 1 ), msg->data, &msg->bit );
-				value = ( value >> 1 );
-			}
+/*
+============
+MSG_WriteBitsTree
+
+The bitstream part of MSG_WriteBits walking the Huffman tree, for comparison
+============
+*/
+static void MSG_WriteBitsTree( msg_t *msg, int value, int bits )
+{
+	int i;
+
+	value &= ( 0xffffffff >> ( 32 - bits ) );
+
+	if ( bits & 7 )
+	{
+		int nbits;
+
+		nbits = bits & 7;
 
-			bits = bits - nbits;
+		for ( i = 0; i < nbits; i++ )
+		{
+			Huff_putBit( ( value & 1 ), msg->data, &msg->bit );
+			value = ( value >> 1 );
 		}
 
-		if ( bits )
+		bits = bits - nbits;
+	}
+
+	if ( bits )
+	{
+		for ( i = 0; i < bits; i += 8 )
 		{
-			for ( i = 0; i < bits; i += 8 )
-			{
-				Huff_offsetTransmit( &msgHuff.compressor, ( value & 0xff ), msg->data, &msg->bit );
-				value = ( value >> 8 );
-			}
+			Huff_offsetTransmit( &msgHuff.compressor, ( value & 0xff ), msg->data, &msg->bit );
+			value = ( value >> 8 );
 		}
+	}
 
-		msg->cursize = ( msg->bit >> 3 ) + 1;
+	msg->cursize = ( msg->bit >> 3 ) + 1;
+}
+
+/*
+============
+MSG_WriteEncodedBits
+
+Appends bits that MSG_WriteBits already wrote in another bitstream message,
+uncompressedBits being the uncompsize they account for. Returns false
+without writing anything if they may not fit, MSG_WriteBits should be
+called instead to detect the overflow.
+============
+*/
+bool MSG_WriteEncodedBits( msg_t *msg, const byte *data, int bits, int uncompressedBits )
+{
+	int  bytes = ( bits + 7 ) >> 3;
+	int  shift = msg->bit & 7;
+	byte *out = msg->data + ( msg->bit >> 3 );
+
+	if ( msg->oob || msg->maxsize - msg->cursize < bytes + 32 )
+	{
+		return false;
+	}
+
+	// the unused bits of a byte are always cleared by MSG_WriteBits
+	if ( !shift )
+	{
+		Com_Memcpy( out, data, bytes );
+	}
+	else
+	{
+		for ( int i = 0; i < bytes; i++ )
+		{
+			out[ i ] |= data[ i ] << shift;
+			out[ i + 1 ] = data[ i ] >> ( 8 - shift );
+		}
+	}
+
+	msg->bit += bits;
+	msg->cursize = ( msg->bit >> 3 ) + 1;
+	msg->uncompsize += uncompressedBits;
+	return true;
+}
+
+/*
+============
+MSG_ReadBitsTree
+
+The bitstream part of MSG_ReadBits walking the Huffman tree, for comparison
+============
+*/
+static int MSG_ReadBitsTree( msg_t *msg, int bits )
+{
+	int value = 0;
+	int get;
+	int i;
+
+	for ( i = 0; i < ( bits & 7 ); i++ )
+	{
+		value |= ( Huff_getBit( msg->data, &msg->bit ) << i );
+	}
+
+	for ( ; i < bits; i += 8 )
+	{
+		Huff_offsetReceive( msgHuff.decompressor.tree, &get, msg->data, &msg->bit );
+		value |= get << i;
 	}
+
+	msg->readcount = ( msg->bit >> 3 ) + 1;
+	return value;
 }
 
 int MSG_ReadBits( msg_t *msg, int bits )
 {
 	int      value;
-	int      get;
 	bool sgn;
-	int      i;
 
 	value = 0;
 
@@ -269,16 +372,7 @@ int MSG_ReadBits( msg_t *msg, int bits )
 	}
 	else
 	{
-		for ( i = 0; i < ( bits & 7 ); i++ )
-		{
-			value |= ( Huff_getBit( msg->data, &msg->bit ) << i );
-		}
-
-		for ( ; i < bits; i += 8 )
-		{
-			Huff_offsetReceive( msgHuff.decompressor.tree, &get, msg->data, &msg->bit );
-			value |= get << i;
-		}
+		value = Huff_ReadBits( &msgHuffTables, msg->data, msg->maxsize, &msg->bit, bits );
 
 		msg->readcount = ( msg->bit >> 3 ) + 1;
 	}
@@ -294,6 +388,163 @@ int MSG_ReadBits( msg_t *msg, int bits )
 	return value;
 }
 
+/*
+============
+MSG_BeginBitWriter
+
+Writing many small values in a row, such as the fields of a delta, with the
+bits gathered in a 64 bit word rather than going to the message one
+MSG_WriteBits at a time. msg->bit and the data only catch up at
+MSG_EndBitWriter, so nothing else may write to the message in between.
+============
+*/
+struct msgBitWriter_t
+{
+	msg_t        *msg;
+	huffWriter_t huff;
+};
+
+static void MSG_BeginBitWriter( msgBitWriter_t *writer, msg_t *msg )
+{
+	writer->msg = msg;
+
+	if ( !msg->oob )
+	{
+		Huff_BeginWriter( &writer->huff, msg->data, msg->bit );
+	}
+}
+
+// MSG_WriteBits for a writer
+static void MSG_PutBits( msgBitWriter_t *writer, int value, int bits )
+{
+	msg_t *msg = writer->msg;
+
+	if ( msg->oob )
+	{
+		MSG_WriteBits( msg, value, bits );
+		return;
+	}
+
+	msg->uncompsize += bits;
+
+	// the same margin as MSG_WriteBits, so a message overflows at the same
+	// size; a 32 bit value takes at most 4 codes, and what is left after it
+	// still holds the 8 bytes Huff_SpillWriter stores from the writer's base
+	if ( MSG_CheckWriteOverflow( msg ) )
+	{
+		return;
+	}
+
+	if ( bits == 0 || bits < -31 || bits > 32 )
+	{
+		Sys::Drop( "MSG_PutBits: bad bits %i", bits );
+	}
+
+	if ( bits < 0 )
+	{
+		bits = -bits;
+	}
+
+	value &= 0xffffffff >> ( 32 - bits );
+
+	if ( bits < 8 )
+	{
+		// such as the change bits, not coded at all
+		Huff_PutRawBits( &writer->huff, value, bits );
+	}
+	else
+	{
+		Huff_PutBits( &msgHuffTables, &writer->huff, value, bits );
+	}
+
+	msg->cursize = ( Huff_WriterOffset( &writer->huff ) >> 3 ) + 1;
+}
+
+static void MSG_EndBitWriter( msgBitWriter_t *writer )
+{
+	if ( !writer->msg->oob )
+	{
+		writer->msg->bit = Huff_EndWriter( &writer->huff );
+	}
+}
+
+/*
+============
+MSG_BeginBitReader
+
+Reading what was written with a msgBitWriter_t, the next bits of the message
+being kept in a 64 bit word. msg->bit and msg->readcount only catch up at
+MSG_EndBitReader.
+============
+*/
+struct msgBitReader_t
+{
+	msg_t        *msg;
+	huffReader_t huff;
+};
+
+static void MSG_BeginBitReader( msgBitReader_t *reader, msg_t *msg )
+{
+	reader->msg = msg;
+
+	if ( !msg->oob )
+	{
+		Huff_BeginReader( &reader->huff, msg->data, msg->maxsize, msg->bit );
+	}
+}
+
+// MSG_ReadBits for a reader
+static int MSG_GetBits( msgBitReader_t *reader, int bits )
+{
+	if ( reader->msg->oob )
+	{
+		return MSG_ReadBits( reader->msg, bits );
+	}
+
+	bool sgn = bits < 0;
+
+	if ( sgn )
+	{
+		bits = -bits;
+	}
+
+	int value = Huff_GetBits( &msgHuffTables, &reader->huff, bits );
+
+	if ( sgn && ( value & ( 1 << ( bits - 1 ) ) ) )
+	{
+		value |= -1 ^ ( ( 1 << bits ) - 1 );
+	}
+
+	return value;
+}
+
+// MSG_ReadShort for a reader
+static int MSG_GetShort( msgBitReader_t *reader )
+{
+	if ( reader->msg->oob )
+	{
+		return MSG_ReadShort( reader->msg );
+	}
+
+	int c = ( short ) MSG_GetBits( reader, 16 );
+
+	if ( ( reader->huff.offset >> 3 ) + 1 > reader->msg->cursize )
+	{
+		c = -1;
+	}
+
+	return c;
+}
+
+static void MSG_EndBitReader( msgBitReader_t *reader )
+{
+	if ( !reader->msg->oob )
+	{
+		reader->msg->bit = reader->huff.offset;
+		reader->msg->readcount = ( reader->msg->bit >> 3 ) + 1;
+	}
+}
+
 //================================================================================
 
 //
@@ -896,6 +1147,218 @@ void MSG_PrioritiseEntitystateFields()
 static const int FLOAT_INT_BITS = 13;
 static const int FLOAT_INT_BIAS = ( 1 << ( FLOAT_INT_BITS - 1 ) );
 
+/*
+==================
+MSG_PutField
+
+Writes the value of a changed field, floats going as small integers when
+they are integral. Entities send a bit first telling if the value is zero,
+player states don't.
+==================
+*/
+static void MSG_PutField( msgBitWriter_t *writer, const netField_t *field, const int *toF, bool zeroBit )
+{
+	if ( field->bits == 0 )
+	{
+		// float
+		float fullFloat = * ( const float * ) toF;
+		int   trunc = ( int ) fullFloat;
+
+		if ( zeroBit )
+		{
+			if ( fullFloat == 0.0f )
+			{
+				MSG_PutBits( writer, 0, 1 );
+				return;
+			}
+
+			MSG_PutBits( writer, 1, 1 );
+		}
+
+		if ( trunc == fullFloat && trunc + FLOAT_INT_BIAS >= 0 && trunc + FLOAT_INT_BIAS < ( 1 << FLOAT_INT_BITS ) )
+		{
+			// send as small integer
+			MSG_PutBits( writer, 0, 1 );
+			MSG_PutBits( writer, trunc + FLOAT_INT_BIAS, FLOAT_INT_BITS );
+		}
+		else
+		{
+			// send as full floating point value
+			MSG_PutBits( writer, 1, 1 );
+			MSG_PutBits( writer, *toF, 32 );
+		}
+	}
+	else
+	{
+		if ( zeroBit )
+		{
+			if ( *toF == 0 )
+			{
+				MSG_PutBits( writer, 0, 1 );
+				return;
+			}
+
+			MSG_PutBits( writer, 1, 1 );
+		}
+
+		// integer
+		MSG_PutBits( writer, *toF, field->bits );
+	}
+}
+
+/*
+==================
+MSG_GetField
+
+Reads what MSG_PutField wrote
+==================
+*/
+static void MSG_GetField( msgBitReader_t *reader, const netField_t *field, int *toF, bool zeroBit, bool print )
+{
+	if ( field->bits == 0 )
+	{
+		// float
+		if ( zeroBit && MSG_GetBits( reader, 1 ) == 0 )
+		{
+			* ( float * ) toF = 0.0f;
+			return;
+		}
+
+		if ( MSG_GetBits( reader, 1 ) == 0 )
+		{
+			// integral float
+			int trunc = MSG_GetBits( reader, FLOAT_INT_BITS );
+			// bias to allow equal parts positive and negative
+			trunc -= FLOAT_INT_BIAS;
+			* ( float * ) toF = trunc;
+
+			if ( print )
+			{
+				Log::Notice( "%s:%i ", field->name, trunc );
+			}
+		}
+		else
+		{
+			// full floating point value
+			*toF = MSG_GetBits( reader, 32 );
+
+			if ( print )
+			{
+				Log::Notice( "%s:%f ", field->name, * ( float * ) toF );
+			}
+		}
+	}
+	else
+	{
+		if ( zeroBit && MSG_GetBits( reader, 1 ) == 0 )
+		{
+			*toF = 0;
+			return;
+		}
+
+		// integer
+		*toF = MSG_GetBits( reader, field->bits );
+
+		if ( print )
+		{
+			Log::Notice( "%s:%i ", field->name, *toF );
+		}
+	}
+}
+
+/*
+==================
+MSG_ChangedWords
+
+Sets the bit of each 32 bit word that differs between from and to in
+changed, comparing 4 words at a time with SSE2
+==================
+*/
+static const int MAX_DELTA_WORDS = MAX_PLAYERSTATE_SIZE / 4;
+static_assert( sizeof( entityState_t ) / 4 <= MAX_DELTA_WORDS, "entityState_t too big for the changed word masks" );
+
+static void MSG_ChangedWords( const int *from, const int *to, int numWords, uint64_t *changed )
+{
+	int i = 0;
+
+	memset( changed, 0, sizeof( uint64_t ) * ( ( numWords + 63 ) / 64 ) );
+
+#if idx86_sse >= 2
+	for ( ; i + 4 <= numWords; i += 4 )
+	{
+		__m128i a = _mm_loadu_si128( ( const __m128i * ) ( from + i ) );
+		__m128i b = _mm_loadu_si128( ( const __m128i * ) ( to + i ) );
+		int     equal = _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpeq_epi32( a, b ) ) );
+
+		changed[ i >> 6 ] |= uint64_t( equal ^ 0xf ) << ( i & 63 );
+	}
+#endif
+
+	for ( ; i < numWords; i++ )
+	{
+		if ( from[ i ] != to[ i ] )
+		{
+			changed[ i >> 6 ] |= uint64_t( 1 ) << ( i & 63 );
+		}
+	}
+}
+
+static int MSG_LowestBit( uint64_t bits )
+{
+#if defined( __GNUC__ ) || defined( __clang__ )
+	return __builtin_ctzll( bits );
+#else
+	int bit = 0;
+
+	while ( !( bits & 1 ) )
+	{
+		bits >>= 1;
+		bit++;
+	}
+
+	return bit;
+#endif
+}
+
+/*
+==================
+MSG_LastChangedField
+
+The number of fields to send for the changed words, lastFields giving the
+last field each word is part of, or -1
+==================
+*/
+static int MSG_LastChangedField( const uint64_t *changed, int numWords, const int *lastFields )
+{
+	int lc = 0;
+
+	for ( int i = 0; i < ( numWords + 63 ) / 64; i++ )
+	{
+		for ( uint64_t bits = changed[ i ]; bits; bits &= bits - 1 )
+		{
+			lc = std::max( lc, lastFields[ i * 64 + MSG_LowestBit( bits ) ] + 1 );
+		}
+	}
+
+	return lc;
+}
+
+// Sets the last field each word of a delta is part of, or -1
+static void MSG_InitLastFields( const netField_t *fields, int numFields, int *lastFields, int numWords )
+{
+	std::fill( lastFields, lastFields + numWords, -1 );
+
+	for ( int i = 0; i < numFields; i++ )
+	{
+		int words = fields[ i ].bits == STATS_GROUP_FIELD ? STATS_GROUP_NUM_STATS : 1;
+
+		for ( int word = fields[ i ].offset / 4; word < fields[ i ].offset / 4 + words; word++ )
+		{
+			lastFields[ word ] = std::max( lastFields[ word ], i );
+		}
+	}
+}
+
 /*
 ==================
 MSG_WriteDeltaEntity
@@ -911,9 +1374,8 @@ void MSG_WriteDeltaEntity( msg_t *msg, entityState_t *from, entityState_t *to, b
 {
 	int        i, lc;
 	netField_t *field;
-	int        trunc;
-	float      fullFloat;
 	int        *fromF, *toF;
+	bool       countStats = MSG_CountFieldStats();
 
 	const int numFields = ARRAY_LEN(entityStateFields);
 
@@ -946,21 +1408,16 @@ void MSG_WriteDeltaEntity( msg_t *msg, entityState_t *from, entityState_t *to, b
 		Sys::Error( "MSG_WriteDeltaEntity: Bad entity number: %i", to->number );
 	}
 
-	lc = 0;
-
-	// build the change vector as bytes so it is endian independent
-	for ( i = 0, field = entityStateFields; i < numFields; i++, field++ )
-	{
-		fromF = ( int * )( ( byte * ) from + field->offset );
-		toF = ( int * )( ( byte * ) to + field->offset );
-
-		if ( *fromF != *toF )
-		{
-			lc = i + 1;
+	static const int numWords = sizeof( entityState_t ) / 4;
+	static const std::array<int, numWords> lastFields = [] {
+		std::array<int, numWords> lastFields;
+		MSG_InitLastFields( entityStateFields, numFields, lastFields.data(), numWords );
+		return lastFields;
+	}();
+	uint64_t changed[ ( numWords + 63 ) / 64 ];
 
-			field->used++;
-		}
-	}
+	MSG_ChangedWords( ( int * ) from, ( int * ) to, numWords, changed );
+	lc = MSG_LastChangedField( changed, numWords, lastFields.data() );
 
 	if ( lc == 0 )
 	{
@@ -977,13 +1434,14 @@ void MSG_WriteDeltaEntity( msg_t *msg, entityState_t *from, entityState_t *to, b
 		return;
 	}
 
-	MSG_WriteBits( msg, to->number, GENTITYNUM_BITS );
-	MSG_WriteBits( msg, 0, 1 );  // not removed
-	MSG_WriteBits( msg, 1, 1 );  // we have a delta
+	msgBitWriter_t writer;
+	MSG_BeginBitWriter( &writer, msg );
 
-	MSG_WriteByte( msg, lc );  // # of changes
+	MSG_PutBits( &writer, to->number, GENTITYNUM_BITS );
+	MSG_PutBits( &writer, 0, 1 );  // not removed
+	MSG_PutBits( &writer, 1, 1 );  // we have a delta
 
-//  Log::Notice( "Delta for ent %i: ", to->number );
+	MSG_PutBits( &writer, lc, 8 );  // # of changes
 
 	for ( i = 0, field = entityStateFields; i < lc; i++, field++ )
 	{
@@ -992,64 +1450,21 @@ void MSG_WriteDeltaEntity( msg_t *msg, entityState_t *from, entityState_t *to, b
 
 		if ( *fromF == *toF )
 		{
-			MSG_WriteBits( msg, 0, 1 );  // no change
+			MSG_PutBits( &writer, 0, 1 );  // no change
 			continue;
 		}
 
-		MSG_WriteBits( msg, 1, 1 );  // changed
-
-		if ( field->bits == 0 )
+		if ( countStats )
 		{
-			// float
-			fullFloat = * ( float * ) toF;
-			trunc = ( int ) fullFloat;
-
-			if ( fullFloat == 0.0f )
-			{
-				MSG_WriteBits( msg, 0, 1 );
-			}
-			else
-			{
-				MSG_WriteBits( msg, 1, 1 );
-
-				if ( trunc == fullFloat && trunc + FLOAT_INT_BIAS >= 0 && trunc + FLOAT_INT_BIAS < ( 1 << FLOAT_INT_BITS ) )
-				{
-					// send as small integer
-					MSG_WriteBits( msg, 0, 1 );
-					MSG_WriteBits( msg, trunc + FLOAT_INT_BIAS, FLOAT_INT_BITS );
-//                  if ( print ) {
-//                      Log::Notice( "%s:%i ", field->name, trunc );
-//                  }
-				}
-				else
-				{
-					// send as full floating point value
-					MSG_WriteBits( msg, 1, 1 );
-					MSG_WriteBits( msg, *toF, 32 );
-//                  if ( print ) {
-//                      Log::Notice( "%s:%f ", field->name, *(float *)toF );
-//                  }
-				}
-			}
-		}
-		else
-		{
-			if ( *toF == 0 )
-			{
-				MSG_WriteBits( msg, 0, 1 );
-			}
-			else
-			{
-				MSG_WriteBits( msg, 1, 1 );
-				// integer
-				MSG_WriteBits( msg, *toF, field->bits );
-//              if ( print ) {
-//                  Log::Notice( "%s:%i ", field->name, *toF );
-//              }
-			}
+			field->used++;
 		}
+
+		MSG_PutBits( &writer, 1, 1 );  // changed
+		MSG_PutField( &writer, field, toF, true );
 	}
 
+	MSG_EndBitWriter( &writer );
+
 //  Log::Notice( "\n" );
 
 	/*
@@ -1087,7 +1502,6 @@ void MSG_ReadDeltaEntity( msg_t *msg, const entityState_t *from, entityState_t *
 	netField_t *field;
 	int        *fromF, *toF;
 	int        print;
-	int        trunc;
 	int        startBit, endBit;
 
 	if ( number < 0 || number >= MAX_GENTITIES )
@@ -1148,72 +1562,27 @@ void MSG_ReadDeltaEntity( msg_t *msg, const entityState_t *from, entityState_t *
 
 	to->number = number;
 
+	msgBitReader_t reader;
+	MSG_BeginBitReader( &reader, msg );
+
 	for ( i = 0, field = entityStateFields; i < lc; i++, field++ )
 	{
 		fromF = ( int * )( ( byte * ) from + field->offset );
 		toF = ( int * )( ( byte * ) to + field->offset );
 
-		if ( !MSG_ReadBits( msg, 1 ) )
+		if ( !MSG_GetBits( &reader, 1 ) )
 		{
 			// no change
 			*toF = *fromF;
 		}
 		else
 		{
-			if ( field->bits == 0 )
-			{
-				// float
-				if ( MSG_ReadBits( msg, 1 ) == 0 )
-				{
-					* ( float * ) toF = 0.0f;
-				}
-				else
-				{
-					if ( MSG_ReadBits( msg, 1 ) == 0 )
-					{
-						// integral float
-						trunc = MSG_ReadBits( msg, FLOAT_INT_BITS );
-						// bias to allow equal parts positive and negative
-						trunc -= FLOAT_INT_BIAS;
-						* ( float * ) toF = trunc;
-
-						if ( print )
-						{
-							Log::Notice( "%s:%i ", field->name, trunc );
-						}
-					}
-					else
-					{
-						// full floating point value
-						*toF = MSG_ReadBits( msg, 32 );
-
-						if ( print )
-						{
-							Log::Notice( "%s:%f ", field->name, * ( float * ) toF );
-						}
-					}
-				}
-			}
-			else
-			{
-				if ( MSG_ReadBits( msg, 1 ) == 0 )
-				{
-					*toF = 0;
-				}
-				else
-				{
-					// integer
-					*toF = MSG_ReadBits( msg, field->bits );
-
-					if ( print )
-					{
-						Log::Notice( "%s:%i ", field->name, *toF );
-					}
-				}
-			}
+			MSG_GetField( &reader, field, toF, true, print );
 		}
 	}
 
+	MSG_EndBitReader( &reader );
+
 	for ( i = lc, field = &entityStateFields[ lc ]; i < numFields; i++, field++ )
 	{
 		fromF = ( int * )( ( byte * ) from + field->offset );
@@ -1266,6 +1635,7 @@ static bool IsValid(const NetcodeTable& table, int size) {
 
 static NetcodeTable playerStateFields;
 static size_t playerStateSize;
+static std::vector<int> playerStateLastFields; // see MSG_InitLastFields
 // This will be called twice (with what should be the same data both times) in a local
 // game where both the cgame and sgame are running.
 void MSG_InitNetcodeTables(NetcodeTable playerStateTable, int psSize) {
@@ -1274,6 +1644,8 @@ void MSG_InitNetcodeTables(NetcodeTable playerStateTable, int psSize) {
 
 	playerStateFields = std::move(playerStateTable);
 	playerStateSize = psSize;
+	playerStateLastFields.resize(psSize / 4);
+	MSG_InitLastFields(playerStateFields.data(), playerStateFields.size(), playerStateLastFields.data(), playerStateLastFields.size());
 }
 // TODO: add function to clear
 
@@ -1321,7 +1693,7 @@ void MSG_PrioritisePlayerStateFields()
 }
 
 // includes presence bit
-static void WriteStatsGroup(msg_t* msg, const int* from, const int* to)
+static void WriteStatsGroup(msgBitWriter_t* writer, const int* from, const int* to)
 {
 	int statsbits = 0;
 	for ( int i = 0; i < STATS_GROUP_NUM_STATS; i++ )
@@ -1333,18 +1705,18 @@ static void WriteStatsGroup(msg_t* msg, const int* from, const int* to)
 	}
 	if (!statsbits)
 	{
-		MSG_WriteBits( msg, 0, 1 );  // no change to stats
+		MSG_PutBits( writer, 0, 1 );  // no change to stats
 		return;
 	}
 
-	MSG_WriteBits( msg, 1, 1 );  // changed
-	MSG_WriteShort( msg, statsbits );
+	MSG_PutBits( writer, 1, 1 );  // changed
+	MSG_PutBits( writer, statsbits, 16 );
 
 	for ( int i = 0; i < MAX_STATS; i++ )
 	{
 		if ( statsbits & ( 1 << i ) )
 		{
-			MSG_WriteShort( msg, to[i] );  //----(SA)    back to short since weapon bits are handled elsewhere now
+			MSG_PutBits( writer, to[i], 16 );  //----(SA)    back to short since weapon bits are handled elsewhere now
 		}
 	}
 }
@@ -1359,10 +1731,9 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, OpaquePlayerState *from, OpaquePlaye
 {
 	int           lc;
 	int        *fromF, *toF;
-	float      fullFloat;
-	int        trunc;
 	int        startBit, endBit;
 	int        print;
+	bool       countStats = MSG_CountFieldStats();
 
 	if ( playerStateFields.empty() )
 		Sys::Drop( "no netcode table" );
@@ -1395,27 +1766,16 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, OpaquePlayerState *from, OpaquePlaye
 		print = 0;
 	}
 
-	int numFields = playerStateFields.size();
-
-	lc = 0;
-
-	for ( int i = 0; i < numFields; i++ )
-	{
-		netField_t* field = &playerStateFields[i];
-		fromF = ( int * )( ( byte * ) from + field->offset );
-		toF = ( int * )( ( byte * ) to + field->offset );
+	int numWords = playerStateSize / 4;
+	uint64_t changed[ ( MAX_DELTA_WORDS + 63 ) / 64 ];
 
-		if (field->bits == STATS_GROUP_FIELD
-			? memcmp(fromF, toF, sizeof(int) * STATS_GROUP_NUM_STATS)
-			: *fromF != *toF )
-		{
-			lc = i + 1;
+	MSG_ChangedWords( ( int * ) from, ( int * ) to, numWords, changed );
+	lc = MSG_LastChangedField( changed, numWords, playerStateLastFields.data() );
 
-			field->used++;
-		}
-	}
+	msgBitWriter_t writer;
+	MSG_BeginBitWriter( &writer, msg );
 
-	MSG_WriteByte( msg, lc );  // # of changes
+	MSG_PutBits( &writer, lc, 8 );  // # of changes
 
 	for ( int i = 0; i < lc; i++ )
 	{
@@ -1425,52 +1785,28 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, OpaquePlayerState *from, OpaquePlaye
 
 		if (field->bits == STATS_GROUP_FIELD)
 		{
-			WriteStatsGroup(msg, fromF, toF);
+			if (countStats && memcmp(fromF, toF, sizeof(int) * STATS_GROUP_NUM_STATS))
+				field->used++;
+			WriteStatsGroup(&writer, fromF, toF);
 			continue;
 		}
 		if ( *fromF == *toF )
 		{
-			MSG_WriteBits( msg, 0, 1 );  // no change
+			MSG_PutBits( &writer, 0, 1 );  // no change
 			continue;
 		}
 
-		MSG_WriteBits( msg, 1, 1 );  // changed
-
-		if ( field->bits == 0 )
+		if ( countStats )
 		{
-			// float
-			fullFloat = * ( float * ) toF;
-			trunc = ( int ) fullFloat;
-
-			if ( trunc == fullFloat && trunc + FLOAT_INT_BIAS >= 0 && trunc + FLOAT_INT_BIAS < ( 1 << FLOAT_INT_BITS ) )
-			{
-				// send as small integer
-				MSG_WriteBits( msg, 0, 1 );
-				MSG_WriteBits( msg, trunc + FLOAT_INT_BIAS, FLOAT_INT_BITS );
-//              if ( print ) {
-//                  Log::Notice( "%s:%i ", field->name, trunc );
-//              }
-			}
-			else
-			{
-				// send as full floating point value
-				MSG_WriteBits( msg, 1, 1 );
-				MSG_WriteBits( msg, *toF, 32 );
-//              if ( print ) {
-//                  Log::Notice( "%s:%f ", field->name, *(float *)toF );
-//              }
-			}
-		}
-		else
-		{
-			// integer
-			MSG_WriteBits( msg, *toF, field->bits );
-//          if ( print ) {
-//              Log::Notice( "%s:%i ", field->name, *toF );
-//          }
+			field->used++;
 		}
+
+		MSG_PutBits( &writer, 1, 1 );  // changed
+		MSG_PutField( &writer, field, toF, false );
 	}
 
+	MSG_EndBitWriter( &writer );
+
 	if ( print )
 	{
 		if ( msg->bit == 0 )
@@ -1487,16 +1823,16 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, OpaquePlayerState *from, OpaquePlaye
 }
 
 // does not include presence bit
-static void ReadStatsGroup(msg_t* msg, int* to, const netField_t& field)
+static void ReadStatsGroup(msgBitReader_t* reader, int* to, const netField_t& field)
 {
 	LOG( field.name );
-	int bits = MSG_ReadShort( msg );
+	int bits = MSG_GetShort( reader );
 
 	for ( int i = 0; i < STATS_GROUP_NUM_STATS; i++ )
 	{
 		if ( bits & ( 1 << i ) )
 		{
-			to[i] = MSG_ReadShort( msg );  //----(SA)    back to short since weapon bits are handled elsewhere now
+			to[i] = MSG_GetShort( reader );  //----(SA)    back to short since weapon bits are handled elsewhere now
 		}
 	}
 }
@@ -1511,7 +1847,6 @@ void MSG_ReadDeltaPlayerstate( msg_t *msg, OpaquePlayerState *from, OpaquePlayer
 	int           startBit, endBit;
 	int           print;
 	int           *fromF, *toF;
-	int           trunc;
 
 	if (playerStateFields.empty())
 		Sys::Drop("no netcode table");
@@ -1553,13 +1888,16 @@ void MSG_ReadDeltaPlayerstate( msg_t *msg, OpaquePlayerState *from, OpaquePlayer
 		Sys::Drop( "invalid playerState field count" );
 	}
 
+	msgBitReader_t reader;
+	MSG_BeginBitReader( &reader, msg );
+
 	for ( int i = 0; i < lc; i++ )
 	{
 		netField_t* field = &playerStateFields[i];
 		fromF = ( int * )( ( byte * ) from + field->offset );
 		toF = ( int * )( ( byte * ) to + field->offset );
 
-		if ( !MSG_ReadBits( msg, 1 ) )
+		if ( !MSG_GetBits( &reader, 1 ) )
 		{
 			// no change
 			if (field->bits == STATS_GROUP_FIELD)
@@ -1567,52 +1905,18 @@ void MSG_ReadDeltaPlayerstate( msg_t *msg, OpaquePlayerState *from, OpaquePlayer
 			else
 				*toF = *fromF;
 		}
+		else if ( field->bits == STATS_GROUP_FIELD )
+		{
+			ReadStatsGroup(&reader, toF, *field);
+		}
 		else
 		{
-			if ( field->bits == 0 )
-			{
-				// float
-				if ( MSG_ReadBits( msg, 1 ) == 0 )
-				{
-					// integral float
-					trunc = MSG_ReadBits( msg, FLOAT_INT_BITS );
-					// bias to allow equal parts positive and negative
-					trunc -= FLOAT_INT_BIAS;
-					* ( float * ) toF = trunc;
-
-					if ( print )
-					{
-						Log::Notice( "%s:%i ", field->name, trunc );
-					}
-				}
-				else
-				{
-					// full floating point value
-					*toF = MSG_ReadBits( msg, 32 );
-
-					if ( print )
-					{
-						Log::Notice( "%s:%f ", field->name, * ( float * ) toF );
-					}
-				}
-			}
-			else if ( field->bits == STATS_GROUP_FIELD )
-			{
-				ReadStatsGroup(msg, toF, *field);
-			}
-			else
-			{
-				// integer
-				*toF = MSG_ReadBits( msg, field->bits );
-
-				if ( print )
-				{
-					Log::Notice( "%s:%i ", field->name, *toF );
-				}
-			}
+			MSG_GetField( &reader, field, toF, false, print );
 		}
 	}
 
+	MSG_EndBitReader( &reader );
+
 	if ( print )
 	{
 		if ( msg->bit == 0 )
@@ -1903,6 +2207,248 @@ void MSG_initHuffman()
 			Huff_addRef( &msgHuff.decompressor, ( byte ) i );  /* Do update */
 		}
 	}
+
+	if ( !Huff_BuildTables( &msgHuff, &msgHuffTables ) )
+	{
+		Sys::Error( "MSG_initHuffman: the message codes don't fit the lookup tables" );
+	}
 }
 
+class TestHuffmanCmd: public Cmd::StaticCmd {
+public:
+	TestHuffmanCmd()
+		: Cmd::StaticCmd("msg_testHuffman", Cmd::SYSTEM, "checks the table driven Huffman codec against the tree walk and times both") {}
+
+	void Run(const Cmd::Args& args) const override
+	{
+		int iterations = 1000;
+
+		if (args.Argc() > 2 || (args.Argc() == 2 && (!Str::ParseInt(iterations, args.Argv(1)) || iterations <= 0))) {
+			PrintUsage(args, "[<iterations>]", "");
+			return;
+		}
+
+		if (!msgInit) {
+			MSG_initHuffman();
+		}
+
+		static byte treeData[ MAX_MSGLEN ], tableData[ MAX_MSGLEN ];
+		std::mt19937 rng(iterations);
+		std::vector<std::pair<int, int>> values;
+		int failures = 0;
+
+		// random values and sizes written at a random offset over garbage, then read back
+		for (int it = 0; it < iterations && failures < 10; it++) {
+			values.clear();
+
+			for (int i = rng() % 256; i >= 0; i--) {
+				int bits = 1 + rng() % 32;
+				values.emplace_back(rng() >> (rng() % 32), bits);
+			}
+
+			for (byte& b : treeData) {
+				b = rng();
+			}
+
+			Com_Memcpy(tableData, treeData, sizeof(tableData));
+
+			// a partial byte never has bits set past the last one written
+			msg_t tree, table;
+			int start = 8 * ( rng() % 8 );
+			MSG_Init(&tree, treeData, sizeof(treeData));
+			MSG_Init(&table, tableData, sizeof(tableData));
+			tree.bit = table.bit = start;
+
+			for (const auto& v : values) {
+				MSG_WriteBitsTree(&tree, v.first, v.second);
+				MSG_WriteBits(&table, v.first, v.second);
+			}
+
+			if (tree.bit != table.bit || memcmp(treeData, tableData, (tree.bit + 7) >> 3)) {
+				Print("Iteration %d: the encoded streams differ", it);
+				failures++;
+				continue;
+			}
+
+			MSG_BeginReading(&tree);
+			MSG_BeginReading(&table);
+			tree.bit = table.bit = start;
+
+			for (const auto& v : values) {
+				int expected = v.first & (0xffffffff >> (32 - v.second));
+				int fromTree = MSG_ReadBitsTree(&tree, v.second);
+				int fromTable = MSG_ReadBits(&table, v.second);
+
+				if (fromTree != expected || fromTable != expected || tree.bit != table.bit) {
+					Print("Iteration %d: read %d bits as %d with the tree and %d with the tables instead of %d",
+					      it, v.second, fromTree, fromTable, expected);
+					failures++;
+					break;
+				}
+			}
+		}
+
+		// both ways over the same bytes, following the frequencies the tree is built from
+		const int bytesPerRun = 1024;
+		std::vector<int> bytes(bytesPerRun);
+		std::discrete_distribution<int> typical(std::begin(msg_hData), std::end(msg_hData));
+		Sys::SteadyClock::duration times[ 4 ]{};
+
+		for (int& b : bytes) {
+			b = typical(rng);
+		}
+
+		for (int it = 0; it < iterations; it++) {
+			msg_t msg;
+			auto start = Sys::SteadyClock::now();
+
+			MSG_Init(&msg, tableData, sizeof(tableData));
+			for (int b : bytes) {
+				MSG_WriteBitsTree(&msg, b, 8);
+			}
+			auto written = Sys::SteadyClock::now();
+
+			MSG_BeginReading(&msg);
+			for (int i = 0; i < bytesPerRun; i++) {
+				MSG_ReadBitsTree(&msg, 8);
+			}
+			auto read = Sys::SteadyClock::now();
+
+			MSG_Init(&msg, tableData, sizeof(tableData));
+			for (int b : bytes) {
+				MSG_WriteBits(&msg, b, 8);
+			}
+			auto tableWritten = Sys::SteadyClock::now();
+
+			MSG_BeginReading(&msg);
+			for (int i = 0; i < bytesPerRun; i++) {
+				MSG_ReadBits(&msg, 8);
+			}
+			auto tableRead = Sys::SteadyClock::now();
+
+			times[ 0 ] += written - start;
+			times[ 1 ] += read - written;
+			times[ 2 ] += tableWritten - read;
+			times[ 3 ] += tableRead - tableWritten;
+		}
+
+		auto perByte = [&](Sys::SteadyClock::duration time) {
+			return std::chrono::duration<double, std::nano>(time).count() / iterations / bytesPerRun;
+		};
+
+		Print("%d round trips: %s", iterations, failures ? "FAILED" : "all identical");
+		Print("%-6s %12s %12s", "", "write ns/B", "read ns/B");
+		Print("%-6s %12.2f %12.2f", "tree", perByte(times[ 0 ]), perByte(times[ 1 ]));
+		Print("%-6s %12.2f %12.2f", "tables", perByte(times[ 2 ]), perByte(times[ 3 ]));
+	}
+};
+static TestHuffmanCmd TestHuffmanCmdRegistration;
+
+class BenchDeltaCmd: public Cmd::StaticCmd {
+public:
+	BenchDeltaCmd()
+		: Cmd::StaticCmd("msg_benchDelta", Cmd::SYSTEM, "times the writing and reading of entity deltas like the ones of a snapshot") {}
+
+	void Run(const Cmd::Args& args) const override
+	{
+		int iterations = 1000;
+
+		if (args.Argc() > 2 || (args.Argc() == 2 && (!Str::ParseInt(iterations, args.Argv(1)) || iterations <= 0))) {
+			PrintUsage(args, "[<iterations>]", "");
+			return;
+		}
+
+		if (!msgInit) {
+			MSG_initHuffman();
+		}
+
+		// entities with a few fields changed, some of the floats being integral
+		const int numEntities = 256;
+		std::vector<entityState_t> from(numEntities), to(numEntities), read(numEntities);
+		std::mt19937 rng(numEntities);
+		std::uniform_real_distribution<float> position(-4096.0f, 4096.0f);
+
+		for (int i = 0; i < numEntities; i++) {
+			for (int pass = 0; pass < 2; pass++) {
+				entityState_t& state = pass ? to[ i ] : from[ i ];
+
+				if (pass) {
+					state = from[ i ];
+				}
+
+				for (const netField_t& field : entityStateFields) {
+					int* value = reinterpret_cast<int*>(reinterpret_cast<byte*>(&state) + field.offset);
+
+					if (pass && rng() % 8) {
+						continue;
+					}
+
+					if (rng() % 4 == 0) {
+						*value = 0;
+					} else if (field.bits == 0) {
+						float f = rng() % 2 ? std::round(position(rng) / 4.0f) : position(rng);
+						Com_Memcpy(value, &f, sizeof(f));
+					} else {
+						*value = rng() & (0xffffffff >> (32 - std::abs(field.bits)));
+					}
+				}
+
+				state.number = i;
+			}
+		}
+
+		static byte data[ MAX_MSGLEN ];
+		msg_t msg;
+		Sys::SteadyClock::duration writeTime{}, readTime{}, nearlyTime{};
+		bool identical = true;
+
+		// most entities barely change between snapshots
+		std::vector<entityState_t> nearly(from);
+		for (entityState_t& state : nearly) {
+			state.pos.trTime++;
+		}
+
+		for (int it = 0; it < iterations; it++) {
+			auto nearlyStart = Sys::SteadyClock::now();
+
+			MSG_Init(&msg, data, sizeof(data));
+			for (int i = 0; i < numEntities; i++) {
+				MSG_WriteDeltaEntity(&msg, &from[ i ], &nearly[ i ], false);
+			}
+			nearlyTime += Sys::SteadyClock::now() - nearlyStart;
+
+			auto start = Sys::SteadyClock::now();
+
+			MSG_Init(&msg, data, sizeof(data));
+			for (int i = 0; i < numEntities; i++) {
+				MSG_WriteDeltaEntity(&msg, &from[ i ], &to[ i ], true);
+			}
+			auto written = Sys::SteadyClock::now();
+
+			MSG_BeginReading(&msg);
+			for (int i = 0; i < numEntities; i++) {
+				MSG_ReadDeltaEntity(&msg, &from[ i ], &read[ i ], MSG_ReadBits(&msg, GENTITYNUM_BITS));
+			}
+			auto done = Sys::SteadyClock::now();
+
+			writeTime += written - start;
+			readTime += done - written;
+
+			if (it == 0) {
+				identical = !msg.overflowed && !memcmp(to.data(), read.data(), sizeof(entityState_t) * numEntities);
+			}
+		}
+
+		auto perEntity = [&](Sys::SteadyClock::duration time) {
+			return std::chrono::duration<double, std::nano>(time).count() / iterations / numEntities;
+		};
+
+		Print("%d entity deltas of %.1f bytes: %s", numEntities, float(msg.cursize) / numEntities,
+		      identical ? "read back identical" : "FAILED");
+		Print("write %.1f ns/entity, read %.1f ns/entity", perEntity(writeTime), perEntity(readTime));
+		Print("write with a single change %.1f ns/entity", perEntity(nearlyTime));
+	}
+};
+static BenchDeltaCmd BenchDeltaCmdRegistration;
+
 //===========================================================================
@@ -101,6 +101,15 @@ static bool winsockInitialized = false;
 #               include <sys/filio.h>
 #       endif
 
+#       ifdef __linux__
+// recvmmsg/sendmmsg are used by the batched network mode
+#               define NET_HAVE_MMSG
+// epoll/timerfd are used by the frame scheduler
+#               define NET_HAVE_EPOLL
+#               include <sys/epoll.h>
+#               include <sys/timerfd.h>
+#       endif
+
 using SOCKET = int;
 constexpr SOCKET INVALID_SOCKET{-1};
 constexpr SOCKET SOCKET_ERROR{-1};
@@ -151,6 +160,14 @@ static cvar_t              *net_mcast6iface;
 
 static struct sockaddr     socksRelayAddr;
 
+#ifdef NET_HAVE_EPOLL
+static Cvar::Cvar<bool> net_frameScheduler("net.frameScheduler", "wait for server frames with epoll and an absolute timerfd deadline", Cvar::NONE, false);
+#endif
+
+#ifdef NET_HAVE_MMSG
+static Cvar::Cvar<bool> net_batchedIO("net.batchedIO", "drain and send UDP packets in batches with recvmmsg/sendmmsg", Cvar::NONE, false);
+#endif
+
 static SOCKET              ip_socket = INVALID_SOCKET;
 static SOCKET              ip6_socket = INVALID_SOCKET;
 static SOCKET              socks_socket = INVALID_SOCKET;
@@ -583,6 +600,353 @@ bool        NET_IsLocalAddress( const netadr_t& adr )
 
 //=============================================================================
 
+/*
+=============================================================================
+
+BATCHED NETWORK MODE
+
+With net.batchedIO enabled, every pending datagram is drained with a single
+recvmmsg call into a preallocated set of packet buffers, and the packets
+queued between NET_BeginPacketBatch and NET_FlushPacketBatch are sent with
+sendmmsg instead of one sendto per packet.
+
+=============================================================================
+*/
+
+static const int NET_BATCH_PACKETS = 64;
+
+// netchan packets are at most MAX_PACKETLEN, bigger ones bypass the batch
+static const int NET_BATCH_SEND_SLOT = 2048;
+
+struct netBatchStats_t
+{
+	uint64_t recvBatches;
+	uint64_t recvPackets;
+	int      recvMax;
+
+	uint64_t sendBatches;
+	uint64_t sendPackets;
+	int      sendMax;
+};
+
+static netBatchStats_t netBatchStats;
+
+#ifdef NET_HAVE_MMSG
+struct netRecvBatch_t
+{
+	byte                    data[ NET_BATCH_PACKETS ][ MAX_MSGLEN ];
+	struct sockaddr_storage from[ NET_BATCH_PACKETS ];
+	struct iovec            iov[ NET_BATCH_PACKETS ];
+	struct mmsghdr          hdr[ NET_BATCH_PACKETS ];
+	int                     current;
+	int                     count;
+};
+
+struct netSendBatch_t
+{
+	byte                    data[ NET_BATCH_PACKETS ][ NET_BATCH_SEND_SLOT ];
+	struct sockaddr_storage to[ NET_BATCH_PACKETS ];
+	SOCKET                  socket[ NET_BATCH_PACKETS ];
+	struct iovec            iov[ NET_BATCH_PACKETS ];
+	struct mmsghdr          hdr[ NET_BATCH_PACKETS ];
+	bool                    active;
+	int                     count;
+};
+
+static netRecvBatch_t recvBatch;
+static netSendBatch_t sendBatch;
+#endif
+
+/*
+==================
+NET_BatchMode
+
+Batching is only done with plain sockets, the SOCKS relay needs per-packet
+headers.
+==================
+*/
+bool NET_BatchMode()
+{
+#ifdef NET_HAVE_MMSG
+	return net_batchedIO.Get() && !usingSocks;
+#else
+	return false;
+#endif
+}
+
+#ifdef NET_HAVE_MMSG
+/*
+==================
+NET_ReceiveBatch
+
+Drains up to the remaining free slots from one socket, returns the number of
+packets received.
+==================
+*/
+static int NET_ReceiveBatch( SOCKET sock, int first )
+{
+	int count = NET_BATCH_PACKETS - first;
+
+	if ( sock == INVALID_SOCKET || count <= 0 )
+	{
+		return 0;
+	}
+
+	for ( int i = first; i < NET_BATCH_PACKETS; i++ )
+	{
+		recvBatch.iov[ i ].iov_base = recvBatch.data[ i ];
+		recvBatch.iov[ i ].iov_len = sizeof( recvBatch.data[ i ] );
+
+		memset( &recvBatch.hdr[ i ], 0, sizeof( recvBatch.hdr[ i ] ) );
+		recvBatch.hdr[ i ].msg_hdr.msg_name = &recvBatch.from[ i ];
+		recvBatch.hdr[ i ].msg_hdr.msg_namelen = sizeof( recvBatch.from[ i ] );
+		recvBatch.hdr[ i ].msg_hdr.msg_iov = &recvBatch.iov[ i ];
+		recvBatch.hdr[ i ].msg_hdr.msg_iovlen = 1;
+	}
+
+	int ret = recvmmsg( sock, &recvBatch.hdr[ first ], count, MSG_DONTWAIT, nullptr );
+
+	if ( ret == SOCKET_ERROR )
+	{
+		int err = socketError;
+
+		if ( err != net::errc::resource_unavailable_try_again && err != net::errc::connection_reset )
+		{
+			Log::Notice( "NET_GetPacket: %s\n", NET_ErrorString() );
+		}
+
+		return 0;
+	}
+
+	netBatchStats.recvBatches++;
+	netBatchStats.recvPackets += ret;
+	netBatchStats.recvMax = std::max( netBatchStats.recvMax, ret );
+
+	return ret;
+}
+
+/*
+==================
+NET_GetBatchedPacket
+
+Returns the next packet of the current batch, draining the sockets again
+once all of them have been consumed.
+==================
+*/
+static bool NET_GetBatchedPacket( netadr_t *net_from, msg_t *net_message )
+{
+	while ( true )
+	{
+		if ( recvBatch.current >= recvBatch.count )
+		{
+			recvBatch.current = 0;
+			recvBatch.count = NET_ReceiveBatch( ip_socket, 0 );
+			recvBatch.count += NET_ReceiveBatch( ip6_socket, recvBatch.count );
+
+			if ( recvBatch.count == 0 )
+			{
+				return false;
+			}
+		}
+
+		int index = recvBatch.current++;
+		const struct mmsghdr& hdr = recvBatch.hdr[ index ];
+		int length = hdr.msg_len;
+
+		SockadrToNetadr( ( struct sockaddr * ) &recvBatch.from[ index ], net_from );
+
+		if ( ( hdr.msg_hdr.msg_flags & MSG_TRUNC ) || length >= net_message->maxsize )
+		{
+			Log::Notice( "Oversize packet from %s\n", NET_AdrToString( *net_from ) );
+			continue;
+		}
+
+		memcpy( net_message->data, recvBatch.data[ index ], length );
+		net_message->readcount = 0;
+		net_message->cursize = length;
+		return true;
+	}
+}
+#else
+static bool NET_GetBatchedPacket( netadr_t*, msg_t* )
+{
+	return false;
+}
+#endif
+
+/*
+==================
+NET_ReportSendError
+==================
+*/
+static void NET_ReportSendError( sa_family_t family )
+{
+	if ( family == AF_INET )
+	{
+		Log::Notice( "Sys_SendPacket (ipv4): %s\n", NET_ErrorString() );
+	}
+	else if ( family == AF_INET6 )
+	{
+		Log::Notice( "Sys_SendPacket (ipv6): %s\n", NET_ErrorString() );
+	}
+	else
+	{
+		Log::Notice( "Sys_SendPacket (%i): %s\n", family , NET_ErrorString() );
+	}
+}
+
+/*
+==================
+NET_BeginPacketBatch
+
+Packets sent until the next NET_FlushPacketBatch are queued instead of sent
+==================
+*/
+void NET_BeginPacketBatch()
+{
+#ifdef NET_HAVE_MMSG
+	sendBatch.active = NET_BatchMode();
+#endif
+}
+
+#ifdef NET_HAVE_MMSG
+/*
+==================
+NET_SendBatch
+
+Sends the queued packets, one sendmmsg call per run of packets going
+through the same socket.
+==================
+*/
+static void NET_SendBatch()
+{
+	int first = 0;
+
+	while ( first < sendBatch.count )
+	{
+		SOCKET sock = sendBatch.socket[ first ];
+		int    last = first + 1;
+
+		while ( last < sendBatch.count && sendBatch.socket[ last ] == sock )
+		{
+			last++;
+		}
+
+		int ret = sendmmsg( sock, &sendBatch.hdr[ first ], last - first, 0 );
+
+		if ( ret == SOCKET_ERROR )
+		{
+			// skip the packet that failed and retry with the rest of the run
+			if ( socketError != net::errc::resource_unavailable_try_again )
+			{
+				NET_ReportSendError( sendBatch.to[ first ].ss_family );
+			}
+
+			ret = 1;
+		}
+		else
+		{
+			netBatchStats.sendBatches++;
+			netBatchStats.sendPackets += ret;
+			netBatchStats.sendMax = std::max( netBatchStats.sendMax, ret );
+		}
+
+		first += ret;
+	}
+
+	sendBatch.count = 0;
+}
+
+/*
+==================
+NET_QueueBatchedPacket
+
+Returns false if the packet has to be sent right away
+==================
+*/
+static bool NET_QueueBatchedPacket( SOCKET sock, int length, const void *data, const struct sockaddr_storage& to, socklen_t tolen )
+{
+	if ( !sendBatch.active )
+	{
+		return false;
+	}
+
+	if ( length > NET_BATCH_SEND_SLOT )
+	{
+		// keep the packets in order
+		NET_SendBatch();
+		return false;
+	}
+
+	if ( sendBatch.count == NET_BATCH_PACKETS )
+	{
+		NET_SendBatch();
+	}
+
+	int index = sendBatch.count++;
+
+	memcpy( sendBatch.data[ index ], data, length );
+	sendBatch.to[ index ] = to;
+	sendBatch.socket[ index ] = sock;
+
+	sendBatch.iov[ index ].iov_base = sendBatch.data[ index ];
+	sendBatch.iov[ index ].iov_len = length;
+
+	memset( &sendBatch.hdr[ index ], 0, sizeof( sendBatch.hdr[ index ] ) );
+	sendBatch.hdr[ index ].msg_hdr.msg_name = &sendBatch.to[ index ];
+	sendBatch.hdr[ index ].msg_hdr.msg_namelen = tolen;
+	sendBatch.hdr[ index ].msg_hdr.msg_iov = &sendBatch.iov[ index ];
+	sendBatch.hdr[ index ].msg_hdr.msg_iovlen = 1;
+
+	return true;
+}
+#endif
+
+/*
+==================
+NET_FlushPacketBatch
+==================
+*/
+void NET_FlushPacketBatch()
+{
+#ifdef NET_HAVE_MMSG
+	NET_SendBatch();
+	sendBatch.active = false;
+#endif
+}
+
+class NetBatchStatsCmd: public Cmd::StaticCmd {
+public:
+	NetBatchStatsCmd()
+		: Cmd::StaticCmd("netBatchStats", Cmd::SYSTEM, "shows the batch sizes achieved by net.batchedIO") {}
+
+	void Run(const Cmd::Args& args) const override
+	{
+		if (args.Argc() == 2 && args.Argv(1) == "reset") {
+			netBatchStats = {};
+			return;
+		}
+
+		if (args.Argc() != 1) {
+			PrintUsage(args, "[reset]", "");
+			return;
+		}
+
+		Print("batched I/O: %s", NET_BatchMode() ? "enabled" : "disabled");
+		Print("received: %lu batches, %lu packets, %.2f average, %d max",
+			netBatchStats.recvBatches, netBatchStats.recvPackets,
+			netBatchStats.recvBatches ? double(netBatchStats.recvPackets) / netBatchStats.recvBatches : 0.0,
+			netBatchStats.recvMax);
+		Print("sent: %lu batches, %lu packets, %.2f average, %d max",
+			netBatchStats.sendBatches, netBatchStats.sendPackets,
+			netBatchStats.sendBatches ? double(netBatchStats.sendPackets) / netBatchStats.sendBatches : 0.0,
+			netBatchStats.sendMax);
+	}
+};
+static NetBatchStatsCmd NetBatchStatsCmdRegistration;
+
+//=============================================================================
+
 /*
 ==================
 Sys_GetPacket
@@ -597,8 +961,14 @@ bool Sys_GetPacket( netadr_t *net_from, msg_t *net_message )
 
 	socklen_t               fromlen;
 	int                     err;
+	bool                    batched = NET_BatchMode();
 
-	if ( ip_socket != INVALID_SOCKET )
+	if ( batched && NET_GetBatchedPacket( net_from, net_message ) )
+	{
+		return true;
+	}
+
+	if ( !batched && ip_socket != INVALID_SOCKET )
 	{
 		fromlen = sizeof( from );
 		ret = recvfrom( ip_socket, ( char * ) net_message->data, net_message->maxsize, 0, ( struct sockaddr * ) &from, &fromlen );
@@ -648,7 +1018,7 @@ bool Sys_GetPacket( netadr_t *net_from, msg_t *net_message )
 		}
 	}
 
-	if ( ip6_socket != INVALID_SOCKET )
+	if ( !batched && ip6_socket != INVALID_SOCKET )
 	{
 		fromlen = sizeof( from );
 		ret = recvfrom( ip6_socket, ( char * ) net_message->data, net_message->maxsize, 0, ( struct sockaddr * ) &from, &fromlen );
@@ -761,10 +1131,22 @@ void Sys_SendPacket( int length, const void *data, const netadr_t& to )
 	{
 		if ( addr.ss_family == AF_INET )
 		{
+#ifdef NET_HAVE_MMSG
+			if ( NET_QueueBatchedPacket( ip_socket, length, data, addr, sizeof( struct sockaddr_in ) ) )
+			{
+				return;
+			}
+#endif
 			ret = sendto( ip_socket, ( const char* )data, length, 0, ( struct sockaddr * ) &addr, sizeof( struct sockaddr_in ) );
 		}
 		else if ( addr.ss_family == AF_INET6 )
 		{
+#ifdef NET_HAVE_MMSG
+			if ( NET_QueueBatchedPacket( ip6_socket, length, data, addr, sizeof( struct sockaddr_in6 ) ) )
+			{
+				return;
+			}
+#endif
 			ret = sendto( ip6_socket, ( const char* )data, length, 0, ( struct sockaddr * ) &addr, sizeof( struct sockaddr_in6 ) );
 		}
 	}
@@ -785,18 +1167,7 @@ void Sys_SendPacket( int length, const void *data, const netadr_t& to )
 			return;
 		}
 
-		if ( addr.ss_family == AF_INET )
-		{
-			Log::Notice( "Sys_SendPacket (ipv4): %s\n", NET_ErrorString() );
-		}
-		else if ( addr.ss_family == AF_INET6 )
-		{
-			Log::Notice( "Sys_SendPacket (ipv6): %s\n", NET_ErrorString() );
-		}
-		else
-		{
-			Log::Notice( "Sys_SendPacket (%i): %s\n", addr.ss_family , NET_ErrorString() );
-		}
+		NET_ReportSendError( addr.ss_family );
 	}
 }
 
@@ -1804,6 +2175,14 @@ void NET_Config( bool enableNetworking )
 
 	if ( stop )
 	{
+#ifdef NET_HAVE_MMSG
+		// drop the packets batched for the sockets being closed
+		recvBatch.current = recvBatch.count = 0;
+		sendBatch.count = 0;
+#endif
+
+		NET_ResetFrameScheduler();
+
 		if ( ip_socket != INVALID_SOCKET )
 		{
 			closesocket( ip_socket );
@@ -2013,6 +2392,337 @@ void NET_Sleep( int msec )
 	select( highestfd + 1, &fdset, nullptr, nullptr, &timeout );
 }
 
+/*
+=============================================================================
+
+FRAME SCHEDULER
+
+With net.frameScheduler enabled, the dedicated server waits for the next
+frame in epoll, with a timerfd armed at the absolute time the frame is due.
+The game sockets, the TTY console and the sgame root socket wake it up
+early so that their events are handled without waiting for the deadline.
+
+=============================================================================
+*/
+
+// frame start lateness histogram bucket upper bounds, in microseconds
+static const int lateness_buckets[] = { 10, 50, 100, 250, 500, 1000, 2000, 5000 };
+static const int NUM_LATENESS_BUCKETS = ARRAY_LEN( lateness_buckets ) + 1;
+
+struct frameSchedulerStats_t
+{
+	uint64_t frames;
+	uint64_t wakeups;
+	uint64_t histogram[ NUM_LATENESS_BUCKETS ];
+	std::chrono::nanoseconds total;
+	std::chrono::nanoseconds max;
+};
+
+static frameSchedulerStats_t schedulerStats;
+
+#ifdef NET_HAVE_EPOLL
+static const int MAX_SCHEDULER_FDS = 5;
+
+static int epollFd = -1;
+static int timerFd = -1;
+static int scheduledFds[ MAX_SCHEDULER_FDS ];
+static int numScheduledFds;
+
+// absolute deadline of the last wait, until the frame it was for starts
+static bool                          frameDeadlinePending = false;
+static Sys::SteadyClock::time_point  frameDeadline;
+
+/*
+====================
+NET_SchedulerFds
+
+Handles the scheduler has to wake up for. The console and the VM sockets are
+not read from the event loop when they become readable so they are
+registered as edge-triggered.
+====================
+*/
+static int NET_SchedulerFds( int *fds, uint32_t *events )
+{
+	int count = 0;
+
+	if ( ip_socket != INVALID_SOCKET )
+	{
+		fds[ count ] = ip_socket;
+		events[ count++ ] = EPOLLIN;
+	}
+
+	if ( ip6_socket != INVALID_SOCKET )
+	{
+		fds[ count ] = ip6_socket;
+		events[ count++ ] = EPOLLIN;
+	}
+
+	if ( isatty( STDIN_FILENO ) )
+	{
+		fds[ count ] = STDIN_FILENO;
+		events[ count++ ] = EPOLLIN | EPOLLET;
+	}
+
+#ifdef BUILD_SERVER
+	if ( gvm.IsActive() && Sys::IsValidHandle( gvm.GetRootSocketHandle() ) )
+	{
+		fds[ count ] = gvm.GetRootSocketHandle();
+		events[ count++ ] = EPOLLIN | EPOLLET;
+	}
+#endif
+
+	return count;
+}
+
+/*
+====================
+NET_SchedulerInit
+
+(Re)creates the epoll set when the watched handles changed
+====================
+*/
+static bool NET_SchedulerInit()
+{
+	int      fds[ MAX_SCHEDULER_FDS ];
+	uint32_t events[ MAX_SCHEDULER_FDS ];
+	int      count = NET_SchedulerFds( fds, events );
+
+	if ( epollFd != -1 && count == numScheduledFds && !memcmp( fds, scheduledFds, count * sizeof( int ) ) )
+	{
+		return true;
+	}
+
+	if ( timerFd == -1 )
+	{
+		timerFd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+
+		if ( timerFd == -1 )
+		{
+			Log::Warn( "NET_SchedulerInit: timerfd_create: %s", strerror( errno ) );
+			return false;
+		}
+	}
+
+	// recreating the set is simpler than diffing it, and only happens
+	// when sockets are reopened or the VM is restarted
+	if ( epollFd != -1 )
+	{
+		close( epollFd );
+	}
+
+	epollFd = epoll_create1( EPOLL_CLOEXEC );
+
+	if ( epollFd == -1 )
+	{
+		Log::Warn( "NET_SchedulerInit: epoll_create1: %s", strerror( errno ) );
+		return false;
+	}
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = timerFd;
+	epoll_ctl( epollFd, EPOLL_CTL_ADD, timerFd, &ev );
+
+	for ( int i = 0; i < count; i++ )
+	{
+		ev.events = events[ i ];
+		ev.data.fd = fds[ i ];
+
+		if ( epoll_ctl( epollFd, EPOLL_CTL_ADD, fds[ i ], &ev ) == -1 )
+		{
+			Log::Debug( "NET_SchedulerInit: can't watch handle %d: %s", fds[ i ], strerror( errno ) );
+		}
+	}
+
+	memcpy( scheduledFds, fds, count * sizeof( int ) );
+	numScheduledFds = count;
+	return true;
+}
+
+#endif
+
+/*
+====================
+NET_ResetFrameScheduler
+
+Must be called when a watched handle is closed, a new one may reuse its
+number and wouldn't be noticed otherwise
+====================
+*/
+void NET_ResetFrameScheduler()
+{
+#ifdef NET_HAVE_EPOLL
+	if ( epollFd != -1 )
+	{
+		close( epollFd );
+		epollFd = -1;
+	}
+
+	if ( timerFd != -1 )
+	{
+		close( timerFd );
+		timerFd = -1;
+	}
+
+	numScheduledFds = 0;
+	frameDeadlinePending = false;
+#endif
+}
+
+/*
+====================
+NET_UseFrameScheduler
+====================
+*/
+bool NET_UseFrameScheduler()
+{
+#ifdef NET_HAVE_EPOLL
+	return net_frameScheduler.Get();
+#else
+	return false;
+#endif
+}
+
+/*
+====================
+NET_SleepUntil
+
+Sleeps until Sys_Milliseconds() reaches deadline or until something
+happens on the network, the console or the game VM
+====================
+*/
+void NET_SleepUntil( int deadline )
+{
+#ifdef NET_HAVE_EPOLL
+	if ( NET_UseFrameScheduler() && NET_SchedulerInit() )
+	{
+		frameDeadline = Sys::MillisecondsTimePoint( deadline );
+		frameDeadlinePending = true;
+
+		if ( Sys::SteadyClock::now() >= frameDeadline )
+		{
+			return;
+		}
+
+		// steady_clock is CLOCK_MONOTONIC so its epoch matches the timerfd one
+		auto sinceEpoch = std::chrono::duration_cast<std::chrono::nanoseconds>( frameDeadline.time_since_epoch() ).count();
+		struct itimerspec spec;
+		memset( &spec, 0, sizeof( spec ) );
+		spec.it_value.tv_sec = sinceEpoch / 1000000000;
+		spec.it_value.tv_nsec = sinceEpoch % 1000000000;
+
+		if ( timerfd_settime( timerFd, TFD_TIMER_ABSTIME, &spec, nullptr ) == -1 )
+		{
+			Log::Warn( "NET_SleepUntil: timerfd_settime: %s", strerror( errno ) );
+			NET_ResetFrameScheduler();
+			return;
+		}
+
+		struct epoll_event events[ MAX_SCHEDULER_FDS + 1 ];
+		int count;
+
+		do
+		{
+			count = epoll_wait( epollFd, events, ARRAY_LEN( events ), -1 );
+		} while ( count == -1 && errno == EINTR );
+
+		schedulerStats.wakeups++;
+
+		for ( int i = 0; i < count; i++ )
+		{
+			if ( events[ i ].data.fd == timerFd )
+			{
+				uint64_t expirations;
+
+				if ( read( timerFd, &expirations, sizeof( expirations ) ) < 0 && errno != EAGAIN )
+				{
+					Log::Debug( "NET_SleepUntil: timerfd read: %s", strerror( errno ) );
+				}
+			}
+		}
+
+		return;
+	}
+#endif
+
+	NET_Sleep( deadline - Sys::Milliseconds() );
+}
+
+/*
+====================
+NET_FrameStarted
+
+Called by the server when a frame starts, to measure how late it is
+compared to the deadline the scheduler waited for
+====================
+*/
+void NET_FrameStarted()
+{
+#ifdef NET_HAVE_EPOLL
+	if ( !frameDeadlinePending )
+	{
+		return;
+	}
+
+	frameDeadlinePending = false;
+
+	auto lateness = std::max( std::chrono::nanoseconds::zero(),
+		std::chrono::duration_cast<std::chrono::nanoseconds>( Sys::SteadyClock::now() - frameDeadline ) );
+	int  usec = std::chrono::duration_cast<std::chrono::microseconds>( lateness ).count();
+	int  bucket = 0;
+
+	while ( bucket < NUM_LATENESS_BUCKETS - 1 && usec >= lateness_buckets[ bucket ] )
+	{
+		bucket++;
+	}
+
+	schedulerStats.frames++;
+	schedulerStats.histogram[ bucket ]++;
+	schedulerStats.total += lateness;
+	schedulerStats.max = std::max( schedulerStats.max, lateness );
+#endif
+}
+
+class FrameLatenessCmd: public Cmd::StaticCmd {
+public:
+	FrameLatenessCmd()
+		: Cmd::StaticCmd("frameLateness", Cmd::SYSTEM, "shows the frame start lateness histogram of net.frameScheduler") {}
+
+	void Run(const Cmd::Args& args) const override
+	{
+		if (args.Argc() == 2 && args.Argv(1) == "reset") {
+			schedulerStats = {};
+			return;
+		}
+
+		if (args.Argc() != 1) {
+			PrintUsage(args, "[reset]", "");
+			return;
+		}
+
+		Print("frame scheduler: %s", NET_UseFrameScheduler() ? "enabled" : "disabled");
+
+		if (!schedulerStats.frames) {
+			return;
+		}
+
+		Print("%lu frames, %lu wakeups, %.1fµs average, %.1fµs max",
+			schedulerStats.frames, schedulerStats.wakeups,
+			schedulerStats.total.count() / 1000.0 / schedulerStats.frames,
+			schedulerStats.max.count() / 1000.0);
+
+		for (int i = 0; i < NUM_LATENESS_BUCKETS; i++) {
+			std::string range = i < NUM_LATENESS_BUCKETS - 1
+				? Str::Format("< %dµs", lateness_buckets[i])
+				: Str::Format(">= %dµs", lateness_buckets[i - 1]);
+
+			Print("%10s: %lu (%.1f%%)", range, schedulerStats.histogram[i],
+				100.0 * schedulerStats.histogram[i] / schedulerStats.frames);
+		}
+	}
+};
+static FrameLatenessCmd FrameLatenessCmdRegistration;
+
 /*
 ====================
 NET_Restart_f
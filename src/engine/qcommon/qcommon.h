@@ -65,6 +65,7 @@ struct usercmd_t;
 struct entityState_t;
 
 void  MSG_WriteBits( msg_t *msg, int value, int bits );
+bool  MSG_WriteEncodedBits( msg_t *msg, const byte *data, int bits, int uncompressedBits );
 
 void  MSG_WriteChar( msg_t *sb, int c );
 void  MSG_WriteByte( msg_t *sb, int c );
@@ -154,6 +155,9 @@ void       NET_Restart_f();
 void       NET_Config( bool enableNetworking );
 
 void       NET_SendPacket( netsrc_t sock, int length, const void *data, const netadr_t& to );
+bool       NET_BatchMode();
+void       NET_BeginPacketBatch();
+void       NET_FlushPacketBatch();
 
 bool   NET_CompareAdr( const netadr_t& a, const netadr_t& b );
 bool   NET_CompareBaseAdr( const netadr_t& a, const netadr_t& b );
@@ -168,6 +172,10 @@ void       NET_JoinMulticast6();
 void       NET_LeaveMulticast6();
 
 void       NET_Sleep( int msec );
+bool       NET_UseFrameScheduler();
+void       NET_SleepUntil( int deadline );
+void       NET_FrameStarted();
+void       NET_ResetFrameScheduler();
 
 #ifdef HAVE_GEOIP
 const char *NET_GeoIP_Country( const netadr_t *a );
@@ -812,6 +820,73 @@ void             Huff_offsetTransmit( huff_t *huff, int ch, byte *fout, int *off
 void             Huff_putBit( int bit, byte *fout, int *offset );
 int              Huff_getBit( byte *fout, int *offset );
 
+/* Lookup tables for a tree that doesn't change anymore, such as the one of
+ * the bitstream messages, giving the same bits as Huff_offsetTransmit and
+ * Huff_offsetReceive without walking the tree one bit at a time */
+
+#define HUFF_DECODE_BITS 11
+
+struct huffTables_t
+{
+    // code of each symbol, the first bit sent being the lowest one
+    uint64_t     codes[ HMAX ];
+    byte         lengths[ HMAX ];
+    int          maxLength;
+
+    // indexed by the next HUFF_DECODE_BITS bits: the symbol and length of
+    // the code they start with, or the node reached for longer codes
+    uint32_t     decode[ 1 << HUFF_DECODE_BITS ];
+    const node_t *subtrees[ 1 << HUFF_DECODE_BITS ];
+};
+
+bool             Huff_BuildTables( const huffman_t *huff, huffTables_t *tables );
+void             Huff_WriteBits( const huffTables_t *tables, byte *fout, int *offset, uint32_t value, int bits );
+uint32_t         Huff_ReadBits( const huffTables_t *tables, const byte *fin, int size, int *offset, int bits );
+
+// For a run of Huff_WriteBits or Huff_ReadBits on the same buffer, keeping
+// the bits in a 64 bit word between the calls
+struct huffWriter_t
+{
+    byte     *fout;
+    int      base; // byte the buffer starts at
+    uint64_t buffer;
+    int      length;
+};
+
+struct huffReader_t
+{
+    const byte *fin;
+    int        size;
+    int        offset;
+    uint64_t   buffer; // the bits following offset
+    int        available;
+};
+
+inline int Huff_WriterOffset( const huffWriter_t *writer )
+{
+    return writer->base * 8 + writer->length;
+}
+
+void             Huff_SpillWriter( huffWriter_t *writer );
+
+// Appends bits that aren't coded, like the bits & 7 lowest ones of a value
+inline void Huff_PutRawBits( huffWriter_t *writer, uint32_t value, int bits )
+{
+    if ( writer->length + bits > 64 )
+    {
+        Huff_SpillWriter( writer );
+    }
+
+    writer->buffer |= uint64_t( value ) << writer->length;
+    writer->length += bits;
+}
+
+void             Huff_BeginWriter( huffWriter_t *writer, byte *fout, int offset );
+void             Huff_PutBits( const huffTables_t *tables, huffWriter_t *writer, uint32_t value, int bits );
+int              Huff_EndWriter( huffWriter_t *writer );
+void             Huff_BeginReader( huffReader_t *reader, const byte *fin, int size, int offset );
+uint32_t         Huff_GetBits( const huffTables_t *tables, huffReader_t *reader, int bits );
+
 #define _(x) Trans_Gettext(x)
 #define C_(x, y) Trans_Pgettext(x, y)
 #define N_(x) (x)
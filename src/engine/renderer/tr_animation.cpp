@@ -600,20 +600,20 @@ void R_AnimationList_f()
 
 /*
 =============
-R_CullMD5
+R_CullMD5Model
+
+Culls the entire model if its bounding box is outside the view frustum
 =============
 */
-static void R_CullMD5( trRefEntity_t *ent )
+void R_CullMD5Model( trRefEntity_t *ent, const model_t *model, const orientationr_t *orientation, frontEndCounters_t *counters )
 {
 	int        i;
 
 	if ( ent->e.skeleton.type == refSkeletonType_t::SK_INVALID )
 	{
 		// no properly set skeleton so use the bounding box by the model instead by the animations
-		md5Model_t *model = tr.currentModel->md5;
-
-		VectorCopy( model->bounds[ 0 ], ent->localBounds[ 0 ] );
-		VectorCopy( model->bounds[ 1 ], ent->localBounds[ 1 ] );
+		VectorCopy( model->md5->bounds[ 0 ], ent->localBounds[ 0 ] );
+		VectorCopy( model->md5->bounds[ 1 ], ent->localBounds[ 1 ] );
 	}
 	else
 	{
@@ -625,23 +625,23 @@ static void R_CullMD5( trRefEntity_t *ent )
 		}
 	}
 
-	R_SetupEntityWorldBounds(ent);
+	R_SetupEntityWorldBounds( ent, orientation );
 
 	switch ( R_CullBox( ent->worldBounds ) )
 	{
 		case cullResult_t::CULL_IN:
-			tr.pc.c_box_cull_md5_in++;
+			counters->c_box_cull_md5_in++;
 			ent->cull = cullResult_t::CULL_IN;
 			return;
 
 		case cullResult_t::CULL_CLIP:
-			tr.pc.c_box_cull_md5_clip++;
+			counters->c_box_cull_md5_clip++;
 			ent->cull = cullResult_t::CULL_CLIP;
 			return;
 
 		case cullResult_t::CULL_OUT:
 		default:
-			tr.pc.c_box_cull_md5_out++;
+			counters->c_box_cull_md5_out++;
 			ent->cull = cullResult_t::CULL_OUT;
 			return;
 	}
@@ -650,6 +650,8 @@ static void R_CullMD5( trRefEntity_t *ent )
 /*
 ==============
 R_AddMD5Surfaces
+
+Adds the surfaces of an entity culled by R_CullMD5Model
 ==============
 */
 void R_AddMD5Surfaces( trRefEntity_t *ent )
@@ -666,10 +668,6 @@ void R_AddMD5Surfaces( trRefEntity_t *ent )
 	personalModel = ( ent->e.renderfx & RF_THIRD_PERSON ) &&
 	  tr.viewParms.portalLevel == 0;
 
-	// cull the entire model if merged bounding box of both frames
-	// is outside the view frustum
-	R_CullMD5( ent );
-
 	if ( ent->cull == cullResult_t::CULL_OUT )
 	{
 		return;
@@ -430,6 +430,9 @@ void RE_SetColorGrading( int slot, qhandle_t hShader )
 		return;
 	}
 
+	// the size is only known once the image is uploaded
+	R_FinishImageLoad( image );
+
 	if ( image->width != REF_COLORGRADEMAP_SIZE && image->height != REF_COLORGRADEMAP_SIZE )
 	{
 		return;
@@ -766,6 +769,9 @@ void RE_BeginFrame()
 
 	GLimp_LogComment( "--- RE_BeginFrame ---\n" );
 
+	// upload the images registered since the last frame
+	R_FinishImageLoads();
+
 	tr.frameCount++;
 	tr.frameSceneNum = 0;
 	tr.viewCount = 0;
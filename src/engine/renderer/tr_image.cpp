@@ -24,12 +24,17 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <common/FileSystem.h>
 #include "InternalImage.h"
 #include "tr_local.h"
+#include "framework/ThreadPool.h"
 
 int                  gl_filter_min = GL_LINEAR_MIPMAP_NEAREST;
 int                  gl_filter_max = GL_LINEAR;
 
 image_t              *r_imageHashTable[ IMAGE_FILE_HASH_SIZE ];
 
+// see R_FindCachedImage
+static int           textureCacheHits;
+static int           textureCacheMisses;
+
 #define Tex_ByteToFloat(v) ( ( (int)(v) - 128 ) / 127.0f )
 #define Tex_FloatToByte(v) ( 128 + (int) ( (v) * 127.0f + 0.5 ) )
 
@@ -457,7 +462,8 @@ void R_ImageList_f()
 	Log::Notice(" %i total texels (not including mipmaps)", texels );
 	Log::Notice(" %d.%02d MB total image memory", dataSize / ( 1024 * 1024 ),
 	           ( dataSize % ( 1024 * 1024 ) ) * 100 / ( 1024 * 1024 ) );
-	Log::Notice(" %i total images\n", tr.images.currentElements );
+	Log::Notice(" %i total images", tr.images.currentElements );
+	Log::Notice(" %i texture cache hits, %i misses\n", textureCacheHits, textureCacheMisses );
 }
 
 //=======================================================================
@@ -797,6 +803,73 @@ R_ConvertBC5Image(const byte **in, byte **out, int numMips, int numLayers,
 	}
 }
 
+/*
+=============================================================================
+
+TEXTURE CACHE
+
+With r_textureCache set, the upload-ready pixels of the 2D images found by
+R_FindImageFile in paks are saved in the texcache/ directory of the homepath.
+That is the first level after downscaling, lightmap and normal map processing
+for uncompressed images, whose mipmaps are made by the GPU, and all the levels
+after conversion for compressed ones. A cache file is named after a hash of a
+key made of the pak of the image file, its path, the imageParams_t and the
+settings changing the processing. Next time the file is mapped and uploaded
+without reading or decoding the image.
+
+=============================================================================
+*/
+
+static Cvar::Cvar<bool> r_textureCache(
+	"r_textureCache",
+	"keep the processed pixels of images in the homepath to skip decoding them next time",
+	Cvar::NONE,
+	false
+);
+
+static const char     TEXTURE_CACHE_MAGIC[ 4 ] = { 'D', 'T', 'X', 'C' };
+static const uint32_t TEXTURE_CACHE_VERSION = 1;
+
+// followed by the key, the levels and the pixels at the given offsets, aligned so that they can be mapped
+struct textureCacheHeader_t
+{
+	char     magic[ 4 ];
+	uint32_t version;
+	uint32_t keyLength;
+	uint32_t numLevels;
+	uint32_t width, height;
+	uint32_t bits;
+	uint32_t internalFormat;
+	uint32_t format; // GL_NONE for compressed levels
+};
+
+struct textureCacheLevel_t
+{
+	uint32_t width, height;
+	uint32_t offset, size;
+};
+
+// levels passed to GL while uploading an image that is missing from the cache
+struct textureCacheRecord_t
+{
+	GLenum                           internalFormat;
+	GLenum                           format;
+	std::vector<textureCacheLevel_t> levels;
+	std::string                      data;
+};
+
+static textureCacheRecord_t *textureCacheRecord;
+
+static void R_FinishImageUpload( image_t *image );
+
+static void R_RecordTextureLevel( GLenum internalFormat, GLenum format, int width, int height, const byte *data, int size )
+{
+	textureCacheRecord->internalFormat = internalFormat;
+	textureCacheRecord->format = format;
+	textureCacheRecord->levels.push_back( { uint32_t( width ), uint32_t( height ), uint32_t( textureCacheRecord->data.size() ), uint32_t( size ) } );
+	textureCacheRecord->data.append( reinterpret_cast<const char *>( data ), size );
+}
+
 /*
 ===============
 R_UploadImage
@@ -820,10 +893,6 @@ void R_UploadImage( const byte **dataArray, int numLayers, int numMips, image_t
 	GLenum     format = GL_RGBA;
 	GLenum     internalFormat = GL_RGB;
 
-	static const vec4_t oneClampBorder = { 1, 1, 1, 1 };
-	static const vec4_t zeroClampBorder = { 0, 0, 0, 1 };
-	static const vec4_t alphaZeroClampBorder = { 0, 0, 0, 0 };
-
 	if ( numMips <= 0 )
 		numMips = 1;
 
@@ -1119,6 +1188,11 @@ void R_UploadImage( const byte **dataArray, int numLayers, int numMips, image_t
 				else
 				{
 					glTexImage2D( target, 0, internalFormat, scaledWidth, scaledHeight, 0, format, GL_UNSIGNED_BYTE, scaledBuffer );
+
+					if ( textureCacheRecord && scaledBuffer )
+					{
+						R_RecordTextureLevel( internalFormat, format, scaledWidth, scaledHeight, scaledBuffer, scaledWidth * scaledHeight * 4 );
+					}
 				}
 
 				break;
@@ -1167,6 +1241,11 @@ void R_UploadImage( const byte **dataArray, int numLayers, int numMips, image_t
 
 				default:
 					glCompressedTexImage2D( target, i, internalFormat, mipWidth, mipHeight, 0, mipSize, data );
+
+					if ( textureCacheRecord && data )
+					{
+						R_RecordTextureLevel( internalFormat, format, mipWidth, mipHeight, data, mipSize );
+					}
 					break;
 				}
 
@@ -1182,6 +1261,27 @@ void R_UploadImage( const byte **dataArray, int numLayers, int numMips, image_t
 
 	GL_CheckErrors();
 
+	if ( scaledBuffer != nullptr )
+	{
+		ri.Hunk_FreeTempMemory( scaledBuffer );
+	}
+
+	R_FinishImageUpload( image );
+}
+
+/*
+===============
+R_FinishImageUpload
+
+Sets the filter and wrap parameters of a bound image after its upload
+===============
+*/
+static void R_FinishImageUpload( image_t *image )
+{
+	static const vec4_t oneClampBorder = { 1, 1, 1, 1 };
+	static const vec4_t zeroClampBorder = { 0, 0, 0, 1 };
+	static const vec4_t alphaZeroClampBorder = { 0, 0, 0, 0 };
+
 	// set filter type
 	switch ( image->filterType )
 	{
@@ -1329,11 +1429,6 @@ void R_UploadImage( const byte **dataArray, int numLayers, int numMips, image_t
 
 	GL_CheckErrors();
 
-	if ( scaledBuffer != nullptr )
-	{
-		ri.Hunk_FreeTempMemory( scaledBuffer );
-	}
-
 	switch ( image->internalFormat )
 	{
 		case GL_RGBA:
@@ -1648,6 +1743,10 @@ Loads any of the supported image types into a canonical
 32 bit format.
 =================
 */
+static void R_LoadImageFile( const char *token, byte **pic, int *width, int *height,
+			     int *numLayers, int *numMips,
+			     int *bits );
+
 static void R_LoadImage( const char **buffer, byte **pic, int *width, int *height,
 			 int *numLayers, int *numMips,
 			 int *bits )
@@ -1666,6 +1765,21 @@ static void R_LoadImage( const char **buffer, byte **pic, int *width, int *heigh
 		return;
 	}
 
+	R_LoadImageFile( token, pic, width, height, numLayers, numMips, bits );
+}
+
+/*
+=================
+R_LoadImageFile
+
+Does the work of R_LoadImage once the name is parsed,
+it may be called from several threads at once.
+=================
+*/
+static void R_LoadImageFile( const char *token, byte **pic, int *width, int *height,
+			     int *numLayers, int *numMips,
+			     int *bits )
+{
 	int        i;
 	const char *ext;
 	char       filename[ MAX_QPATH ];
@@ -1729,9 +1843,659 @@ static void R_LoadImage( const char **buffer, byte **pic, int *width, int *heigh
 
 	if ( bestLoader >= 0 )
 	{
-		char *altName = va( "%s%s.%s", prefix, filename, imageLoaders[ bestLoader ].ext );
-		imageLoaders[ bestLoader ].ImageLoader( altName, pic, width, height, numLayers, numMips, bits, alphaByte );
+		std::string altName = Str::Format( "%s%s.%s", prefix, filename, imageLoaders[ bestLoader ].ext );
+		imageLoaders[ bestLoader ].ImageLoader( altName.c_str(), pic, width, height, numLayers, numMips, bits, alphaByte );
+	}
+}
+
+/*
+=================
+R_ResolveImageFile
+
+Tells which file R_LoadImageFile would load, without reading it,
+or returns an empty string if there is none
+=================
+*/
+static std::string R_ResolveImageFile( const char *token )
+{
+	char       filename[ MAX_QPATH ];
+	const char *ext;
+	const char *prefix;
+	int        bestLoader;
+
+	Q_strncpyz( filename, token, sizeof( filename ) );
+
+	ext = COM_GetExtension( filename );
+
+	if ( *ext )
+	{
+		for ( int i = 0; i < numImageLoaders; i++ )
+		{
+			if ( !Q_stricmp( ext, imageLoaders[ i ].ext ) )
+			{
+				if ( FS_FileExists( filename ) )
+				{
+					return filename;
+				}
+
+				break;
+			}
+		}
+	}
+
+	bestLoader = R_FindImageLoader( filename, &prefix );
+
+	if ( *ext && bestLoader == -1 )
+	{
+		COM_StripExtension3( token, filename, sizeof( filename ) );
+
+		bestLoader = R_FindImageLoader( filename, &prefix );
+	}
+
+	if ( bestLoader == -1 )
+	{
+		return "";
+	}
+
+	return Str::Format( "%s%s.%s", prefix, filename, imageLoaders[ bestLoader ].ext );
+}
+
+static std::string R_TextureCachePath( const std::string &key )
+{
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for ( char c : key )
+	{
+		hash = ( hash ^ byte( c ) ) * 0x100000001b3ULL;
+	}
+
+	return Str::Format( "texcache/%016x.dtx", hash );
+}
+
+// the key and the levels are padded so that the pixels are aligned
+static size_t R_TextureCacheDataOffset( uint32_t keyLength, uint32_t numLevels )
+{
+	size_t levelsOffset = PAD( sizeof( textureCacheHeader_t ) + keyLength, 4 );
+
+	return PAD( levelsOffset + numLevels * sizeof( textureCacheLevel_t ), 16 );
+}
+
+/*
+===============
+R_TextureCacheKey
+
+Returns what the processed pixels of an image depend on,
+or an empty string if the image can't be cached
+===============
+*/
+static std::string R_TextureCacheKey( const char *name, const imageParams_t &imageParams )
+{
+	if ( !r_textureCache.Get() )
+	{
+		return "";
+	}
+
+	const char *buffer_p = name;
+	std::string fileName = R_ResolveImageFile( COM_ParseExt2( &buffer_p, false ) );
+
+	// files in the homepath may change anytime
+	const FS::LoadedPakInfo *pak = fileName.empty() ? nullptr : FS::PakPath::LocateFile( fileName );
+
+	if ( !pak )
+	{
+		return "";
+	}
+
+	std::error_code err;
+	auto timestamp = FS::PakPath::FileTimestamp( fileName, err );
+
+	if ( err )
+	{
+		return "";
+	}
+
+	return Str::Format( "%s_%s %08x %d %s %x %d %d %d %d %d %d %d %d %d %d %d %d",
+	                    pak->name, pak->version, pak->realChecksum ? *pak->realChecksum : 0,
+	                    timestamp.time_since_epoch().count(),
+	                    fileName, imageParams.bits, imageParams.minDimension, imageParams.maxDimension,
+	                    r_picMip->integer, r_imageMaxDimension->integer,
+	                    r_ignoreMaterialMinDimension->integer, r_ignoreMaterialMaxDimension->integer,
+	                    r_replaceMaterialMinDimensionIfPresentWithMaxDimension->integer,
+	                    glConfig.maxTextureSize, glConfig2.textureCompressionRGTCAvailable,
+	                    GLEW_EXT_texture_compression_dxt1 || GLEW_EXT_texture_compression_s3tc,
+	                    tr.overbrightBits, tr.mapOverBrightBits );
+}
+
+// bytes per 4x4 block of the compressed formats R_UploadImage uses, 0 for others
+static int R_TextureCacheBlockSize( uint32_t internalFormat )
+{
+	switch ( internalFormat )
+	{
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RED_RGTC1:
+		return 8;
+
+	case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+	case GL_COMPRESSED_RG_RGTC2:
+		return 16;
+
+	default:
+		return 0;
+	}
+}
+
+/*
+===============
+R_CheckCachedLevels
+
+Checks that the levels of a texture cache file have the sizes GL will read
+for their dimensions, and that the first one is the image downscaled
+===============
+*/
+static bool R_CheckCachedLevels( const textureCacheHeader_t *header, const textureCacheLevel_t *levels )
+{
+	uint32_t width = levels[ 0 ].width;
+	uint32_t height = levels[ 0 ].height;
+
+	if ( width < 1 || height < 1 || width > uint32_t( glConfig.maxTextureSize ) || height > uint32_t( glConfig.maxTextureSize ) )
+	{
+		return false;
+	}
+
+	// by the same number of halvings for both sides, clamped to 1
+	int step = 0;
+
+	while ( std::max( header->width >> step, 1u ) != width || std::max( header->height >> step, 1u ) != height )
+	{
+		if ( ( header->width >> step ) <= 1 && ( header->height >> step ) <= 1 )
+		{
+			return false;
+		}
+
+		step++;
+	}
+
+	if ( header->format != GL_NONE )
+	{
+		// the mipmaps are made by glGenerateMipmap
+		return header->numLevels == 1 && levels[ 0 ].size == uint64_t( width ) * height * 4;
+	}
+
+	int blockSize = R_TextureCacheBlockSize( header->internalFormat );
+
+	if ( !blockSize )
+	{
+		return false;
+	}
+
+	for ( uint32_t i = 0; i < header->numLevels; i++ )
+	{
+		if ( levels[ i ].width != width || levels[ i ].height != height
+		     || levels[ i ].size != uint64_t( ( width + 3 ) >> 2 ) * ( ( height + 3 ) >> 2 ) * blockSize )
+		{
+			return false;
+		}
+
+		width = std::max( width >> 1, 1u );
+		height = std::max( height >> 1, 1u );
+	}
+
+	return true;
+}
+
+/*
+===============
+R_FindCachedImage
+
+Creates an image from its texture cache file if there is a valid one
+===============
+*/
+static image_t *R_FindCachedImage( const char *name, const std::string &key, const imageParams_t &imageParams )
+{
+	std::error_code err;
+	FS::PakPath::MappedFile file = FS::HomePath::MapFile( R_TextureCachePath( key ), err );
+	const textureCacheHeader_t *header = reinterpret_cast<const textureCacheHeader_t *>( file.data() );
+	const textureCacheLevel_t *levels = nullptr;
+	const char *data = nullptr;
+	bool valid = !err && file.size() >= sizeof( textureCacheHeader_t )
+		&& !memcmp( header->magic, TEXTURE_CACHE_MAGIC, sizeof( header->magic ) )
+		&& header->version == TEXTURE_CACHE_VERSION
+		&& header->keyLength == key.size()
+		&& header->numLevels >= 1 && header->numLevels <= MAX_TEXTURE_MIPS
+		&& file.size() >= R_TextureCacheDataOffset( header->keyLength, header->numLevels )
+		&& !key.compare( 0, key.size(), file.data() + sizeof( textureCacheHeader_t ), header->keyLength );
+
+	if ( valid )
+	{
+		size_t dataOffset = R_TextureCacheDataOffset( header->keyLength, header->numLevels );
+
+		levels = reinterpret_cast<const textureCacheLevel_t *>( file.data() + PAD( sizeof( textureCacheHeader_t ) + header->keyLength, 4 ) );
+		data = file.data() + dataOffset;
+
+		for ( uint32_t i = 0; i < header->numLevels; i++ )
+		{
+			valid = valid && levels[ i ].size <= file.size() - dataOffset && levels[ i ].offset <= file.size() - dataOffset - levels[ i ].size;
+		}
+
+		valid = valid && R_CheckCachedLevels( header, levels );
+	}
+
+	if ( !valid )
+	{
+		textureCacheMisses++;
+		return nullptr;
+	}
+
+	image_t *image = R_AllocImage( name, true );
+
+	if ( !image )
+	{
+		return nullptr;
+	}
+
+	image->type = GL_TEXTURE_2D;
+	image->width = header->width;
+	image->height = header->height;
+	image->bits = header->bits;
+	image->filterType = imageParams.filterType;
+	image->wrapType = imageParams.wrapType;
+	image->uploadWidth = levels[ 0 ].width;
+	image->uploadHeight = levels[ 0 ].height;
+	image->internalFormat = header->internalFormat;
+
+	GL_Bind( image );
+
+	if ( header->format != GL_NONE )
+	{
+		glTexImage2D( GL_TEXTURE_2D, 0, header->internalFormat, levels[ 0 ].width, levels[ 0 ].height, 0,
+		              header->format, GL_UNSIGNED_BYTE, data + levels[ 0 ].offset );
+
+		if ( image->filterType == filterType_t::FT_DEFAULT )
+		{
+			glGenerateMipmap( GL_TEXTURE_2D );
+			glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );  // default to trilinear
+		}
+	}
+	else
+	{
+		for ( uint32_t i = 0; i < header->numLevels; i++ )
+		{
+			glCompressedTexImage2D( GL_TEXTURE_2D, i, header->internalFormat, levels[ i ].width, levels[ i ].height, 0,
+			                        levels[ i ].size, data + levels[ i ].offset );
+		}
+	}
+
+	GL_CheckErrors();
+
+	R_FinishImageUpload( image );
+
+	if( r_exportTextures->integer ) {
+		R_ExportTexture( image );
+	}
+
+	textureCacheHits++;
+	return image;
+}
+
+/*
+===============
+R_SaveCachedImage
+===============
+*/
+static void R_SaveCachedImage( const image_t *image, const std::string &key, const textureCacheRecord_t &record )
+{
+	if ( record.levels.empty() || record.levels.size() > MAX_TEXTURE_MIPS )
+	{
+		return;
+	}
+
+	textureCacheHeader_t header;
+	memcpy( header.magic, TEXTURE_CACHE_MAGIC, sizeof( header.magic ) );
+	header.version = TEXTURE_CACHE_VERSION;
+	header.keyLength = key.size();
+	header.numLevels = record.levels.size();
+	header.width = image->width;
+	header.height = image->height;
+	header.bits = image->bits;
+	header.internalFormat = record.internalFormat;
+	header.format = record.format;
+
+	std::string out( reinterpret_cast<const char *>( &header ), sizeof( header ) );
+	out += key;
+	out.resize( PAD( out.size(), 4 ) );
+	out.append( reinterpret_cast<const char *>( record.levels.data() ), record.levels.size() * sizeof( textureCacheLevel_t ) );
+	out.resize( R_TextureCacheDataOffset( header.keyLength, header.numLevels ) );
+	out += record.data;
+
+	// Write to a temporary file first so that a partially written file is never used
+	std::string path = R_TextureCachePath( key );
+	std::string tempName = FS::HomePath::TempFileName( path );
+	std::error_code err;
+	FS::File file = FS::HomePath::OpenWrite( tempName, err );
+	if ( !err )
+		file.Write( out.data(), out.size(), err );
+	if ( !err )
+		file.Close( err );
+	if ( !err )
+		FS::HomePath::MoveFile( path, tempName, err );
+	if ( err )
+	{
+		Log::Warn( "couldn't save texture cache file '%s': %s", path, err.message() );
+		std::error_code ignored;
+		FS::HomePath::DeleteFile( tempName, ignored );
+	}
+}
+
+// records the levels uploaded while it is alive to save them in the texture cache
+class textureCacheRecorder_t
+{
+public:
+	textureCacheRecorder_t( const std::string &key )
+		: key( key )
+	{
+		if ( !key.empty() )
+		{
+			textureCacheRecord = &record;
+		}
+	}
+
+	~textureCacheRecorder_t()
+	{
+		textureCacheRecord = nullptr;
+	}
+
+	void Save( const image_t *image )
+	{
+		if ( image && !key.empty() )
+		{
+			R_SaveCachedImage( image, key, record );
+		}
+	}
+
+private:
+	const std::string    &key;
+	textureCacheRecord_t record;
+};
+
+/*
+=============================================================================
+
+ASYNCHRONOUS IMAGE LOADING
+
+With r_asyncImageLoad set, R_FindImageFile only checks that the file exists
+and returns an image_t without contents. R_FinishImageLoads then reads and
+decodes the queued files on worker threads and uploads them on the main
+thread, in the order they were registered, since only it may make GL calls.
+The queue is flushed at the beginning of each frame and at the end of the
+registration, or image by image by R_FinishImageLoad when some code needs
+the size or the flags of an image right away.
+
+=============================================================================
+*/
+
+static Cvar::Modified<Cvar::Range<Cvar::Cvar<int>>> r_asyncImageLoad(
+	"r_asyncImageLoad",
+	"number of extra threads reading and decoding images, 0 to load them synchronously",
+	Cvar::NONE,
+	0, 0, 32
+);
+
+// number of images decoded before uploading them, bounds the memory held by decoded pictures
+static const int ASYNC_IMAGE_BATCH = 64;
+
+struct pendingImage_t
+{
+	image_t       *image;
+	std::string   fileName;
+	imageParams_t imageParams;
+	std::string   cacheKey;
+};
+
+struct decodedImage_t
+{
+	byte                      *pic[ MAX_TEXTURE_MIPS * MAX_TEXTURE_LAYERS ];
+	int                       width, height, numLayers, numMips;
+	int                       bits;
+	Sys::SteadyClock::duration decodeTime;
+};
+
+struct asyncImageStats_t
+{
+	int                        numImages;
+	int                        numFlushes;
+	Sys::SteadyClock::duration decodeTime; // summed over the threads
+	Sys::SteadyClock::duration wallTime;
+	Sys::SteadyClock::duration uploadTime;
+};
+
+static Sys::ThreadPool             imageWorkers;
+static std::vector<pendingImage_t> pendingImages;
+static std::vector<decodedImage_t> decodedImages;
+static asyncImageStats_t           asyncImageStats;
+
+static void R_UploadDefaultImage( image_t *image, const imageParams_t &imageParams );
+
+static image_t *R_QueueImage( const char *name, const imageParams_t &imageParams, const std::string &cacheKey )
+{
+	const char *buffer_p = name;
+	const char *token = COM_ParseExt2( &buffer_p, false );
+
+	if ( !token[ 0 ] )
+	{
+		Log::Warn("NULL parameter for R_LoadImage" );
+		return nullptr;
+	}
+
+	if ( R_ResolveImageFile( token ).empty() )
+	{
+		return nullptr;
+	}
+
+	image_t *image = R_AllocImage( name, true );
+
+	if ( !image )
+	{
+		return nullptr;
+	}
+
+	image->type = GL_TEXTURE_2D;
+	image->bits = imageParams.bits;
+	image->filterType = imageParams.filterType;
+	image->wrapType = imageParams.wrapType;
+
+	pendingImages.push_back( { image, token, imageParams, cacheKey } );
+
+	return image;
+}
+
+// called from the worker threads
+static void R_DecodeImage( const pendingImage_t &pending, decodedImage_t &decoded )
+{
+	Sys::SteadyClock::time_point start = Sys::SteadyClock::now();
+
+	decoded.pic[ 0 ] = nullptr;
+	decoded.width = decoded.height = decoded.numLayers = decoded.numMips = 0;
+	decoded.bits = pending.imageParams.bits;
+
+	R_LoadImageFile( pending.fileName.c_str(), decoded.pic, &decoded.width, &decoded.height,
+	                 &decoded.numLayers, &decoded.numMips, &decoded.bits );
+
+	if ( decoded.pic[ 0 ] && decoded.numLayers == 0 && ( decoded.bits & IF_LIGHTMAP ) )
+	{
+		R_ProcessLightmap( decoded.pic[ 0 ], 4, decoded.width, decoded.height, decoded.bits, decoded.pic[ 0 ] );
+	}
+
+	decoded.decodeTime = Sys::SteadyClock::now() - start;
+}
+
+static void R_UploadDecodedImage( const pendingImage_t &pending, decodedImage_t &decoded )
+{
+	image_t *image = pending.image;
+
+	if ( !decoded.pic[ 0 ] || decoded.numLayers > 0 )
+	{
+		// the file was there when the image was registered, so this is a broken one
+		Log::Warn( "couldn't load image '%s', using the default image", image->name );
+
+		if ( decoded.pic[ 0 ] )
+		{
+			ri.Free( decoded.pic[ 0 ] );
+		}
+
+		R_UploadDefaultImage( image, pending.imageParams );
+		return;
+	}
+
+	imageParams_t imageParams = pending.imageParams;
+	imageParams.bits = decoded.bits;
+
+	image->width = decoded.width;
+	image->height = decoded.height;
+	image->bits = decoded.bits;
+
+	textureCacheRecorder_t recorder( pending.cacheKey );
+
+	R_UploadImage( ( const byte ** ) decoded.pic, 1, decoded.numMips, image, imageParams );
+
+	if( r_exportTextures->integer ) {
+		R_ExportTexture( image );
+	}
+
+	recorder.Save( image );
+
+	ri.Free( decoded.pic[ 0 ] );
+}
+
+/*
+===============
+R_FinishImageLoads
+
+Decodes and uploads all the queued images
+===============
+*/
+void R_FinishImageLoads()
+{
+	if ( pendingImages.empty() )
+	{
+		return;
+	}
+
+	// we are about to upload textures
+	R_SyncRenderThread();
+
+	if ( Util::optional<int> numThreads = r_asyncImageLoad.GetModifiedValue() )
+	{
+		imageWorkers.Resize( *numThreads );
+	}
+
+	asyncImageStats.numFlushes++;
+
+	for ( size_t first = 0; first < pendingImages.size(); first += ASYNC_IMAGE_BATCH )
+	{
+		int count = std::min<size_t>( ASYNC_IMAGE_BATCH, pendingImages.size() - first );
+
+		decodedImages.resize( count );
+
+		for ( decodedImage_t &decoded : decodedImages )
+		{
+			decoded.pic[ 0 ] = nullptr;
+		}
+
+		Sys::SteadyClock::time_point start = Sys::SteadyClock::now();
+
+		try
+		{
+			imageWorkers.Run( count, [ first ]( int index, int ) {
+				R_DecodeImage( pendingImages[ first + index ], decodedImages[ index ] );
+			} );
+		}
+		catch ( ... )
+		{
+			// a loader dropped, forget about the whole queue
+			for ( int i = 0; i < count; i++ )
+			{
+				if ( decodedImages[ i ].pic[ 0 ] )
+				{
+					ri.Free( decodedImages[ i ].pic[ 0 ] );
+				}
+			}
+
+			pendingImages.clear();
+			throw;
+		}
+
+		Sys::SteadyClock::time_point decoded = Sys::SteadyClock::now();
+
+		for ( int i = 0; i < count; i++ )
+		{
+			R_UploadDecodedImage( pendingImages[ first + i ], decodedImages[ i ] );
+			asyncImageStats.decodeTime += decodedImages[ i ].decodeTime;
+		}
+
+		asyncImageStats.numImages += count;
+		asyncImageStats.wallTime += decoded - start;
+		asyncImageStats.uploadTime += Sys::SteadyClock::now() - decoded;
+	}
+
+	pendingImages.clear();
+}
+
+/*
+===============
+R_FinishImageLoad
+
+Loads a queued image right away
+===============
+*/
+void R_FinishImageLoad( image_t *image )
+{
+	auto it = std::find_if( pendingImages.begin(), pendingImages.end(), [ image ]( const pendingImage_t &pending ) {
+		return pending.image == image;
+	} );
+
+	if ( it == pendingImages.end() )
+	{
+		return;
+	}
+
+	R_SyncRenderThread();
+
+	pendingImage_t pending = std::move( *it );
+	pendingImages.erase( it );
+
+	decodedImages.resize( std::max<size_t>( decodedImages.size(), 1 ) );
+	R_DecodeImage( pending, decodedImages[ 0 ] );
+	R_UploadDecodedImage( pending, decodedImages[ 0 ] );
+}
+
+/*
+===============
+R_ReportImageLoads
+
+Tells how much the worker threads saved since the last report
+===============
+*/
+void R_ReportImageLoads()
+{
+	using std::chrono::duration_cast;
+	using std::chrono::milliseconds;
+
+	if ( !asyncImageStats.numImages )
+	{
+		return;
 	}
+
+	int decodeMsec = duration_cast<milliseconds>( asyncImageStats.decodeTime ).count();
+	int wallMsec = duration_cast<milliseconds>( asyncImageStats.wallTime ).count();
+	int uploadMsec = duration_cast<milliseconds>( asyncImageStats.uploadTime ).count();
+
+	Log::Notice( "%d images decoded on %d threads in %d flushes: %d ms of decoding took %d ms, %d ms saved, %d ms uploading",
+	             asyncImageStats.numImages, imageWorkers.NumWorkers(), asyncImageStats.numFlushes,
+	             decodeMsec, wallMsec, decodeMsec - wallMsec, uploadMsec );
+
+	asyncImageStats = {};
 }
 
 /*
@@ -1785,6 +2549,18 @@ image_t *R_FindImageFile( const char *imageName, imageParams_t &imageParams )
 		}
 	}
 
+	std::string cacheKey = R_TextureCacheKey( buffer, imageParams );
+
+	if ( !cacheKey.empty() && ( image = R_FindCachedImage( buffer, cacheKey, imageParams ) ) )
+	{
+		return image;
+	}
+
+	if ( r_asyncImageLoad.Get() )
+	{
+		return R_QueueImage( buffer, imageParams, cacheKey );
+	}
+
 	// load the pic from disk
 	pic[ 0 ] = nullptr;
 	buffer_p = &buffer[ 0 ];
@@ -1804,8 +2580,12 @@ image_t *R_FindImageFile( const char *imageName, imageParams_t &imageParams )
 		R_ProcessLightmap( pic[ 0 ], 4, width, height, imageParams.bits, pic[ 0 ] );
 	}
 
+	textureCacheRecorder_t recorder( cacheKey );
+
 	image = R_CreateImage( ( char * ) buffer, (const byte **)pic, width, height, numMips, imageParams );
 
+	recorder.Save( image );
+
 	ri.Free( mallocPtr );
 	return image;
 }
@@ -2295,20 +3075,13 @@ static void R_CreateFogImage()
 	glTexParameterfv( GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor );
 }
 
-/*
-==================
-R_CreateDefaultImage
-==================
-*/
 static const int DEFAULT_SIZE = 128;
-static void R_CreateDefaultImage()
+static void R_DefaultImageData( byte data[ DEFAULT_SIZE ][ DEFAULT_SIZE ][ 4 ] )
 {
-	int  x;
-	byte data[ DEFAULT_SIZE ][ DEFAULT_SIZE ][ 4 ];
-	byte *dataPtr = &data[0][0][0];
+	int x;
 
 	// the default image will be a box, to allow you to see the mapping coordinates
-	Com_Memset( data, 32, sizeof( data ) );
+	Com_Memset( data, 32, DEFAULT_SIZE * DEFAULT_SIZE * 4 );
 
 	for ( x = 0; x < DEFAULT_SIZE; x++ )
 	{
@@ -2321,6 +3094,19 @@ static void R_CreateDefaultImage()
 		data[ x ][ DEFAULT_SIZE - 1 ][ 0 ] =
 		  data[ x ][ DEFAULT_SIZE - 1 ][ 1 ] = data[ x ][ DEFAULT_SIZE - 1 ][ 2 ] = data[ x ][ DEFAULT_SIZE - 1 ][ 3 ] = 255;
 	}
+}
+
+/*
+==================
+R_CreateDefaultImage
+==================
+*/
+static void R_CreateDefaultImage()
+{
+	byte data[ DEFAULT_SIZE ][ DEFAULT_SIZE ][ 4 ];
+	byte *dataPtr = &data[0][0][0];
+
+	R_DefaultImageData( data );
 
 	imageParams_t imageParams = {};
 	imageParams.bits = IF_NOPICMIP;
@@ -2330,6 +3116,21 @@ static void R_CreateDefaultImage()
 	tr.defaultImage = R_CreateImage( "_default", ( const byte ** ) &dataPtr, DEFAULT_SIZE, DEFAULT_SIZE, 1, imageParams );
 }
 
+// gives an image the contents of the default one, when it couldn't be loaded
+static void R_UploadDefaultImage( image_t *image, const imageParams_t &imageParams )
+{
+	byte data[ DEFAULT_SIZE ][ DEFAULT_SIZE ][ 4 ];
+	const byte *dataPtr = &data[0][0][0];
+
+	R_DefaultImageData( data );
+
+	image->width = DEFAULT_SIZE;
+	image->height = DEFAULT_SIZE;
+	image->bits = imageParams.bits;
+
+	R_UploadImage( &dataPtr, 1, 1, image, imageParams );
+}
+
 static void R_CreateRandomNormalsImage()
 {
 	int  x, y;
@@ -2970,6 +3771,8 @@ void R_ShutdownImages()
 
 	Com_Memset( glState.currenttextures, 0, sizeof( glState.currenttextures ) );
 
+	pendingImages.clear();
+
 	Com_DestroyGrowList( &tr.images );
 	Com_DestroyGrowList( &tr.lightmaps );
 	Com_DestroyGrowList( &tr.deluxemaps );
@@ -3000,6 +3803,8 @@ void RE_GetTextureSize( int textureID, int *width, int *height )
 		return;
 	}
 
+	R_FinishImageLoad( baseImage );
+
 	if ( width )
 	{
 		*width = baseImage->width;
@@ -1508,6 +1508,8 @@ ScreenshotCmd screenshotPNGRegistration("screenshotPNG", ssFormat_t::SSF_PNG, "p
 	*/
 	void RE_EndRegistration()
 	{
+		R_FinishImageLoads();
+		R_ReportImageLoads();
 		R_SyncRenderThread();
 		if ( r_lazyShaders->integer == 1 )
 		{
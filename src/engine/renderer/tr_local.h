@@ -2443,6 +2443,14 @@ static inline void halfToFloat( const f16vec4_t in, vec4_t out )
 		int c_decalProjectors, c_decalTestSurfaces, c_decalClipSurfaces, c_decalSurfaces, c_decalSurfacesCreated;
 	};
 
+// the result of culling a model entity, see R_CullEntity
+	struct entityCull_t
+	{
+		orientationr_t orientation;
+		model_t        *model;
+		int            lod; // MOD_MESH only
+	};
+
 #define FOG_TABLE_SIZE  256
 #define FUNCTABLE_SIZE  1024
 #define FUNCTABLE_SIZE2 10
@@ -3064,7 +3072,8 @@ inline bool checkGLErrors()
 	void           R_RenderView( viewParms_t *parms );
 	void           R_RenderPostProcess();
 
-	void           R_AddMDVSurfaces( trRefEntity_t *e );
+	int            R_CullMDVModel( trRefEntity_t *e, const model_t *model, const orientationr_t *orientation, frontEndCounters_t *counters );
+	void           R_AddMDVSurfaces( trRefEntity_t *e, int lod );
 	void           R_AddMDVInteractions( trRefEntity_t *e, trRefLight_t *light, interactionType_t iaType );
 
 	void           R_AddPolygonSurfaces();
@@ -3076,12 +3085,14 @@ inline bool checkGLErrors()
 
 	cullResult_t   R_CullBox( vec3_t worldBounds[ 2 ] );
 	cullResult_t   R_CullLocalBox( vec3_t bounds[ 2 ] );
-	cullResult_t   R_CullLocalPointAndRadius( vec3_t origin, float radius );
+	cullResult_t   R_CullLocalPointAndRadius( const orientationr_t *orientation, vec3_t origin, float radius );
 	cullResult_t   R_CullPointAndRadius( vec3_t origin, float radius );
 
 	int            R_FogWorldBox( vec3_t bounds[ 2 ] );
 
-	void           R_SetupEntityWorldBounds( trRefEntity_t *ent );
+	void           R_SetupEntityWorldBounds( trRefEntity_t *ent, const orientationr_t *orientation );
+
+	void           R_CullEntity( trRefEntity_t *ent, entityCull_t *cull, frontEndCounters_t *counters );
 
 	void           R_RotateEntityForViewParms( const trRefEntity_t *ent, const viewParms_t *viewParms, orientationr_t *orien );
 	void           R_RotateEntityForLight( const trRefEntity_t *ent, const trRefLight_t *light, orientationr_t *orien );
@@ -3233,6 +3244,9 @@ inline bool checkGLErrors()
 	int R_FindImageLoader( const char *baseName );
 	image_t *R_FindImageFile( const char *name, imageParams_t &imageParams );
 	image_t *R_FindCubeImage( const char *name, imageParams_t &imageParams );
+	void    R_FinishImageLoads();
+	void    R_FinishImageLoad( image_t *image );
+	void    R_ReportImageLoads();
 
 	image_t *R_CreateImage( const char *name, const byte **pic, int width, int height, int numMips, const imageParams_t &imageParams );
 
@@ -3454,11 +3468,14 @@ inline bool checkGLErrors()
 	============================================================
 	*/
 
+	void     R_CullBSPModel( trRefEntity_t *e, const model_t *model, const orientationr_t *orientation );
 	void     R_AddBSPModelSurfaces( trRefEntity_t *e );
+	const entityCull_t *R_CullEntities();
 	void     R_AddWorldSurfaces();
 	bool R_inPVS( const vec3_t p1, const vec3_t p2 );
 	bool R_inPVVS( const vec3_t p1, const vec3_t p2 );
 
+	void     R_GatherWorldInteractions( trRefLight_t **lights, int numLights );
 	void     R_AddWorldInteractions( trRefLight_t *light );
 	void     R_AddPrecachedWorldInteractions( trRefLight_t *light );
 	void     R_ShutdownVBOs();
@@ -3670,9 +3687,11 @@ inline bool checkGLErrors()
 	skelAnimation_t *R_GetAnimationByHandle( qhandle_t hAnim );
 	void            R_AnimationList_f();
 
+	void            R_CullMD5Model( trRefEntity_t *ent, const model_t *model, const orientationr_t *orientation, frontEndCounters_t *counters );
 	void            R_AddMD5Surfaces( trRefEntity_t *ent );
 	void            R_AddMD5Interactions( trRefEntity_t *ent, trRefLight_t *light, interactionType_t iaType );
 
+	void            R_CullIQMModel( trRefEntity_t *ent, const model_t *model, const orientationr_t *orientation, frontEndCounters_t *counters );
 	void		R_AddIQMSurfaces( trRefEntity_t *ent );
 	void            R_AddIQMInteractions( trRefEntity_t *ent, trRefLight_t *light, interactionType_t iaType );
 
@@ -399,11 +399,11 @@ cullResult_t R_CullLocalBox( vec3_t localBounds[ 2 ] )
 R_CullLocalPointAndRadius
 =================
 */
-cullResult_t R_CullLocalPointAndRadius( vec3_t pt, float radius )
+cullResult_t R_CullLocalPointAndRadius( const orientationr_t *orientation, vec3_t pt, float radius )
 {
 	vec3_t transformed;
 
-	R_LocalPointToWorld( pt, transformed );
+	MatrixTransformPoint( orientation->transformMatrix, pt, transformed );
 
 	return R_CullPointAndRadius( transformed, radius );
 }
@@ -616,9 +616,9 @@ R_SetupEntityWorldBounds
 Tr3B - needs R_RotateEntityForViewParms
 =================
 */
-void R_SetupEntityWorldBounds( trRefEntity_t *ent )
+void R_SetupEntityWorldBounds( trRefEntity_t *ent, const orientationr_t *orientation )
 {
-	MatrixTransformBounds(tr.orientation.transformMatrix, ent->localBounds[0], ent->localBounds[1], ent->worldBounds[0], ent->worldBounds[1]);
+	MatrixTransformBounds(orientation->transformMatrix, ent->localBounds[0], ent->localBounds[1], ent->worldBounds[0], ent->worldBounds[1]);
 }
 
 /*
@@ -1988,6 +1988,21 @@ void R_AddDrawSurf( surfaceType_t *surface, shader_t *shader, int lightmapNum, i
 	}
 }
 
+// the drawSurfs are sorted with an LSD radix sort on their 64 bit sort keys,
+// which only moves the keys and the positions of the surfaces in each pass
+struct drawSurfKey_t
+{
+	uint64_t sort;
+	uint32_t index;
+};
+
+static const int SORT_RADIX_BITS = 8;
+static const int SORT_RADIX_SIZE = 1 << SORT_RADIX_BITS;
+static const int SORT_RADIX_PASSES = 64 / SORT_RADIX_BITS;
+
+static drawSurfKey_t sortKeys[ 2 ][ MAX_DRAWSURFS ];
+static drawSurf_t    sortedDrawSurfs[ MAX_DRAWSURFS ];
+
 /*
 =================
 R_SortDrawSurfs
@@ -1995,9 +2010,12 @@ R_SortDrawSurfs
 */
 static void R_SortDrawSurfs()
 {
-	drawSurf_t   *drawSurf;
-	shader_t     *shader;
-	int          i, sort;
+	drawSurf_t    *drawSurfs, *drawSurf;
+	drawSurfKey_t *keys;
+	shader_t      *shader;
+	int           i, sort, pass, numDrawSurfs;
+	int           sortCounts[ Util::ordinal( shaderSort_t::SS_NUM_SORTS ) ] = {};
+	int           histograms[ SORT_RADIX_PASSES ][ SORT_RADIX_SIZE ] = {};
 
 	// it is possible for some views to not have any surfaces
 	if ( tr.viewParms.numDrawSurfs < 1 )
@@ -2029,16 +2047,15 @@ static void R_SortDrawSurfs()
 		ia->next = nullptr;
 	}
 
-	std::sort( tr.viewParms.drawSurfs, tr.viewParms.drawSurfs + tr.viewParms.numDrawSurfs,
-	           []( const drawSurf_t &a, const drawSurf_t &b ) {
-	               return a.sort < b.sort;
-	           } );
+	numDrawSurfs = tr.viewParms.numDrawSurfs;
+	drawSurfs = tr.viewParms.drawSurfs;
+	keys = sortKeys[ 0 ];
 
-	// compute the offsets of the first surface of each SS_* type
-	sort = Util::ordinal( shaderSort_t::SS_BAD ) - 1;
-	for ( i = 0; i < tr.viewParms.numDrawSurfs; i++ )
+	// gather the keys with the histograms of all their digits, and count the
+	// surfaces of each SS_* type to get the offsets of the first ones
+	for ( i = 0; i < numDrawSurfs; i++ )
 	{
-		drawSurf = &tr.viewParms.drawSurfs[ i ];
+		drawSurf = &drawSurfs[ i ];
 		shader = drawSurf->shader;
 
 		// no shader should ever have this sort type
@@ -2047,12 +2064,63 @@ static void R_SortDrawSurfs()
 			Sys::Drop( "Shader '%s'with sort == SS_BAD", shader->name );
 		}
 
-		while ( sort < Util::ordinal( shaderSort_t::SS_NUM_SORTS ) - 1 && shader->sort > sort ) {
-			tr.viewParms.firstDrawSurf[ ++sort ] = i;
+		sort = Math::Clamp( (int) ceilf( shader->sort ), 0, Util::ordinal( shaderSort_t::SS_NUM_SORTS ) - 1 );
+		sortCounts[ sort ]++;
+
+		keys[ i ].sort = drawSurf->sort;
+		keys[ i ].index = i;
+
+		for ( pass = 0; pass < SORT_RADIX_PASSES; pass++ )
+		{
+			histograms[ pass ][ ( drawSurf->sort >> ( pass * SORT_RADIX_BITS ) ) & ( SORT_RADIX_SIZE - 1 ) ]++;
 		}
 	}
-	while ( sort < Util::ordinal( shaderSort_t::SS_NUM_SORTS ) ) {
-		tr.viewParms.firstDrawSurf[ ++sort ] = tr.viewParms.numDrawSurfs;
+
+	for ( pass = 0; pass < SORT_RADIX_PASSES; pass++ )
+	{
+		int *histogram = histograms[ pass ];
+		int shift = pass * SORT_RADIX_BITS;
+
+		// skip the digits which are the same for all surfaces, such as the
+		// high bits of the shader number or the fog number without fog
+		if ( histogram[ ( keys[ 0 ].sort >> shift ) & ( SORT_RADIX_SIZE - 1 ) ] == numDrawSurfs )
+		{
+			continue;
+		}
+
+		int offset = 0;
+
+		for ( int digit = 0; digit < SORT_RADIX_SIZE; digit++ )
+		{
+			int count = histogram[ digit ];
+			histogram[ digit ] = offset;
+			offset += count;
+		}
+
+		drawSurfKey_t *out = keys == sortKeys[ 0 ] ? sortKeys[ 1 ] : sortKeys[ 0 ];
+
+		for ( i = 0; i < numDrawSurfs; i++ )
+		{
+			out[ histogram[ ( keys[ i ].sort >> shift ) & ( SORT_RADIX_SIZE - 1 ) ]++ ] = keys[ i ];
+		}
+
+		keys = out;
+	}
+
+	// move the surfaces only once, in their final order
+	for ( i = 0; i < numDrawSurfs; i++ )
+	{
+		sortedDrawSurfs[ i ] = drawSurfs[ keys[ i ].index ];
+	}
+
+	std::copy( sortedDrawSurfs, sortedDrawSurfs + numDrawSurfs, drawSurfs );
+
+	// compute the offsets of the first surface of each SS_* type
+	tr.viewParms.firstDrawSurf[ 0 ] = 0;
+
+	for ( sort = 0; sort < Util::ordinal( shaderSort_t::SS_NUM_SORTS ); sort++ )
+	{
+		tr.viewParms.firstDrawSurf[ sort + 1 ] = tr.viewParms.firstDrawSurf[ sort ] + sortCounts[ sort ];
 	}
 
 	// tell renderer backend to render the depth for this view
@@ -2083,9 +2151,63 @@ static void R_SortDrawSurfs()
 	R_AddDrawViewCmd( false );
 }
 
+/*
+=============
+R_CullEntity
+
+Culls a model entity for the current view, without changing the globals of
+the front end so that it can run on the front end workers. The r_speeds
+counters go to counters.
+=============
+*/
+void R_CullEntity( trRefEntity_t *ent, entityCull_t *cull, frontEndCounters_t *counters )
+{
+	// the same entities as R_AddEntitySurfaces
+	if ( ent->e.reType != refEntityType_t::RT_MODEL ||
+	     ( ( ent->e.renderfx & RF_FIRST_PERSON ) && ( tr.viewParms.portalLevel > 0 || tr.viewParms.isMirror ) ) )
+	{
+		return;
+	}
+
+	R_RotateEntityForViewParms( ent, &tr.viewParms, &cull->orientation );
+
+	cull->model = R_GetModelByHandle( ent->e.hModel );
+	cull->lod = 0;
+
+	if ( !cull->model )
+	{
+		return;
+	}
+
+	switch ( cull->model->type )
+	{
+		case modtype_t::MOD_MESH:
+			cull->lod = R_CullMDVModel( ent, cull->model, &cull->orientation, counters );
+			break;
+
+		case modtype_t::MOD_MD5:
+			R_CullMD5Model( ent, cull->model, &cull->orientation, counters );
+			break;
+
+		case modtype_t::MOD_IQM:
+			R_CullIQMModel( ent, cull->model, &cull->orientation, counters );
+			break;
+
+		case modtype_t::MOD_BSP:
+			R_CullBSPModel( ent, cull->model, &cull->orientation );
+			break;
+
+		default:
+			break;
+	}
+}
+
 /*
 =============
 R_AddEntitySurfaces
+
+The entities are culled first, on the front end workers if there are some,
+and then added in order
 =============
 */
 void R_AddEntitySurfaces()
@@ -2093,12 +2215,15 @@ void R_AddEntitySurfaces()
 	int           i;
 	trRefEntity_t *ent;
 	shader_t      *shader;
+	entityCull_t  serialCull;
 
 	if ( !r_drawentities->integer )
 	{
 		return;
 	}
 
+	const entityCull_t *culls = R_CullEntities();
+
 	for ( i = 0; i < tr.refdef.numEntities; i++ )
 	{
 		ent = tr.currentEntity = &tr.refdef.entities[ i ];
@@ -2136,10 +2261,18 @@ void R_AddEntitySurfaces()
 				break;
 
 			case refEntityType_t::RT_MODEL:
-				// we must set up parts of tr.or for model culling
-				R_RotateEntityForViewParms( ent, &tr.viewParms, &tr.orientation );
+			{
+				const entityCull_t *cull = culls ? &culls[ i ] : &serialCull;
 
-				tr.currentModel = R_GetModelByHandle( ent->e.hModel );
+				if ( !culls )
+				{
+					R_CullEntity( ent, &serialCull, &tr.pc );
+				}
+
+				// the model code uses tr.orientation as well
+				tr.orientation = cull->orientation;
+
+				tr.currentModel = cull->model;
 
 				if ( !tr.currentModel )
 				{
@@ -2150,7 +2283,7 @@ void R_AddEntitySurfaces()
 					switch ( tr.currentModel->type )
 					{
 						case modtype_t::MOD_MESH:
-							R_AddMDVSurfaces( ent );
+							R_AddMDVSurfaces( ent, cull->lod );
 							break;
 
 						case modtype_t::MOD_MD5:
@@ -2186,6 +2319,7 @@ void R_AddEntitySurfaces()
 				}
 
 				break;
+			}
 
 			default:
 				Sys::Drop( "R_AddEntitySurfaces: Bad reType" );
@@ -2341,11 +2475,13 @@ R_AddLightInteractions
 */
 void R_AddLightInteractions()
 {
-	int          i;
+	int          i, numVisibleLights;
 	trRefLight_t *light;
+	trRefLight_t *visibleLights[ MAX_REF_LIGHTS ];
 	bspNode_t    *leaf;
 	link_t       *l;
 
+	numVisibleLights = 0;
 	tr.refdef.numShaderLights = 0;
 	for ( i = 0; i < tr.refdef.numLights; i++ )
 	{
@@ -2500,6 +2636,19 @@ void R_AddLightInteractions()
 		// look for proper attenuation shader
 		R_SetupLightShader( light );
 
+		visibleLights[ numVisibleLights++ ] = light;
+	}
+
+	// the world interactions of dynamic lights may be found in parallel
+	R_GatherWorldInteractions( visibleLights, numVisibleLights );
+
+	for ( i = 0; i < numVisibleLights; i++ )
+	{
+		light = tr.currentLight = visibleLights[ i ];
+
+		// set up tr.or for this light again
+		R_RotateLightForViewParms( light, &tr.viewParms, &tr.orientation );
+
 		// setup interactions
 		light->firstInteraction = nullptr;
 		light->lastInteraction = nullptr;
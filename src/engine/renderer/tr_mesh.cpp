@@ -28,7 +28,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 R_CullMDV
 =============
 */
-static void R_CullMDV( mdvModel_t *model, trRefEntity_t *ent )
+static void R_CullMDV( mdvModel_t *model, trRefEntity_t *ent, const orientationr_t *orientation, frontEndCounters_t *counters )
 {
 	mdvFrame_t *oldFrame, *newFrame;
 	int        i;
@@ -47,34 +47,34 @@ static void R_CullMDV( mdvModel_t *model, trRefEntity_t *ent )
 	}
 
 	// setup world bounds for intersection tests
-	R_SetupEntityWorldBounds(ent);
+	R_SetupEntityWorldBounds( ent, orientation );
 
 	// cull bounding sphere ONLY if this is not an upscaled entity
 	if ( !ent->e.nonNormalizedAxes )
 	{
 		if ( ent->e.frame == ent->e.oldframe )
 		{
-			switch ( R_CullLocalPointAndRadius( newFrame->localOrigin, newFrame->radius ) )
+			switch ( R_CullLocalPointAndRadius( orientation, newFrame->localOrigin, newFrame->radius ) )
 			{
 				case cullResult_t::CULL_OUT:
-					tr.pc.c_sphere_cull_mdv_out++;
+					counters->c_sphere_cull_mdv_out++;
 					ent->cull = cullResult_t::CULL_OUT;
 					return;
 
 				case cullResult_t::CULL_IN:
-					tr.pc.c_sphere_cull_mdv_in++;
+					counters->c_sphere_cull_mdv_in++;
 					ent->cull = cullResult_t::CULL_IN;
 					return;
 
 				case cullResult_t::CULL_CLIP:
-					tr.pc.c_sphere_cull_mdv_clip++;
+					counters->c_sphere_cull_mdv_clip++;
 					break;
 			}
 		}
 		else
 		{
 			cullResult_t sphereCullB;
-			cullResult_t sphereCull = R_CullLocalPointAndRadius( newFrame->localOrigin, newFrame->radius );
+			cullResult_t sphereCull = R_CullLocalPointAndRadius( orientation, newFrame->localOrigin, newFrame->radius );
 
 			if ( newFrame == oldFrame )
 			{
@@ -82,26 +82,26 @@ static void R_CullMDV( mdvModel_t *model, trRefEntity_t *ent )
 			}
 			else
 			{
-				sphereCullB = R_CullLocalPointAndRadius( oldFrame->localOrigin, oldFrame->radius );
+				sphereCullB = R_CullLocalPointAndRadius( orientation, oldFrame->localOrigin, oldFrame->radius );
 			}
 
 			if ( sphereCull == sphereCullB )
 			{
 				if ( sphereCull == cullResult_t::CULL_OUT )
 				{
-					tr.pc.c_sphere_cull_mdv_out++;
+					counters->c_sphere_cull_mdv_out++;
 					ent->cull = cullResult_t::CULL_OUT;
 					return;
 				}
 				else if ( sphereCull == cullResult_t::CULL_IN )
 				{
-					tr.pc.c_sphere_cull_mdv_in++;
+					counters->c_sphere_cull_mdv_in++;
 					ent->cull = cullResult_t::CULL_IN;
 					return;
 				}
 				else
 				{
-					tr.pc.c_sphere_cull_mdv_clip++;
+					counters->c_sphere_cull_mdv_clip++;
 				}
 			}
 		}
@@ -110,18 +110,18 @@ static void R_CullMDV( mdvModel_t *model, trRefEntity_t *ent )
 	switch ( R_CullBox( ent->worldBounds ) )
 	{
 		case cullResult_t::CULL_IN:
-			tr.pc.c_box_cull_mdv_in++;
+			counters->c_box_cull_mdv_in++;
 			ent->cull = cullResult_t::CULL_IN;
 			return;
 
 		case cullResult_t::CULL_CLIP:
-			tr.pc.c_box_cull_mdv_clip++;
+			counters->c_box_cull_mdv_clip++;
 			ent->cull = cullResult_t::CULL_CLIP;
 			return;
 
 		case cullResult_t::CULL_OUT:
 		default:
-			tr.pc.c_box_cull_mdv_out++;
+			counters->c_box_cull_mdv_out++;
 			ent->cull = cullResult_t::CULL_OUT;
 			return;
 	}
@@ -132,7 +132,7 @@ static void R_CullMDV( mdvModel_t *model, trRefEntity_t *ent )
 R_ComputeLOD
 =================
 */
-int R_ComputeLOD( trRefEntity_t *ent )
+int R_ComputeLOD( const model_t *model, trRefEntity_t *ent )
 {
 	float      radius;
 	float      flod, lodscale;
@@ -140,7 +140,7 @@ int R_ComputeLOD( trRefEntity_t *ent )
 	mdvFrame_t *frame;
 	int        lod;
 
-	if ( tr.currentModel->numLods < 2 )
+	if ( model->numLods < 2 )
 	{
 		// model has only 1 LOD level, skip computations and bias
 		lod = 0;
@@ -150,7 +150,7 @@ int R_ComputeLOD( trRefEntity_t *ent )
 		// multiple LODs exist, so compute projected bounding sphere
 		// and use that as a criteria for selecting LOD
 
-		frame = tr.currentModel->mdv[ 0 ]->frames;
+		frame = model->mdv[ 0 ]->frames;
 		frame += ent->e.frame;
 
 		radius = RadiusFromBounds( frame->bounds[ 0 ], frame->bounds[ 1 ] );
@@ -172,24 +172,24 @@ int R_ComputeLOD( trRefEntity_t *ent )
 			flod = 0;
 		}
 
-		flod *= tr.currentModel->numLods;
+		flod *= model->numLods;
 		lod = Q_ftol( flod );
 
 		if ( lod < 0 )
 		{
 			lod = 0;
 		}
-		else if ( lod >= tr.currentModel->numLods )
+		else if ( lod >= model->numLods )
 		{
-			lod = tr.currentModel->numLods - 1;
+			lod = model->numLods - 1;
 		}
 	}
 
 	lod += r_lodBias->integer;
 
-	if ( lod >= tr.currentModel->numLods )
+	if ( lod >= model->numLods )
 	{
-		lod = tr.currentModel->numLods - 1;
+		lod = model->numLods - 1;
 	}
 
 	if ( lod < 0 )
@@ -247,27 +247,20 @@ static shader_t *GetMDVSurfaceShader( const trRefEntity_t *ent, mdvSurface_t *md
 
 /*
 =================
-R_AddMDVSurfaces
+R_CullMDVModel
+
+Validates the frames, picks the LOD and culls the entire model if the merged
+bounding box of both frames is outside the view frustum, returns the LOD
 =================
 */
-void R_AddMDVSurfaces( trRefEntity_t *ent )
+int R_CullMDVModel( trRefEntity_t *ent, const model_t *model, const orientationr_t *orientation, frontEndCounters_t *counters )
 {
-	int          i;
-	mdvModel_t   *model = nullptr;
-	mdvSurface_t *mdvSurface = nullptr;
-	shader_t     *shader = nullptr;
-	int          lod;
-	bool     personalModel;
-	int          fogNum;
-
-	// don't add third_person objects if not in a portal
-	personalModel = ( ent->e.renderfx & RF_THIRD_PERSON ) &&
-	  tr.viewParms.portalLevel == 0;
+	int lod;
 
 	if ( ent->e.renderfx & RF_WRAP_FRAMES )
 	{
-		ent->e.frame %= tr.currentModel->mdv[ 0 ]->numFrames;
-		ent->e.oldframe %= tr.currentModel->mdv[ 0 ]->numFrames;
+		ent->e.frame %= model->mdv[ 0 ]->numFrames;
+		ent->e.oldframe %= model->mdv[ 0 ]->numFrames;
 	}
 
 	// compute LOD
@@ -277,27 +270,48 @@ void R_AddMDVSurfaces( trRefEntity_t *ent )
 	}
 	else
 	{
-		lod = R_ComputeLOD( ent );
+		lod = R_ComputeLOD( model, ent );
 	}
 
 	// Validate the frames so there is no chance of a crash.
 	// This will write directly into the entity structure, so
 	// when the surfaces are rendered, they don't need to be
 	// range checked again.
-	if ( ( ent->e.frame >= tr.currentModel->mdv[ lod ]->numFrames )
-	     || ( ent->e.frame < 0 ) || ( ent->e.oldframe >= tr.currentModel->mdv[ lod ]->numFrames ) || ( ent->e.oldframe < 0 ) )
+	if ( ( ent->e.frame >= model->mdv[ lod ]->numFrames )
+	     || ( ent->e.frame < 0 ) || ( ent->e.oldframe >= model->mdv[ lod ]->numFrames ) || ( ent->e.oldframe < 0 ) )
 	{
 		Log::Debug("R_AddMDVSurfaces: no such frame %d to %d for '%s' (%d)",
-		           ent->e.oldframe, ent->e.frame, tr.currentModel->name, tr.currentModel->mdv[ lod ]->numFrames );
+		           ent->e.oldframe, ent->e.frame, model->name, model->mdv[ lod ]->numFrames );
 		ent->e.frame = 0;
 		ent->e.oldframe = 0;
 	}
 
-	model = tr.currentModel->mdv[ lod ];
+	R_CullMDV( model->mdv[ lod ], ent, orientation, counters );
 
-	// cull the entire model if merged bounding box of both frames
-	// is outside the view frustum.
-	R_CullMDV( model, ent );
+	return lod;
+}
+
+/*
+=================
+R_AddMDVSurfaces
+
+Adds the surfaces of an entity culled by R_CullMDVModel
+=================
+*/
+void R_AddMDVSurfaces( trRefEntity_t *ent, int lod )
+{
+	int          i;
+	mdvModel_t   *model = nullptr;
+	mdvSurface_t *mdvSurface = nullptr;
+	shader_t     *shader = nullptr;
+	bool     personalModel;
+	int          fogNum;
+
+	// don't add third_person objects if not in a portal
+	personalModel = ( ent->e.renderfx & RF_THIRD_PERSON ) &&
+	  tr.viewParms.portalLevel == 0;
+
+	model = tr.currentModel->mdv[ lod ];
 
 	if ( ent->cull == CULL_OUT )
 	{
@@ -403,7 +417,7 @@ void R_AddMDVInteractions( trRefEntity_t *ent, trRefLight_t *light, interactionT
 	  tr.viewParms.portalLevel == 0;
 
 	// compute LOD
-	lod = R_ComputeLOD( ent );
+	lod = R_ComputeLOD( tr.currentModel, ent );
 
 	model = tr.currentModel->mdv[ lod ];
 
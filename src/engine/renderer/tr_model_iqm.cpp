@@ -901,13 +901,15 @@ bool R_LoadIQModel( model_t *mod, void *buffer, int filesize,
 
 /*
 =============
-R_CullIQM
+R_CullIQMModel
+
+Culls the entire model if its bounding box is outside the view frustum
 =============
 */
-static void R_CullIQM( trRefEntity_t *ent ) {
+void R_CullIQMModel( trRefEntity_t *ent, const model_t *iqmModel, const orientationr_t *orientation, frontEndCounters_t *counters ) {
 	vec3_t     localBounds[ 2 ];
 	float      scale = ent->e.skeleton.scale;
-	IQModel_t *model = tr.currentModel->iqm;
+	IQModel_t *model = iqmModel->iqm;
 	IQAnim_t  *anim = model->anims;
 	float     *bounds;
 
@@ -930,21 +932,21 @@ static void R_CullIQM( trRefEntity_t *ent ) {
 	VectorScale( localBounds[1], scale, ent->localBounds[ 1 ] );
 
 	
-	R_SetupEntityWorldBounds(ent);
+	R_SetupEntityWorldBounds( ent, orientation );
 
 	switch ( R_CullBox( ent->worldBounds ) )
 	{
 	case cullResult_t::CULL_IN:
-		tr.pc.c_box_cull_md5_in++;
+		counters->c_box_cull_md5_in++;
 		ent->cull = cullResult_t::CULL_IN;
 		return;
 	case cullResult_t::CULL_CLIP:
-		tr.pc.c_box_cull_md5_clip++;
+		counters->c_box_cull_md5_clip++;
 		ent->cull = cullResult_t::CULL_CLIP;
 		return;
 	case cullResult_t::CULL_OUT:
 	default:
-		tr.pc.c_box_cull_md5_out++;
+		counters->c_box_cull_md5_out++;
 		ent->cull = cullResult_t::CULL_OUT;
 		return;
 	}
@@ -954,7 +956,7 @@ static void R_CullIQM( trRefEntity_t *ent ) {
 =================
 R_AddIQMSurfaces
 
-Add all surfaces of this model
+Add all surfaces of this model, culled by R_CullIQMModel
 =================
 */
 void R_AddIQMSurfaces( trRefEntity_t *ent ) {
@@ -973,15 +975,9 @@ void R_AddIQMSurfaces( trRefEntity_t *ent ) {
 	personalModel = (ent->e.renderfx & RF_THIRD_PERSON) &&
 	  tr.viewParms.portalLevel == 0;
 
-	//
-	// cull the entire model if merged bounding box of both frames
-	// is outside the view frustum.
-	//
-	R_CullIQM( ent );
-
 	// HACK: Never cull first-person models, due to issues with a certain model's bounds
 	// A first-person model not in the player's sight seems like something that should not happen in any case
-	// But R_CullIQM is always called because it sets some fields used by other code
+	// But R_CullIQMModel is always called because it sets some fields used by other code
 	if ( ent->cull == cullResult_t::CULL_OUT && !( ent->e.renderfx & RF_FIRST_PERSON ) )
 	{
 		return;
@@ -21,6 +21,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 ===========================================================================
 */
 // tr_shader.c -- this file deals with the parsing and definition of shaders
+#include <common/FileSystem.h>
 #include "tr_local.h"
 #include "gl_shader.h"
 
@@ -31,7 +32,16 @@ static const int FILE_HASH_SIZE       = 1024;
 static shader_t      *shaderHashTable[ FILE_HASH_SIZE ];
 
 static const int MAX_SHADERTEXT_HASH  = 2048;
-static const char          **shaderTextHashTable[ MAX_SHADERTEXT_HASH ];
+
+// a shader in the combined text of the shader files
+struct shaderTextEntry_t
+{
+	const char *name;
+	const char *text; // right after the name
+};
+
+// each bucket ends with an entry with a null name
+static shaderTextEntry_t   *shaderTextHashTable[ MAX_SHADERTEXT_HASH ];
 
 static char          *s_shaderText;
 
@@ -1610,6 +1620,12 @@ static void ParseNormalMapDetectHeightMap( shaderStage_t *stage, const char **te
 
 	ParseNormalMap( stage, text, bundleIndex );
 
+	// the alpha channel is only known once the image is uploaded
+	if ( stage->bundle[ bundleIndex ].image[ 0 ] )
+	{
+		R_FinishImageLoad( stage->bundle[ bundleIndex ].image[ 0 ] );
+	}
+
 	/* Tell renderer to enable relief mapping since an heightmap is found,
 	also tell renderer to not abuse normalmap alpha channel because it's an heightmap.
 
@@ -5581,20 +5597,15 @@ If found, it will return a valid shader
 */
 static const char    *FindShaderInShaderText( const char *shaderName )
 {
-	const char *token, *p;
-
 	int  i, hash;
 
 	hash = generateHashValue( shaderName, MAX_SHADERTEXT_HASH );
 
-	for ( i = 0; shaderTextHashTable[ hash ][ i ]; i++ )
+	for ( i = 0; shaderTextHashTable[ hash ][ i ].name; i++ )
 	{
-		p = shaderTextHashTable[ hash ][ i ];
-		token = COM_ParseExt2( &p, true );
-
-		if ( !Q_stricmp( token, shaderName ) )
+		if ( !Q_stricmp( shaderTextHashTable[ hash ][ i ].name, shaderName ) )
 		{
-			return p;
+			return shaderTextHashTable[ hash ][ i ].text;
 		}
 	}
 
@@ -6239,42 +6250,274 @@ void R_ShaderExp_f()
 
 /*
 ====================
-ScanAndLoadShaderFiles
+ParseShaderTable
 
-Finds and loads all .shader files, combining them into
-a single large text block that can be scanned for shader names
-=====================
+Generates a table unless one with the same name exists,
+text points right after the "table" keyword
+====================
 */
-static const int MAX_SHADER_FILES = 4096;
-static void ScanAndLoadShaderFiles()
+static void ParseShaderTable( const char **text )
 {
-	char **shaderFiles;
-	char *buffers[ MAX_SHADER_FILES ];
-	const char *p;
-	int  numShaderFiles;
-	int  i;
-	const char *oldp, *token;
-	char *textEnd;
-	const char **hashMem;
-	int  shaderTextHashTableSizes[ MAX_SHADERTEXT_HASH ], hash, size;
-	char filename[ MAX_QPATH ];
-	size_t sum = 0, summand;
+	const char    *token;
+	int           depth;
+	float         values[ FUNCTABLE_SIZE ];
+	int           numValues;
+	shaderTable_t *tb;
+	bool          alreadyCreated;
+	int           hash;
 
-	Log::Debug("----- ScanAndLoadShaderFiles -----" );
+	// zeroes all shaders, booleans can be assumed as false
+	Com_Memset( &table, 0, sizeof( table ) );
 
-	// scan for shader files
-	shaderFiles = ri.FS_ListFiles( "scripts", ".shader", &numShaderFiles );
+	token = COM_ParseExt2( text, true );
 
-	if ( !shaderFiles || !numShaderFiles )
+	Q_strncpyz( table.name, token, sizeof( table.name ) );
+
+	// check if already created
+	alreadyCreated = false;
+	hash = generateHashValue( table.name, MAX_SHADERTABLE_HASH );
+
+	for ( tb = shaderTableHashTable[ hash ]; tb; tb = tb->next )
 	{
-		Log::Warn("no shader files found" );
+		if ( Q_stricmp( tb->name, table.name ) == 0 )
+		{
+			// match found
+			alreadyCreated = true;
+			break;
+		}
 	}
 
-	if ( numShaderFiles > MAX_SHADER_FILES )
+	depth = 0;
+	numValues = 0;
+
+	do
 	{
-		numShaderFiles = MAX_SHADER_FILES;
+		token = COM_ParseExt2( text, true );
+
+		if ( !Q_stricmp( token, "snap" ) )
+		{
+			table.snap = true;
+		}
+		else if ( !Q_stricmp( token, "clamp" ) )
+		{
+			table.clamp = true;
+		}
+		else if ( token[ 0 ] == '{' )
+		{
+			depth++;
+		}
+		else if ( token[ 0 ] == '}' )
+		{
+			depth--;
+		}
+		else if ( token[ 0 ] == ',' )
+		{
+			continue;
+		}
+		else
+		{
+			if ( numValues == FUNCTABLE_SIZE )
+			{
+				Log::Warn("FUNCTABLE_SIZE hit" );
+				break;
+			}
+
+			values[ numValues++ ] = atof( token );
+		}
+	}
+	while ( depth && *text );
+
+	if ( !alreadyCreated )
+	{
+		Log::Debug("...generating '%s'", table.name );
+		GeneratePermanentShaderTable( values, numValues );
+	}
+}
+
+/*
+=============================================================================
+
+SHADER INDEX
+
+Finding the shader names in the combined text of the shader files means
+tokenizing all of it, so the result is kept in the homepath: the combined
+text, the names of the shaders with where their text starts, and where the
+tables are. The index is used as long as the list of shader files and the
+paks they come from don't change, then the shader files aren't even read.
+
+=============================================================================
+*/
+
+static Cvar::Cvar<bool> r_shaderIndexCache(
+	"r_shaderIndexCache",
+	"keep the index of the shader files in the homepath to skip scanning them next time",
+	Cvar::NONE,
+	true
+);
+
+static const char     SHADER_INDEX_CACHE_FILE[] = "shaderindex.cache";
+static const uint32_t SHADER_INDEX_CACHE_VERSION = 1;
+
+struct shaderIndexEntry_t
+{
+	uint32_t nameOffset; // in the names
+	uint32_t textOffset; // right after the name
+};
+
+struct shaderIndex_t
+{
+	std::string                     text;
+	std::string                     names; // null terminated
+	std::vector<shaderIndexEntry_t> entries;
+	std::vector<uint32_t>           tables; // right after the "table" keyword
+};
+
+// what the combined text depends on: the shader files and their paks
+static std::string ShaderIndexKey( char **shaderFiles, int numShaderFiles )
+{
+	std::string key;
+
+	for ( int i = 0; i < numShaderFiles; i++ )
+	{
+		std::string path = Str::Format( "scripts/%s", shaderFiles[ i ] );
+		const FS::LoadedPakInfo *pak = FS::PakPath::LocateFile( path );
+		std::error_code err;
+		auto timestamp = FS::PakPath::FileTimestamp( path, err );
+
+		if ( !pak || err )
+		{
+			return "";
+		}
+
+		key += Str::Format( "%s %s_%s %08x %d\n", path, pak->name, pak->version,
+		                    pak->realChecksum ? *pak->realChecksum : 0,
+		                    timestamp.time_since_epoch().count() );
+	}
+
+	return key;
+}
+
+static bool LoadShaderIndex( const std::string &key, shaderIndex_t &index )
+{
+	std::error_code err;
+	FS::PakPath::MappedFile file = FS::HomePath::MapFile( SHADER_INDEX_CACHE_FILE, err );
+
+	if ( err )
+	{
+		return false;
+	}
+
+	Util::Reader reader;
+	reader.SetView( file.data(), file.size() );
+
+	try
+	{
+		if ( reader.Read<uint32_t>() != SHADER_INDEX_CACHE_VERSION || reader.Read<std::string>() != key )
+		{
+			return false;
+		}
+
+		uint32_t textLength = reader.Read<uint32_t>();
+		index.text.assign( static_cast<const char *>( reader.ReadInline( textLength ) ), textLength );
+
+		uint32_t namesLength = reader.Read<uint32_t>();
+		index.names.assign( static_cast<const char *>( reader.ReadInline( namesLength ) ), namesLength );
+
+		index.entries.resize( reader.Read<uint32_t>() );
+
+		for ( shaderIndexEntry_t &entry : index.entries )
+		{
+			entry.nameOffset = reader.Read<uint32_t>();
+			entry.textOffset = reader.Read<uint32_t>();
+
+			if ( entry.nameOffset >= namesLength || entry.textOffset > textLength )
+			{
+				return false;
+			}
+		}
+
+		index.tables.resize( reader.Read<uint32_t>() );
+
+		for ( uint32_t &offset : index.tables )
+		{
+			offset = reader.Read<uint32_t>();
+
+			if ( offset > textLength )
+			{
+				return false;
+			}
+		}
+
+		reader.CheckEndRead();
+	}
+	catch ( Sys::DropErr & )
+	{
+		return false;
 	}
 
+	return !index.names.empty() ? index.names.back() == '\0' : index.entries.empty();
+}
+
+static void SaveShaderIndex( const std::string &key, const shaderIndex_t &index )
+{
+	Util::Writer writer;
+	writer.Write<uint32_t>( SHADER_INDEX_CACHE_VERSION );
+	writer.Write<std::string>( key );
+	writer.Write<uint32_t>( index.text.size() );
+	writer.WriteData( index.text.data(), index.text.size() );
+	writer.Write<uint32_t>( index.names.size() );
+	writer.WriteData( index.names.data(), index.names.size() );
+	writer.Write<uint32_t>( index.entries.size() );
+
+	for ( const shaderIndexEntry_t &entry : index.entries )
+	{
+		writer.Write<uint32_t>( entry.nameOffset );
+		writer.Write<uint32_t>( entry.textOffset );
+	}
+
+	writer.Write<uint32_t>( index.tables.size() );
+
+	for ( uint32_t offset : index.tables )
+	{
+		writer.Write<uint32_t>( offset );
+	}
+
+	// Write to a temporary file first so that a partially written index is never used
+	std::string tempName = FS::HomePath::TempFileName( SHADER_INDEX_CACHE_FILE );
+	std::error_code err;
+	FS::File file = FS::HomePath::OpenWrite( tempName, err );
+	if ( !err )
+		file.Write( writer.GetData().data(), writer.GetData().size(), err );
+	if ( !err )
+		file.Close( err );
+	if ( !err )
+		FS::HomePath::MoveFile( SHADER_INDEX_CACHE_FILE, tempName, err );
+	if ( err )
+	{
+		Log::Warn( "couldn't save the shader index: %s", err.message() );
+		std::error_code ignored;
+		FS::HomePath::DeleteFile( tempName, ignored );
+	}
+}
+
+/*
+====================
+ScanShaderFiles
+
+Loads all .shader files, combining them into a single large text block,
+and finds the shader names and tables in it
+=====================
+*/
+static const int MAX_SHADER_FILES = 4096;
+static void ScanShaderFiles( char **shaderFiles, int numShaderFiles, shaderIndex_t &index )
+{
+	char *buffers[ MAX_SHADER_FILES ];
+	const char *p;
+	int  i;
+	const char *token;
+	char filename[ MAX_QPATH ];
+	size_t sum = 0, summand;
+
 	// load and parse shader files
 	for ( i = 0; i < numShaderFiles; i++ )
 	{
@@ -6329,9 +6572,7 @@ static void ScanAndLoadShaderFiles()
 	}
 
 	// build single large buffer
-	s_shaderText = (char*) ri.Hunk_Alloc( sum + numShaderFiles * 2, ha_pref::h_low );
-	s_shaderText[ 0 ] = '\0';
-	textEnd = s_shaderText;
+	index.text.reserve( sum + numShaderFiles );
 
 	// free in reverse order, so the temp files are all dumped
 	for ( i = numShaderFiles - 1; i >= 0; i-- )
@@ -6341,24 +6582,17 @@ static void ScanAndLoadShaderFiles()
 			continue;
 		}
 
-		strcat( textEnd, buffers[ i ] );
-		strcat( textEnd, "\n" );
-		textEnd += strlen( textEnd );
+		index.text += buffers[ i ];
+		index.text += '\n';
 		ri.FS_FreeFile( buffers[ i ] );
 	}
 
 	// ydnar: unixify all shaders
-	COM_FixPath( s_shaderText );
+	COM_FixPath( &index.text[ 0 ] );
 
-	COM_Compress( s_shaderText );
+	index.text.resize( COM_Compress( &index.text[ 0 ] ) );
 
-	// free up memory
-	ri.FS_FreeFileList( shaderFiles );
-
-	Com_Memset( shaderTextHashTableSizes, 0, sizeof( shaderTextHashTableSizes ) );
-	size = 0;
-
-	p = s_shaderText;
+	p = index.text.c_str();
 
 	// look for shader names
 	while ( true )
@@ -6373,6 +6607,8 @@ static void ScanAndLoadShaderFiles()
 		// skip shader tables
 		if ( !Q_stricmp( token, "table" ) )
 		{
+			index.tables.push_back( p - index.text.c_str() );
+
 			// skip table name
 			token = COM_ParseExt2( &p, true );
 
@@ -6380,122 +6616,112 @@ static void ScanAndLoadShaderFiles()
 		}
 		else
 		{
-			hash = generateHashValue( token, MAX_SHADERTEXT_HASH );
-			shaderTextHashTableSizes[ hash ]++;
-			size++;
+			index.entries.push_back( { uint32_t( index.names.size() ), uint32_t( p - index.text.c_str() ) } );
+			index.names += token;
+			index.names += '\0';
+
 			SkipBracedSection( &p );
 		}
 	}
+}
 
-	size += MAX_SHADERTEXT_HASH;
+/*
+====================
+ScanAndLoadShaderFiles
 
-	hashMem = (const char**) ri.Hunk_Alloc( size * sizeof( char * ), ha_pref::h_low );
+Finds the shaders of all the .shader files, from the shader index
+if it is up to date, and generates the tables
+=====================
+*/
+static void ScanAndLoadShaderFiles()
+{
+	char **shaderFiles;
+	int  numShaderFiles;
+	int  i, hash;
+	int  shaderTextHashTableSizes[ MAX_SHADERTEXT_HASH ];
+	shaderTextEntry_t *hashMem;
+	char *names;
+	const char *p;
+	shaderIndex_t index;
+	std::string key;
+	bool indexed;
 
-	for ( i = 0; i < MAX_SHADERTEXT_HASH; i++ )
+	Log::Debug("----- ScanAndLoadShaderFiles -----" );
+
+	// scan for shader files
+	shaderFiles = ri.FS_ListFiles( "scripts", ".shader", &numShaderFiles );
+
+	if ( !shaderFiles || !numShaderFiles )
 	{
-		shaderTextHashTable[ i ] = hashMem;
-		hashMem += shaderTextHashTableSizes[ i ] + 1;
+		Log::Warn("no shader files found" );
 	}
 
-	Com_Memset( shaderTextHashTableSizes, 0, sizeof( shaderTextHashTableSizes ) );
+	if ( numShaderFiles > MAX_SHADER_FILES )
+	{
+		numShaderFiles = MAX_SHADER_FILES;
+	}
 
-	p = s_shaderText;
+	if ( r_shaderIndexCache.Get() )
+	{
+		key = ShaderIndexKey( shaderFiles, numShaderFiles );
+	}
 
-	// look for shader names
-	while ( true )
+	indexed = !key.empty() && LoadShaderIndex( key, index );
+
+	if ( !indexed )
 	{
-		oldp = p;
-		token = COM_ParseExt( &p, true );
+		index = {};
+		ScanShaderFiles( shaderFiles, numShaderFiles, index );
 
-		if ( token[ 0 ] == 0 )
+		if ( !key.empty() )
 		{
-			break;
+			SaveShaderIndex( key, index );
 		}
+	}
 
-		// parse shader tables
-		if ( !Q_stricmp( token, "table" ) )
-		{
-			int           depth;
-			float         values[ FUNCTABLE_SIZE ];
-			int           numValues;
-			shaderTable_t *tb;
-			bool      alreadyCreated;
-
-			// zeroes all shaders, booleans can be assumed as false
-			Com_Memset( &table, 0, sizeof( table ) );
-
-			token = COM_ParseExt2( &p, true );
+	// free up memory
+	ri.FS_FreeFileList( shaderFiles );
 
-			Q_strncpyz( table.name, token, sizeof( table.name ) );
+	s_shaderText = (char*) ri.Hunk_Alloc( index.text.size() + 1, ha_pref::h_low );
+	Com_Memcpy( s_shaderText, index.text.c_str(), index.text.size() + 1 );
 
-			// check if already created
-			alreadyCreated = false;
-			hash = generateHashValue( table.name, MAX_SHADERTABLE_HASH );
+	names = (char*) ri.Hunk_Alloc( index.names.size() + 1, ha_pref::h_low );
+	Com_Memcpy( names, index.names.c_str(), index.names.size() + 1 );
 
-			for ( tb = shaderTableHashTable[ hash ]; tb; tb = tb->next )
-			{
-				if ( Q_stricmp( tb->name, table.name ) == 0 )
-				{
-					// match found
-					alreadyCreated = true;
-					break;
-				}
-			}
+	Com_Memset( shaderTextHashTableSizes, 0, sizeof( shaderTextHashTableSizes ) );
 
-			depth = 0;
-			numValues = 0;
+	for ( const shaderIndexEntry_t &entry : index.entries )
+	{
+		hash = generateHashValue( names + entry.nameOffset, MAX_SHADERTEXT_HASH );
+		shaderTextHashTableSizes[ hash ]++;
+	}
 
-			do
-			{
-				token = COM_ParseExt2( &p, true );
+	hashMem = (shaderTextEntry_t*) ri.Hunk_Alloc( ( index.entries.size() + MAX_SHADERTEXT_HASH ) * sizeof( shaderTextEntry_t ), ha_pref::h_low );
 
-				if ( !Q_stricmp( token, "snap" ) )
-				{
-					table.snap = true;
-				}
-				else if ( !Q_stricmp( token, "clamp" ) )
-				{
-					table.clamp = true;
-				}
-				else if ( token[ 0 ] == '{' )
-				{
-					depth++;
-				}
-				else if ( token[ 0 ] == '}' )
-				{
-					depth--;
-				}
-				else if ( token[ 0 ] == ',' )
-				{
-					continue;
-				}
-				else
-				{
-					if ( numValues == FUNCTABLE_SIZE )
-					{
-						Log::Warn("FUNCTABLE_SIZE hit" );
-						break;
-					}
+	for ( i = 0; i < MAX_SHADERTEXT_HASH; i++ )
+	{
+		shaderTextHashTable[ i ] = hashMem;
+		hashMem += shaderTextHashTableSizes[ i ] + 1;
+	}
 
-					values[ numValues++ ] = atof( token );
-				}
-			}
-			while ( depth && p );
+	Com_Memset( shaderTextHashTableSizes, 0, sizeof( shaderTextHashTableSizes ) );
 
-			if ( !alreadyCreated )
-			{
-				Log::Debug("...generating '%s'", table.name );
-				GeneratePermanentShaderTable( values, numValues );
-			}
-		}
-		else
-		{
-			hash = generateHashValue( token, MAX_SHADERTEXT_HASH );
-			shaderTextHashTable[ hash ][ shaderTextHashTableSizes[ hash ]++ ] = oldp;
+	for ( const shaderIndexEntry_t &entry : index.entries )
+	{
+		hash = generateHashValue( names + entry.nameOffset, MAX_SHADERTEXT_HASH );
+		shaderTextHashTable[ hash ][ shaderTextHashTableSizes[ hash ]++ ] = { names + entry.nameOffset, s_shaderText + entry.textOffset };
+	}
 
-			SkipBracedSection( &p );
-		}
+	// parse shader tables
+	for ( uint32_t offset : index.tables )
+	{
+		p = s_shaderText + offset;
+		ParseShaderTable( &p );
 	}
+
+	Log::Debug( "%d shaders and %d tables in %d shader files, %s",
+	             (int) index.entries.size(), (int) index.tables.size(), numShaderFiles,
+	             indexed ? "from the shader index" : "scanned" );
 }
 
 /*
@@ -6542,6 +6768,8 @@ R_InitShaders
 */
 void R_InitShaders()
 {
+	int startTime = ri.Milliseconds();
+
 	Com_Memset( shaderTableHashTable, 0, sizeof( shaderTableHashTable ) );
 	Com_Memset( shaderHashTable, 0, sizeof( shaderHashTable ) );
 
@@ -6550,6 +6778,8 @@ void R_InitShaders()
 	ScanAndLoadShaderFiles();
 
 	CreateExternalShaders();
+
+	Log::Debug( "R_InitShaders: %d msec", ri.Milliseconds() - startTime );
 }
 
 /*
@@ -24,6 +24,19 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include "tr_local.h"
 #include "gl_shader.h"
+#include "framework/ThreadPool.h"
+
+// how a surface was culled, so that a worker thread can cull it and the
+// main thread update the r_speeds counters (see R_CountSurfaceCull)
+enum surfaceCull_t
+{
+	SC_CULLED = BIT( 0 ),
+	SC_PLANE_IN = BIT( 1 ),
+	SC_PLANE_OUT = BIT( 2 ),
+	SC_BOX_IN = BIT( 3 ),
+	SC_BOX_CLIP = BIT( 4 ),
+	SC_BOX_OUT = BIT( 5 )
+};
 
 /*
 ================
@@ -33,28 +46,30 @@ Tries to back face cull surfaces before they are lighted or
 added to the sorting list.
 
 This will also allow mirrors on both sides of a model without recursion.
+Returns the surfaceCull_t bits telling if and how it was culled.
 ================
 */
-static bool R_CullSurface( surfaceType_t *surface, shader_t *shader, int planeBits )
+static int R_CullSurface( surfaceType_t *surface, shader_t *shader, int planeBits )
 {
 	srfGeneric_t *gen;
 	float        d;
+	int          cull = 0;
 
 	// allow culling to be disabled
 	if ( r_nocull->integer )
 	{
-		return false;
+		return 0;
 	}
 
 	// ydnar: made surface culling generic, inline with q3map2 surface classification
 	if ( *surface == surfaceType_t::SF_GRID && r_nocurves->integer )
 	{
-		return true;
+		return SC_CULLED;
 	}
 
 	if ( *surface != surfaceType_t::SF_FACE && *surface != surfaceType_t::SF_TRIANGLES && *surface != surfaceType_t::SF_VBO_MESH && *surface != surfaceType_t::SF_GRID )
 	{
-		return true;
+		return SC_CULLED;
 	}
 
 	// get generic surface
@@ -73,52 +88,58 @@ static bool R_CullSurface( surfaceType_t *surface, shader_t *shader, int planeBi
 		{
 			if ( d < -8.0f )
 			{
-				tr.pc.c_plane_cull_out++;
-				return true;
+				return SC_CULLED | SC_PLANE_OUT;
 			}
 		}
 		else if ( shader->cullType == CT_BACK_SIDED )
 		{
 			if ( d > 8.0f )
 			{
-				tr.pc.c_plane_cull_out++;
-				return true;
+				return SC_CULLED | SC_PLANE_OUT;
 			}
 		}
 
-		tr.pc.c_plane_cull_in++;
+		cull |= SC_PLANE_IN;
 	}
 
 	if ( planeBits )
 	{
-		cullResult_t cull;
+		cullResult_t result;
 
 		if ( tr.currentEntity != &tr.worldEntity )
 		{
-			cull = R_CullLocalBox( gen->bounds );
+			result = R_CullLocalBox( gen->bounds );
 		}
 		else
 		{
-			cull = R_CullBox( gen->bounds );
+			result = R_CullBox( gen->bounds );
 		}
 
-		if ( cull == CULL_OUT )
+		if ( result == CULL_OUT )
 		{
-			tr.pc.c_box_cull_out++;
-			return true;
+			return cull | SC_CULLED | SC_BOX_OUT;
 		}
-		else if ( cull == CULL_CLIP )
+		else if ( result == CULL_CLIP )
 		{
-			tr.pc.c_box_cull_clip++;
+			cull |= SC_BOX_CLIP;
 		}
 		else
 		{
-			tr.pc.c_box_cull_in++;
+			cull |= SC_BOX_IN;
 		}
 	}
 
 	// must be visible
-	return false;
+	return cull;
+}
+
+static void R_CountSurfaceCull( int cull )
+{
+	tr.pc.c_plane_cull_in += !!( cull & SC_PLANE_IN );
+	tr.pc.c_plane_cull_out += !!( cull & SC_PLANE_OUT );
+	tr.pc.c_box_cull_in += !!( cull & SC_BOX_IN );
+	tr.pc.c_box_cull_clip += !!( cull & SC_BOX_CLIP );
+	tr.pc.c_box_cull_out += !!( cull & SC_BOX_OUT );
 }
 
 static bool R_CullLightSurface( surfaceType_t *surface, shader_t *shader, trRefLight_t *light, byte *cubeSideBits )
@@ -199,6 +220,97 @@ static bool R_CullLightSurface( surfaceType_t *surface, shader_t *shader, trRefL
 	return false;
 }
 
+/*
+=============================================================================
+
+The BSP traversals of the front end can run on worker threads: the walk of
+the main view, split into subtrees, and the walks finding the world
+interactions of the dynamic lights, one per light. A worker only records
+what the walk finds in traversal order, the nodes and leaves reached and how
+their surfaces are culled, or the surfaces that get an interaction, and the
+main thread then adds them in that order, so the draw surfaces, interactions
+and r_speeds counters don't depend on the thread count.
+
+The entities are culled on the workers too, one task per entity, into an
+array of their orientations, models and LODs, and R_AddEntitySurfaces then
+adds their surfaces in entity order.
+
+=============================================================================
+*/
+
+static Cvar::Modified<Cvar::Range<Cvar::Cvar<int>>> r_frontEndThreads(
+	"r_frontEndThreads",
+	"number of extra threads walking the BSP for the view and the dynamic lights and culling the entities, 0 to do it all in the main thread",
+	Cvar::NONE,
+	0, 0, 32
+);
+
+static Sys::ThreadPool frontEndWorkers;
+
+static void R_ResizeFrontEndWorkers()
+{
+	if ( Util::optional<int> numThreads = r_frontEndThreads.GetModifiedValue() )
+	{
+		frontEndWorkers.Resize( *numThreads );
+	}
+}
+
+struct gatheredInteraction_t
+{
+	bspSurface_t *surf;
+	int          bits;
+	byte         cubeSideBits;
+	bool         firstAddition;
+};
+
+struct gatheredLight_t
+{
+	bool                               gathered;
+	std::vector<gatheredInteraction_t> interactions;
+	int                                surfacesCulled;
+};
+
+// per worker replacement for bspSurface_t::lightCount and interactionBits
+struct interactionWorker_t
+{
+	bspSurface_t      *surfaces; // tr.world is the same for every map
+	int               numSurfaces;
+	int               lightCount;
+	std::vector<int>  lightCounts;
+	std::vector<byte> interactionBits;
+};
+
+static std::vector<interactionWorker_t> interactionWorkerData;
+static gatheredLight_t                  gatheredLights[ MAX_REF_LIGHTS ];
+
+// the main view is split into subtrees this many nodes below the root
+static const int WORLD_SPLIT_DEPTH = 6;
+
+struct gatheredLeaf_t
+{
+	bspNode_t *node;
+	int       planeBits;
+	int       decalBits;
+	int       firstCull; // the surfaceCull_t of its view surfaces, in worldTask_t::culls
+};
+
+// a node of the main view walk, in traversal order, with what a worker
+// found below it if walk is set
+struct worldTask_t
+{
+	bspNode_t                   *node;
+	int                         planeBits;
+	int                         decalBits;
+	bool                        walk;
+
+	std::vector<bspNode_t *>    traversal;
+	std::vector<gatheredLeaf_t> leaves;
+	std::vector<byte>           culls;
+};
+
+static std::vector<worldTask_t> worldTasks;
+static int                      numWorldTasks;
+
 /*
 ======================
 R_AddInteractionSurface
@@ -279,9 +391,11 @@ static void R_AddDecalSurface( bspSurface_t *surf, int decalBits )
 /*
 ======================
 R_AddWorldSurface
+
+cull is the surfaceCull_t found by a worker thread, or -1 to cull here
 ======================
 */
-static bool R_AddWorldSurface( bspSurface_t *surf, int fogIndex, int planeBits )
+static bool R_AddWorldSurface( bspSurface_t *surf, int fogIndex, int planeBits, int cull = -1 )
 {
 	if ( surf->viewCount == tr.viewCountNoReset )
 	{
@@ -291,7 +405,14 @@ static bool R_AddWorldSurface( bspSurface_t *surf, int fogIndex, int planeBits )
 	surf->viewCount = tr.viewCountNoReset;
 
 	// try to cull before lighting or adding
-	if ( R_CullSurface( surf->data, surf->shader, planeBits ) )
+	if ( cull < 0 )
+	{
+		cull = R_CullSurface( surf->data, surf->shader, planeBits );
+	}
+
+	R_CountSurfaceCull( cull );
+
+	if ( cull & SC_CULLED )
 	{
 		return true;
 	}
@@ -310,34 +431,44 @@ static bool R_AddWorldSurface( bspSurface_t *surf, int fogIndex, int planeBits )
 
 /*
 =================
-R_AddBSPModelSurfaces
+R_CullBSPModel
 =================
 */
-void R_AddBSPModelSurfaces( trRefEntity_t *ent )
+void R_CullBSPModel( trRefEntity_t *ent, const model_t *model, const orientationr_t *orientation )
 {
-	bspModel_t *bspModel;
-	model_t    *pModel;
-	unsigned int i;
-	vec3_t     boundsCenter;
-	int        fogNum;
-
-	pModel = R_GetModelByHandle( ent->e.hModel );
-	bspModel = pModel->bsp;
+	bspModel_t *bspModel = model->bsp;
 
 	// copy local bounds
-	for ( i = 0; i < 3; i++ )
+	for ( int i = 0; i < 3; i++ )
 	{
 		ent->localBounds[ 0 ][ i ] = bspModel->bounds[ 0 ][ i ];
 		ent->localBounds[ 1 ][ i ] = bspModel->bounds[ 1 ][ i ];
 	}
 
-	R_SetupEntityWorldBounds(ent);
+	R_SetupEntityWorldBounds( ent, orientation );
+
+	ent->cull = R_CullBox( ent->worldBounds );
+}
+
+/*
+=================
+R_AddBSPModelSurfaces
+
+Adds the surfaces of an entity culled by R_CullBSPModel
+=================
+*/
+void R_AddBSPModelSurfaces( trRefEntity_t *ent )
+{
+	bspModel_t *bspModel;
+	unsigned int i;
+	vec3_t     boundsCenter;
+	int        fogNum;
+
+	bspModel = tr.currentModel->bsp;
 
 	VectorAdd( ent->worldBounds[ 0 ], ent->worldBounds[ 1 ], boundsCenter );
 	VectorScale( boundsCenter, 0.5f, boundsCenter );
 
-	ent->cull = R_CullBox( ent->worldBounds );
-
 	if ( ent->cull == CULL_OUT )
 	{
 		return;
@@ -354,6 +485,49 @@ void R_AddBSPModelSurfaces( trRefEntity_t *ent )
 	}
 }
 
+/*
+=================
+R_CullEntities
+
+Culls the entities of the view on worker threads, into an array indexed like
+tr.refdef.entities, or returns nullptr to let R_AddEntitySurfaces cull them
+=================
+*/
+const entityCull_t *R_CullEntities()
+{
+	static std::vector<entityCull_t> entityCulls;
+	static std::vector<frontEndCounters_t> workerCounters;
+
+	if ( !r_frontEndThreads.Get() || tr.refdef.numEntities < 2 )
+	{
+		return nullptr;
+	}
+
+	R_ResizeFrontEndWorkers();
+	entityCulls.resize( tr.refdef.numEntities );
+	workerCounters.assign( frontEndWorkers.NumWorkers(), frontEndCounters_t() );
+
+	frontEndWorkers.Run( tr.refdef.numEntities, []( int index, int workerNum ) {
+		R_CullEntity( &tr.refdef.entities[ index ], &entityCulls[ index ], &workerCounters[ workerNum ] );
+	} );
+
+	// the model culls only count these
+	for ( const frontEndCounters_t &counters : workerCounters )
+	{
+		tr.pc.c_sphere_cull_mdv_in += counters.c_sphere_cull_mdv_in;
+		tr.pc.c_sphere_cull_mdv_clip += counters.c_sphere_cull_mdv_clip;
+		tr.pc.c_sphere_cull_mdv_out += counters.c_sphere_cull_mdv_out;
+		tr.pc.c_box_cull_mdv_in += counters.c_box_cull_mdv_in;
+		tr.pc.c_box_cull_mdv_clip += counters.c_box_cull_mdv_clip;
+		tr.pc.c_box_cull_mdv_out += counters.c_box_cull_mdv_out;
+		tr.pc.c_box_cull_md5_in += counters.c_box_cull_md5_in;
+		tr.pc.c_box_cull_md5_clip += counters.c_box_cull_md5_clip;
+		tr.pc.c_box_cull_md5_out += counters.c_box_cull_md5_out;
+	}
+
+	return entityCulls.data();
+}
+
 /*
 =============================================================
 
@@ -362,7 +536,14 @@ void R_AddBSPModelSurfaces( trRefEntity_t *ent )
 =============================================================
 */
 
-static void R_AddLeafSurfaces( bspNode_t *node, int decalBits, int planeBits )
+/*
+================
+R_AddLeafSurfaces
+
+culls are the surfaceCull_t of the view surfaces if a worker thread culled them
+================
+*/
+static void R_AddLeafSurfaces( bspNode_t *node, int decalBits, int planeBits, const byte *culls = nullptr )
 {
 	int          c;
 	bspSurface_t **mark;
@@ -410,7 +591,7 @@ static void R_AddLeafSurfaces( bspNode_t *node, int decalBits, int planeBits )
 	{
 		// the surface may have already been added if it
 		// spans multiple leafs
-		if ( R_AddWorldSurface( *view, ( *view )->fogIndex, planeBits ) )
+		if ( R_AddWorldSurface( *view, ( *view )->fogIndex, planeBits, culls ? *culls++ : -1 ) )
 		{
 			R_AddDecalSurface( *mark, decalBits );
 		}
@@ -424,71 +605,117 @@ static void R_AddLeafSurfaces( bspNode_t *node, int decalBits, int planeBits )
 
 /*
 ================
-R_RecursiveWorldNode
+R_GatherLeafSurfaces
+
+Culls the view surfaces of a leaf on a worker thread, they are added by R_AddLeafSurfaces
 ================
 */
-static void R_RecursiveWorldNode( bspNode_t *node, int planeBits, int decalBits )
+static void R_GatherLeafSurfaces( bspNode_t *node, int decalBits, int planeBits, worldTask_t *task )
 {
-	do
+	bspSurface_t **view = tr.world->viewSurfaces + node->firstMarkSurface;
+
+	task->leaves.push_back( { node, planeBits, decalBits, int( task->culls.size() ) } );
+
+	for ( int c = node->numMarkSurfaces; c--; view++ )
 	{
-		// if the node wasn't marked as potentially visible, exit
-		if ( node->visCounts[ tr.visIndex ] != tr.visCounts[ tr.visIndex ] )
-		{
-			return;
-		}
+		task->culls.push_back( R_CullSurface( ( *view )->data, ( *view )->shader, planeBits ) );
+	}
+}
 
-		if ( node->contents != -1 && !node->numMarkSurfaces )
-		{
-			// don't waste time dealing with this empty leaf
-			return;
-		}
+/*
+================
+R_CullWorldNode
 
-		// if the bounding volume is outside the frustum, nothing
-		// inside can be visible
-		if ( !r_nocull->integer )
-		{
-			int i;
-			int r;
+Returns false if nothing below the node can be visible, planeBits and
+decalBits are narrowed to what the descendants need to check
+================
+*/
+static bool R_CullWorldNode( bspNode_t *node, int *planeBits, int *decalBits )
+{
+	// if the node wasn't marked as potentially visible, exit
+	if ( node->visCounts[ tr.visIndex ] != tr.visCounts[ tr.visIndex ] )
+	{
+		return false;
+	}
 
-			for ( i = 0; i < FRUSTUM_PLANES; i++ )
+	if ( node->contents != -1 && !node->numMarkSurfaces )
+	{
+		// don't waste time dealing with this empty leaf
+		return false;
+	}
+
+	// if the bounding volume is outside the frustum, nothing
+	// inside can be visible
+	if ( !r_nocull->integer )
+	{
+		int i;
+		int r;
+
+		for ( i = 0; i < FRUSTUM_PLANES; i++ )
+		{
+			if ( *planeBits & ( 1 << i ) )
 			{
-				if ( planeBits & ( 1 << i ) )
-				{
-					r = BoxOnPlaneSide( node->mins, node->maxs, &tr.viewParms.frustums[ 0 ][ i ] );
+				r = BoxOnPlaneSide( node->mins, node->maxs, &tr.viewParms.frustums[ 0 ][ i ] );
 
-					if ( r == 2 )
-					{
-						return; // culled
-					}
+				if ( r == 2 )
+				{
+					return false; // culled
+				}
 
-					if ( r == 1 )
-					{
-						planeBits &= ~( 1 << i );  // all descendants will also be in front
-					}
+				if ( r == 1 )
+				{
+					*planeBits &= ~( 1 << i );  // all descendants will also be in front
 				}
 			}
 		}
+	}
 
-		backEndData[ tr.smpFrame ]->traversalList[ backEndData[ tr.smpFrame ]->traversalLength++ ] = node;
+	// ydnar: cull decals
+	if ( *decalBits )
+	{
+		int i;
 
-		// ydnar: cull decals
-		if ( decalBits )
+		for ( i = 0; i < tr.refdef.numDecalProjectors; i++ )
 		{
-			int i;
-
-			for ( i = 0; i < tr.refdef.numDecalProjectors; i++ )
+			if ( *decalBits & ( 1 << i ) )
 			{
-				if ( decalBits & ( 1 << i ) )
+				// test decal bounds against node bounds
+				if ( tr.refdef.decalProjectors[ i ].shader == nullptr ||
+				     !R_TestDecalBoundingBox( &tr.refdef.decalProjectors[ i ], node->mins, node->maxs ) )
 				{
-					// test decal bounds against node bounds
-					if ( tr.refdef.decalProjectors[ i ].shader == nullptr ||
-					     !R_TestDecalBoundingBox( &tr.refdef.decalProjectors[ i ], node->mins, node->maxs ) )
-					{
-						decalBits &= ~( 1 << i );
-					}
+					*decalBits &= ~( 1 << i );
 				}
 			}
 		}
+	}
+
+	return true;
+}
+
+/*
+================
+R_RecursiveWorldNode
+
+The nodes and leaves are recorded in task when called from a worker thread
+================
+*/
+static void R_RecursiveWorldNode( bspNode_t *node, int planeBits, int decalBits, worldTask_t *task = nullptr )
+{
+	do
+	{
+		if ( !R_CullWorldNode( node, &planeBits, &decalBits ) )
+		{
+			return;
+		}
+
+		if ( task )
+		{
+			task->traversal.push_back( node );
+		}
+		else
+		{
+			backEndData[ tr.smpFrame ]->traversalList[ backEndData[ tr.smpFrame ]->traversalLength++ ] = node;
+		}
 
 		if ( node->contents != -1 )
 		{
@@ -500,7 +727,7 @@ static void R_RecursiveWorldNode( bspNode_t *node, int planeBits, int decalBits
 		uint32_t side = d <= 0;
 
 		// recurse down the children, front side first
-		R_RecursiveWorldNode( node->children[ side ], planeBits, decalBits );
+		R_RecursiveWorldNode( node->children[ side ], planeBits, decalBits, task );
 
 		// tail recurse
 		node = node->children[ side ^ 1 ];
@@ -510,16 +737,173 @@ static void R_RecursiveWorldNode( bspNode_t *node, int planeBits, int decalBits
 	if ( node->numMarkSurfaces )
 	{
 		// ydnar: moved off to separate function
-		R_AddLeafSurfaces( node, decalBits, planeBits );
+		if ( task )
+		{
+			R_GatherLeafSurfaces( node, decalBits, planeBits, task );
+		}
+		else
+		{
+			R_AddLeafSurfaces( node, decalBits, planeBits );
+		}
 	}
 }
 
+static void R_AddWorldTask( bspNode_t *node, int planeBits, int decalBits, bool walk )
+{
+	if ( numWorldTasks == static_cast<int>( worldTasks.size() ) )
+	{
+		worldTasks.emplace_back();
+	}
+
+	worldTask_t *task = &worldTasks[ numWorldTasks++ ];
+
+	task->node = node;
+	task->planeBits = planeBits;
+	task->decalBits = decalBits;
+	task->walk = walk;
+	task->traversal.clear();
+	task->leaves.clear();
+	task->culls.clear();
+}
+
+/*
+================
+R_SplitWorldNode
+
+R_RecursiveWorldNode down to depth, leaving the subtrees below to the workers
+================
+*/
+static void R_SplitWorldNode( bspNode_t *node, int planeBits, int decalBits, int depth )
+{
+	if ( !depth || node->contents != -1 )
+	{
+		R_AddWorldTask( node, planeBits, decalBits, true );
+		return;
+	}
+
+	if ( !R_CullWorldNode( node, &planeBits, &decalBits ) )
+	{
+		return;
+	}
+
+	R_AddWorldTask( node, planeBits, decalBits, false );
+
+	float d = DotProduct(tr.viewParms.orientation.viewOrigin, node->plane->normal) - node->plane->dist;
+
+	uint32_t side = d <= 0;
+
+	// front side first
+	R_SplitWorldNode( node->children[ side ], planeBits, decalBits, depth - 1 );
+	R_SplitWorldNode( node->children[ side ^ 1 ], planeBits, decalBits, depth - 1 );
+}
+
+/*
+================
+R_WalkWorldNodes
+
+R_RecursiveWorldNode with the subtrees walked on worker threads and their
+surfaces added on the main thread in traversal order
+================
+*/
+static void R_WalkWorldNodes()
+{
+	numWorldTasks = 0;
+
+	R_SplitWorldNode( tr.world->nodes, FRUSTUM_CLIPALL, tr.refdef.decalBits, WORLD_SPLIT_DEPTH );
+
+	R_ResizeFrontEndWorkers();
+
+	frontEndWorkers.Run( numWorldTasks, []( int index, int ) {
+		worldTask_t *task = &worldTasks[ index ];
+
+		if ( task->walk )
+		{
+			R_RecursiveWorldNode( task->node, task->planeBits, task->decalBits, task );
+		}
+	} );
+
+	for ( int i = 0; i < numWorldTasks; i++ )
+	{
+		const worldTask_t &task = worldTasks[ i ];
+
+		if ( !task.walk )
+		{
+			backEndData[ tr.smpFrame ]->traversalList[ backEndData[ tr.smpFrame ]->traversalLength++ ] = task.node;
+			continue;
+		}
+
+		for ( bspNode_t *node : task.traversal )
+		{
+			backEndData[ tr.smpFrame ]->traversalList[ backEndData[ tr.smpFrame ]->traversalLength++ ] = node;
+		}
+
+		for ( const gatheredLeaf_t &leaf : task.leaves )
+		{
+			R_AddLeafSurfaces( leaf.node, leaf.decalBits, leaf.planeBits, &task.culls[ leaf.firstCull ] );
+		}
+	}
+}
+
+/*
+======================
+R_GatherInteractionSurface
+
+R_AddInteractionSurface for a worker thread
+======================
+*/
+static void R_GatherInteractionSurface( bspSurface_t *surf, trRefLight_t *light, int interactionBits,
+                                        interactionWorker_t *worker, gatheredLight_t *gathered )
+{
+	byte cubeSideBits = CUBESIDE_CLIPALL;
+	bool firstAddition = false;
+	int  index = surf - tr.world->surfaces;
+	int  bits;
+
+	if ( worker->lightCounts[ index ] != worker->lightCount )
+	{
+		worker->interactionBits[ index ] = 0;
+		worker->lightCounts[ index ] = worker->lightCount;
+		firstAddition = true;
+	}
+
+	// only add interactions we haven't already added
+	bits = interactionBits & ~worker->interactionBits[ index ];
+
+	if ( !bits )
+	{
+		return;
+	}
+
+	worker->interactionBits[ index ] |= bits;
+
+	//  skip all surfaces that don't matter for lighting only pass
+	if ( surf->shader->isSky || ( !surf->shader->interactLight && surf->shader->noShadows ) )
+	{
+		return;
+	}
+
+	if ( R_CullLightSurface( surf->data, surf->shader, light, &cubeSideBits ) )
+	{
+		// only dynamic lights are gathered
+		if ( firstAddition )
+		{
+			gathered->surfacesCulled++;
+		}
+		return;
+	}
+
+	gathered->interactions.push_back( { surf, bits, cubeSideBits, firstAddition } );
+}
+
 /*
 ================
 R_RecursiveInteractionNode
+
+The surfaces are recorded in gathered when called from a worker thread
 ================
 */
-static void R_RecursiveInteractionNode( bspNode_t *node, trRefLight_t *light, int planeBits, int interactionBits )
+static void R_RecursiveInteractionNode( bspNode_t *node, trRefLight_t *light, int planeBits, int interactionBits,
+                                        interactionWorker_t *worker = nullptr, gatheredLight_t *gathered = nullptr )
 {
 	int i;
 	int r;
@@ -589,7 +973,7 @@ static void R_RecursiveInteractionNode( bspNode_t *node, trRefLight_t *light, in
 			case 3:
 			default:
 				// recurse down the children, front side first
-				R_RecursiveInteractionNode( node->children[ 0 ], light, planeBits, interactionBits );
+				R_RecursiveInteractionNode( node->children[ 0 ], light, planeBits, interactionBits, worker, gathered );
 
 				// tail recurse
 				node = node->children[ 1 ];
@@ -612,7 +996,16 @@ static void R_RecursiveInteractionNode( bspNode_t *node, trRefLight_t *light, in
 			// the surface may have already been added if it
 			// spans multiple leafs
 			surf = *mark;
-			R_AddInteractionSurface( surf, light, interactionBits );
+
+			if ( gathered )
+			{
+				R_GatherInteractionSurface( surf, light, interactionBits, worker, gathered );
+			}
+			else
+			{
+				R_AddInteractionSurface( surf, light, interactionBits );
+			}
+
 			mark++;
 		}
 	}
@@ -909,13 +1302,102 @@ void R_AddWorldSurfaces()
 		backEndData[ tr.smpFrame ]->traversalLength = 0;
 
 		// update visbounds and add surfaces that weren't cached with VBOs
-		R_RecursiveWorldNode( tr.world->nodes, FRUSTUM_CLIPALL, tr.refdef.decalBits );
+		if ( r_frontEndThreads.Get() )
+		{
+			R_WalkWorldNodes();
+		}
+		else
+		{
+			R_RecursiveWorldNode( tr.world->nodes, FRUSTUM_CLIPALL, tr.refdef.decalBits );
+		}
 
 		// ydnar: add decal surfaces
 		R_AddDecalSurfaces( tr.world->models );
 	}
 }
 
+static int R_WorldInteractionBits( const trRefLight_t *light )
+{
+	int interactionBits = IA_DEFAULT;
+
+	if ( light->restrictInteractionFirst >= 0 )
+	{
+		interactionBits = IA_DEFAULTCLIP;
+	}
+
+	if ( r_shadows->integer <= Util::ordinal(shadowingMode_t::SHADOWING_BLOB) || light->l.noShadows )
+	{
+		interactionBits = interactionBits & IA_LIGHT;
+	}
+
+	return interactionBits;
+}
+
+/*
+=============
+R_GatherWorldInteractions
+
+Finds the world interactions of the dynamic lights among the given ones on
+worker threads, the other lights are left to R_AddWorldInteractions
+=============
+*/
+void R_GatherWorldInteractions( trRefLight_t **lights, int numLights )
+{
+	std::vector<trRefLight_t *> dynamicLights;
+
+	for ( int i = 0; i < tr.refdef.numLights; i++ )
+	{
+		gatheredLights[ i ].gathered = false;
+	}
+
+	if ( !r_frontEndThreads.Get() || !r_drawworld->integer || ( tr.refdef.rdflags & RDF_NOWORLDMODEL ) )
+	{
+		return;
+	}
+
+	for ( int i = 0; i < numLights; i++ )
+	{
+		if ( !lights[ i ]->isStatic )
+		{
+			dynamicLights.push_back( lights[ i ] );
+		}
+	}
+
+	if ( dynamicLights.size() < 2 )
+	{
+		return;
+	}
+
+	R_ResizeFrontEndWorkers();
+	interactionWorkerData.resize( frontEndWorkers.NumWorkers() );
+
+	for ( interactionWorker_t &worker : interactionWorkerData )
+	{
+		if ( worker.surfaces != tr.world->surfaces || worker.numSurfaces != tr.world->numSurfaces )
+		{
+			worker.surfaces = tr.world->surfaces;
+			worker.numSurfaces = tr.world->numSurfaces;
+			worker.lightCount = 0;
+			worker.lightCounts.assign( tr.world->numSurfaces, -1 );
+			worker.interactionBits.assign( tr.world->numSurfaces, 0 );
+		}
+	}
+
+	frontEndWorkers.Run( dynamicLights.size(), [ &dynamicLights ]( int index, int workerNum ) {
+		trRefLight_t        *light = dynamicLights[ index ];
+		gatheredLight_t     *gathered = &gatheredLights[ light - tr.refdef.lights ];
+		interactionWorker_t *worker = &interactionWorkerData[ workerNum ];
+
+		gathered->interactions.clear();
+		gathered->surfacesCulled = 0;
+		worker->lightCount++;
+
+		R_RecursiveInteractionNode( tr.world->nodes, light, FRUSTUM_CLIPALL, R_WorldInteractionBits( light ), worker, gathered );
+
+		gathered->gathered = true;
+	} );
+}
+
 /*
 =============
 R_AddWorldInteractions
@@ -923,7 +1405,7 @@ R_AddWorldInteractions
 */
 void R_AddWorldInteractions( trRefLight_t *light )
 {
-	int interactionBits;
+	gatheredLight_t *gathered;
 
 	if ( !r_drawworld->integer )
 	{
@@ -937,22 +1419,31 @@ void R_AddWorldInteractions( trRefLight_t *light )
 
 	tr.currentEntity = &tr.worldEntity;
 
-	// perform frustum culling and add all the potentially visible surfaces
-	tr.lightCount++;
-
-	interactionBits = IA_DEFAULT;
+	// add the interactions found by R_GatherWorldInteractions in their order
+	gathered = &gatheredLights[ light - tr.refdef.lights ];
 
-	if ( light->restrictInteractionFirst >= 0 )
+	if ( gathered->gathered )
 	{
-		interactionBits = IA_DEFAULTCLIP;
-	}
+		gathered->gathered = false;
 
-	if ( r_shadows->integer <= Util::ordinal(shadowingMode_t::SHADOWING_BLOB) || light->l.noShadows )
-	{
-		interactionBits = interactionBits & IA_LIGHT;
+		for ( const gatheredInteraction_t &ia : gathered->interactions )
+		{
+			R_AddLightInteraction( light, ia.surf->data, ia.surf->shader, ia.cubeSideBits, ( interactionType_t ) ia.bits );
+
+			if ( ia.firstAddition )
+			{
+				tr.pc.c_dlightSurfaces++;
+			}
+		}
+
+		tr.pc.c_dlightSurfacesCulled += gathered->surfacesCulled;
+		return;
 	}
 
-	R_RecursiveInteractionNode( tr.world->nodes, light, FRUSTUM_CLIPALL, interactionBits );
+	// perform frustum culling and add all the potentially visible surfaces
+	tr.lightCount++;
+
+	R_RecursiveInteractionNode( tr.world->nodes, light, FRUSTUM_CLIPALL, R_WorldInteractionBits( light ) );
 }
 
 /*
@@ -51,7 +51,6 @@ Maryland 20850 USA.
 struct svEntity_t
 {
 	entityState_t        baseline; // for delta compression of initial sighting
-	int                  snapshotCounter; // used to prevent double adding from portal views
 };
 
 enum class serverState_t
@@ -68,7 +67,6 @@ struct server_t
 	int           serverId; // changes each server start
 	int           restartedServerId; // serverId before a map_restart
 	int           checksumFeed; // the feed key that we use to compute the pure checksum strings
-	int             snapshotCounter; // incremented for each snapshot built
 	int             timeResidual; // <= 1000 / sv_frame->value
 	int             nextFrameTime; // when time > nextFrameTime, process world
 	struct cmodel_t *models[ MAX_MODELS ];
@@ -275,6 +273,7 @@ public:
 	void GameClientUserInfoChanged(int clientNum);
 	void GameClientDisconnect(int clientNum);
 	void GameClientCommand(int clientNum, const char* command);
+	void GameFinishClientThink(int clientNum);
 	void GameClientThink(int clientNum);
 	void GameRunFrame(int levelTime);
 	bool GameSnapshotCallback(int entityNum, int clientNum);
@@ -287,6 +286,9 @@ private:
 	IPC::SharedMemory shmRegion;
 
 	std::unique_ptr<VM::CommonVMServices> services;
+
+	// Queue generation in which a think of each client was queued
+	uint32_t thinkQueued[ MAX_CLIENTS ];
 };
 
 //=============================================================================
@@ -424,6 +426,57 @@ bool SV_IsBot( const client_t* client );
 
 int  SV_BotGetConsoleMessage( int client, char *buf, int size );
 
+//
+// sv_profile.cpp
+//
+enum class svProfileZone_t
+{
+	FRAME,
+	CALC_PINGS,
+	GAME_RUN_FRAME,
+	CHECK_TIMEOUTS,
+	SEND_MESSAGES,
+	BUILD_SNAPSHOT,
+	WRITE_SNAPSHOT, // includes the Huffman compression done while writing
+	EMIT_ENTITIES,
+	TRANSMIT,
+	HEARTBEAT,
+	NUM_ZONES
+};
+
+void SV_ProfileBeginFrame();
+void SV_ProfileEndFrame();
+bool SV_ProfileRecording();
+void SV_ProfileSuspend( bool suspend );
+void SV_ProfileAdd( svProfileZone_t zone, Sys::SteadyClock::duration duration );
+
+// Adds the time spent in the enclosing scope to a zone of the current frame
+class SVProfileScope
+{
+public:
+	SVProfileScope( svProfileZone_t zone )
+		: zone( zone ), recording( SV_ProfileRecording() )
+	{
+		if ( recording )
+		{
+			start = Sys::SteadyClock::now();
+		}
+	}
+
+	~SVProfileScope()
+	{
+		if ( recording )
+		{
+			SV_ProfileAdd( zone, Sys::SteadyClock::now() - start );
+		}
+	}
+
+private:
+	svProfileZone_t              zone;
+	bool                         recording;
+	Sys::SteadyClock::time_point start;
+};
+
 //
 // sv_net_chan.c
 //
@@ -1280,6 +1280,9 @@ Also called by bot code
 */
 void SV_ClientThink( client_t *cl, usercmd_t *cmd )
 {
+	// the queued think of the client reads lastUsercmd, run it first
+	gvm.GameFinishClientThink( cl - svs.clients );
+
 	cl->lastUsercmd = *cmd;
 
 	if ( cl->state != clientState_t::CS_ACTIVE )
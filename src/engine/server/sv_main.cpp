@@ -1326,6 +1326,9 @@ void SV_Frame( int msec )
 
 	frameStartTime = Sys_Milliseconds();
 
+	// run the thinks queued while reading the client packets
+	gvm.FlushQueue();
+
 	// if it isn't time for the next frame, do nothing
 	if ( sv_fps->integer < 1 )
 	{
@@ -1340,10 +1343,19 @@ void SV_Frame( int msec )
 	{
 		// NET_Sleep will give the OS time slices until either get a packet
 		// or time enough for a server frame has gone by
-		NET_Sleep( frameMsec - sv.timeResidual );
+		if ( NET_UseFrameScheduler() )
+		{
+			NET_SleepUntil( com_frameTime + frameMsec - sv.timeResidual );
+		}
+		else
+		{
+			NET_Sleep( frameMsec - sv.timeResidual );
+		}
 		return;
 	}
 
+	NET_FrameStarted();
+
 	// if time is about to hit the 32nd bit, kick all clients
 	// and clear sv.time, rather
 	// than checking for negative time wraparound everywhere.
@@ -1375,6 +1387,8 @@ void SV_Frame( int msec )
 		return;
 	}
 
+	SV_ProfileBeginFrame();
+
 	// update infostrings if anything has been changed
 	if ( cvar_modifiedFlags & CVAR_SERVERINFO )
 	{
@@ -1398,7 +1412,10 @@ void SV_Frame( int msec )
 	}
 
 	// update ping based on the all received frames
-	SV_CalcPings();
+	{
+		SVProfileScope zone( svProfileZone_t::CALC_PINGS );
+		SV_CalcPings();
+	}
 
 	// run the game simulation in chunks
 	while ( sv.timeResidual >= frameMsec )
@@ -1408,6 +1425,7 @@ void SV_Frame( int msec )
 		sv.time += frameMsec;
 
 		// let everything in the world think and move
+		SVProfileScope zone( svProfileZone_t::GAME_RUN_FRAME );
 		gvm.GameRunFrame( sv.time );
 	}
 
@@ -1417,13 +1435,24 @@ void SV_Frame( int msec )
 	}
 
 	// check timeouts
-	SV_CheckTimeouts();
+	{
+		SVProfileScope zone( svProfileZone_t::CHECK_TIMEOUTS );
+		SV_CheckTimeouts();
+	}
 
 	// send messages back to the clients
-	SV_SendClientMessages();
+	{
+		SVProfileScope zone( svProfileZone_t::SEND_MESSAGES );
+		SV_SendClientMessages();
+	}
 
 	// send a heartbeat to the master if needed
-	SV_MasterHeartbeat( HEARTBEAT_GAME );
+	{
+		SVProfileScope zone( svProfileZone_t::HEARTBEAT );
+		SV_MasterHeartbeat( HEARTBEAT_GAME );
+	}
+
+	SV_ProfileEndFrame();
 
 	frameEndTime = Sys_Milliseconds();
 
@@ -0,0 +1,413 @@
+/*
+===========================================================================
+Daemon BSD Source Code
+Copyright (c) 2026, Daemon Developers
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Daemon developers nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DAEMON DEVELOPERS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================
+*/
+
+// sv_profile.cpp -- per-frame timings of the server frame phases
+
+#include "common/Common.h"
+#include "server.h"
+
+static Cvar::Cvar<bool> sv_profileFrames(
+	"server.profile",
+	"record per-frame timings of the server frame phases, see /sv_profile",
+	Cvar::NONE,
+	false
+);
+
+// number of frames kept in the history
+static const int PROFILE_FRAMES = 1024;
+
+static const char* const profileZoneNames[] = {
+	"frame",
+	"calcPings",
+	"gameRunFrame",
+	"checkTimeouts",
+	"sendMessages",
+	"buildSnapshot",
+	"writeSnapshot",
+	"emitEntities",
+	"transmit",
+	"heartbeat",
+};
+static_assert(ARRAY_LEN(profileZoneNames) == Util::ordinal(svProfileZone_t::NUM_ZONES), "profileZoneNames is out of sync");
+
+// Quantities counted once per frame, they are not timed
+enum class profileCounter_t
+{
+	SGAME_MESSAGES, // messages sent to sgame including queue flushes
+	SGAME_QUEUED, // messages queued for sgame
+	IPC_ALLOCATIONS, // message buffers which had to be allocated in the engine
+	NUM_COUNTERS
+};
+
+static const char* const profileCounterNames[] = {
+	"sgameMessages",
+	"sgameQueued",
+	"ipcAllocations",
+};
+static_assert(ARRAY_LEN(profileCounterNames) == Util::ordinal(profileCounter_t::NUM_COUNTERS), "profileCounterNames is out of sync");
+
+struct profileFrame_t
+{
+	int      frameNum;
+	int      time;
+	uint64_t ns[ Util::ordinal(svProfileZone_t::NUM_ZONES) ];
+	int      calls[ Util::ordinal(svProfileZone_t::NUM_ZONES) ];
+	int      counts[ Util::ordinal(profileCounter_t::NUM_COUNTERS) ];
+};
+
+static struct {
+	bool           recording;
+	bool           suspended;
+	Sys::SteadyClock::time_point frameStart;
+	profileFrame_t current;
+
+	// ring buffer of the last PROFILE_FRAMES frames
+	profileFrame_t frames[ PROFILE_FRAMES ];
+	int            numFrames;
+	int            nextFrame;
+
+	// message counts of sgame and allocation count at the end of the previous frame
+	uint64_t       sgameSent;
+	uint64_t       sgameQueued;
+	uint64_t       ipcAllocations;
+} svProfile;
+
+bool SV_ProfileRecording()
+{
+	return svProfile.recording && !svProfile.suspended;
+}
+
+/*
+==================
+SV_ProfileSuspend
+
+Stops recording the zones entered while the snapshot workers are running,
+the caller measures the whole parallel section instead
+==================
+*/
+void SV_ProfileSuspend( bool suspend )
+{
+	svProfile.suspended = suspend;
+}
+
+/*
+==================
+SV_ProfileBeginFrame
+==================
+*/
+void SV_ProfileBeginFrame()
+{
+	svProfile.recording = sv_profileFrames.Get();
+
+	if ( !svProfile.recording )
+	{
+		return;
+	}
+
+	svProfile.current = {};
+	svProfile.current.frameNum = svs.currentFrameIndex;
+	svProfile.current.time = svs.time;
+	svProfile.frameStart = Sys::SteadyClock::now();
+}
+
+/*
+==================
+SV_ProfileEndFrame
+==================
+*/
+void SV_ProfileEndFrame()
+{
+	// counted from the end of the previous frame, to include the messages
+	// sent while reading the client packets before this frame
+	uint64_t sgameSent = gvm.GetSentMsgs();
+	uint64_t sgameQueued = gvm.GetQueuedMsgs();
+	int sentSinceLast = sgameSent - svProfile.sgameSent;
+	int queuedSinceLast = sgameQueued - svProfile.sgameQueued;
+	svProfile.sgameSent = sgameSent;
+	svProfile.sgameQueued = sgameQueued;
+	uint64_t ipcAllocations = Util::GetBufferAllocations();
+	int allocationsSinceLast = ipcAllocations - svProfile.ipcAllocations;
+	svProfile.ipcAllocations = ipcAllocations;
+
+	if ( !svProfile.recording )
+	{
+		return;
+	}
+
+	SV_ProfileAdd( svProfileZone_t::FRAME, Sys::SteadyClock::now() - svProfile.frameStart );
+	svProfile.current.counts[ Util::ordinal( profileCounter_t::SGAME_MESSAGES ) ] = sentSinceLast;
+	svProfile.current.counts[ Util::ordinal( profileCounter_t::SGAME_QUEUED ) ] = queuedSinceLast;
+	svProfile.current.counts[ Util::ordinal( profileCounter_t::IPC_ALLOCATIONS ) ] = allocationsSinceLast;
+	svProfile.current.time = svs.time;
+
+	svProfile.frames[ svProfile.nextFrame ] = svProfile.current;
+	svProfile.nextFrame = ( svProfile.nextFrame + 1 ) % PROFILE_FRAMES;
+	svProfile.numFrames = std::min( svProfile.numFrames + 1, PROFILE_FRAMES );
+	svProfile.recording = false;
+}
+
+void SV_ProfileAdd( svProfileZone_t zone, Sys::SteadyClock::duration duration )
+{
+	int index = Util::ordinal( zone );
+
+	svProfile.current.ns[ index ] += std::chrono::duration_cast<std::chrono::nanoseconds>( duration ).count();
+	svProfile.current.calls[ index ]++;
+}
+
+// The recorded frames, oldest first
+static std::vector<const profileFrame_t*> SV_ProfileFrames()
+{
+	std::vector<const profileFrame_t*> frames;
+	int first = ( svProfile.nextFrame - svProfile.numFrames + PROFILE_FRAMES ) % PROFILE_FRAMES;
+
+	for ( int i = 0; i < svProfile.numFrames; i++ )
+	{
+		frames.push_back( &svProfile.frames[ ( first + i ) % PROFILE_FRAMES ] );
+	}
+
+	return frames;
+}
+
+struct profileSummary_t
+{
+	uint64_t p50, p99, max;
+	double   calls;
+};
+
+static profileSummary_t SV_ProfileSummary( const std::vector<const profileFrame_t*>& frames, int zone )
+{
+	profileSummary_t summary{};
+
+	if ( frames.empty() )
+	{
+		return summary;
+	}
+
+	std::vector<uint64_t> ns;
+	uint64_t calls = 0;
+
+	for ( const profileFrame_t* frame : frames )
+	{
+		ns.push_back( frame->ns[ zone ] );
+		calls += frame->calls[ zone ];
+	}
+
+	std::sort( ns.begin(), ns.end() );
+
+	summary.p50 = ns[ ( ns.size() - 1 ) / 2 ];
+	summary.p99 = ns[ ( ns.size() - 1 ) * 99 / 100 ];
+	summary.max = ns.back();
+	summary.calls = double( calls ) / frames.size();
+	return summary;
+}
+
+struct counterSummary_t
+{
+	double mean;
+	int    max;
+};
+
+static counterSummary_t SV_CounterSummary( const std::vector<const profileFrame_t*>& frames, int counter )
+{
+	counterSummary_t summary{};
+
+	if ( frames.empty() )
+	{
+		return summary;
+	}
+
+	uint64_t total = 0;
+
+	for ( const profileFrame_t* frame : frames )
+	{
+		total += frame->counts[ counter ];
+		summary.max = std::max( summary.max, frame->counts[ counter ] );
+	}
+
+	summary.mean = double( total ) / frames.size();
+	return summary;
+}
+
+static void SV_ProfileWriteJSON( FS::File& file, const std::vector<const profileFrame_t*>& frames )
+{
+	int numZones = Util::ordinal( svProfileZone_t::NUM_ZONES );
+	int numCounters = Util::ordinal( profileCounter_t::NUM_COUNTERS );
+
+	file.Printf( "{\n\t\"summary\": {\n" );
+
+	for ( int zone = 0; zone < numZones; zone++ )
+	{
+		profileSummary_t summary = SV_ProfileSummary( frames, zone );
+		file.Printf( "\t\t\"%s\": { \"p50\": %d, \"p99\": %d, \"max\": %d, \"calls\": %.2f }%s\n",
+		             profileZoneNames[ zone ], summary.p50, summary.p99, summary.max, summary.calls,
+		             zone == numZones - 1 ? "" : "," );
+	}
+
+	file.Printf( "\t},\n\t\"counters\": {\n" );
+
+	for ( int counter = 0; counter < numCounters; counter++ )
+	{
+		counterSummary_t summary = SV_CounterSummary( frames, counter );
+		file.Printf( "\t\t\"%s\": { \"mean\": %.2f, \"max\": %d }%s\n",
+		             profileCounterNames[ counter ], summary.mean, summary.max,
+		             counter == numCounters - 1 ? "" : "," );
+	}
+
+	file.Printf( "\t},\n\t\"frames\": [\n" );
+
+	for ( size_t i = 0; i < frames.size(); i++ )
+	{
+		file.Printf( "\t\t{ \"frame\": %d, \"time\": %d", frames[ i ]->frameNum, frames[ i ]->time );
+
+		for ( int zone = 0; zone < numZones; zone++ )
+		{
+			file.Printf( ", \"%s\": [%d, %d]", profileZoneNames[ zone ], frames[ i ]->ns[ zone ], frames[ i ]->calls[ zone ] );
+		}
+
+		for ( int counter = 0; counter < numCounters; counter++ )
+		{
+			file.Printf( ", \"%s\": %d", profileCounterNames[ counter ], frames[ i ]->counts[ counter ] );
+		}
+
+		file.Printf( " }%s\n", i == frames.size() - 1 ? "" : "," );
+	}
+
+	file.Printf( "\t]\n}\n" );
+}
+
+static void SV_ProfileWriteCSV( FS::File& file, const std::vector<const profileFrame_t*>& frames )
+{
+	int numZones = Util::ordinal( svProfileZone_t::NUM_ZONES );
+	int numCounters = Util::ordinal( profileCounter_t::NUM_COUNTERS );
+
+	file.Printf( "frame,time" );
+
+	for ( int zone = 0; zone < numZones; zone++ )
+	{
+		file.Printf( ",%s_ns,%s_calls", profileZoneNames[ zone ], profileZoneNames[ zone ] );
+	}
+
+	for ( int counter = 0; counter < numCounters; counter++ )
+	{
+		file.Printf( ",%s", profileCounterNames[ counter ] );
+	}
+
+	file.Printf( "\n" );
+
+	for ( const profileFrame_t* frame : frames )
+	{
+		file.Printf( "%d,%d", frame->frameNum, frame->time );
+
+		for ( int zone = 0; zone < numZones; zone++ )
+		{
+			file.Printf( ",%d,%d", frame->ns[ zone ], frame->calls[ zone ] );
+		}
+
+		for ( int counter = 0; counter < numCounters; counter++ )
+		{
+			file.Printf( ",%d", frame->counts[ counter ] );
+		}
+
+		file.Printf( "\n" );
+	}
+}
+
+class ProfileCmd: public Cmd::StaticCmd {
+public:
+	ProfileCmd()
+		: Cmd::StaticCmd("sv_profile", Cmd::SYSTEM, "shows or dumps the server frame timings recorded with server.profile") {}
+
+	void Run(const Cmd::Args& args) const override
+	{
+		if (args.Argc() == 1) {
+			PrintSummary();
+		} else if (args.Argc() == 2 && args.Argv(1) == "reset") {
+			svProfile.numFrames = 0;
+			svProfile.nextFrame = 0;
+		} else if ((args.Argc() == 2 || args.Argc() == 3) && (args.Argv(1) == "json" || args.Argv(1) == "csv")) {
+			const std::string& format = args.Argv(1);
+			std::string filename = args.Argc() == 3 ? args.Argv(2) : "sv_profile." + format;
+			Dump(format, filename);
+		} else {
+			PrintUsage(args, "[reset | json [<file>] | csv [<file>]]", "");
+		}
+	}
+
+private:
+	void PrintSummary() const
+	{
+		auto frames = SV_ProfileFrames();
+
+		if (frames.empty()) {
+			Print("No frames recorded, set server.profile to 1 to record them");
+			return;
+		}
+
+		Print("%d frames, times in microseconds, nested zones are included in their parent", frames.size());
+		Print("%-14s %10s %10s %10s %8s", "zone", "p50", "p99", "max", "calls");
+
+		for (int zone = 0; zone < Util::ordinal(svProfileZone_t::NUM_ZONES); zone++) {
+			profileSummary_t summary = SV_ProfileSummary(frames, zone);
+			Print("%-14s %10.1f %10.1f %10.1f %8.2f", profileZoneNames[zone],
+				summary.p50 / 1000.0, summary.p99 / 1000.0, summary.max / 1000.0, summary.calls);
+		}
+
+		Print("%-14s %10s %10s", "counter", "mean", "max");
+
+		for (int counter = 0; counter < Util::ordinal(profileCounter_t::NUM_COUNTERS); counter++) {
+			counterSummary_t summary = SV_CounterSummary(frames, counter);
+			Print("%-14s %10.2f %10d", profileCounterNames[counter], summary.mean, summary.max);
+		}
+	}
+
+	void Dump(const std::string& format, const std::string& filename) const
+	{
+		if (!FS::Path::BaseName(filename).size() || !Str::IsSuffix("." + format, filename)) {
+			Print("The file name must end with .%s", format);
+			return;
+		}
+
+		try {
+			FS::File file = FS::HomePath::OpenWrite(filename);
+
+			if (format == "json") {
+				SV_ProfileWriteJSON(file, SV_ProfileFrames());
+			} else {
+				SV_ProfileWriteCSV(file, SV_ProfileFrames());
+			}
+
+			file.Close();
+			Print("Wrote %d frames to %s", svProfile.numFrames, filename);
+		} catch (std::system_error& err) {
+			Print("Couldn't write %s: %s", filename, err.what());
+		}
+	}
+};
+static ProfileCmd ProfileCmdRegistration;
@@ -285,6 +285,9 @@ static void SV_InitGameVM()
 {
 	int i;
 
+	// the frame scheduler has to watch the root socket of the new VM
+	NET_ResetFrameScheduler();
+
 	// start the entity parsing at the beginning
 	sv.entityParsePoint = CM_EntityString();
 
@@ -339,7 +342,7 @@ void SV_InitGameProgs()
 	SV_InitGameVM();
 }
 
-GameVM::GameVM(): VM::VMBase("sgame", Cvar::NONE), services(nullptr) {
+GameVM::GameVM(): VM::VMBase("sgame", Cvar::NONE), services(nullptr), thinkQueued() {
 }
 
 void GameVM::Start()
@@ -406,7 +409,7 @@ void GameVM::GameClientBegin(int clientNum)
 
 void GameVM::GameClientUserInfoChanged(int clientNum)
 {
-	this->SendMsg<GameClientUserinfoChangedMsg>(clientNum);
+	this->QueueMsg<GameClientUserinfoChangedMsg>(clientNum);
 }
 
 void GameVM::GameClientDisconnect(int clientNum)
@@ -419,9 +422,21 @@ void GameVM::GameClientCommand(int clientNum, const char* command)
 	this->SendMsg<GameClientCommandMsg>(clientNum, command);
 }
 
+void GameVM::GameFinishClientThink(int clientNum)
+{
+	// The game reads the usercmd back when it handles the think, so the queued
+	// think must run before the usercmd of the client changes.
+	if (thinkQueued[clientNum] == GetQueueGeneration()) {
+		FlushQueue();
+	}
+}
+
 void GameVM::GameClientThink(int clientNum)
 {
-	this->SendMsg<GameClientThinkMsg>(clientNum);
+	GameFinishClientThink(clientNum);
+
+	this->QueueMsg<GameClientThinkMsg>(clientNum);
+	thinkQueued[clientNum] = GetQueueGeneration();
 }
 
 void GameVM::GameRunFrame(int levelTime)
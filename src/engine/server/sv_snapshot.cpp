@@ -34,6 +34,7 @@ Maryland 20850 USA.
 
 #include "server.h"
 #include "qcommon/sys.h"
+#include "framework/ThreadPool.h"
 
 /*
 =============================================================================
@@ -57,6 +58,214 @@ A server packet will look something like:
 =============================================================================
 */
 
+/*
+=============================================================================
+
+SNAPSHOT DELTA CACHE
+
+Clients often send the same entity delta: everyone acknowledging a
+broadcast entity at the same time, spectators following the same player,
+all the new entities sent from their baseline. The bits written by
+MSG_WriteDeltaEntity are kept for each entity and reused when the same
+pair of states comes up again. The entries are keyed by the hashes of the
+states, which only avoid comparing the full states of mismatching entries.
+
+=============================================================================
+*/
+
+static Cvar::Cvar<bool> sv_snapshotDeltaCache(
+	"server.snapshotDeltaCache",
+	"reuse the entity deltas encoded for other clients",
+	Cvar::NONE,
+	true
+);
+
+static const int DELTA_CACHE_WAYS = 4;
+static const int DELTA_CACHE_BYTES = 256;
+
+struct deltaCacheEntry_t
+{
+	uint32_t      fromHash;
+	uint32_t      toHash;
+	bool          force;
+	entityState_t from;
+	entityState_t to;
+	int           bits;
+	int           uncompressedBits;
+	byte          data[ DELTA_CACHE_BYTES ];
+};
+
+struct deltaCacheSlot_t
+{
+	std::mutex        mutex;
+	int               frame; // entries of older frames are discarded
+	int               numEntries;
+	int               nextEntry;
+	deltaCacheEntry_t entries[ DELTA_CACHE_WAYS ];
+};
+
+static struct {
+	deltaCacheSlot_t      slots[ MAX_GENTITIES ];
+	int                   frame;
+
+	std::atomic<uint64_t> hits;
+	std::atomic<uint64_t> misses;
+	std::atomic<uint64_t> uncached; // too large to be stored
+} deltaCache;
+
+static uint32_t SV_HashEntityState( const entityState_t *state )
+{
+	const uint32_t *words = reinterpret_cast<const uint32_t*>( state );
+	uint32_t       hash = 2166136261u;
+
+	for ( size_t i = 0; i < sizeof( *state ) / 4; i++ )
+	{
+		hash = ( hash ^ words[ i ] ) * 16777619u;
+	}
+
+	return hash;
+}
+
+/*
+=============
+SV_BeginDeltaCacheFrame
+
+Starts a new generation of entries, the old ones are dropped when their slot is used
+=============
+*/
+static void SV_BeginDeltaCacheFrame()
+{
+	deltaCache.frame++;
+}
+
+/*
+=============
+SV_WriteDeltaEntity
+
+MSG_WriteDeltaEntity for entity updates, going through the cache
+=============
+*/
+static void SV_WriteDeltaEntity( msg_t *msg, entityState_t *from, entityState_t *to, bool force )
+{
+	if ( !sv_snapshotDeltaCache.Get() || to->number < 0 || to->number >= MAX_GENTITIES )
+	{
+		MSG_WriteDeltaEntity( msg, from, to, force );
+		return;
+	}
+
+	// unchanged entities are skipped without hashing them
+	if ( !force && !memcmp( from, to, sizeof( *from ) ) )
+	{
+		return;
+	}
+
+	deltaCacheSlot_t& slot = deltaCache.slots[ to->number ];
+	uint32_t fromHash = SV_HashEntityState( from );
+	uint32_t toHash = SV_HashEntityState( to );
+
+	{
+		std::lock_guard<std::mutex> lock( slot.mutex );
+
+		if ( slot.frame != deltaCache.frame )
+		{
+			slot.frame = deltaCache.frame;
+			slot.numEntries = 0;
+			slot.nextEntry = 0;
+		}
+
+		for ( int i = 0; i < slot.numEntries; i++ )
+		{
+			const deltaCacheEntry_t& entry = slot.entries[ i ];
+
+			if ( entry.fromHash != fromHash || entry.toHash != toHash || entry.force != force ||
+			     memcmp( &entry.from, from, sizeof( *from ) ) || memcmp( &entry.to, to, sizeof( *to ) ) )
+			{
+				continue;
+			}
+
+			if ( MSG_WriteEncodedBits( msg, entry.data, entry.bits, entry.uncompressedBits ) )
+			{
+				deltaCache.hits.fetch_add( 1, std::memory_order_relaxed );
+				return;
+			}
+
+			break;
+		}
+	}
+
+	// encode it apart first, so that the bits can be stored
+	byte  buffer[ DELTA_CACHE_BYTES + 32 ];
+	msg_t encoded;
+
+	MSG_Init( &encoded, buffer, sizeof( buffer ) );
+	MSG_WriteDeltaEntity( &encoded, from, to, force );
+
+	if ( encoded.overflowed || !MSG_WriteEncodedBits( msg, encoded.data, encoded.bit, encoded.uncompsize ) )
+	{
+		deltaCache.uncached.fetch_add( 1, std::memory_order_relaxed );
+		MSG_WriteDeltaEntity( msg, from, to, force );
+		return;
+	}
+
+	deltaCache.misses.fetch_add( 1, std::memory_order_relaxed );
+
+	std::lock_guard<std::mutex> lock( slot.mutex );
+
+	if ( slot.frame != deltaCache.frame )
+	{
+		slot.frame = deltaCache.frame;
+		slot.numEntries = 0;
+		slot.nextEntry = 0;
+	}
+
+	deltaCacheEntry_t& entry = slot.entries[ slot.nextEntry ];
+	entry.fromHash = fromHash;
+	entry.toHash = toHash;
+	entry.force = force;
+	entry.from = *from;
+	entry.to = *to;
+	entry.bits = encoded.bit;
+	entry.uncompressedBits = encoded.uncompsize;
+	Com_Memcpy( entry.data, encoded.data, ( encoded.bit + 7 ) >> 3 );
+
+	slot.nextEntry = ( slot.nextEntry + 1 ) % DELTA_CACHE_WAYS;
+	slot.numEntries = std::min( slot.numEntries + 1, DELTA_CACHE_WAYS );
+}
+
+class SnapshotCacheStatsCmd: public Cmd::StaticCmd {
+public:
+	SnapshotCacheStatsCmd()
+		: Cmd::StaticCmd("sv_snapshotCacheStats", Cmd::SYSTEM, "shows the hit rate of the snapshot delta cache") {}
+
+	void Run(const Cmd::Args& args) const override
+	{
+		if (args.Argc() == 2 && args.Argv(1) == "reset") {
+			deltaCache.hits = 0;
+			deltaCache.misses = 0;
+			deltaCache.uncached = 0;
+			return;
+		}
+
+		if (args.Argc() != 1) {
+			PrintUsage(args, "[reset]", "");
+			return;
+		}
+
+		uint64_t hits = deltaCache.hits;
+		uint64_t misses = deltaCache.misses;
+		uint64_t uncached = deltaCache.uncached;
+		uint64_t total = hits + misses + uncached;
+
+		Print("%d entity deltas: %d hits, %d misses, %d not cached",
+		      total, hits, misses, uncached);
+
+		if (total) {
+			Print("Hit rate: %.1f%%", 100.0 * hits / total);
+		}
+	}
+};
+static SnapshotCacheStatsCmd SnapshotCacheStatsCmdRegistration;
+
 /*
 =============
 SV_EmitPacketEntities
@@ -71,6 +280,8 @@ static void SV_EmitPacketEntities( const clientSnapshot_t *from, clientSnapshot_
 	int           oldnum, newnum;
 	int           from_num_entities;
 
+	SVProfileScope zone( svProfileZone_t::EMIT_ENTITIES );
+
     MSG_WriteShort(msg, to->num_entities);
 
 	// generate the delta update
@@ -118,7 +329,7 @@ static void SV_EmitPacketEntities( const clientSnapshot_t *from, clientSnapshot_
 			// delta update from old position
 			// because the force parm is false, this will not result
 			// in any bytes being emitted if the entity has not changed at all
-			MSG_WriteDeltaEntity( msg, oldent, newent, false );
+			SV_WriteDeltaEntity( msg, oldent, newent, false );
 			oldindex++;
 			newindex++;
 			continue;
@@ -127,7 +338,7 @@ static void SV_EmitPacketEntities( const clientSnapshot_t *from, clientSnapshot_
 		if ( newnum < oldnum )
 		{
 			// this is a new entity, send it from the baseline
-			MSG_WriteDeltaEntity( msg, &sv.svEntities[ newnum ].baseline, newent, true );
+			SV_WriteDeltaEntity( msg, &sv.svEntities[ newnum ].baseline, newent, true );
 			newindex++;
 			continue;
 		}
@@ -146,47 +357,58 @@ static void SV_EmitPacketEntities( const clientSnapshot_t *from, clientSnapshot_
 
 /*
 ==================
-SV_WriteSnapshotToClient
+SV_SnapshotDeltaFrame
+
+Tries to use a previous frame as the source for delta compressing the snapshot,
+nextSnapshotEntities is svs.nextSnapshotEntities once the snapshot is stored
 ==================
 */
-static void SV_WriteSnapshotToClient( client_t *client, msg_t *msg )
+static void SV_SnapshotDeltaFrame( client_t *client, int nextSnapshotEntities, clientSnapshot_t **oldframe, int *lastframe )
 {
-	clientSnapshot_t *frame, *oldframe;
-	int              lastframe;
-	int              i;
-	int              snapFlags;
-
-	// this is the snapshot we are creating
-	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
-
-	// try to use a previous frame as the source for delta compressing the snapshot
 	if ( client->deltaMessage <= 0 || client->state != clientState_t::CS_ACTIVE )
 	{
 		// client is asking for a retransmit
-		oldframe = nullptr;
-		lastframe = 0;
+		*oldframe = nullptr;
+		*lastframe = 0;
 	}
 	else if ( client->netchan.outgoingSequence - client->deltaMessage >= ( PACKET_BACKUP - 3 ) )
 	{
 		// client hasn't gotten a good message through in a long time
 		Log::Debug( "%s^*: Delta request from out of date packet.", client->name );
-		oldframe = nullptr;
-		lastframe = 0;
+		*oldframe = nullptr;
+		*lastframe = 0;
 	}
 	else
 	{
 		// we have a valid snapshot to delta from
-		oldframe = &client->frames[ client->deltaMessage & PACKET_MASK ];
-		lastframe = client->netchan.outgoingSequence - client->deltaMessage;
+		*oldframe = &client->frames[ client->deltaMessage & PACKET_MASK ];
+		*lastframe = client->netchan.outgoingSequence - client->deltaMessage;
 
 		// the snapshot's entities may still have rolled off the buffer, though
-		if ( oldframe->first_entity <= svs.nextSnapshotEntities - svs.numSnapshotEntities )
+		if ( ( *oldframe )->first_entity <= nextSnapshotEntities - svs.numSnapshotEntities )
 		{
 			Log::Debug( "%s^*: Delta request from out of date entities.", client->name );
-			oldframe = nullptr;
-			lastframe = 0;
+			*oldframe = nullptr;
+			*lastframe = 0;
 		}
 	}
+}
+
+/*
+==================
+SV_WriteSnapshotToClient
+==================
+*/
+static void SV_WriteSnapshotToClient( client_t *client, msg_t *msg, clientSnapshot_t *oldframe, int lastframe )
+{
+	clientSnapshot_t *frame;
+	int              i;
+	int              snapFlags;
+
+	SVProfileScope zone( svProfileZone_t::WRITE_SNAPSHOT );
+
+	// this is the snapshot we are creating
+	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
 
 	MSG_WriteByte( msg, svc_snapshot );
 
@@ -279,10 +501,23 @@ static const int MAX_SNAPSHOT_ENTITIES = 2048;
 
 struct snapshotEntityNumbers_t
 {
-	int numSnapshotEntities;
-	int snapshotEntities[ MAX_SNAPSHOT_ENTITIES ];
+	int      numSnapshotEntities;
+	int      snapshotEntities[ MAX_SNAPSHOT_ENTITIES ];
+
+	// entities already considered for this snapshot, to prevent double adding from portal views
+	uint64_t added[ MAX_GENTITIES / 64 ];
 };
 
+static bool SV_SnapshotHasEntity( const snapshotEntityNumbers_t *eNums, int num )
+{
+	return eNums->added[ num / 64 ] & ( uint64_t( 1 ) << ( num % 64 ) );
+}
+
+static void SV_MarkSnapshotEntity( snapshotEntityNumbers_t *eNums, int num )
+{
+	eNums->added[ num / 64 ] |= uint64_t( 1 ) << ( num % 64 );
+}
+
 /*
 =======================
 SV_QsortEntityNumbers
@@ -313,16 +548,15 @@ static int SV_QsortEntityNumbers( const void *a, const void *b )
 SV_AddEntToSnapshot
 ===============
 */
-static void SV_AddEntToSnapshot( sharedEntity_t *clientEnt, svEntity_t *svEnt, sharedEntity_t *gEnt,
-                                 snapshotEntityNumbers_t *eNums )
+static void SV_AddEntToSnapshot( sharedEntity_t *clientEnt, sharedEntity_t *gEnt, snapshotEntityNumbers_t *eNums )
 {
 	// if we have already added this entity to this snapshot, don't add again
-	if ( svEnt->snapshotCounter == sv.snapshotCounter )
+	if ( SV_SnapshotHasEntity( eNums, gEnt->s.number ) )
 	{
 		return;
 	}
 
-	svEnt->snapshotCounter = sv.snapshotCounter;
+	SV_MarkSnapshotEntity( eNums, gEnt->s.number );
 
 	// if we are full, silently discard entities
 	if ( eNums->numSnapshotEntities == MAX_SNAPSHOT_ENTITIES )
@@ -342,353 +576,668 @@ static void SV_AddEntToSnapshot( sharedEntity_t *clientEnt, svEntity_t *svEnt, s
 	eNums->numSnapshotEntities++;
 }
 
+/*
+=============================================================================
+
+SNAPSHOT ENTITY INDEX
+
+The entities are linked by the game module directly in the shared gentities
+so the index is rebuilt once per SV_SendClientMessages, which only needs a
+single pass over the entities instead of one per client and portal view.
+Only the entities that can pass the visibility tests of a given viewpoint
+are tested, in entity number order, so the resulting snapshots are the same
+as with the linear scan.
+
+=============================================================================
+*/
+
+static Cvar::Cvar<bool> sv_snapshotEntityIndex(
+	"server.snapshotEntityIndex",
+	"look up the entities visible to clients in a per-cluster index instead of testing them all",
+	Cvar::NONE,
+	true
+);
+
+static const int ENTITY_WORDS = MAX_GENTITIES / 64;
+
+struct entityIndex_t
+{
+	bool             enabled;
+	bool             valid;
+
+	// entities that have to be tested from every viewpoint
+	uint64_t         unclustered[ ENTITY_WORDS ];
+
+	// entities touching each cluster, in clusterEntities[ clusterStart[ c ] .. clusterStart[ c + 1 ] - 1 ]
+	std::vector<int> clusterStart;
+	std::vector<int> clusterEntities;
+	std::vector<int> occupiedClusters;
+
+	// entities having a given entity as their otherEntityNum, for SVF_VISDUMMY_MULTIPLE
+	int              dummyMasterStart[ MAX_GENTITIES + 1 ];
+	std::vector<int> dummyMasters;
+};
+
+static entityIndex_t entityIndex;
+
 /*
 ===============
-SV_AddEntitiesVisibleFromPoint
+SV_IndexedEntity
+
+Returns the linked, sendable entity with the given number or nullptr
 ===============
 */
-static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *frame,
-//                                  snapshotEntityNumbers_t *eNums, bool portal, clientSnapshot_t *oldframe, bool localClient ) {
-//                                  snapshotEntityNumbers_t *eNums, bool portal ) {
-    snapshotEntityNumbers_t *eNums /*, bool portal, bool localClient */ )
+static sharedEntity_t *SV_IndexedEntity( int e )
 {
-	int            e, i;
-	sharedEntity_t *ent, *playerEnt;
-	svEntity_t     *svEnt;
-	int            l;
-	int            clientarea, clientcluster;
-	int            leafnum;
-//	int             c_fullsend;
-	byte           *clientpvs;
-	byte           *bitvector;
+	sharedEntity_t *ent = SV_GentityNum( e );
 
-	// during an error shutdown message we may need to transmit
-	// the shutdown message after the server has shutdown, so
-	// specifically check for it
-	if (sv.state == serverState_t::SS_DEAD)
+	if ( !ent->r.linked )
 	{
-		return;
+		return nullptr;
 	}
 
-	leafnum = CM_PointLeafnum( origin );
-	clientarea = CM_LeafArea( leafnum );
-	clientcluster = CM_LeafCluster( leafnum );
+	if ( ent->s.number != e )
+	{
+		Log::Debug( "FIXING ENT->S.NUMBER!!!" );
+		ent->s.number = e;
+	}
 
-	// calculate the visible areas
-	frame->areabytes = CM_WriteAreaBits( frame->areabits, clientarea );
+	if ( ent->r.svFlags & SVF_NOCLIENT )
+	{
+		return nullptr;
+	}
 
-	clientpvs = CM_ClusterPVS( clientcluster );
+	return ent;
+}
 
-//	c_fullsend = 0;
+/*
+===============
+SV_EntityClusters
 
-	playerEnt = SV_GentityNum( frame->ps.clientNum );
+Returns false if the entity has to be tested from every viewpoint,
+otherwise fills the clusters it can be seen from.
+===============
+*/
+static bool SV_EntityClusters( const sharedEntity_t *ent, int numClusters, int *clusters, int *count )
+{
+	*count = 0;
 
-	if ( playerEnt->r.svFlags & SVF_SELF_PORTAL )
+	if ( ent->r.svFlags & ( SVF_BROADCAST | SVF_CLIENTS_IN_RANGE ) )
 	{
-		SV_AddEntitiesVisibleFromPoint( playerEnt->s.origin2, frame, eNums );
+		return false;
 	}
 
-	for ( e = 0; e < sv.num_entities; e++ )
+	if ( ent->r.svFlags & SVF_IGNOREBMODELEXTENTS )
 	{
-		ent = SV_GentityNum( e );
-
-		// never send entities that aren't linked in
-		if ( !ent->r.linked )
+		clusters[ ( *count )++ ] = ent->r.originCluster;
+	}
+	else
+	{
+		// entities without cluster are never visible, the ones
+		// with too many clusters take the overflow path
+		if ( ent->r.numClusters < 0 || ent->r.numClusters > MAX_ENT_CLUSTERS || ent->r.lastCluster )
 		{
-			continue;
+			return false;
 		}
 
-		if ( ent->s.number != e )
+		for ( int i = 0; i < ent->r.numClusters; i++ )
 		{
-			Log::Debug( "FIXING ENT->S.NUMBER!!!" );
-			ent->s.number = e;
+			clusters[ ( *count )++ ] = ent->r.clusternums[ i ];
 		}
+	}
 
-		// entities can be flagged to explicitly not be sent to the client
-		if ( ent->r.svFlags & SVF_NOCLIENT )
+	for ( int i = 0; i < *count; i++ )
+	{
+		if ( clusters[ i ] < 0 || clusters[ i ] >= numClusters )
 		{
-			continue;
+			return false;
 		}
+	}
 
-		// entities can be flagged to be sent to only one client
-		if ( ent->r.svFlags & SVF_SINGLECLIENT )
-		{
-			if ( ent->r.singleClient != frame->ps.clientNum )
-			{
-				continue;
-			}
-		}
+	return true;
+}
 
-		// entities can be flagged to be sent to everyone but one client
-		if ( ent->r.svFlags & SVF_NOTSINGLECLIENT )
-		{
-			if ( ent->r.singleClient == frame->ps.clientNum )
-			{
-				continue;
-			}
-		}
+/*
+===============
+SV_FixEntityNumbers
+
+Fixes the numbers of the linked entities on the main thread, so that the
+snapshot workers only have to read them
+===============
+*/
+static void SV_FixEntityNumbers()
+{
+	for ( int e = 0; e < sv.num_entities; e++ )
+	{
+		sharedEntity_t *ent = SV_GentityNum( e );
 
-		// entities can be flagged to be sent to only a given mask of clients
-		if ( ent->r.svFlags & SVF_CLIENTMASK )
+		if ( ent->r.linked && ent->s.number != e )
 		{
-			if ( frame->ps.clientNum >= 32 )
-			{
-				if ( ~ent->r.hiMask & ( 1 << ( frame->ps.clientNum - 32 ) ) )
-				{
-					continue;
-				}
-			}
-			else
-			{
-				if ( ~ent->r.loMask & ( 1 << frame->ps.clientNum ) )
-				{
-					continue;
-				}
-			}
+			Log::Debug( "FIXING ENT->S.NUMBER!!!" );
+			ent->s.number = e;
 		}
+	}
+}
 
-		svEnt = SV_SvEntityForGentity( ent );
+/*
+===============
+SV_BuildEntityIndex
+===============
+*/
+static void SV_BuildEntityIndex()
+{
+	int numClusters = CM_NumClusters();
+	int clusters[ MAX_ENT_CLUSTERS ];
+	int count;
 
-		// don't double add an entity through portals
-		if ( svEnt->snapshotCounter == sv.snapshotCounter )
-		{
-			continue;
-		}
+	entityIndex.clusterStart.assign( numClusters + 1, 0 );
+	entityIndex.occupiedClusters.clear();
+	memset( entityIndex.unclustered, 0, sizeof( entityIndex.unclustered ) );
+	memset( entityIndex.dummyMasterStart, 0, sizeof( entityIndex.dummyMasterStart ) );
+
+	// count the entities of each cluster, then fill them in a second pass
+	for ( int e = 0; e < sv.num_entities; e++ )
+	{
+		sharedEntity_t *ent = SV_IndexedEntity( e );
 
-		// broadcast entities are always sent
-		if ( ent->r.svFlags & SVF_BROADCAST )
+		if ( !ent )
 		{
-			SV_AddEntToSnapshot( playerEnt, svEnt, ent, eNums );
 			continue;
 		}
 
-		// send entity if the client is in range
-		if ( (ent->r.svFlags & SVF_CLIENTS_IN_RANGE) &&
-		     Distance( ent->s.origin, playerEnt->s.origin ) <= ent->r.clientRadius )
+		if ( ent->s.otherEntityNum >= 0 && ent->s.otherEntityNum < MAX_GENTITIES && ent->s.otherEntityNum != e )
 		{
-			SV_AddEntToSnapshot( playerEnt, svEnt, ent, eNums );
-			continue;
+			entityIndex.dummyMasterStart[ ent->s.otherEntityNum + 1 ]++;
 		}
 
-		bitvector = clientpvs;
-
-		// Gordon: just check origin for being in pvs, ignore bmodel extents
-		if ( ent->r.svFlags & SVF_IGNOREBMODELEXTENTS )
+		if ( !SV_EntityClusters( ent, numClusters, clusters, &count ) )
 		{
-			if ( bitvector[ ent->r.originCluster >> 3 ] & ( 1 << ( ent->r.originCluster & 7 ) ) )
-			{
-				SV_AddEntToSnapshot( playerEnt, svEnt, ent, eNums );
-			}
-
+			entityIndex.unclustered[ e / 64 ] |= uint64_t( 1 ) << ( e % 64 );
 			continue;
 		}
 
-		// ignore if not touching a PV leaf
-		// check area
-		if ( !CM_AreasConnected( clientarea, ent->r.areanum ) )
+		for ( int i = 0; i < count; i++ )
 		{
-			// doors can legally straddle two areas, so
-			// we may need to check another one
-			if ( !CM_AreasConnected( clientarea, ent->r.areanum2 ) )
+			if ( !entityIndex.clusterStart[ clusters[ i ] + 1 ]++ )
 			{
-				continue;
+				entityIndex.occupiedClusters.push_back( clusters[ i ] );
 			}
 		}
+	}
+
+	for ( int c = 0; c < numClusters; c++ )
+	{
+		entityIndex.clusterStart[ c + 1 ] += entityIndex.clusterStart[ c ];
+	}
+
+	for ( int e = 0; e < MAX_GENTITIES; e++ )
+	{
+		entityIndex.dummyMasterStart[ e + 1 ] += entityIndex.dummyMasterStart[ e ];
+	}
+
+	std::vector<int> clusterFill( entityIndex.clusterStart.begin(), entityIndex.clusterStart.end() - 1 );
+	std::vector<int> dummyFill( entityIndex.dummyMasterStart, entityIndex.dummyMasterStart + MAX_GENTITIES );
+
+	entityIndex.clusterEntities.resize( entityIndex.clusterStart[ numClusters ] );
+	entityIndex.dummyMasters.resize( entityIndex.dummyMasterStart[ MAX_GENTITIES ] );
+
+	for ( int e = 0; e < sv.num_entities; e++ )
+	{
+		sharedEntity_t *ent = SV_IndexedEntity( e );
 
-		// check individual leafs
-		if ( !ent->r.numClusters )
+		if ( !ent )
 		{
 			continue;
 		}
 
-		l = 0;
-
-		for ( i = 0; i < std::min(std::max(0, ent->r.numClusters), MAX_ENT_CLUSTERS); i++ )
+		if ( ent->s.otherEntityNum >= 0 && ent->s.otherEntityNum < MAX_GENTITIES && ent->s.otherEntityNum != e )
 		{
-			l = ent->r.clusternums[ i ];
-
-			if ( bitvector[ l >> 3 ] & ( 1 << ( l & 7 ) ) )
-			{
-				break;
-			}
+			entityIndex.dummyMasters[ dummyFill[ ent->s.otherEntityNum ]++ ] = e;
 		}
 
-		// if we haven't found it to be visible,
-		// check the overflow clusters that couldn't be stored
-		if ( i == ent->r.numClusters )
+		if ( SV_EntityClusters( ent, numClusters, clusters, &count ) )
 		{
-			if ( ent->r.lastCluster )
-			{
-				for ( ; l <= ent->r.lastCluster; l++ )
-				{
-					if ( bitvector[ l >> 3 ] & ( 1 << ( l & 7 ) ) )
-					{
-						break;
-					}
-				}
-
-				if ( l == ent->r.lastCluster )
-				{
-					continue;
-				}
-			}
-			else
+			for ( int i = 0; i < count; i++ )
 			{
-				continue;
+				entityIndex.clusterEntities[ clusterFill[ clusters[ i ] ]++ ] = e;
 			}
 		}
+	}
 
-		//----(SA) added "visibility dummies"
-		if ( ent->r.svFlags & SVF_VISDUMMY )
-		{
-			sharedEntity_t *ment = nullptr;
-
-			//find master;
-			ment = SV_GentityNum( ent->s.otherEntityNum );
+	entityIndex.valid = true;
+}
 
-			if ( ment )
-			{
-				svEntity_t *master = nullptr;
+static int SV_LowestBit( uint64_t bits )
+{
+#if defined( __GNUC__ ) || defined( __clang__ )
+	return __builtin_ctzll( bits );
+#else
+	int bit = 0;
 
-				master = SV_SvEntityForGentity( ment );
+	while ( !( bits & 1 ) )
+	{
+		bits >>= 1;
+		bit++;
+	}
 
-				if ( master->snapshotCounter == sv.snapshotCounter || !ment->r.linked )
-				{
-					continue;
-				}
+	return bit;
+#endif
+}
 
-				SV_AddEntToSnapshot( playerEnt, master, ment, eNums );
-			}
+/*
+===============
+SV_IndexedEntitiesInPVS
 
-			continue; // master needs to be added, but not this dummy ent
-		}
-		//----(SA) end
-		else if ( ent->r.svFlags & SVF_VISDUMMY_MULTIPLE )
+Marks the entities which may be visible with the given PVS
+===============
+*/
+static void SV_IndexedEntitiesInPVS( const byte *pvs, uint64_t *entities )
+{
+	memcpy( entities, entityIndex.unclustered, sizeof( entityIndex.unclustered ) );
+
+	for ( int cluster : entityIndex.occupiedClusters )
+	{
+		if ( !( pvs[ cluster >> 3 ] & ( 1 << ( cluster & 7 ) ) ) )
 		{
-			{
-				int            h;
-				sharedEntity_t *ment = nullptr;
-				svEntity_t     *master = nullptr;
+			continue;
+		}
 
-				for ( h = 0; h < sv.num_entities; h++ )
-				{
-					ment = SV_GentityNum( h );
-
-					if ( ment == ent )
-					{
-						continue;
-					}
-
-					if ( ment )
-					{
-						master = SV_SvEntityForGentity( ment );
-					}
-					else
-					{
-						continue;
-					}
-
-					if ( !( ment->r.linked ) )
-					{
-						continue;
-					}
-
-					if ( ment->s.number != h )
-					{
-						Log::Debug( "FIXING vis dummy multiple ment->S.NUMBER!!!" );
-						ment->s.number = h;
-					}
-
-					if ( ment->r.svFlags & SVF_NOCLIENT )
-					{
-						continue;
-					}
-
-					if ( master->snapshotCounter == sv.snapshotCounter )
-					{
-						continue;
-					}
-
-					if ( ment->s.otherEntityNum == ent->s.number )
-					{
-						SV_AddEntToSnapshot( playerEnt, master, ment, eNums );
-					}
-				}
+		for ( int i = entityIndex.clusterStart[ cluster ]; i < entityIndex.clusterStart[ cluster + 1 ]; i++ )
+		{
+			int e = entityIndex.clusterEntities[ i ];
+			entities[ e / 64 ] |= uint64_t( 1 ) << ( e % 64 );
+		}
+	}
+}
+
+// Allows the snapshots built in its scope to use the index, which is built on first use
+class EntityIndexScope
+{
+public:
+	explicit EntityIndexScope( bool enabled )
+	{
+		entityIndex.enabled = enabled;
+		entityIndex.valid = false;
+	}
 
+	~EntityIndexScope()
+	{
+		entityIndex.enabled = false;
+		entityIndex.valid = false;
+	}
+};
+
+struct visibilityContext_t
+{
+	vec3_t           origin;
+	clientSnapshot_t *frame;
+	snapshotEntityNumbers_t *eNums;
+	sharedEntity_t   *playerEnt;
+	int              clientarea;
+	const byte       *clientpvs;
+};
+
+static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *frame, snapshotEntityNumbers_t *eNums );
+
+/*
+===============
+SV_AddVisDummyMasters
+
+Adds the entities having a SVF_VISDUMMY_MULTIPLE entity as otherEntityNum
+===============
+*/
+static void SV_AddVisDummyMasters( const visibilityContext_t& ctx, sharedEntity_t *ent )
+{
+	if ( entityIndex.valid )
+	{
+		for ( int i = entityIndex.dummyMasterStart[ ent->s.number ]; i < entityIndex.dummyMasterStart[ ent->s.number + 1 ]; i++ )
+		{
+			int h = entityIndex.dummyMasters[ i ];
+
+			if ( SV_SnapshotHasEntity( ctx.eNums, h ) )
+			{
 				continue;
 			}
+
+			SV_AddEntToSnapshot( ctx.playerEnt, SV_GentityNum( h ), ctx.eNums );
+		}
+
+		return;
+	}
+
+	int            h;
+	sharedEntity_t *ment = nullptr;
+
+	for ( h = 0; h < sv.num_entities; h++ )
+	{
+		ment = SV_GentityNum( h );
+
+		if ( ment == ent || !ment )
+		{
+			continue;
+		}
+
+		if ( !( ment->r.linked ) )
+		{
+			continue;
+		}
+
+		if ( ment->s.number != h )
+		{
+			Log::Debug( "FIXING vis dummy multiple ment->S.NUMBER!!!" );
+			ment->s.number = h;
+		}
+
+		if ( ment->r.svFlags & SVF_NOCLIENT )
+		{
+			continue;
+		}
+
+		if ( SV_SnapshotHasEntity( ctx.eNums, h ) )
+		{
+			continue;
+		}
+
+		if ( ment->s.otherEntityNum == ent->s.number )
+		{
+			SV_AddEntToSnapshot( ctx.playerEnt, ment, ctx.eNums );
+		}
+	}
+}
+
+/*
+===============
+SV_AddEntityIfVisible
+===============
+*/
+static void SV_AddEntityIfVisible( const visibilityContext_t& ctx, int e )
+{
+	int            i;
+	sharedEntity_t *ent;
+	int            l;
+	const byte     *bitvector;
+
+	ent = SV_GentityNum( e );
+
+	// never send entities that aren't linked in
+	if ( !ent->r.linked )
+	{
+		return;
+	}
+
+	if ( ent->s.number != e )
+	{
+		Log::Debug( "FIXING ENT->S.NUMBER!!!" );
+		ent->s.number = e;
+	}
+
+	// entities can be flagged to explicitly not be sent to the client
+	if ( ent->r.svFlags & SVF_NOCLIENT )
+	{
+		return;
+	}
+
+	// entities can be flagged to be sent to only one client
+	if ( ent->r.svFlags & SVF_SINGLECLIENT )
+	{
+		if ( ent->r.singleClient != ctx.frame->ps.clientNum )
+		{
+			return;
 		}
+	}
 
-		// add it
-		SV_AddEntToSnapshot( playerEnt, svEnt, ent, eNums );
+	// entities can be flagged to be sent to everyone but one client
+	if ( ent->r.svFlags & SVF_NOTSINGLECLIENT )
+	{
+		if ( ent->r.singleClient == ctx.frame->ps.clientNum )
+		{
+			return;
+		}
+	}
 
-		// if it's a portal entity, add everything visible from its camera position
-		if ( ent->r.svFlags & SVF_PORTAL )
+	// entities can be flagged to be sent to only a given mask of clients
+	if ( ent->r.svFlags & SVF_CLIENTMASK )
+	{
+		if ( ctx.frame->ps.clientNum >= 32 )
+		{
+			if ( ~ent->r.hiMask & ( 1 << ( ctx.frame->ps.clientNum - 32 ) ) )
+			{
+				return;
+			}
+		}
+		else
 		{
-			if ( ent->s.generic1 )
+			if ( ~ent->r.loMask & ( 1 << ctx.frame->ps.clientNum ) )
 			{
-				vec3_t dir;
-				VectorSubtract( ent->s.origin, origin, dir );
+				return;
+			}
+		}
+	}
+
+	// don't double add an entity through portals
+	if ( SV_SnapshotHasEntity( ctx.eNums, e ) )
+	{
+		return;
+	}
+
+	// broadcast entities are always sent
+	if ( ent->r.svFlags & SVF_BROADCAST )
+	{
+		SV_AddEntToSnapshot( ctx.playerEnt, ent, ctx.eNums );
+		return;
+	}
+
+	// send entity if the client is in range
+	if ( (ent->r.svFlags & SVF_CLIENTS_IN_RANGE) &&
+	     Distance( ent->s.origin, ctx.playerEnt->s.origin ) <= ent->r.clientRadius )
+	{
+		SV_AddEntToSnapshot( ctx.playerEnt, ent, ctx.eNums );
+		return;
+	}
+
+	bitvector = ctx.clientpvs;
+
+	// Gordon: just check origin for being in pvs, ignore bmodel extents
+	if ( ent->r.svFlags & SVF_IGNOREBMODELEXTENTS )
+	{
+		if ( bitvector[ ent->r.originCluster >> 3 ] & ( 1 << ( ent->r.originCluster & 7 ) ) )
+		{
+			SV_AddEntToSnapshot( ctx.playerEnt, ent, ctx.eNums );
+		}
+
+		return;
+	}
 
-				if ( VectorLengthSquared( dir ) > ( float ) ent->s.generic1 * ent->s.generic1 )
+	// ignore if not touching a PV leaf
+	// check area
+	if ( !CM_AreasConnected( ctx.clientarea, ent->r.areanum ) )
+	{
+		// doors can legally straddle two areas, so
+		// we may need to check another one
+		if ( !CM_AreasConnected( ctx.clientarea, ent->r.areanum2 ) )
+		{
+			return;
+		}
+	}
+
+	// check individual leafs
+	if ( !ent->r.numClusters )
+	{
+		return;
+	}
+
+	l = 0;
+
+	for ( i = 0; i < std::min(std::max(0, ent->r.numClusters), MAX_ENT_CLUSTERS); i++ )
+	{
+		l = ent->r.clusternums[ i ];
+
+		if ( bitvector[ l >> 3 ] & ( 1 << ( l & 7 ) ) )
+		{
+			break;
+		}
+	}
+
+	// if we haven't found it to be visible,
+	// check the overflow clusters that couldn't be stored
+	if ( i == ent->r.numClusters )
+	{
+		if ( ent->r.lastCluster )
+		{
+			for ( ; l <= ent->r.lastCluster; l++ )
+			{
+				if ( bitvector[ l >> 3 ] & ( 1 << ( l & 7 ) ) )
 				{
-					continue;
+					break;
 				}
 			}
 
-//          SV_AddEntitiesVisibleFromPoint( ent->s.origin2, frame, eNums, true, oldframe, localClient );
-			SV_AddEntitiesVisibleFromPoint( ent->s.origin2, frame, eNums /*, true, localClient */ );
+			if ( l == ent->r.lastCluster )
+			{
+				return;
+			}
+		}
+		else
+		{
+			return;
+		}
+	}
+
+	//----(SA) added "visibility dummies"
+	if ( ent->r.svFlags & SVF_VISDUMMY )
+	{
+		sharedEntity_t *ment = nullptr;
+
+		//find master;
+		ment = SV_GentityNum( ent->s.otherEntityNum );
+
+		if ( ment )
+		{
+			svEntity_t *master = nullptr;
+
+			master = SV_SvEntityForGentity( ment );
+
+			if ( SV_SnapshotHasEntity( ctx.eNums, master - sv.svEntities ) || !ment->r.linked )
+			{
+				return;
+			}
+
+			SV_AddEntToSnapshot( ctx.playerEnt, ment, ctx.eNums );
 		}
 
-		continue;
+		return; // master needs to be added, but not this dummy ent
+	}
+	//----(SA) end
+	else if ( ent->r.svFlags & SVF_VISDUMMY_MULTIPLE )
+	{
+		SV_AddVisDummyMasters( ctx, ent );
+		return;
 	}
-}
 
-/*
-=============
-SV_BuildClientSnapshot
+	// add it
+	SV_AddEntToSnapshot( ctx.playerEnt, ent, ctx.eNums );
 
-Decides which entities are going to be visible to the client, and
-copies off the playerstate and areabits.
+	// if it's a portal entity, add everything visible from its camera position
+	if ( ent->r.svFlags & SVF_PORTAL )
+	{
+		if ( ent->s.generic1 )
+		{
+			vec3_t dir;
+			VectorSubtract( ent->s.origin, ctx.origin, dir );
 
-This properly handles multiple recursive portals, but the render
-currently doesn't.
+			if ( VectorLengthSquared( dir ) > ( float ) ent->s.generic1 * ent->s.generic1 )
+			{
+				return;
+			}
+		}
 
-For viewing through other player's eyes, clent can be something other than client->gentity
-=============
+		SV_AddEntitiesVisibleFromPoint( ent->s.origin2, ctx.frame, ctx.eNums );
+	}
+}
+
+/*
+===============
+SV_AddEntitiesVisibleFromPoint
+===============
 */
-static void SV_BuildClientSnapshot( client_t *client )
+static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *frame, snapshotEntityNumbers_t *eNums )
 {
-	vec3_t                  org;
-	clientSnapshot_t        *frame;
-	snapshotEntityNumbers_t entityNumbers;
-	int                     i;
-	sharedEntity_t          *ent;
-	entityState_t           *state;
-	svEntity_t              *svEnt;
-	sharedEntity_t          *clent;
-	int                     clientNum;
+	visibilityContext_t ctx;
+	int                 leafnum;
+	int                 clientcluster;
+
+	// during an error shutdown message we may need to transmit
+	// the shutdown message after the server has shutdown, so
+	// specifically check for it
+	if (sv.state == serverState_t::SS_DEAD)
+	{
+		return;
+	}
 
-	// bump the counter used to prevent double adding
-	sv.snapshotCounter++;
+	VectorCopy( origin, ctx.origin );
+	ctx.frame = frame;
+	ctx.eNums = eNums;
 
-	// this is the frame we are creating
-	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+	leafnum = CM_PointLeafnum( origin );
+	ctx.clientarea = CM_LeafArea( leafnum );
+	clientcluster = CM_LeafCluster( leafnum );
 
-	// clear everything in this snapshot
-	entityNumbers.numSnapshotEntities = 0;
-	Com_Memset( frame->areabits, 0, sizeof( frame->areabits ) );
+	// calculate the visible areas
+	frame->areabytes = CM_WriteAreaBits( frame->areabits, ctx.clientarea );
 
-	// show_bug.cgi?id=62
-	frame->num_entities = 0;
+	ctx.clientpvs = CM_ClusterPVS( clientcluster );
+
+	ctx.playerEnt = SV_GentityNum( frame->ps.clientNum );
 
-	clent = client->gentity;
+	if ( ctx.playerEnt->r.svFlags & SVF_SELF_PORTAL )
+	{
+		SV_AddEntitiesVisibleFromPoint( ctx.playerEnt->s.origin2, frame, eNums );
+	}
 
-	if ( !clent || client->state == clientState_t::CS_ZOMBIE )
+	if ( entityIndex.enabled && !entityIndex.valid )
 	{
+		SV_BuildEntityIndex();
+	}
+
+	if ( entityIndex.valid )
+	{
+		uint64_t entities[ ENTITY_WORDS ];
+
+		SV_IndexedEntitiesInPVS( ctx.clientpvs, entities );
+
+		for ( int word = 0; word < ENTITY_WORDS; word++ )
+		{
+			for ( uint64_t bits = entities[ word ]; bits; bits &= bits - 1 )
+			{
+				SV_AddEntityIfVisible( ctx, word * 64 + SV_LowestBit( bits ) );
+			}
+		}
+
 		return;
 	}
 
+	for ( int e = 0; e < sv.num_entities; e++ )
+	{
+		SV_AddEntityIfVisible( ctx, e );
+	}
+}
+
+/*
+=============
+SV_CollectSnapshotEntities
+
+Fills the sorted numbers of the entities visible to the client,
+its playerstate and the areabits it can see
+=============
+*/
+static void SV_CollectSnapshotEntities( client_t *client, clientSnapshot_t *frame, snapshotEntityNumbers_t *eNums )
+{
+	vec3_t org;
+	int    clientNum;
+
+	eNums->numSnapshotEntities = 0;
+	Com_Memset( eNums->added, 0, sizeof( eNums->added ) );
+
 	// grab the current playerState_t
 	OpaquePlayerState* ps = SV_GameClientNum( client - svs.clients );
 	memcpy(&frame->ps, ps, sizeof(frame->ps));
@@ -702,14 +1251,12 @@ static void SV_BuildClientSnapshot( client_t *client )
 		Sys::Drop( "SV_SvEntityForGentity: bad gEnt" );
 	}
 
-	svEnt = &sv.svEntities[ clientNum ];
+	SV_MarkSnapshotEntity( eNums, clientNum );
 
-	svEnt->snapshotCounter = sv.snapshotCounter;
-
-	if ( clent->r.svFlags & SVF_SELF_PORTAL_EXCLUSIVE )
+	if ( client->gentity->r.svFlags & SVF_SELF_PORTAL_EXCLUSIVE )
 	{
 		// find the client's viewpoint
-		VectorCopy( clent->s.origin2, org );
+		VectorCopy( client->gentity->s.origin2, org );
 	}
 	else
 	{
@@ -720,14 +1267,46 @@ static void SV_BuildClientSnapshot( client_t *client )
 
 	// add all the entities directly visible to the eye, which
 	// may include portal entities that merge other viewpoints
-	SV_AddEntitiesVisibleFromPoint( org, frame, &entityNumbers /*, false, client->netchan.remoteAddress.type == NA_LOOPBACK */ );
+	SV_AddEntitiesVisibleFromPoint( org, frame, eNums /*, false, client->netchan.remoteAddress.type == NA_LOOPBACK */ );
 
 	// if there were portals visible, there may be out of order entities
 	// in the list which will need to be resorted for the delta compression
 	// to work correctly.  This also catches the error condition
 	// of an entity being included twice.
-	qsort( entityNumbers.snapshotEntities, entityNumbers.numSnapshotEntities,
-	       sizeof( entityNumbers.snapshotEntities[ 0 ] ), SV_QsortEntityNumbers );
+	qsort( eNums->snapshotEntities, eNums->numSnapshotEntities,
+	       sizeof( eNums->snapshotEntities[ 0 ] ), SV_QsortEntityNumbers );
+}
+
+/*
+=============
+SV_PrepareClientSnapshot
+
+Decides which entities are going to be visible to the client, and
+copies off the playerstate and areabits.
+
+This properly handles multiple recursive portals, but the render
+currently doesn't.
+
+Returns false if the snapshot has no entities at all.
+=============
+*/
+static bool SV_PrepareClientSnapshot( client_t *client, clientSnapshot_t *frame, snapshotEntityNumbers_t *eNums )
+{
+	int i;
+
+	// clear everything in this snapshot
+	eNums->numSnapshotEntities = 0;
+	Com_Memset( frame->areabits, 0, sizeof( frame->areabits ) );
+
+	// show_bug.cgi?id=62
+	frame->num_entities = 0;
+
+	if ( !client->gentity || client->state == clientState_t::CS_ZOMBIE )
+	{
+		return false;
+	}
+
+	SV_CollectSnapshotEntities( client, frame, eNums );
 
 	// now that all viewpoint's areabits have been OR'd together, invert
 	// all of them to make it a mask vector, which is what the renderer wants
@@ -736,25 +1315,68 @@ static void SV_BuildClientSnapshot( client_t *client )
 		( ( int * ) frame->areabits ) [ i ] = ( ( int * ) frame->areabits ) [ i ] ^ -1;
 	}
 
-	// copy the entity states out
-	frame->num_entities = 0;
+	return true;
+}
+
+/*
+=============
+SV_AllocateSnapshotEntities
+
+Reserves the slice of svs.snapshotEntities the entities of the frame are copied to
+=============
+*/
+static void SV_AllocateSnapshotEntities( clientSnapshot_t *frame, const snapshotEntityNumbers_t *eNums )
+{
 	frame->first_entity = svs.nextSnapshotEntities;
+	frame->num_entities = eNums->numSnapshotEntities;
+	svs.nextSnapshotEntities += eNums->numSnapshotEntities;
+
+	// this should never hit, map should always be restarted first in SV_Frame
+	if ( svs.nextSnapshotEntities >= 0x7FFFFFFE )
+	{
+		Sys::Error( "svs.nextSnapshotEntities wrapped" );
+	}
+}
+
+/*
+=============
+SV_StoreSnapshotEntities
+
+Copies the entity states out to the slice of the frame
+=============
+*/
+static void SV_StoreSnapshotEntities( const clientSnapshot_t *frame, const snapshotEntityNumbers_t *eNums )
+{
+	for ( int i = 0; i < eNums->numSnapshotEntities; i++ )
+	{
+		sharedEntity_t *ent = SV_GentityNum( eNums->snapshotEntities[ i ] );
+
+		svs.snapshotEntities[ ( frame->first_entity + i ) % svs.numSnapshotEntities ] = ent->s;
+	}
+}
+
+/*
+=============
+SV_BuildClientSnapshot
 
-	for ( i = 0; i < entityNumbers.numSnapshotEntities; i++ )
-	{
-		ent = SV_GentityNum( entityNumbers.snapshotEntities[ i ] );
-		state = &svs.snapshotEntities[ svs.nextSnapshotEntities % svs.numSnapshotEntities ];
-		*state = ent->s;
-		svs.nextSnapshotEntities++;
+For viewing through other player's eyes, clent can be something other than client->gentity
+=============
+*/
+static void SV_BuildClientSnapshot( client_t *client )
+{
+	clientSnapshot_t        *frame;
+	snapshotEntityNumbers_t entityNumbers;
 
-		// this should never hit, map should always be restarted first in SV_Frame
-		if ( svs.nextSnapshotEntities >= 0x7FFFFFFE )
-		{
-			Sys::Error( "svs.nextSnapshotEntities wrapped" );
-		}
+	// this is the frame we are creating
+	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
 
-		frame->num_entities++;
+	if ( !SV_PrepareClientSnapshot( client, frame, &entityNumbers ) )
+	{
+		return;
 	}
+
+	SV_AllocateSnapshotEntities( frame, &entityNumbers );
+	SV_StoreSnapshotEntities( frame, &entityNumbers );
 }
 
 /*
@@ -827,7 +1449,10 @@ void SV_SendMessageToClient( msg_t *msg, client_t *client )
 	client->frames[ client->netchan.outgoingSequence & PACKET_MASK ].messageAcked = -1;
 
 	// send the datagram
-	SV_Netchan_Transmit( client, msg );
+	{
+		SVProfileScope zone( svProfileZone_t::TRANSMIT );
+		SV_Netchan_Transmit( client, msg );
+	}
 
 	// set nextSnapshotTime based on rate and requested number of updates
 
@@ -920,6 +1545,51 @@ void SV_SendClientIdle( client_t *client )
 	sv.ubpsTotalBytes += msg.uncompsize / 8; // NERVE - SMF - net debugging
 }
 
+/*
+=======================
+SV_WriteClientSnapshotMessage
+=======================
+*/
+static void SV_WriteClientSnapshotMessage( client_t *client, msg_t *msg, clientSnapshot_t *oldframe, int lastframe )
+{
+	// NOTE, MRE: all server->client messages now acknowledge
+	// let the client know which reliable clientCommands we have received
+	MSG_WriteLong( msg, client->lastClientCommand );
+
+	// (re)send any reliable server commands
+	SV_UpdateServerCommandsToClient( client, msg );
+
+	// send over all the relevant entityState_t
+	// and the playerState_t
+	SV_WriteSnapshotToClient( client, msg, oldframe, lastframe );
+}
+
+/*
+=======================
+SV_FinishClientSnapshot
+=======================
+*/
+static void SV_FinishClientSnapshot( client_t *client, msg_t *msg )
+{
+	// Add any download data if the client is downloading
+	SV_WriteDownloadToClient( client, msg );
+
+	// check for overflow
+	if ( msg->overflowed )
+	{
+		Log::Warn("msg overflowed for %s", client->name );
+		MSG_Clear( msg );
+
+		SV_DropClient( client, "Msg overflowed" );
+		return;
+	}
+
+	SV_SendMessageToClient( msg, client );
+
+	sv.bpsTotalBytes += msg->cursize; // NERVE - SMF - net debugging
+	sv.ubpsTotalBytes += msg->uncompsize / 8; // NERVE - SMF - net debugging
+}
+
 /*
 =======================
 SV_SendClientSnapshot
@@ -930,8 +1600,10 @@ Also called by SV_FinalCommand
 */
 void SV_SendClientSnapshot( client_t *client )
 {
-	byte  msg_buf[ MAX_MSGLEN ];
-	msg_t msg;
+	byte             msg_buf[ MAX_MSGLEN ];
+	msg_t            msg;
+	clientSnapshot_t *oldframe;
+	int              lastframe;
 
 	//bani
 	if ( client->state < clientState_t::CS_ACTIVE )
@@ -946,7 +1618,10 @@ void SV_SendClientSnapshot( client_t *client )
 	}
 
 	// build the snapshot
-	SV_BuildClientSnapshot( client );
+	{
+		SVProfileScope zone( svProfileZone_t::BUILD_SNAPSHOT );
+		SV_BuildClientSnapshot( client );
+	}
 
 	// bots need to have their snapshots built, but
 	// those are queried directly without needing to be sent
@@ -955,38 +1630,302 @@ void SV_SendClientSnapshot( client_t *client )
 		return;
 	}
 
+	SV_SnapshotDeltaFrame( client, svs.nextSnapshotEntities, &oldframe, &lastframe );
+
 	MSG_Init( &msg, msg_buf, sizeof( msg_buf ) );
 
-	// NOTE, MRE: all server->client messages now acknowledge
-	// let the client know which reliable clientCommands we have received
-	MSG_WriteLong( &msg, client->lastClientCommand );
+	SV_WriteClientSnapshotMessage( client, &msg, oldframe, lastframe );
 
-	// (re)send any reliable server commands
-	SV_UpdateServerCommandsToClient( client, &msg );
+	SV_FinishClientSnapshot( client, &msg );
+}
 
-	// send over all the relevant entityState_t
-	// and the playerState_t
-	SV_WriteSnapshotToClient( client, &msg );
+/*
+=============================================================================
 
-	// Add any download data if the client is downloading
-	SV_WriteDownloadToClient( client, &msg );
+PARALLEL SNAPSHOTS
 
-	// check for overflow
-	if ( msg.overflowed )
+With server.snapshotThreads set, the snapshots of all the clients due this
+frame are built and encoded by a pool of worker threads:
+ 1. the visible entities of each client are collected in parallel,
+ 2. the slices of svs.snapshotEntities and the delta frames are assigned
+    serially, in client order, as the serial code would,
+ 3. the entity states are copied to the slices and the messages are
+    written in parallel,
+ 4. the messages get their download data and are sent serially.
+
+The result is the same as with SV_SendClientSnapshot called for each client
+in turn, except when a client gets dropped for an overflowed message: that
+only happens once all the snapshots are built. The snapshot callbacks run
+in the game module, so the entities are collected on the main thread if an
+entity has one, and the messages are written in turn if a client could read
+snapshot entities overwritten by another client's slice.
+
+=============================================================================
+*/
+
+static Cvar::Modified<Cvar::Range<Cvar::Cvar<int>>> sv_snapshotThreads(
+	"server.snapshotThreads",
+	"number of extra threads building and encoding the client snapshots, 0 to do it all in the main thread",
+	Cvar::NONE,
+	0, 0, 32
+);
+
+struct snapshotJob_t
+{
+	client_t                *client;
+	bool                    built;
+	snapshotEntityNumbers_t entityNumbers;
+	clientSnapshot_t        *oldframe;
+	int                     lastframe;
+	msg_t                   msg;
+	byte                    msgBuffer[ MAX_MSGLEN ];
+};
+
+static Sys::ThreadPool                             snapshotWorkers;
+static std::vector<std::unique_ptr<snapshotJob_t>> snapshotJobs;
+
+// frames left to check against the serial code, see sv_verifySnapshotThreads
+static struct {
+	int frames;
+	int snapshots;
+	int mismatches;
+} snapshotVerify;
+
+static bool SV_SnapshotCallbacksUsed()
+{
+	for ( int e = 0; e < sv.num_entities; e++ )
 	{
-		Log::Warn("msg overflowed for %s", client->name );
-		MSG_Clear( &msg );
+		sharedEntity_t *ent = SV_GentityNum( e );
 
-		SV_DropClient( client, "Msg overflowed" );
-		return;
+		if ( ent->r.linked && ent->r.snapshotCallback )
+		{
+			return true;
+		}
 	}
 
-	SV_SendMessageToClient( &msg, client );
+	return false;
+}
 
-	sv.bpsTotalBytes += msg.cursize; // NERVE - SMF - net debugging
-	sv.ubpsTotalBytes += msg.uncompsize / 8; // NERVE - SMF - net debugging
+/*
+=======================
+SV_RunSnapshotJobs
+
+The zones entered by the jobs are not profiled, the caller profiles the whole step
+=======================
+*/
+static void SV_RunSnapshotJobs( int count, bool parallel, const Sys::ThreadPool::Job& job )
+{
+	SV_ProfileSuspend( true );
+
+	try
+	{
+		if ( parallel )
+		{
+			snapshotWorkers.Run( count, job );
+		}
+		else
+		{
+			for ( int i = 0; i < count; i++ )
+			{
+				job( i, 0 );
+			}
+		}
+	}
+	catch ( ... )
+	{
+		SV_ProfileSuspend( false );
+		throw;
+	}
+
+	SV_ProfileSuspend( false );
+}
+
+/*
+=======================
+SV_VerifySnapshotJob
+
+Builds and writes the snapshot again on the main thread and compares it
+=======================
+*/
+static void SV_VerifySnapshotJob( const snapshotJob_t& job, bool checkEntities )
+{
+	static clientSnapshot_t        frame;
+	static snapshotEntityNumbers_t entityNumbers;
+	static byte                    msgBuffer[ MAX_MSGLEN ];
+	const clientSnapshot_t         *built = &job.client->frames[ job.client->netchan.outgoingSequence & PACKET_MASK ];
+	msg_t                          msg;
+	bool                           same = true;
+
+	if ( checkEntities && job.built )
+	{
+		SV_PrepareClientSnapshot( job.client, &frame, &entityNumbers );
+
+		same = entityNumbers.numSnapshotEntities == job.entityNumbers.numSnapshotEntities &&
+		       !memcmp( entityNumbers.snapshotEntities, job.entityNumbers.snapshotEntities,
+		                entityNumbers.numSnapshotEntities * sizeof( entityNumbers.snapshotEntities[ 0 ] ) ) &&
+		       !memcmp( frame.areabits, built->areabits, sizeof( frame.areabits ) ) &&
+		       frame.areabytes == built->areabytes &&
+		       !memcmp( &frame.ps, &built->ps, sizeof( frame.ps ) );
+	}
+
+	MSG_Init( &msg, msgBuffer, sizeof( msgBuffer ) );
+	SV_WriteClientSnapshotMessage( job.client, &msg, job.oldframe, job.lastframe );
+
+	if ( !same || msg.cursize != job.msg.cursize || msg.bit != job.msg.bit ||
+	     msg.overflowed != job.msg.overflowed || memcmp( msg.data, job.msg.data, msg.cursize ) )
+	{
+		Log::Warn( "Parallel snapshot of %s^* differs from the serial one", job.client->name );
+		snapshotVerify.mismatches++;
+	}
+
+	snapshotVerify.snapshots++;
+}
+
+/*
+=======================
+SV_SendClientSnapshots
+
+Sends their snapshot to the clients, which must be active and not bots
+=======================
+*/
+static void SV_SendClientSnapshots( const std::vector<client_t*>& clients )
+{
+	int count = clients.size();
+
+	if ( Util::optional<int> numThreads = sv_snapshotThreads.GetModifiedValue() )
+	{
+		snapshotWorkers.Resize( *numThreads );
+	}
+
+	while ( static_cast<int>( snapshotJobs.size() ) < count )
+	{
+		snapshotJobs.emplace_back( new snapshotJob_t );
+	}
+
+	for ( int i = 0; i < count; i++ )
+	{
+		snapshotJobs[ i ]->client = clients[ i ];
+	}
+
+	// the workers can only read the index and the entity numbers, the
+	// checks of SV_AddEntityIfVisible don't write to them after this
+	if ( entityIndex.enabled && !entityIndex.valid )
+	{
+		SV_BuildEntityIndex();
+	}
+	else
+	{
+		SV_FixEntityNumbers();
+	}
+
+	bool parallelBuild = !SV_SnapshotCallbacksUsed();
+
+	{
+		SVProfileScope zone( svProfileZone_t::BUILD_SNAPSHOT );
+
+		SV_RunSnapshotJobs( count, parallelBuild, [ & ]( int i, int )
+		{
+			snapshotJob_t& job = *snapshotJobs[ i ];
+			clientSnapshot_t *frame = &job.client->frames[ job.client->netchan.outgoingSequence & PACKET_MASK ];
+
+			job.built = SV_PrepareClientSnapshot( job.client, frame, &job.entityNumbers );
+		} );
+	}
+
+	// the lowest position of svs.snapshotEntities read by a job
+	int firstRead = svs.nextSnapshotEntities;
+
+	for ( int i = 0; i < count; i++ )
+	{
+		snapshotJob_t& job = *snapshotJobs[ i ];
+		clientSnapshot_t *frame = &job.client->frames[ job.client->netchan.outgoingSequence & PACKET_MASK ];
+
+		if ( job.built )
+		{
+			SV_AllocateSnapshotEntities( frame, &job.entityNumbers );
+		}
+
+		SV_SnapshotDeltaFrame( job.client, svs.nextSnapshotEntities, &job.oldframe, &job.lastframe );
+
+		if ( job.oldframe && job.oldframe->num_entities )
+		{
+			firstRead = std::min( firstRead, job.oldframe->first_entity );
+		}
+	}
+
+	// with a small svs.snapshotEntities, a job could write over the entities
+	// another one reads, writing the messages in turn keeps the serial result
+	bool parallelWrite = firstRead >= svs.nextSnapshotEntities - svs.numSnapshotEntities;
+
+	{
+		SVProfileScope zone( svProfileZone_t::WRITE_SNAPSHOT );
+
+		SV_RunSnapshotJobs( count, parallelWrite, [ & ]( int i, int )
+		{
+			snapshotJob_t& job = *snapshotJobs[ i ];
+			clientSnapshot_t *frame = &job.client->frames[ job.client->netchan.outgoingSequence & PACKET_MASK ];
+
+			if ( job.built )
+			{
+				SV_StoreSnapshotEntities( frame, &job.entityNumbers );
+			}
+
+			MSG_Init( &job.msg, job.msgBuffer, sizeof( job.msgBuffer ) );
+			SV_WriteClientSnapshotMessage( job.client, &job.msg, job.oldframe, job.lastframe );
+		} );
+	}
+
+	if ( snapshotVerify.frames > 0 )
+	{
+		SV_ProfileSuspend( true );
+
+		for ( int i = 0; i < count; i++ )
+		{
+			SV_VerifySnapshotJob( *snapshotJobs[ i ], parallelBuild );
+		}
+
+		SV_ProfileSuspend( false );
+
+		if ( --snapshotVerify.frames == 0 )
+		{
+			Log::Notice( "%d parallel snapshots verified, %d differ from the serial ones",
+			             snapshotVerify.snapshots, snapshotVerify.mismatches );
+		}
+	}
+
+	for ( int i = 0; i < count; i++ )
+	{
+		SV_FinishClientSnapshot( snapshotJobs[ i ]->client, &snapshotJobs[ i ]->msg );
+	}
 }
 
+class VerifySnapshotThreadsCmd: public Cmd::StaticCmd {
+public:
+	VerifySnapshotThreadsCmd()
+		: Cmd::StaticCmd("sv_verifySnapshotThreads", Cmd::SYSTEM, "checks that the snapshots built by the worker threads are the same as the serial ones") {}
+
+	void Run(const Cmd::Args& args) const override
+	{
+		int frames = 100;
+
+		if (args.Argc() > 2 || (args.Argc() == 2 && (!Str::ParseInt(frames, args.Argv(1)) || frames <= 0))) {
+			PrintUsage(args, "[<frames>]", "");
+			return;
+		}
+
+		if (sv_snapshotThreads.Get() == 0) {
+			Print("server.snapshotThreads is 0, the snapshots are built serially");
+			return;
+		}
+
+		snapshotVerify.frames = frames;
+		snapshotVerify.snapshots = 0;
+		snapshotVerify.mismatches = 0;
+		Print("Comparing the snapshots of the next %d frames", frames);
+	}
+};
+static VerifySnapshotThreadsCmd VerifySnapshotThreadsCmdRegistration;
+
 /*
 =======================
 SV_SendClientMessages
@@ -998,6 +1937,7 @@ void SV_SendClientMessages()
 	int      i;
 	client_t *c;
 	int      numclients = 0; // NERVE - SMF - net debugging
+	std::vector<client_t*> snapshotClients;
 
 	sv.bpsTotalBytes = 0; // NERVE - SMF - net debugging
 	sv.ubpsTotalBytes = 0; // NERVE - SMF - net debugging
@@ -1005,6 +1945,13 @@ void SV_SendClientMessages()
 	// Gordon: update any changed configstrings from this frame
 	SV_UpdateConfigStrings();
 
+	// the entities can't move until all the snapshots of this frame are built
+	EntityIndexScope entityIndexScope( sv_snapshotEntityIndex.Get() );
+	SV_BeginDeltaCacheFrame();
+
+	// in batched network mode all the snapshots go out in one sendmmsg
+	NET_BeginPacketBatch();
+
 	// send a message to each connected client
 	for ( i = 0; i < sv_maxclients->integer; i++ )
 	{
@@ -1036,12 +1983,30 @@ void SV_SendClientMessages()
 		if ( c->netchan.unsentFragments )
 		{
 			c->nextSnapshotTime = svs.time + SV_RateMsec( c, c->netchan.unsentLength - c->netchan.unsentFragmentStart );
+			SVProfileScope zone( svProfileZone_t::TRANSMIT );
 			SV_Netchan_TransmitNextFragment( c );
 			continue;
 		}
 
 		// generate and send a new message
-		SV_SendClientSnapshot( c );
+		if ( sv_snapshotThreads.Get() && c->state >= clientState_t::CS_ACTIVE )
+		{
+			snapshotClients.push_back( c );
+		}
+		else
+		{
+			SV_SendClientSnapshot( c );
+		}
+	}
+
+	if ( !snapshotClients.empty() )
+	{
+		SV_SendClientSnapshots( snapshotClients );
+	}
+
+	{
+		SVProfileScope zone( svProfileZone_t::TRANSMIT );
+		NET_FlushPacketBatch();
 	}
 
 	// NERVE - SMF - net debugging
@@ -1097,3 +2062,97 @@ void SV_SendClientMessages()
 
 	// -NERVE - SMF
 }
+
+class BenchSnapshotEntitiesCmd: public Cmd::StaticCmd {
+public:
+	BenchSnapshotEntitiesCmd()
+		: Cmd::StaticCmd("sv_benchSnapshotEntities", Cmd::SYSTEM, "compares the snapshot entity lookup with and without the entity index") {}
+
+	void Run(const Cmd::Args& args) const override
+	{
+		int iterations = 100;
+
+		if (args.Argc() > 2 || (args.Argc() == 2 && (!Str::ParseInt(iterations, args.Argv(1)) || iterations <= 0))) {
+			PrintUsage(args, "[<iterations>]", "");
+			return;
+		}
+
+		if (sv.state != serverState_t::SS_GAME) {
+			Print("The server is not running");
+			return;
+		}
+
+		std::vector<client_t*> viewers;
+
+		for (int i = 0; i < sv_maxclients->integer; i++) {
+			client_t* client = &svs.clients[i];
+
+			if (client->state == clientState_t::CS_ACTIVE && client->gentity) {
+				viewers.push_back(client);
+			}
+		}
+
+		if (viewers.empty()) {
+			Print("No active client to take the viewpoints from");
+			return;
+		}
+
+		static clientSnapshot_t frame;
+		static snapshotEntityNumbers_t expected, entityNumbers;
+		int mismatches = 0;
+
+		// both lookups must give the same snapshots
+		for (client_t* client : viewers) {
+			expected.numSnapshotEntities = 0;
+			entityNumbers.numSnapshotEntities = 0;
+
+			{
+				EntityIndexScope entityIndexScope(false);
+				SV_CollectSnapshotEntities(client, &frame, &expected);
+			}
+			{
+				EntityIndexScope entityIndexScope(true);
+				SV_CollectSnapshotEntities(client, &frame, &entityNumbers);
+			}
+
+			if (expected.numSnapshotEntities != entityNumbers.numSnapshotEntities ||
+			    memcmp(expected.snapshotEntities, entityNumbers.snapshotEntities,
+			           expected.numSnapshotEntities * sizeof(expected.snapshotEntities[0]))) {
+				Print("Mismatch for client %d: %d entities with the linear scan, %d with the index",
+				      int(client - svs.clients), expected.numSnapshotEntities, entityNumbers.numSnapshotEntities);
+				mismatches++;
+			}
+		}
+
+		// the index is built once per frame, for all the clients
+		Sys::SteadyClock::duration times[2]{};
+
+		for (int it = 0; it < iterations; it++) {
+			for (bool useIndex : {false, true}) {
+				auto start = Sys::SteadyClock::now();
+				EntityIndexScope entityIndexScope(useIndex);
+
+				for (client_t* client : viewers) {
+					entityNumbers.numSnapshotEntities = 0;
+					SV_CollectSnapshotEntities(client, &frame, &entityNumbers);
+				}
+
+				times[useIndex] += Sys::SteadyClock::now() - start;
+			}
+		}
+
+		Print("%d entities, %d viewpoints, %d iterations", sv.num_entities, viewers.size(), iterations);
+
+		for (bool useIndex : {false, true}) {
+			Print("%-12s %8.1f us per frame", useIndex ? "index" : "linear scan",
+			      std::chrono::duration<double, std::micro>(times[useIndex]).count() / iterations);
+		}
+
+		if (mismatches) {
+			Print("%d snapshots differ", mismatches);
+		} else {
+			Print("All the snapshots are identical");
+		}
+	}
+};
+static BenchSnapshotEntitiesCmd BenchSnapshotEntitiesCmdRegistration;
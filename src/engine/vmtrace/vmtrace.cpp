@@ -0,0 +1,211 @@
+/*
+===========================================================================
+Daemon BSD Source Code
+Copyright (c) 2013-2016, Daemon Developers
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Daemon developers nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DAEMON DEVELOPERS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================
+*/
+
+// vmtrace -- reads a syscall trace written by /vmTraceDump and prints the call
+// counts and latency histograms of each message
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "engine/framework/VMTrace.h"
+
+using VM::traceRecord_t;
+
+// Latencies are bucketed by powers of two of microseconds, the last bucket
+// holds everything above
+static const int NUM_BUCKETS = 24;
+
+struct messageStats_t {
+	uint64_t calls = 0;
+	uint64_t bytes = 0;
+	uint64_t replyBytes = 0;
+	std::vector<uint64_t> ns; // inclusive of the nested messages
+	uint64_t selfNs = 0;
+};
+
+struct openMessage_t {
+	traceRecord_t start;
+	uint64_t childNs;
+};
+
+static int Bucket(uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	int bucket = 0;
+	while (us > 0 && bucket < NUM_BUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+static std::string MessageName(uint32_t id, bool vmToEngine)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "%s %d:%d", vmToEngine ? "V->E" : "E->V", id >> 16, id & 0xffff);
+	return name;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <name>.syscallTrace\n", argv[0]);
+		return 1;
+	}
+
+	FILE* file = fopen(argv[1], "rb");
+	if (!file) {
+		fprintf(stderr, "Couldn't open %s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+
+	char magic[sizeof(VM::TRACE_MAGIC)];
+	VM::traceHeader_t header;
+	if (fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, VM::TRACE_MAGIC, sizeof(magic)) != 0
+	    || fread(&header, sizeof(header), 1, file) != 1) {
+		fprintf(stderr, "%s is not a syscall trace\n", argv[1]);
+		return 1;
+	}
+
+	// Check the record count against the file size before allocating them
+	long dataStart = ftell(file);
+	if (dataStart < 0 || fseek(file, 0, SEEK_END) != 0) {
+		fprintf(stderr, "Couldn't seek in %s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+	long fileSize = ftell(file);
+	if (fileSize < dataStart || header.numRecords > uint64_t(fileSize - dataStart) / sizeof(traceRecord_t)) {
+		fprintf(stderr, "%s is truncated\n", argv[1]);
+		return 1;
+	}
+	fseek(file, dataStart, SEEK_SET);
+
+	std::vector<traceRecord_t> records(header.numRecords);
+	if (fread(records.data(), sizeof(traceRecord_t), records.size(), file) != records.size()) {
+		fprintf(stderr, "%s is truncated\n", argv[1]);
+		return 1;
+	}
+	fclose(file);
+
+	// Match the ends with the starts. Messages that started before the
+	// oldest record or weren't finished when the trace was written are
+	// skipped.
+	std::map<std::pair<bool, uint32_t>, messageStats_t> stats;
+	std::vector<openMessage_t> open;
+	uint64_t unmatched = 0;
+	for (const traceRecord_t& record : records) {
+		bool vmToEngine = record.flags & VM::TRACE_VM_TO_ENGINE;
+
+		if (record.flags & VM::TRACE_START) {
+			if (record.depth != open.size()) {
+				unmatched += open.size();
+				open.clear();
+				if (record.depth != 0)
+					continue;
+			}
+			open.push_back({record, 0});
+			continue;
+		}
+
+		if (open.empty() || record.depth != open.size() - 1 || open.back().start.id != record.id
+		    || (open.back().start.flags & VM::TRACE_VM_TO_ENGINE) != (record.flags & VM::TRACE_VM_TO_ENGINE)) {
+			unmatched += open.size() + 1;
+			open.clear();
+			continue;
+		}
+
+		openMessage_t message = open.back();
+		open.pop_back();
+		uint64_t ns = record.ns - message.start.ns;
+
+		messageStats_t& stat = stats[{vmToEngine, record.id}];
+		stat.calls++;
+		stat.bytes += message.start.size;
+		stat.replyBytes += record.size;
+		stat.ns.push_back(ns);
+		stat.selfNs += ns - std::min(ns, message.childNs);
+
+		if (!open.empty())
+			open.back().childNs += ns;
+	}
+	unmatched += open.size();
+
+	double span = records.empty() ? 0 : (records.back().ns - records.front().ns) / 1e9;
+	printf("%zu records over %.3f s, %llu older records were overwritten, %llu unmatched\n\n",
+	       records.size(), span, (unsigned long long)header.droppedRecords, (unsigned long long)unmatched);
+
+	// Most expensive first
+	std::vector<std::pair<std::pair<bool, uint32_t>, messageStats_t*>> sorted;
+	for (auto& stat : stats)
+		sorted.emplace_back(stat.first, &stat.second);
+	std::sort(sorted.begin(), sorted.end(), [](const decltype(sorted)::value_type& a, const decltype(sorted)::value_type& b) {
+		return a.second->selfNs > b.second->selfNs;
+	});
+
+	printf("%-16s %9s %10s %10s %9s %9s %9s %9s %10s %10s\n", "message", "calls", "total ms", "self ms",
+	       "p50 us", "p90 us", "p99 us", "max us", "bytes", "reply");
+	for (auto& entry : sorted) {
+		messageStats_t& stat = *entry.second;
+		std::sort(stat.ns.begin(), stat.ns.end());
+		uint64_t total = 0;
+		for (uint64_t ns : stat.ns)
+			total += ns;
+		size_t n = stat.ns.size();
+		printf("%-16s %9llu %10.3f %10.3f %9.1f %9.1f %9.1f %9.1f %10llu %10llu\n",
+		       MessageName(entry.first.second, entry.first.first).c_str(), (unsigned long long)stat.calls,
+		       total / 1e6, stat.selfNs / 1e6, stat.ns[(n - 1) / 2] / 1e3, stat.ns[(n - 1) * 9 / 10] / 1e3,
+		       stat.ns[(n - 1) * 99 / 100] / 1e3, stat.ns.back() / 1e3,
+		       (unsigned long long)stat.bytes, (unsigned long long)stat.replyBytes);
+	}
+
+	printf("\nLatency histograms, calls per bucket of at most the given microseconds\n");
+	for (auto& entry : sorted) {
+		uint64_t buckets[NUM_BUCKETS] = {};
+		for (uint64_t ns : entry.second->ns)
+			buckets[Bucket(ns)]++;
+
+		printf("%s\n", MessageName(entry.first.second, entry.first.first).c_str());
+		for (int i = 0; i < NUM_BUCKETS; i++) {
+			if (buckets[i] == 0)
+				continue;
+			if (i == NUM_BUCKETS - 1)
+				printf("  %10s %9llu\n", "more", (unsigned long long)buckets[i]);
+			else
+				printf("  %10llu %9llu\n", (1ULL << i) - 1, (unsigned long long)buckets[i]);
+		}
+	}
+
+	return 0;
+}
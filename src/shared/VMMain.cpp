@@ -31,6 +31,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "VMMain.h"
 #include "CommonProxies.h"
 #include "common/IPC/CommonSyscalls.h"
+#include "common/IPC/CommandBuffer.h"
 #ifndef _WIN32
 #include <unistd.h>
 #endif
@@ -46,6 +47,72 @@ class ExitException {};
 }
 #endif
 
+// Messages the engine queued with VMBase::QueueMsg, they are handled in order
+// when the engine flushes the queue.
+static IPC::SharedMemory engineQueueShm;
+static IPC::CommandBuffer engineQueue;
+
+static void ConsumeEngineQueue()
+{
+	while (true) {
+		engineQueue.LoadWriterData();
+		if (!engineQueue.CanRead(sizeof(uint32_t))) {
+			if (engineQueue.GetMaxReadLength() != 0) {
+				Sys::Drop("Engine command buffer had an incomplete length write");
+			}
+			return;
+		}
+
+		uint32_t size;
+		engineQueue.Read((char*)&size, sizeof(uint32_t));
+		if (!engineQueue.CanRead(size + sizeof(uint32_t))) {
+			Sys::Drop("Engine command buffer had an incomplete message write");
+		}
+
+		Util::Reader reader;
+		reader.GetData().resize(size);
+		engineQueue.Read(reader.GetData().data(), size, sizeof(uint32_t));
+
+		// Advance before handling the message, the engine may flush the queue
+		// again while we handle it and that must continue after this message.
+		engineQueue.AdvanceReadPointer(size + sizeof(uint32_t));
+
+		uint32_t id = reader.Read<uint32_t>();
+		VM::rootChannel.discardReply = true;
+		VM::VMHandleSyscall(id, std::move(reader));
+		VM::rootChannel.discardReply = false;
+	}
+}
+
+void VM::HandleSyscall(uint32_t id, Util::Reader reader)
+{
+	int major = id >> 16;
+	int minor = id & 0xffff;
+
+	if (major != VM::COMMAND_BUFFER) {
+		VMHandleSyscall(id, std::move(reader));
+		return;
+	}
+
+	switch (minor) {
+		case IPC::COMMAND_BUFFER_LOCATE:
+			IPC::HandleMsg<IPC::CommandBufferLocateMsg>(VM::rootChannel, std::move(reader), [] (IPC::SharedMemory mem) {
+				engineQueueShm = std::move(mem);
+				engineQueue.Init(engineQueueShm.GetBase(), engineQueueShm.GetSize());
+			});
+			break;
+
+		case IPC::COMMAND_BUFFER_CONSUME:
+			IPC::HandleMsg<IPC::CommandBufferConsumeMsg>(VM::rootChannel, std::move(reader), [] {
+				ConsumeEngineQueue();
+			});
+			break;
+
+		default:
+			Sys::Drop("Bad engine command buffer syscall minor number: %d", minor);
+	}
+}
+
 // Common initialization code for both VM types
 static void CommonInit(Sys::OSHandle rootSocket)
 {
@@ -63,7 +130,7 @@ static void CommonInit(Sys::OSHandle rootSocket)
 		if (id == IPC::ID_EXIT) {
 			return;
 		}
-		VM::VMHandleSyscall(id, std::move(reader));
+		VM::HandleSyscall(id, std::move(reader));
 	}
 }
 
@@ -44,9 +44,12 @@ namespace VM {
 	void GetNetcodeTables(NetcodeTable& playerStateTable, int& playerStateSize);
 	extern int VM_API_VERSION;
 
+	// Handles the messages common to all VMs and passes the others to VMHandleSyscall
+	void HandleSyscall(uint32_t id, Util::Reader reader);
+
 	// Send a message to the engine
 	template<typename Msg, typename... Args> void SendMsg(Args&&... args) {
-		IPC::SendMsg<Msg>(rootChannel, VMHandleSyscall, std::forward<Args>(args)...);
+		IPC::SendMsg<Msg>(rootChannel, HandleSyscall, std::forward<Args>(args)...);
 	}
 
 }